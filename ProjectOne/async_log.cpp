@@ -0,0 +1,373 @@
+#include "async_log.h"
+
+#include <algorithm>        // std::stable_sort
+#include <chrono>           // steady_clock, for ordering and rate limiting
+#include <condition_variable>
+#include <cstdio>           // snprintf, fwrite
+#include <cstdlib>          // atexit
+#include <memory>           // std::unique_ptr
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Unnamed namespace
+namespace
+{
+    const size_t RING_BYTES = 64 * 1024;        // Per thread, a power of two
+    const size_t MAX_STRING_BYTES = 2048;       // Longer string arguments are cut
+    const int DRAIN_INTERVAL_MS = 10;
+    const unsigned RECORD_WRAP = 0x80000000u;   // Size flag: the rest of the ring is padding
+
+    typedef std::chrono::steady_clock Clock;
+
+    // Fixed part of every record, the encoded arguments follow. Records are 8-byte aligned.
+    struct RecordHeader
+    {
+        unsigned size;          // Whole record, header included
+        unsigned severity;
+        unsigned suppressed;
+        unsigned argCount;
+        long long timestamp;    // Clock ticks, to merge the threads' messages in order
+        const char* format;
+    };
+
+    /* Single producer (the owning thread), single consumer (whoever holds gDrainMutex).
+     * head and tail only grow; position & (RING_BYTES - 1) is the offset into bytes.
+     */
+    struct LogRing
+    {
+        unsigned char bytes[RING_BYTES];
+        std::atomic<unsigned long long> head;   // Written by the producer
+        std::atomic<unsigned long long> tail;   // Written by the consumer
+        std::atomic<unsigned long long> dropped;
+        std::atomic<bool> retired;              // The owning thread has exited
+
+        LogRing() : head(0), tail(0), dropped(0), retired(false) {}
+    };
+
+    // Frees nothing itself, the drain does that once the ring is retired and empty
+    struct ThreadRing
+    {
+        LogRing* ring;
+
+        ThreadRing() : ring(nullptr) {}
+        ~ThreadRing()
+        {
+            if (ring)
+                ring->retired = true;
+        }
+    };
+
+    std::mutex gRingsMutex;
+    std::vector<std::unique_ptr<LogRing> > gRings;
+    thread_local ThreadRing tRing;
+
+    std::mutex gDrainMutex;                 // Held by whoever is consuming the rings
+    std::thread gLogThread;
+    std::atomic<bool> gRunning(false);
+    std::mutex gStopMutex;
+    std::condition_variable gStopSignal;
+    bool gStopping = false;
+
+    // A decoded record waiting to be printed
+    struct Line
+    {
+        long long timestamp;
+        std::string text;
+    };
+
+    LogRing* threadRing()
+    {
+        if (!tRing.ring)
+        {
+            LogRing* ring = new LogRing();
+            std::lock_guard<std::mutex> lock(gRingsMutex);
+            gRings.push_back(std::unique_ptr<LogRing>(ring));
+            tRing.ring = ring;
+        }
+        return tRing.ring;
+    }
+
+    size_t align8(size_t bytes)
+    {
+        return (bytes + 7) & ~(size_t)7;
+    }
+
+    size_t encodedSize(const logdetail::Arg& arg)
+    {
+        switch (arg.type)
+        {
+        case logdetail::ARG_BOOL:
+        case logdetail::ARG_CHAR:
+            return 2;
+        case logdetail::ARG_STRING:
+            return 1 + sizeof(unsigned short) + std::min(arg.length, MAX_STRING_BYTES);
+        default:
+            return 1 + 8;
+        }
+    }
+
+    unsigned char* encode(unsigned char* out, const logdetail::Arg& arg)
+    {
+        *out++ = (unsigned char)arg.type;
+        switch (arg.type)
+        {
+        case logdetail::ARG_BOOL:
+        case logdetail::ARG_CHAR:
+            *out++ = (unsigned char)arg.i;
+            break;
+        case logdetail::ARG_STRING:
+        {
+            unsigned short length = (unsigned short)std::min(arg.length, MAX_STRING_BYTES);
+            memcpy(out, &length, sizeof(length));
+            memcpy(out + sizeof(length), arg.s, length);
+            out += sizeof(length) + length;
+        }
+        break;
+        default:
+            memcpy(out, &arg.u, 8);
+            out += 8;
+            break;
+        }
+        return out;
+    }
+
+    // Formats one argument onto text, reading it from in; returns the next argument
+    const unsigned char* decode(const unsigned char* in, std::string& text)
+    {
+        char buffer[64];
+        logdetail::ArgType type = (logdetail::ArgType)*in++;
+        switch (type)
+        {
+        case logdetail::ARG_BOOL:
+            text += *in++ ? "true" : "false";
+            return in;
+        case logdetail::ARG_CHAR:
+            text += (char)*in++;
+            return in;
+        case logdetail::ARG_STRING:
+        {
+            unsigned short length;
+            memcpy(&length, in, sizeof(length));
+            text.append((const char*)in + sizeof(length), length);
+            return in + sizeof(length) + length;
+        }
+        default:
+            break;
+        }
+
+        logdetail::Arg value;
+        memcpy(&value.u, in, 8);
+        if (type == logdetail::ARG_INT)
+            snprintf(buffer, sizeof(buffer), "%lld", value.i);
+        else if (type == logdetail::ARG_UINT)
+            snprintf(buffer, sizeof(buffer), "%llu", value.u);
+        else if (type == logdetail::ARG_DOUBLE)
+            snprintf(buffer, sizeof(buffer), "%g", value.d);
+        else
+            snprintf(buffer, sizeof(buffer), "%p", value.p);
+        text += buffer;
+        return in + 8;
+    }
+
+    void format(const RecordHeader& header, const unsigned char* args, std::string& text)
+    {
+        static const char* const prefixes[] = { "DEBUG: ", "INFO: ", "WARNING: ", "ERROR: " };
+        text = prefixes[header.severity];
+
+        unsigned used = 0;
+        for (const char* c = header.format; *c; ++c)
+        {
+            if (c[0] == '{' && c[1] == '}' && used < header.argCount)
+            {
+                args = decode(args, text);
+                ++used;
+                ++c;
+            }
+            else
+                text += *c;
+        }
+
+        if (header.suppressed)
+        {
+            char buffer[64];
+            snprintf(buffer, sizeof(buffer), " (%u more suppressed)", header.suppressed);
+            text += buffer;
+        }
+        text += '\n';
+    }
+
+    // Formats everything in the rings and prints it in timestamp order. Caller holds gDrainMutex.
+    void drain()
+    {
+        std::vector<Line> lines;
+        unsigned long long dropped = 0;
+
+        std::lock_guard<std::mutex> lock(gRingsMutex);
+        for (size_t r = 0; r < gRings.size(); )
+        {
+            LogRing& ring = *gRings[r];
+            bool retired = ring.retired.load();     // Before head, so a retired ring read as empty really is
+            unsigned long long head = ring.head.load(std::memory_order_acquire);
+            unsigned long long tail = ring.tail.load(std::memory_order_relaxed);
+
+            while (tail != head)
+            {
+                const unsigned char* record = ring.bytes + (tail & (RING_BYTES - 1));
+                RecordHeader header;
+                memcpy(&header.size, record, sizeof(header.size));
+                if (header.size & RECORD_WRAP)
+                {
+                    tail += header.size & ~RECORD_WRAP;
+                    continue;
+                }
+                memcpy(&header, record, sizeof(header));
+
+                Line line;
+                line.timestamp = header.timestamp;
+                format(header, record + sizeof(header), line.text);
+                lines.push_back(line);
+                tail += header.size;
+            }
+            ring.tail.store(tail, std::memory_order_release);
+            dropped += ring.dropped.exchange(0);
+
+            if (retired)
+                gRings.erase(gRings.begin() + r);
+            else
+                ++r;
+        }
+
+        if (lines.empty() && dropped == 0)
+            return;
+
+        std::stable_sort(lines.begin(), lines.end(), [](const Line& a, const Line& b) { return a.timestamp < b.timestamp; });
+        for (size_t i = 0; i < lines.size(); ++i)
+            fwrite(lines[i].text.data(), 1, lines[i].text.size(), stdout);
+        if (dropped)
+            fprintf(stdout, "WARNING: %llu log messages dropped, the ring buffer was full\n", dropped);
+        fflush(stdout);
+    }
+
+    void logThread()
+    {
+        std::unique_lock<std::mutex> lock(gStopMutex);
+        while (!gStopping)
+        {
+            gStopSignal.wait_for(lock, std::chrono::milliseconds(DRAIN_INTERVAL_MS));
+            std::lock_guard<std::mutex> drainLock(gDrainMutex);
+            drain();
+        }
+    }
+}
+
+
+bool logdetail::allow(LogSite& site, unsigned& suppressed)
+{
+    unsigned long long second = (unsigned long long)std::chrono::duration_cast<std::chrono::seconds>(Clock::now().time_since_epoch()).count();
+
+    // A new second starts a new budget; losing this race only means one more or one less message
+    unsigned long long current = site.second.load(std::memory_order_relaxed);
+    if (current != second && site.second.compare_exchange_strong(current, second))
+        site.count = 0;
+
+    if (site.count.fetch_add(1) < LOG_RATE_LIMIT)
+    {
+        suppressed = site.suppressed.exchange(0);
+        return true;
+    }
+    site.suppressed.fetch_add(1);
+    return false;
+}
+
+
+void logdetail::write(LogSeverity severity, unsigned suppressed, const char* format, const Arg* args, size_t count)
+{
+    size_t size = sizeof(RecordHeader);
+    for (size_t i = 0; i < count; ++i)
+        size += encodedSize(args[i]);
+    size = align8(size);
+
+    LogRing& ring = *threadRing();
+    unsigned long long head = ring.head.load(std::memory_order_relaxed);
+    unsigned long long tail = ring.tail.load(std::memory_order_acquire);
+
+    // Records don't wrap: when the end of the ring is too short, pad it and start over at 0
+    size_t offset = (size_t)(head & (RING_BYTES - 1));
+    size_t padding = offset + size > RING_BYTES ? RING_BYTES - offset : 0;
+    if (head + padding + size - tail > RING_BYTES)
+    {
+        ring.dropped.fetch_add(1);
+        return;
+    }
+    if (padding)
+    {
+        unsigned marker = (unsigned)padding | RECORD_WRAP;
+        memcpy(ring.bytes + offset, &marker, sizeof(marker));
+        offset = 0;
+    }
+
+    RecordHeader header;
+    header.size = (unsigned)size;
+    header.severity = (unsigned)severity;
+    header.suppressed = suppressed;
+    header.argCount = (unsigned)count;
+    header.timestamp = (long long)Clock::now().time_since_epoch().count();
+    header.format = format;
+
+    unsigned char* out = ring.bytes + offset;
+    memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+    for (size_t i = 0; i < count; ++i)
+        out = encode(out, args[i]);
+
+    ring.head.store(head + padding + size, std::memory_order_release);
+
+    // Without the thread the caller prints its own message, unless another thread is already at it
+    if (!gRunning.load(std::memory_order_relaxed))
+    {
+        std::lock_guard<std::mutex> lock(gDrainMutex);
+        drain();
+    }
+}
+
+
+void UStartLog()
+{
+    if (gRunning.exchange(true))
+        return;
+
+    static bool registered = false;
+    if (!registered)
+    {
+        atexit(UStopLog);
+        registered = true;
+    }
+
+    gStopping = false;
+    gLogThread = std::thread(logThread);
+}
+
+
+void UStopLog()
+{
+    if (!gRunning.load())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(gStopMutex);
+        gStopping = true;
+    }
+    gStopSignal.notify_all();
+    gLogThread.join();
+    gRunning = false;
+
+    UFlushLog();
+}
+
+
+void UFlushLog()
+{
+    std::lock_guard<std::mutex> lock(gDrainMutex);
+    drain();
+}
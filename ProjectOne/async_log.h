@@ -0,0 +1,132 @@
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>          // strlen
+#include <string>
+
+enum LogSeverity
+{
+    LOG_DEBUG = 0,
+    LOG_INFO = 1,
+    LOG_WARNING = 2,
+    LOG_ERROR = 3
+};
+
+// Messages below this severity are compiled out. Override on the command line, e.g. /DLOG_MIN_SEVERITY=2.
+#ifndef LOG_MIN_SEVERITY
+#ifdef _DEBUG
+#define LOG_MIN_SEVERITY 0
+#else
+#define LOG_MIN_SEVERITY 1
+#endif
+#endif
+
+// Messages one call site may log per second, the rest are counted and reported with the next one let through
+const unsigned LOG_RATE_LIMIT = 20;
+
+// Per call site rate limiting state. Static storage only, it relies on zero initialization.
+struct LogSite
+{
+    std::atomic<unsigned long long> second;
+    std::atomic<unsigned> count;
+    std::atomic<unsigned> suppressed;
+};
+
+// Argument encoding behind ULog
+namespace logdetail
+{
+    enum ArgType
+    {
+        ARG_INT,
+        ARG_UINT,
+        ARG_DOUBLE,
+        ARG_BOOL,
+        ARG_CHAR,
+        ARG_STRING,
+        ARG_POINTER
+    };
+
+    // One argument as it is handed to the encoder; strings are copied into the record, not kept
+    struct Arg
+    {
+        ArgType type;
+        union
+        {
+            long long i;
+            unsigned long long u;
+            double d;
+            const void* p;
+            const char* s;
+        };
+        size_t length;      // ARG_STRING only
+    };
+
+    inline Arg arg(int v) { Arg a; a.type = ARG_INT; a.i = v; return a; }
+    inline Arg arg(long v) { Arg a; a.type = ARG_INT; a.i = v; return a; }
+    inline Arg arg(long long v) { Arg a; a.type = ARG_INT; a.i = v; return a; }
+    inline Arg arg(unsigned v) { Arg a; a.type = ARG_UINT; a.u = v; return a; }
+    inline Arg arg(unsigned long v) { Arg a; a.type = ARG_UINT; a.u = v; return a; }
+    inline Arg arg(unsigned long long v) { Arg a; a.type = ARG_UINT; a.u = v; return a; }
+    inline Arg arg(double v) { Arg a; a.type = ARG_DOUBLE; a.d = v; return a; }
+    inline Arg arg(bool v) { Arg a; a.type = ARG_BOOL; a.u = v; return a; }
+    inline Arg arg(char v) { Arg a; a.type = ARG_CHAR; a.i = v; return a; }
+    inline Arg arg(const void* v) { Arg a; a.type = ARG_POINTER; a.p = v; return a; }
+    inline Arg arg(const char* v) { Arg a; a.type = ARG_STRING; a.s = v ? v : "(null)"; a.length = strlen(a.s); return a; }
+    inline Arg arg(const unsigned char* v) { return arg((const char*)v); }     // glGetString
+    inline Arg arg(const std::string& v) { Arg a; a.type = ARG_STRING; a.s = v.c_str(); a.length = v.size(); return a; }
+
+    bool allow(LogSite& site, unsigned& suppressed);
+    void write(LogSeverity severity, unsigned suppressed, const char* format, const Arg* args, size_t count);
+}
+
+/* Logs format with every {} replaced by the next argument. The caller only copies the
+ * arguments into its own thread's ring buffer, in binary; a background thread formats and
+ * prints them. Never blocks: when the ring is full the message is dropped and counted.
+ * format must be a string literal, only its address is stored.
+ */
+template <typename... Args>
+void ULog(LogSite& site, LogSeverity severity, const char* format, const Args&... args)
+{
+    unsigned suppressed;
+    if (!logdetail::allow(site, suppressed))
+        return;
+    const logdetail::Arg encoded[sizeof...(Args) + 1] = { logdetail::arg(args)... };
+    logdetail::write(severity, suppressed, format, encoded, sizeof...(Args));
+}
+
+#define ULOG_AT(severity, ...) do { static LogSite uLogSite; ULog(uLogSite, severity, __VA_ARGS__); } while (0)
+
+#if LOG_MIN_SEVERITY <= 0
+#define ULOG_DEBUG(...) ULOG_AT(LOG_DEBUG, __VA_ARGS__)
+#else
+#define ULOG_DEBUG(...) do {} while (0)
+#endif
+
+#if LOG_MIN_SEVERITY <= 1
+#define ULOG_INFO(...) ULOG_AT(LOG_INFO, __VA_ARGS__)
+#else
+#define ULOG_INFO(...) do {} while (0)
+#endif
+
+#if LOG_MIN_SEVERITY <= 2
+#define ULOG_WARNING(...) ULOG_AT(LOG_WARNING, __VA_ARGS__)
+#else
+#define ULOG_WARNING(...) do {} while (0)
+#endif
+
+#define ULOG_ERROR(...) ULOG_AT(LOG_ERROR, __VA_ARGS__)
+
+/* Starts the thread that formats and prints the messages. Before it runs (and after
+ * UStopLog) every message is printed by the thread that logs it.
+ */
+void UStartLog();
+
+// Prints what is left and stops the thread; also registered with atexit by UStartLog
+void UStopLog();
+
+// Prints every message logged so far before it returns
+void UFlushLog();
+
+#endif
@@ -0,0 +1,201 @@
+#include "dynamic_resolution.h"
+
+#include <algorithm>        // std::min, std::max
+#include <cmath>            // sqrt, fabs
+
+#include "async_log.h"
+#include "gl_capture.h"     // Routes the GL calls through the capture wrappers
+
+// Unnamed namespace
+namespace
+{
+    // Share of the way to a higher scale taken per measurement
+    const float RISE_RATE = 0.25f;
+
+    // Scale changes smaller than this keep the current size, rises take at least this much
+    const float MIN_STEP = 0.02f;
+
+    // (Re)creates the offscreen color and depth targets at the window's size
+    bool createTarget(DynamicResolution& resolution, int width, int height)
+    {
+        if (!resolution.framebuffer && !resolution.framebuffer.create(0, "dynamic resolution"))
+            return false;
+        if (!resolution.color.create((size_t)width * height * 4, "dynamic resolution color") ||
+            !resolution.depth.create((size_t)width * height * 4, "dynamic resolution depth"))
+            return false;
+
+        glBindTexture(GL_TEXTURE_2D, resolution.color);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+        glBindTexture(GL_TEXTURE_2D, resolution.depth);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, resolution.framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, resolution.color, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, resolution.depth, 0);
+        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (status != GL_FRAMEBUFFER_COMPLETE)
+        {
+            ULOG_ERROR("Dynamic resolution target is incomplete (status {})", (unsigned)status);
+            return false;
+        }
+
+        resolution.targetWidth = width;
+        resolution.targetHeight = height;
+        return true;
+    }
+
+    // Reads the timers that are done, oldest first, and moves the scale accordingly
+    void collectTimers(DynamicResolution& resolution)
+    {
+        for (int i = 0; i < DYNAMIC_RESOLUTION_QUERIES; ++i)
+        {
+            int q = (resolution.nextQuery + i) % DYNAMIC_RESOLUTION_QUERIES;
+            if (!resolution.queryPending[q])
+                continue;
+
+            GLint available = 0;
+            glGetQueryObjectiv(resolution.queries[q], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                break;      // The newer ones aren't done either
+
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(resolution.queries[q], GL_QUERY_RESULT, &nanoseconds);
+            resolution.queryPending[q] = false;
+
+            resolution.gpuMs = (float)(nanoseconds / 1.0e6);
+            resolution.scale = UUpdateResolutionScale(resolution.scale, resolution.queryScale[q], resolution.gpuMs, resolution.targetMs);
+        }
+    }
+}
+
+
+DynamicResolution::DynamicResolution()
+    : targetWidth(0), targetHeight(0), nextQuery(0), timing(false), targetMs(0.0f), scale(DYNAMIC_RESOLUTION_MAX_SCALE),
+      frameScale(1.0f), width(0), height(0), gpuMs(0.0f), enabled(true)
+{
+    for (int q = 0; q < DYNAMIC_RESOLUTION_QUERIES; ++q)
+    {
+        queryScale[q] = 1.0f;
+        queryPending[q] = false;
+    }
+}
+
+
+float UUpdateResolutionScale(float scale, float sampleScale, float gpuMs, float targetMs)
+{
+    if (targetMs <= 0.0f || gpuMs <= 0.0f)
+        return scale;
+
+    float ideal = sampleScale * sqrt(targetMs * DYNAMIC_RESOLUTION_HEADROOM / gpuMs);
+    ideal = std::min(std::max(ideal, DYNAMIC_RESOLUTION_MIN_SCALE), DYNAMIC_RESOLUTION_MAX_SCALE);
+
+    // Small differences keep the size, except the last bit up to full size; rises move part of
+    // the way, but at least one step
+    if (fabs(ideal - scale) < MIN_STEP && ideal < DYNAMIC_RESOLUTION_MAX_SCALE)
+        return scale;
+    if (ideal < scale)
+        return ideal;
+    return std::min(std::max(scale + (ideal - scale) * RISE_RATE, scale + MIN_STEP), ideal);
+}
+
+
+void UBeginDynamicResolution(DynamicResolution& resolution, int viewportWidth, int viewportHeight, bool fullResolution)
+{
+    viewportWidth = std::max(viewportWidth, 1);     // Minimized windows report 0
+    viewportHeight = std::max(viewportHeight, 1);
+
+    if (resolution.enabled && (!resolution.upscale ||
+        ((resolution.targetWidth != viewportWidth || resolution.targetHeight != viewportHeight) && !createTarget(resolution, viewportWidth, viewportHeight))))
+    {
+        ULOG_WARNING("Dynamic resolution is off, rendering straight to the window");
+        resolution.enabled = false;
+    }
+
+    resolution.frameScale = resolution.enabled && !fullResolution && resolution.targetMs > 0.0f ? resolution.scale : 1.0f;
+    resolution.width = std::max((int)(viewportWidth * resolution.frameScale + 0.5f), 1);
+    resolution.height = std::max((int)(viewportHeight * resolution.frameScale + 0.5f), 1);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, resolution.enabled ? resolution.framebuffer.get() : 0);
+    glViewport(0, 0, resolution.width, resolution.height);
+
+    // A slot whose result hasn't come back yet is skipped, this frame goes untimed
+    int q = resolution.nextQuery;
+    resolution.timing = !resolution.queryPending[q] && (resolution.queries[q] || resolution.queries[q].create(0, "frame timer"));
+    if (resolution.timing)
+        glBeginQuery(GL_TIME_ELAPSED, resolution.queries[q]);
+}
+
+
+void UEndDynamicResolution(DynamicResolution& resolution, int viewportWidth, int viewportHeight)
+{
+    if (resolution.enabled)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, std::max(viewportWidth, 1), std::max(viewportHeight, 1));
+        glDisable(GL_DEPTH_TEST);
+
+        glUseProgram(resolution.upscale);
+        glUniform2f(glGetUniformLocation(resolution.upscale, "sourceScale"),
+            (float)resolution.width / resolution.targetWidth, (float)resolution.height / resolution.targetHeight);
+        glUniform2f(glGetUniformLocation(resolution.upscale, "texelSize"), 1.0f / resolution.targetWidth, 1.0f / resolution.targetHeight);
+        // Full size needs no sharpening, half size gets all of it
+        glUniform1f(glGetUniformLocation(resolution.upscale, "sharpness"), std::min((1.0f - resolution.frameScale) * 2.0f, 1.0f));
+
+        if (!resolution.emptyVao)
+            resolution.emptyVao.create(0, "full-screen triangle");
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, resolution.color);
+        glBindVertexArray(resolution.emptyVao);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glUseProgram(0);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    if (resolution.timing)
+    {
+        int q = resolution.nextQuery;
+        glEndQuery(GL_TIME_ELAPSED);
+        resolution.queryPending[q] = true;
+        resolution.queryScale[q] = resolution.frameScale;
+        resolution.nextQuery = (q + 1) % DYNAMIC_RESOLUTION_QUERIES;
+        resolution.timing = false;
+    }
+
+    collectTimers(resolution);
+}
+
+
+bool UResolutionReduced(const DynamicResolution& resolution)
+{
+    return resolution.frameScale < 1.0f;
+}
+
+
+void UDestroyDynamicResolution(DynamicResolution& resolution)
+{
+    for (int q = 0; q < DYNAMIC_RESOLUTION_QUERIES; ++q)
+    {
+        resolution.queries[q].reset();
+        resolution.queryPending[q] = false;
+    }
+    resolution.framebuffer.reset();
+    resolution.color.reset();
+    resolution.depth.reset();
+    resolution.emptyVao.reset();
+    resolution.upscale.reset();
+    resolution.targetWidth = resolution.targetHeight = 0;
+}
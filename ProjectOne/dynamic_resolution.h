@@ -0,0 +1,69 @@
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include <GLEW/glew.h>      // GLEW library
+
+#include "gpu_resources.h"  // Owning handles for the offscreen target and the timers
+
+// Render scale limits, as a fraction of the window's width and height
+const float DYNAMIC_RESOLUTION_MIN_SCALE = 0.5f;
+const float DYNAMIC_RESOLUTION_MAX_SCALE = 1.0f;
+
+// The controller aims this far below the target, so a spike doesn't miss it straight away
+const float DYNAMIC_RESOLUTION_HEADROOM = 0.9f;
+
+// Timer queries in flight; results are read a few frames late instead of stalling the GPU
+const int DYNAMIC_RESOLUTION_QUERIES = 4;
+
+/* Renders the scene into an offscreen target at a scale of the window size and upscales it
+ * to the window with a contrast-adaptive sharpen. GPU timer queries measure every frame and
+ * the scale follows them to keep the GPU time under the target.
+ */
+struct DynamicResolution
+{
+    GpuProgram upscale;         // Set by the caller, see upscaleVertexShaderSource in main.cpp
+    GpuVertexArray emptyVao;    // The full-screen triangle comes from gl_VertexID
+    GpuFramebuffer framebuffer;
+    GpuTexture color;
+    GpuTexture depth;
+    int targetWidth;            // Allocated size, the window's; frames use the lower left part of it
+    int targetHeight;
+
+    GpuQuery queries[DYNAMIC_RESOLUTION_QUERIES];
+    float queryScale[DYNAMIC_RESOLUTION_QUERIES];  // Scale the timed frame was drawn at
+    bool queryPending[DYNAMIC_RESOLUTION_QUERIES];
+    int nextQuery;
+    bool timing;                // A query was started this frame
+
+    float targetMs;             // 0 turns scaling off
+    float scale;                // Controller state
+    float frameScale;           // This frame's scale, 1 for full resolution frames
+    int width;                  // This frame's render size
+    int height;
+    float gpuMs;                // Latest measurement
+    bool enabled;               // False when the offscreen target can't be made: render straight to the window
+
+    DynamicResolution();
+};
+
+/* Picks the next scale from a frame that took gpuMs at sampleScale. GPU time is taken as
+ * proportional to the pixel count, so the scale that would have hit the target follows from
+ * the square root of the ratio. Drops react at once, rises are damped so it doesn't oscillate.
+ */
+float UUpdateResolutionScale(float scale, float sampleScale, float gpuMs, float targetMs);
+
+/* Binds the offscreen target at this frame's render size (the whole window when
+ * fullResolution is set) and starts its timer. Creates or resizes the target as needed.
+ */
+void UBeginDynamicResolution(DynamicResolution& resolution, int viewportWidth, int viewportHeight, bool fullResolution);
+
+// Upscales to the default framebuffer, stops the timer and feeds finished timers to the controller
+void UEndDynamicResolution(DynamicResolution& resolution, int viewportWidth, int viewportHeight);
+
+// Whether the last frame was drawn below the window's resolution
+bool UResolutionReduced(const DynamicResolution& resolution);
+
+// Releases the GL objects, needs the context
+void UDestroyDynamicResolution(DynamicResolution& resolution);
+
+#endif
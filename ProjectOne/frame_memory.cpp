@@ -0,0 +1,196 @@
+#include "frame_memory.h"
+
+#include <atomic>
+#include <cstdint>          // uintptr_t
+#include <cstdlib>          // malloc, free
+
+#include "async_log.h"
+
+// Unnamed namespace
+namespace
+{
+    // Heap block for an allocation that didn't fit, chained so the reset can free it
+    struct OverflowBlock
+    {
+        OverflowBlock* next;
+        size_t padding;     // Keeps what follows at POOL_BLOCK_ALIGNMENT on 64-bit
+    };
+
+    struct FrameArena
+    {
+        std::vector<unsigned char> memory;
+        std::atomic<size_t> used;
+        std::atomic<size_t> overflowBytes;
+        std::atomic<OverflowBlock*> overflow;
+
+        FrameArena() : used(0), overflowBytes(0), overflow(nullptr) {}
+    };
+
+    FrameArena gArenas[2];
+    std::atomic<FrameArena*> gArena(&gArenas[0]);
+
+    std::atomic<unsigned> gGuardedAllocations(0);
+    std::atomic<size_t> gGuardedBytes(0);
+    thread_local bool tGuarded = false;
+
+    void resetArena(FrameArena& arena)
+    {
+        OverflowBlock* block = arena.overflow.exchange(nullptr);
+        while (block)
+        {
+            OverflowBlock* next = block->next;
+            ::operator delete(block);
+            block = next;
+        }
+
+        // Whatever spilled last time fits from now on, with room to spare
+        size_t overflowBytes = arena.overflowBytes.exchange(0);
+        if (overflowBytes > 0)
+        {
+            size_t capacity = (arena.memory.size() + overflowBytes) * 3 / 2;
+            ULOG_WARNING("Frame arena overflowed by {} bytes, growing it from {} to {} bytes", overflowBytes, arena.memory.size(), capacity);
+            std::vector<unsigned char>(capacity).swap(arena.memory);
+        }
+        arena.used = 0;
+    }
+
+    void* allocateOverflow(FrameArena& arena, size_t bytes, size_t alignment)
+    {
+        // alignment - 1 spare bytes let the start move up past the header to any alignment
+        OverflowBlock* block = static_cast<OverflowBlock*>(::operator new(sizeof(OverflowBlock) + bytes + alignment - 1));
+        block->next = arena.overflow.load();
+        while (!arena.overflow.compare_exchange_weak(block->next, block))
+            ;
+        arena.overflowBytes.fetch_add(bytes + alignment - 1);
+        return (void*)(((uintptr_t)(block + 1) + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    }
+}
+
+
+void UInitFrameMemory(size_t arenaBytes)
+{
+    for (int a = 0; a < 2; ++a)
+    {
+        resetArena(gArenas[a]);
+        gArenas[a].memory.assign(arenaBytes, 0);
+    }
+    gArena = &gArenas[0];
+}
+
+
+void UBeginFrameMemory()
+{
+    FrameArena* next = gArena.load() == &gArenas[0] ? &gArenas[1] : &gArenas[0];
+    resetArena(*next);
+    gArena = next;
+}
+
+
+void* UFrameAllocate(size_t bytes, size_t alignment)
+{
+    FrameArena& arena = *gArena.load();
+    uintptr_t base = (uintptr_t)arena.memory.data();
+    size_t capacity = arena.memory.size();
+
+    size_t offset = arena.used.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        size_t aligned = (size_t)(((base + offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base);
+        if (aligned + bytes > capacity)
+            break;
+        if (arena.used.compare_exchange_weak(offset, aligned + bytes, std::memory_order_relaxed))
+            return (void*)(base + aligned);
+    }
+
+    // Out of room: the heap covers the rest of this frame, the arena grows at its next reset
+    return allocateOverflow(arena, bytes, alignment);
+}
+
+
+void* UPoolAllocate(BlockPool& pool)
+{
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    if (!pool.freeList)
+    {
+        unsigned char* chunk = static_cast<unsigned char*>(::operator new(pool.blockBytes * POOL_CHUNK_BLOCKS));
+        pool.chunks.push_back(chunk);
+        for (size_t b = POOL_CHUNK_BLOCKS; b-- > 0; )
+        {
+            void* block = chunk + b * pool.blockBytes;
+            *static_cast<void**>(block) = pool.freeList;
+            pool.freeList = block;
+        }
+    }
+
+    void* block = pool.freeList;
+    pool.freeList = *static_cast<void**>(block);
+    return block;
+}
+
+
+void UPoolFree(BlockPool& pool, void* block)
+{
+    if (!block)
+        return;
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    *static_cast<void**>(block) = pool.freeList;
+    pool.freeList = block;
+}
+
+
+void UBeginAllocationGuard()
+{
+    gGuardedAllocations = 0;
+    gGuardedBytes = 0;
+    tGuarded = true;
+}
+
+
+void UEndAllocationGuard(AllocationGuardStats& stats)
+{
+    tGuarded = false;
+    stats.allocations = gGuardedAllocations.load();
+    stats.bytes = gGuardedBytes.load();
+}
+
+
+bool UAllocationGuarded()
+{
+    return tGuarded;
+}
+
+
+void USetAllocationGuarded(bool guarded)
+{
+    tGuarded = guarded;
+}
+
+
+#if FRAME_ALLOCATION_GUARD
+// The other forms of new and delete forward to these (sized delete not everywhere, so it's replaced as well)
+void* operator new(size_t bytes)
+{
+    if (tGuarded)
+    {
+        gGuardedAllocations.fetch_add(1);
+        gGuardedBytes.fetch_add(bytes);
+    }
+
+    void* p = malloc(bytes > 0 ? bytes : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+#endif
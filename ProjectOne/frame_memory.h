@@ -0,0 +1,141 @@
+#ifndef FRAME_MEMORY_H
+#define FRAME_MEMORY_H
+
+#include <cstddef>
+#include <mutex>
+#include <new>              // operator new for pool arrays
+#include <vector>
+
+// Heap allocation guard: the global operator new counts what guarded threads allocate. On in debug builds.
+#ifndef FRAME_ALLOCATION_GUARD
+#ifdef _DEBUG
+#define FRAME_ALLOCATION_GUARD 1
+#else
+#define FRAME_ALLOCATION_GUARD 0
+#endif
+#endif
+
+// Starting size of each of the two frame arenas; one that overflows grows at its next reset
+const size_t FRAME_ARENA_BYTES = 1024 * 1024;
+
+// Pool blocks are a multiple of this, which is also the strictest alignment they serve
+const size_t POOL_BLOCK_ALIGNMENT = 16;
+
+// Blocks a pool carves out of the heap at a time
+const size_t POOL_CHUNK_BLOCKS = 64;
+
+/* Frame memory: scratch for one frame comes from a linear arena, allocating bumps an offset,
+ * freeing does nothing and the whole arena is reset at once. There are two; UBeginFrameMemory
+ * switches to the one the frame before last used, so what a frame allocated stays valid
+ * through the next one. Allocation is lock-free and safe from the job workers; resetting and
+ * growing belong to the thread that runs the frames, while no frame jobs are running.
+ */
+void UInitFrameMemory(size_t arenaBytes);
+void UBeginFrameMemory();
+void* UFrameAllocate(size_t bytes, size_t alignment);
+
+// Hands out frame arena memory to standard containers. Never let one outlive the next frame.
+template <typename T>
+struct FrameAllocator
+{
+    typedef T value_type;
+
+    FrameAllocator() {}
+    template <typename U>
+    FrameAllocator(const FrameAllocator<U>&) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(UFrameAllocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T*, size_t) {}
+
+    template <typename U>
+    struct rebind { typedef FrameAllocator<U> other; };
+};
+
+template <typename T, typename U>
+bool operator==(const FrameAllocator<T>&, const FrameAllocator<U>&) { return true; }
+template <typename T, typename U>
+bool operator!=(const FrameAllocator<T>&, const FrameAllocator<U>&) { return false; }
+
+template <typename T>
+using FrameVector = std::vector<T, FrameAllocator<T> >;
+
+/* Fixed-size blocks for long-lived objects that come and go one at a time, such as map
+ * nodes. Freed blocks go on a free list and are handed out again before a new chunk is
+ * carved, so a pool stops touching the heap once it has seen its peak.
+ */
+struct BlockPool
+{
+    std::mutex mutex;
+    size_t blockBytes;
+    void* freeList;
+    std::vector<unsigned char*> chunks;
+
+    explicit BlockPool(size_t bytes) : blockBytes(bytes), freeList(nullptr) {}
+};
+
+void* UPoolAllocate(BlockPool& pool);
+void UPoolFree(BlockPool& pool, void* block);
+
+// One pool per block size, shared by every type that rounds up to it. Never destroyed, like the containers using it may not be.
+template <size_t BlockBytes>
+BlockPool& UBlockPool()
+{
+    static BlockPool* pool = new BlockPool(BlockBytes);
+    return *pool;
+}
+
+// Single objects come from the block pool of their size; arrays (hash buckets) are rare and go to the heap
+template <typename T>
+struct PoolAllocator
+{
+    typedef T value_type;
+    static const size_t BLOCK_BYTES = (sizeof(T) + POOL_BLOCK_ALIGNMENT - 1) / POOL_BLOCK_ALIGNMENT * POOL_BLOCK_ALIGNMENT;
+    static_assert(alignof(T) <= POOL_BLOCK_ALIGNMENT, "pool blocks are not aligned enough for this type");
+
+    PoolAllocator() {}
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+        if (n == 1)
+            return static_cast<T*>(UPoolAllocate(UBlockPool<BLOCK_BYTES>()));
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        if (n == 1)
+            UPoolFree(UBlockPool<BLOCK_BYTES>(), p);
+        else
+            ::operator delete(p);
+    }
+
+    template <typename U>
+    struct rebind { typedef PoolAllocator<U> other; };
+};
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&) { return true; }
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&) { return false; }
+
+// What guarded threads allocated since UBeginAllocationGuard
+struct AllocationGuardStats
+{
+    unsigned allocations;
+    size_t bytes;
+};
+
+/* Guards the calling thread and starts a new count. Jobs submitted from a guarded thread run
+ * guarded too, on whichever thread picks them up. Without FRAME_ALLOCATION_GUARD nothing is
+ * counted. To find an allocation, break in the counting branch of operator new.
+ */
+void UBeginAllocationGuard();
+void UEndAllocationGuard(AllocationGuardStats& stats);
+
+// The calling thread's guard, for the job pool to carry over to the jobs it runs
+bool UAllocationGuarded();
+void USetAllocationGuarded(bool guarded);
+
+#endif
@@ -0,0 +1,1950 @@
+#define GL_CAPTURE_IMPLEMENTATION
+#include "gl_capture.h"
+
+#include <algorithm>        // std::sort, std::min, std::max
+#include <atomic>           // std::atomic
+#include <chrono>           // Replay timing
+#include <cstdint>
+#include <cstdio>           // fopen, fwrite
+#include <cstring>          // memcpy, memcmp
+#include <map>
+#include <set>
+#include <string>
+#include <utility>          // std::pair
+#include <vector>
+
+#include "async_log.h"
+
+// Unnamed namespace
+namespace
+{
+    enum CaptureOp
+    {
+        OP_ACTIVE_TEXTURE,
+        OP_ATTACH_SHADER,
+        OP_BEGIN_QUERY,
+        OP_BIND_BUFFER,
+        OP_BIND_FRAMEBUFFER,
+        OP_BIND_TEXTURE,
+        OP_BIND_VERTEX_ARRAY,
+        OP_BUFFER_DATA,
+        OP_BUFFER_SUB_DATA,         // What was written to a mapped range, recorded at the unmap
+        OP_CLEAR,
+        OP_CLEAR_COLOR,
+        OP_COMPILE_SHADER,
+        OP_CREATE_PROGRAM,
+        OP_CREATE_SHADER,
+        OP_DELETE_BUFFERS,
+        OP_DELETE_FRAMEBUFFERS,
+        OP_DELETE_PROGRAM,
+        OP_DELETE_QUERIES,
+        OP_DELETE_SHADER,
+        OP_DELETE_TEXTURES,
+        OP_DELETE_VERTEX_ARRAYS,
+        OP_DISABLE,
+        OP_DRAW_ARRAYS,
+        OP_DRAW_ELEMENTS,
+        OP_DRAW_ELEMENTS_INSTANCED,
+        OP_ENABLE,
+        OP_ENABLE_VERTEX_ATTRIB_ARRAY,
+        OP_END_QUERY,
+        OP_FRAMEBUFFER_TEXTURE_2D,
+        OP_GEN_BUFFERS,
+        OP_GEN_FRAMEBUFFERS,
+        OP_GEN_QUERIES,
+        OP_GEN_TEXTURES,
+        OP_GEN_VERTEX_ARRAYS,
+        OP_GET_UNIFORM_LOCATION,
+        OP_LINK_PROGRAM,
+        OP_SHADER_SOURCE,
+        OP_TEX_IMAGE_2D,
+        OP_TEX_PARAMETERI,
+        OP_UNIFORM_1F,
+        OP_UNIFORM_1I,
+        OP_UNIFORM_2F,
+        OP_UNIFORM_3F,
+        OP_UNIFORM_MATRIX_4FV,
+        OP_USE_PROGRAM,
+        OP_VERTEX_ATTRIB_POINTER,
+        OP_VIEWPORT,
+        OP_VIEWPORT_INDEXED,        // Not shadowed: glViewport resets them, and the renderer sets them again every frame
+        OP_FRAME_END,
+        OP_COUNT
+    };
+
+    const char* const OP_NAMES[OP_COUNT] = {
+        "glActiveTexture", "glAttachShader", "glBeginQuery", "glBindBuffer", "glBindFramebuffer", "glBindTexture",
+        "glBindVertexArray", "glBufferData", "glBufferSubData (unmap)", "glClear", "glClearColor", "glCompileShader",
+        "glCreateProgram", "glCreateShader", "glDeleteBuffers", "glDeleteFramebuffers", "glDeleteProgram", "glDeleteQueries",
+        "glDeleteShader", "glDeleteTextures", "glDeleteVertexArrays", "glDisable", "glDrawArrays", "glDrawElements",
+        "glDrawElementsInstanced", "glEnable", "glEnableVertexAttribArray", "glEndQuery", "glFramebufferTexture2D", "glGenBuffers", "glGenFramebuffers",
+        "glGenQueries", "glGenTextures", "glGenVertexArrays", "glGetUniformLocation", "glLinkProgram", "glShaderSource",
+        "glTexImage2D", "glTexParameteri", "glUniform1f", "glUniform1i", "glUniform2f", "glUniform3f",
+        "glUniformMatrix4fv", "glUseProgram", "glVertexAttribPointer", "glViewport", "glViewportIndexedf", "frame end"
+    };
+
+    // Opcode and payload size in front of every command
+    const size_t COMMAND_HEADER_BYTES = sizeof(uint16_t) + sizeof(uint32_t);
+
+    // Texture unpacking is left at GL's default row alignment
+    const size_t UNPACK_ALIGNMENT = 4;
+
+    // Shaders the prologue recreates for linked programs are named from here, clear of live names
+    const GLuint PROLOGUE_SHADER_NAMES = 0x80000000u;
+
+    const int MAX_ATTRIBUTES = 16;
+    const size_t SLOWEST_CALLS = 10;
+
+    // Appends one command to a stream; the payload size is filled in when it goes out of scope
+    struct CommandWriter
+    {
+        std::vector<unsigned char>& out;
+        size_t start;
+
+        CommandWriter(std::vector<unsigned char>& stream, CaptureOp op) : out(stream), start(stream.size())
+        {
+            put((uint16_t)op);
+            put((uint32_t)0);
+        }
+
+        ~CommandWriter()
+        {
+            uint32_t size = (uint32_t)(out.size() - start - COMMAND_HEADER_BYTES);
+            memcpy(&out[start + sizeof(uint16_t)], &size, sizeof(size));
+        }
+
+        void append(const void* data, size_t bytes)
+        {
+            const unsigned char* p = static_cast<const unsigned char*>(data);
+            out.insert(out.end(), p, p + bytes);
+        }
+
+        template <typename T>
+        void put(const T& value)
+        {
+            append(&value, sizeof(T));
+        }
+
+        // Length-prefixed bytes
+        void blob(const void* data, size_t bytes)
+        {
+            put((uint64_t)bytes);
+            if (bytes > 0)
+                append(data, bytes);
+        }
+    };
+
+    // Reads a command's payload; reading past the end clears ok instead
+    struct CommandReader
+    {
+        const unsigned char* data;
+        size_t size;
+        size_t position;
+        bool ok;
+
+        CommandReader(const unsigned char* payload, size_t bytes) : data(payload), size(bytes), position(0), ok(true) {}
+
+        template <typename T>
+        T get()
+        {
+            T value = T();
+            if (position + sizeof(T) > size)
+            {
+                ok = false;
+                return value;
+            }
+            memcpy(&value, data + position, sizeof(T));
+            position += sizeof(T);
+            return value;
+        }
+
+        const unsigned char* blob(uint64_t& bytes)
+        {
+            bytes = get<uint64_t>();
+            if (!ok || bytes > size - position)
+            {
+                ok = false;
+                bytes = 0;
+                return nullptr;
+            }
+            const unsigned char* p = data + position;
+            position += (size_t)bytes;
+            return p;
+        }
+    };
+
+    struct ShadowLevel
+    {
+        GLint internalFormat;
+        GLsizei width;
+        GLsizei height;
+        GLenum format;
+        GLenum type;
+        bool hasPixels;
+        std::vector<unsigned char> pixels;
+    };
+
+    struct ShadowTexture
+    {
+        std::map<GLenum, GLint> parameters;
+        std::map<GLint, ShadowLevel> levels;
+    };
+
+    struct ShadowBuffer
+    {
+        std::vector<unsigned char> data;
+        GLenum usage;
+        void* mapped;               // Set between glMapBufferRange and glUnmapBuffer
+        GLintptr mappedOffset;
+        GLsizeiptr mappedLength;
+        bool mappedForWrite;
+    };
+
+    struct ShadowShader
+    {
+        GLenum type;
+        std::string source;
+    };
+
+    struct ShadowProgram
+    {
+        std::vector<ShadowShader> shaders;      // Copies of what was attached, the shaders themselves are usually deleted
+        bool linked;
+        std::map<GLint, std::string> uniformNames;
+        std::map<GLint, std::vector<unsigned char>> uniformValues;  // The last glUniform* command per location
+    };
+
+    struct ShadowAttribute
+    {
+        bool enabled;
+        bool pointerSet;
+        GLuint buffer;
+        GLint size;
+        GLenum type;
+        GLboolean normalized;
+        GLsizei stride;
+        uint64_t offset;
+    };
+
+    struct ShadowVertexArray
+    {
+        GLuint elementBuffer;
+        ShadowAttribute attributes[MAX_ATTRIBUTES];
+    };
+
+    struct ShadowFramebuffer
+    {
+        std::map<GLenum, std::pair<GLuint, GLint>> attachments;    // Texture and level
+    };
+
+    // What the GL context holds, as far as the wrapped calls changed it
+    struct ShadowState
+    {
+        std::map<GLuint, ShadowBuffer> buffers;
+        std::map<GLuint, ShadowTexture> textures;
+        std::map<GLuint, ShadowVertexArray> vertexArrays;
+        std::map<GLuint, ShadowFramebuffer> framebuffers;
+        std::map<GLuint, ShadowShader> shaders;
+        std::map<GLuint, ShadowProgram> programs;
+        std::set<GLuint> queries;
+
+        std::map<GLenum, GLuint> bufferBindings;    // All but GL_ELEMENT_ARRAY_BUFFER, which belongs to the vertex array
+        std::map<GLenum, GLuint> textureUnits;      // GL_TEXTURE_2D binding per GL_TEXTUREi
+        std::map<GLenum, bool> capabilities;
+        GLenum activeTexture;
+        GLuint vertexArray;
+        GLuint program;
+        GLuint framebuffer;
+        GLint viewport[4];
+        GLfloat clearColor[4];
+
+        ShadowState() : activeTexture(GL_TEXTURE0), vertexArray(0), program(0), framebuffer(0), viewport(), clearColor() {}
+    };
+
+    std::string gFilename;
+    int gFrames = 1;
+    bool gArmed = false;
+    std::atomic<bool> gRequested(false);
+    bool gRecording = false;
+    int gFramesRecorded = 0;
+    unsigned gWidth = 0;
+    unsigned gHeight = 0;
+    ShadowState gShadow;
+    std::vector<unsigned char> gPrologue;
+    std::vector<unsigned char> gFrameStream;
+
+
+    // Bytes glTexImage2D reads for an image
+    size_t imageBytes(GLsizei width, GLsizei height, GLenum format, GLenum type)
+    {
+        size_t components = 4;
+        switch (format)
+        {
+        case GL_RED: case GL_DEPTH_COMPONENT: components = 1; break;
+        case GL_RG: components = 2; break;
+        case GL_RGB: components = 3; break;
+        default: break;
+        }
+
+        size_t componentBytes = 1;
+        switch (type)
+        {
+        case GL_UNSIGNED_SHORT: case GL_HALF_FLOAT: componentBytes = 2; break;
+        case GL_UNSIGNED_INT: case GL_FLOAT: componentBytes = 4; break;
+        case GL_UNSIGNED_INT_24_8: components = 1; componentBytes = 4; break;
+        default: break;
+        }
+
+        size_t row = (size_t)std::max(width, 0) * components * componentBytes;
+        row = (row + UNPACK_ALIGNMENT - 1) / UNPACK_ALIGNMENT * UNPACK_ALIGNMENT;
+        return row * (size_t)std::max(height, 0);
+    }
+
+    GLuint boundBuffer(GLenum target)
+    {
+        if (target == GL_ELEMENT_ARRAY_BUFFER)
+            return gShadow.vertexArrays[gShadow.vertexArray].elementBuffer;
+        std::map<GLenum, GLuint>::const_iterator found = gShadow.bufferBindings.find(target);
+        return found == gShadow.bufferBindings.end() ? 0 : found->second;
+    }
+
+    GLuint boundTexture()
+    {
+        std::map<GLenum, GLuint>::const_iterator found = gShadow.textureUnits.find(gShadow.activeTexture);
+        return found == gShadow.textureUnits.end() ? 0 : found->second;
+    }
+
+
+    // Command encoders, shared by the wrappers and the prologue
+
+    void writeName(std::vector<unsigned char>& out, CaptureOp op, GLuint name)
+    {
+        CommandWriter command(out, op);
+        command.put(name);
+    }
+
+    void writeEnum(std::vector<unsigned char>& out, CaptureOp op, GLenum value)
+    {
+        CommandWriter command(out, op);
+        command.put(value);
+    }
+
+    void writeTargetName(std::vector<unsigned char>& out, CaptureOp op, GLenum target, GLuint name)
+    {
+        CommandWriter command(out, op);
+        command.put(target);
+        command.put(name);
+    }
+
+    void writeNames(std::vector<unsigned char>& out, CaptureOp op, GLsizei n, const GLuint* names)
+    {
+        CommandWriter command(out, op);
+        command.put(n);
+        command.append(names, sizeof(GLuint) * (size_t)std::max(n, 0));
+    }
+
+    void writeBufferData(std::vector<unsigned char>& out, GLenum target, size_t size, const void* data, GLenum usage)
+    {
+        CommandWriter command(out, OP_BUFFER_DATA);
+        command.put(target);
+        command.put((uint64_t)size);
+        command.put(usage);
+        command.put((uint8_t)(data != nullptr));
+        if (data)
+            command.blob(data, size);
+    }
+
+    void writeBufferSubData(std::vector<unsigned char>& out, GLenum target, size_t offset, const void* data, size_t size)
+    {
+        CommandWriter command(out, OP_BUFFER_SUB_DATA);
+        command.put(target);
+        command.put((uint64_t)offset);
+        command.blob(data, size);
+    }
+
+    void writeCreate(std::vector<unsigned char>& out, CaptureOp op, GLenum type, GLuint name)
+    {
+        CommandWriter command(out, op);
+        command.put(type);
+        command.put(name);
+    }
+
+    void writeShaderSource(std::vector<unsigned char>& out, GLuint shader, const std::string& source)
+    {
+        CommandWriter command(out, OP_SHADER_SOURCE);
+        command.put(shader);
+        command.blob(source.data(), source.size());
+    }
+
+    void writeFramebufferTexture2D(std::vector<unsigned char>& out, GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level)
+    {
+        CommandWriter command(out, OP_FRAMEBUFFER_TEXTURE_2D);
+        command.put(target);
+        command.put(attachment);
+        command.put(textarget);
+        command.put(texture);
+        command.put(level);
+    }
+
+    void writeGetUniformLocation(std::vector<unsigned char>& out, GLuint program, GLint location, const std::string& name)
+    {
+        CommandWriter command(out, OP_GET_UNIFORM_LOCATION);
+        command.put(program);
+        command.put(location);
+        command.blob(name.data(), name.size());
+    }
+
+    // source: 0 no pixels, 1 pixels follow, 2 read from the pixel unpack buffer at offset
+    void writeTexImage2D(std::vector<unsigned char>& out, GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height,
+        GLint border, GLenum format, GLenum type, uint8_t source, const void* pixels, uint64_t offset)
+    {
+        CommandWriter command(out, OP_TEX_IMAGE_2D);
+        command.put(target);
+        command.put(level);
+        command.put(internalformat);
+        command.put(width);
+        command.put(height);
+        command.put(border);
+        command.put(format);
+        command.put(type);
+        command.put(source);
+        if (source == 1)
+            command.blob(pixels, imageBytes(width, height, format, type));
+        else if (source == 2)
+            command.put(offset);
+    }
+
+    void writeTexParameteri(std::vector<unsigned char>& out, GLenum target, GLenum pname, GLint param)
+    {
+        CommandWriter command(out, OP_TEX_PARAMETERI);
+        command.put(target);
+        command.put(pname);
+        command.put(param);
+    }
+
+    void writeVertexAttribPointer(std::vector<unsigned char>& out, GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, uint64_t offset)
+    {
+        CommandWriter command(out, OP_VERTEX_ATTRIB_POINTER);
+        command.put(index);
+        command.put(size);
+        command.put(type);
+        command.put((uint8_t)normalized);
+        command.put(stride);
+        command.put(offset);
+    }
+
+    void writeViewport(std::vector<unsigned char>& out, const GLint* viewport)
+    {
+        CommandWriter command(out, OP_VIEWPORT);
+        command.append(viewport, sizeof(GLint) * 4);
+    }
+
+    void writeClearColor(std::vector<unsigned char>& out, const GLfloat* color)
+    {
+        CommandWriter command(out, OP_CLEAR_COLOR);
+        command.append(color, sizeof(GLfloat) * 4);
+    }
+
+    void writeUniformFloats(std::vector<unsigned char>& out, CaptureOp op, GLint location, const GLfloat* values, size_t count)
+    {
+        CommandWriter command(out, op);
+        command.put(location);
+        command.append(values, sizeof(GLfloat) * count);
+    }
+
+    // Keeps the program's latest value for the prologue and records the call
+    void recordUniform(CaptureOp op, GLint location, const GLfloat* values, size_t count)
+    {
+        if (gShadow.program != 0 && location >= 0)
+        {
+            std::vector<unsigned char>& value = gShadow.programs[gShadow.program].uniformValues[location];
+            value.clear();
+            writeUniformFloats(value, op, location, values, count);
+        }
+        if (gRecording)
+            writeUniformFloats(gFrameStream, op, location, values, count);
+    }
+
+
+    /* Commands that recreate every shadowed object and then the bindings and state of the
+     * moment. Objects are made with all bindings at 0 and left that way until the end.
+     */
+    void writePrologue(std::vector<unsigned char>& out)
+    {
+        for (std::map<GLuint, ShadowBuffer>::const_iterator it = gShadow.buffers.begin(); it != gShadow.buffers.end(); ++it)
+        {
+            writeNames(out, OP_GEN_BUFFERS, 1, &it->first);
+            writeTargetName(out, OP_BIND_BUFFER, GL_COPY_WRITE_BUFFER, it->first);
+            if (it->second.usage != 0)
+                writeBufferData(out, GL_COPY_WRITE_BUFFER, it->second.data.size(), it->second.data.empty() ? nullptr : &it->second.data[0], it->second.usage);
+        }
+        writeTargetName(out, OP_BIND_BUFFER, GL_COPY_WRITE_BUFFER, 0);
+
+        for (std::map<GLuint, ShadowTexture>::const_iterator it = gShadow.textures.begin(); it != gShadow.textures.end(); ++it)
+        {
+            writeNames(out, OP_GEN_TEXTURES, 1, &it->first);
+            writeTargetName(out, OP_BIND_TEXTURE, GL_TEXTURE_2D, it->first);
+            for (std::map<GLint, ShadowLevel>::const_iterator level = it->second.levels.begin(); level != it->second.levels.end(); ++level)
+            {
+                const ShadowLevel& image = level->second;
+                writeTexImage2D(out, GL_TEXTURE_2D, level->first, image.internalFormat, image.width, image.height, 0, image.format, image.type,
+                    image.hasPixels ? 1 : 0, image.hasPixels ? &image.pixels[0] : nullptr, 0);
+            }
+            for (std::map<GLenum, GLint>::const_iterator parameter = it->second.parameters.begin(); parameter != it->second.parameters.end(); ++parameter)
+                writeTexParameteri(out, GL_TEXTURE_2D, parameter->first, parameter->second);
+        }
+        writeTargetName(out, OP_BIND_TEXTURE, GL_TEXTURE_2D, 0);
+
+        for (std::map<GLuint, ShadowShader>::const_iterator it = gShadow.shaders.begin(); it != gShadow.shaders.end(); ++it)
+        {
+            writeCreate(out, OP_CREATE_SHADER, it->second.type, it->first);
+            writeShaderSource(out, it->first, it->second.source);
+            writeName(out, OP_COMPILE_SHADER, it->first);
+        }
+
+        GLuint nextShader = PROLOGUE_SHADER_NAMES;
+        for (std::map<GLuint, ShadowProgram>::const_iterator it = gShadow.programs.begin(); it != gShadow.programs.end(); ++it)
+        {
+            const ShadowProgram& program = it->second;
+            writeCreate(out, OP_CREATE_PROGRAM, 0, it->first);
+            GLuint firstShader = nextShader;
+            for (size_t s = 0; s < program.shaders.size(); ++s, ++nextShader)
+            {
+                writeCreate(out, OP_CREATE_SHADER, program.shaders[s].type, nextShader);
+                writeShaderSource(out, nextShader, program.shaders[s].source);
+                writeName(out, OP_COMPILE_SHADER, nextShader);
+                writeTargetName(out, OP_ATTACH_SHADER, it->first, nextShader);
+            }
+            if (!program.linked)
+                continue;
+
+            writeName(out, OP_LINK_PROGRAM, it->first);
+            for (GLuint shader = firstShader; shader < nextShader; ++shader)
+                writeName(out, OP_DELETE_SHADER, shader);
+
+            writeName(out, OP_USE_PROGRAM, it->first);
+            for (std::map<GLint, std::string>::const_iterator uniform = program.uniformNames.begin(); uniform != program.uniformNames.end(); ++uniform)
+                writeGetUniformLocation(out, it->first, uniform->first, uniform->second);
+            for (std::map<GLint, std::vector<unsigned char>>::const_iterator value = program.uniformValues.begin(); value != program.uniformValues.end(); ++value)
+                out.insert(out.end(), value->second.begin(), value->second.end());
+        }
+        writeName(out, OP_USE_PROGRAM, 0);
+
+        for (std::map<GLuint, ShadowVertexArray>::const_iterator it = gShadow.vertexArrays.begin(); it != gShadow.vertexArrays.end(); ++it)
+        {
+            if (it->first == 0)
+                continue;
+            writeNames(out, OP_GEN_VERTEX_ARRAYS, 1, &it->first);
+            writeName(out, OP_BIND_VERTEX_ARRAY, it->first);
+            for (int a = 0; a < MAX_ATTRIBUTES; ++a)
+            {
+                const ShadowAttribute& attribute = it->second.attributes[a];
+                if (attribute.pointerSet)
+                {
+                    writeTargetName(out, OP_BIND_BUFFER, GL_ARRAY_BUFFER, attribute.buffer);
+                    writeVertexAttribPointer(out, a, attribute.size, attribute.type, attribute.normalized, attribute.stride, attribute.offset);
+                }
+                if (attribute.enabled)
+                    writeName(out, OP_ENABLE_VERTEX_ATTRIB_ARRAY, a);
+            }
+            writeTargetName(out, OP_BIND_BUFFER, GL_ELEMENT_ARRAY_BUFFER, it->second.elementBuffer);
+        }
+        writeName(out, OP_BIND_VERTEX_ARRAY, 0);
+        writeTargetName(out, OP_BIND_BUFFER, GL_ARRAY_BUFFER, 0);
+
+        for (std::map<GLuint, ShadowFramebuffer>::const_iterator it = gShadow.framebuffers.begin(); it != gShadow.framebuffers.end(); ++it)
+        {
+            writeNames(out, OP_GEN_FRAMEBUFFERS, 1, &it->first);
+            writeTargetName(out, OP_BIND_FRAMEBUFFER, GL_FRAMEBUFFER, it->first);
+            for (std::map<GLenum, std::pair<GLuint, GLint>>::const_iterator attachment = it->second.attachments.begin(); attachment != it->second.attachments.end(); ++attachment)
+                writeFramebufferTexture2D(out, GL_FRAMEBUFFER, attachment->first, GL_TEXTURE_2D, attachment->second.first, attachment->second.second);
+        }
+
+        for (std::set<GLuint>::const_iterator it = gShadow.queries.begin(); it != gShadow.queries.end(); ++it)
+            writeNames(out, OP_GEN_QUERIES, 1, &*it);
+
+        // The state the first captured frame starts from
+        writeViewport(out, gShadow.viewport);
+        writeClearColor(out, gShadow.clearColor);
+        for (std::map<GLenum, bool>::const_iterator it = gShadow.capabilities.begin(); it != gShadow.capabilities.end(); ++it)
+            writeEnum(out, it->second ? OP_ENABLE : OP_DISABLE, it->first);
+        writeTargetName(out, OP_BIND_FRAMEBUFFER, GL_FRAMEBUFFER, gShadow.framebuffer);
+        writeName(out, OP_USE_PROGRAM, gShadow.program);
+        writeName(out, OP_BIND_VERTEX_ARRAY, gShadow.vertexArray);
+        for (std::map<GLenum, GLuint>::const_iterator it = gShadow.textureUnits.begin(); it != gShadow.textureUnits.end(); ++it)
+        {
+            writeEnum(out, OP_ACTIVE_TEXTURE, it->first);
+            writeTargetName(out, OP_BIND_TEXTURE, GL_TEXTURE_2D, it->second);
+        }
+        writeEnum(out, OP_ACTIVE_TEXTURE, gShadow.activeTexture);
+        for (std::map<GLenum, GLuint>::const_iterator it = gShadow.bufferBindings.begin(); it != gShadow.bufferBindings.end(); ++it)
+            writeTargetName(out, OP_BIND_BUFFER, it->first, it->second);
+    }
+
+    unsigned countCommands(const std::vector<unsigned char>& stream)
+    {
+        unsigned count = 0;
+        for (size_t position = 0; position + COMMAND_HEADER_BYTES <= stream.size(); ++count)
+        {
+            uint32_t size;
+            memcpy(&size, &stream[position + sizeof(uint16_t)], sizeof(size));
+            position += COMMAND_HEADER_BYTES + size;
+        }
+        return count;
+    }
+
+    bool writeCaptureFile(const std::vector<unsigned char>& prologue)
+    {
+        GlCaptureFileHeader header;
+        memcpy(header.magic, GL_CAPTURE_MAGIC, sizeof(header.magic));
+        header.version = GL_CAPTURE_VERSION;
+        header.width = gWidth;
+        header.height = gHeight;
+        header.frameCount = (unsigned)gFramesRecorded;
+        header.commandCount = countCommands(gFrameStream);
+        header.prologueBytes = prologue.size();
+        header.frameBytes = gFrameStream.size();
+
+        FILE* file = fopen(gFilename.c_str(), "wb");
+        if (!file)
+        {
+            ULOG_ERROR("Can't write GL capture {}", gFilename);
+            return false;
+        }
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+            && (prologue.empty() || fwrite(&prologue[0], 1, prologue.size(), file) == prologue.size())
+            && (gFrameStream.empty() || fwrite(&gFrameStream[0], 1, gFrameStream.size(), file) == gFrameStream.size());
+        ok = fclose(file) == 0 && ok;
+        if (!ok)
+        {
+            ULOG_ERROR("Failed writing GL capture {}", gFilename);
+            return false;
+        }
+
+        ULOG_INFO("Captured {} frames, {} calls to {}: {} KiB of state, {} KiB of frames", header.frameCount, header.commandCount,
+            gFilename, prologue.size() / 1024, gFrameStream.size() / 1024);
+        return true;
+    }
+
+    // Replay
+
+    struct ReplayState
+    {
+        std::map<GLuint, GLuint> buffers;
+        std::map<GLuint, GLuint> textures;
+        std::map<GLuint, GLuint> vertexArrays;
+        std::map<GLuint, GLuint> framebuffers;
+        std::map<GLuint, GLuint> queries;
+        std::map<GLuint, GLuint> shaders;
+        std::map<GLuint, GLuint> programs;
+        std::map<std::pair<GLuint, GLint>, GLint> uniformLocations;    // Captured program and location to ours
+        GLuint program;             // Captured name of the program in use
+        GLuint target;              // Stands in for the default framebuffer
+    };
+
+    struct OpTiming
+    {
+        unsigned long long count;
+        double seconds;
+        double slowest;
+    };
+
+    struct SlowCall
+    {
+        double seconds;
+        int frame;
+        unsigned index;             // Command number in the frame
+        CaptureOp op;
+    };
+
+    struct ReplayStats
+    {
+        OpTiming ops[OP_COUNT];
+        std::vector<SlowCall> slowest;
+        std::vector<double> frameSeconds;
+        bool finishEachCall;
+    };
+
+    GLuint mapName(const std::map<GLuint, GLuint>& names, GLuint name)
+    {
+        std::map<GLuint, GLuint>::const_iterator found = names.find(name);
+        return found == names.end() ? 0 : found->second;
+    }
+
+    GLint mapLocation(const ReplayState& state, GLint location)
+    {
+        if (location < 0)
+            return location;
+        std::map<std::pair<GLuint, GLint>, GLint>::const_iterator found = state.uniformLocations.find(std::make_pair(state.program, location));
+        return found == state.uniformLocations.end() ? -1 : found->second;
+    }
+
+    // The glGen* and glDelete* entry points all share glGenBuffers' and glDeleteBuffers' signatures
+    void generateNames(CommandReader& reader, std::map<GLuint, GLuint>& names, PFNGLGENBUFFERSPROC gen)
+    {
+        GLsizei n = reader.get<GLsizei>();
+        for (GLsizei i = 0; i < n && reader.ok; ++i)
+        {
+            GLuint captured = reader.get<GLuint>();
+            GLuint name = 0;
+            gen(1, &name);
+            names[captured] = name;
+        }
+    }
+
+    void deleteNames(CommandReader& reader, std::map<GLuint, GLuint>& names, PFNGLDELETEBUFFERSPROC del)
+    {
+        GLsizei n = reader.get<GLsizei>();
+        for (GLsizei i = 0; i < n && reader.ok; ++i)
+        {
+            GLuint captured = reader.get<GLuint>();
+            GLuint name = mapName(names, captured);
+            if (name != 0)
+                del(1, &name);
+            names.erase(captured);
+        }
+    }
+
+    // Runs one command, false when it can't be decoded
+    bool replayCommand(CaptureOp op, CommandReader& in, ReplayState& state)
+    {
+        switch (op)
+        {
+        case OP_ACTIVE_TEXTURE:
+            glActiveTexture(in.get<GLenum>());
+            break;
+        case OP_ATTACH_SHADER:
+        {
+            GLuint program = mapName(state.programs, in.get<GLuint>());
+            glAttachShader(program, mapName(state.shaders, in.get<GLuint>()));
+            break;
+        }
+        case OP_BEGIN_QUERY:
+        {
+            GLenum target = in.get<GLenum>();
+            glBeginQuery(target, mapName(state.queries, in.get<GLuint>()));
+            break;
+        }
+        case OP_BIND_BUFFER:
+        {
+            GLenum target = in.get<GLenum>();
+            glBindBuffer(target, mapName(state.buffers, in.get<GLuint>()));
+            break;
+        }
+        case OP_BIND_FRAMEBUFFER:
+        {
+            GLenum target = in.get<GLenum>();
+            GLuint framebuffer = in.get<GLuint>();
+            glBindFramebuffer(target, framebuffer == 0 ? state.target : mapName(state.framebuffers, framebuffer));
+            break;
+        }
+        case OP_BIND_TEXTURE:
+        {
+            GLenum target = in.get<GLenum>();
+            glBindTexture(target, mapName(state.textures, in.get<GLuint>()));
+            break;
+        }
+        case OP_BIND_VERTEX_ARRAY:
+            glBindVertexArray(mapName(state.vertexArrays, in.get<GLuint>()));
+            break;
+        case OP_BUFFER_DATA:
+        {
+            GLenum target = in.get<GLenum>();
+            uint64_t size = in.get<uint64_t>();
+            GLenum usage = in.get<GLenum>();
+            const unsigned char* data = nullptr;
+            uint64_t bytes = 0;
+            // A blob that doesn't match the size fails the command, like a truncated one
+            if (in.get<uint8_t>())
+            {
+                data = in.blob(bytes);
+                if (bytes != size)
+                    in.ok = false;
+            }
+            if (in.ok)
+                glBufferData(target, (GLsizeiptr)size, data, usage);
+            break;
+        }
+        case OP_BUFFER_SUB_DATA:
+        {
+            GLenum target = in.get<GLenum>();
+            uint64_t offset = in.get<uint64_t>();
+            uint64_t bytes = 0;
+            const unsigned char* data = in.blob(bytes);
+            if (in.ok)
+                glBufferSubData(target, (GLintptr)offset, (GLsizeiptr)bytes, data);
+            break;
+        }
+        case OP_CLEAR:
+            glClear(in.get<GLbitfield>());
+            break;
+        case OP_CLEAR_COLOR:
+        {
+            GLfloat color[4];
+            for (int i = 0; i < 4; ++i)
+                color[i] = in.get<GLfloat>();
+            glClearColor(color[0], color[1], color[2], color[3]);
+            break;
+        }
+        case OP_COMPILE_SHADER:
+            glCompileShader(mapName(state.shaders, in.get<GLuint>()));
+            break;
+        case OP_CREATE_PROGRAM:
+        {
+            in.get<GLenum>();
+            GLuint captured = in.get<GLuint>();
+            state.programs[captured] = glCreateProgram();
+            break;
+        }
+        case OP_CREATE_SHADER:
+        {
+            GLenum type = in.get<GLenum>();
+            GLuint captured = in.get<GLuint>();
+            state.shaders[captured] = glCreateShader(type);
+            break;
+        }
+        case OP_DELETE_BUFFERS:
+            deleteNames(in, state.buffers, glDeleteBuffers);
+            break;
+        case OP_DELETE_FRAMEBUFFERS:
+            deleteNames(in, state.framebuffers, glDeleteFramebuffers);
+            break;
+        case OP_DELETE_PROGRAM:
+        {
+            GLuint captured = in.get<GLuint>();
+            glDeleteProgram(mapName(state.programs, captured));
+            state.programs.erase(captured);
+            break;
+        }
+        case OP_DELETE_QUERIES:
+            deleteNames(in, state.queries, glDeleteQueries);
+            break;
+        case OP_DELETE_SHADER:
+        {
+            GLuint captured = in.get<GLuint>();
+            glDeleteShader(mapName(state.shaders, captured));
+            state.shaders.erase(captured);
+            break;
+        }
+        case OP_DELETE_TEXTURES:
+            deleteNames(in, state.textures, glDeleteTextures);
+            break;
+        case OP_DELETE_VERTEX_ARRAYS:
+            deleteNames(in, state.vertexArrays, glDeleteVertexArrays);
+            break;
+        case OP_DISABLE:
+            glDisable(in.get<GLenum>());
+            break;
+        case OP_DRAW_ARRAYS:
+        {
+            GLenum mode = in.get<GLenum>();
+            GLint first = in.get<GLint>();
+            glDrawArrays(mode, first, in.get<GLsizei>());
+            break;
+        }
+        case OP_DRAW_ELEMENTS:
+        {
+            GLenum mode = in.get<GLenum>();
+            GLsizei count = in.get<GLsizei>();
+            GLenum type = in.get<GLenum>();
+            uint64_t offset = in.get<uint64_t>();
+            glDrawElements(mode, count, type, (const void*)(uintptr_t)offset);
+            break;
+        }
+        case OP_DRAW_ELEMENTS_INSTANCED:
+        {
+            GLenum mode = in.get<GLenum>();
+            GLsizei count = in.get<GLsizei>();
+            GLenum type = in.get<GLenum>();
+            uint64_t offset = in.get<uint64_t>();
+            glDrawElementsInstanced(mode, count, type, (const void*)(uintptr_t)offset, in.get<GLsizei>());
+            break;
+        }
+        case OP_ENABLE:
+            glEnable(in.get<GLenum>());
+            break;
+        case OP_ENABLE_VERTEX_ATTRIB_ARRAY:
+            glEnableVertexAttribArray(in.get<GLuint>());
+            break;
+        case OP_END_QUERY:
+            glEndQuery(in.get<GLenum>());
+            break;
+        case OP_FRAMEBUFFER_TEXTURE_2D:
+        {
+            GLenum target = in.get<GLenum>();
+            GLenum attachment = in.get<GLenum>();
+            GLenum textarget = in.get<GLenum>();
+            GLuint texture = mapName(state.textures, in.get<GLuint>());
+            glFramebufferTexture2D(target, attachment, textarget, texture, in.get<GLint>());
+            break;
+        }
+        case OP_GEN_BUFFERS:
+            generateNames(in, state.buffers, glGenBuffers);
+            break;
+        case OP_GEN_FRAMEBUFFERS:
+            generateNames(in, state.framebuffers, glGenFramebuffers);
+            break;
+        case OP_GEN_QUERIES:
+            generateNames(in, state.queries, glGenQueries);
+            break;
+        case OP_GEN_TEXTURES:
+            generateNames(in, state.textures, glGenTextures);
+            break;
+        case OP_GEN_VERTEX_ARRAYS:
+            generateNames(in, state.vertexArrays, glGenVertexArrays);
+            break;
+        case OP_GET_UNIFORM_LOCATION:
+        {
+            GLuint program = in.get<GLuint>();
+            GLint location = in.get<GLint>();
+            uint64_t bytes = 0;
+            const unsigned char* name = in.blob(bytes);
+            if (in.ok && location >= 0)
+            {
+                std::string uniform((const char*)name, (size_t)bytes);
+                state.uniformLocations[std::make_pair(program, location)] = glGetUniformLocation(mapName(state.programs, program), uniform.c_str());
+            }
+            break;
+        }
+        case OP_LINK_PROGRAM:
+            glLinkProgram(mapName(state.programs, in.get<GLuint>()));
+            break;
+        case OP_SHADER_SOURCE:
+        {
+            GLuint shader = mapName(state.shaders, in.get<GLuint>());
+            uint64_t bytes = 0;
+            const GLchar* source = (const GLchar*)in.blob(bytes);
+            GLint length = (GLint)bytes;
+            if (in.ok)
+                glShaderSource(shader, 1, &source, &length);
+            break;
+        }
+        case OP_TEX_IMAGE_2D:
+        {
+            GLenum target = in.get<GLenum>();
+            GLint level = in.get<GLint>();
+            GLint internalformat = in.get<GLint>();
+            GLsizei width = in.get<GLsizei>();
+            GLsizei height = in.get<GLsizei>();
+            GLint border = in.get<GLint>();
+            GLenum format = in.get<GLenum>();
+            GLenum type = in.get<GLenum>();
+            uint8_t source = in.get<uint8_t>();
+            const void* pixels = nullptr;
+            uint64_t bytes = 0;
+            if (source == 1)
+            {
+                pixels = in.blob(bytes);
+                if (bytes < imageBytes(width, height, format, type))
+                    in.ok = false;
+            }
+            else if (source == 2)
+                pixels = (const void*)(uintptr_t)in.get<uint64_t>();
+            if (in.ok)
+                glTexImage2D(target, level, internalformat, width, height, border, format, type, pixels);
+            break;
+        }
+        case OP_TEX_PARAMETERI:
+        {
+            GLenum target = in.get<GLenum>();
+            GLenum pname = in.get<GLenum>();
+            glTexParameteri(target, pname, in.get<GLint>());
+            break;
+        }
+        case OP_UNIFORM_1F:
+        case OP_UNIFORM_1I:
+        case OP_UNIFORM_2F:
+        case OP_UNIFORM_3F:
+        {
+            GLint location = mapLocation(state, in.get<GLint>());
+            GLfloat v[3] = { 0.0f, 0.0f, 0.0f };
+            int count = op == OP_UNIFORM_3F ? 3 : op == OP_UNIFORM_2F ? 2 : 1;
+            for (int i = 0; i < count; ++i)
+                v[i] = in.get<GLfloat>();
+            if (op == OP_UNIFORM_1I)
+            {
+                GLint value;
+                memcpy(&value, &v[0], sizeof(value));
+                glUniform1i(location, value);
+            }
+            else if (op == OP_UNIFORM_1F)
+                glUniform1f(location, v[0]);
+            else if (op == OP_UNIFORM_2F)
+                glUniform2f(location, v[0], v[1]);
+            else
+                glUniform3f(location, v[0], v[1], v[2]);
+            break;
+        }
+        case OP_UNIFORM_MATRIX_4FV:
+        {
+            GLint location = mapLocation(state, in.get<GLint>());
+            GLsizei count = in.get<GLsizei>();
+            GLboolean transpose = in.get<uint8_t>();
+            uint64_t bytes = 0;
+            const unsigned char* values = in.blob(bytes);
+            if (bytes != sizeof(GLfloat) * 16 * (size_t)count)
+                in.ok = false;
+            else if (in.ok && count > 0)
+            {
+                std::vector<GLfloat> matrices((size_t)count * 16);
+                memcpy(matrices.data(), values, (size_t)bytes);
+                glUniformMatrix4fv(location, count, transpose, matrices.data());
+            }
+            break;
+        }
+        case OP_USE_PROGRAM:
+            state.program = in.get<GLuint>();
+            glUseProgram(mapName(state.programs, state.program));
+            break;
+        case OP_VERTEX_ATTRIB_POINTER:
+        {
+            GLuint index = in.get<GLuint>();
+            GLint size = in.get<GLint>();
+            GLenum type = in.get<GLenum>();
+            GLboolean normalized = in.get<uint8_t>();
+            GLsizei stride = in.get<GLsizei>();
+            uint64_t offset = in.get<uint64_t>();
+            glVertexAttribPointer(index, size, type, normalized, stride, (const void*)(uintptr_t)offset);
+            break;
+        }
+        case OP_VIEWPORT:
+        {
+            GLint viewport[4];
+            for (int i = 0; i < 4; ++i)
+                viewport[i] = in.get<GLint>();
+            glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+            break;
+        }
+        case OP_VIEWPORT_INDEXED:
+        {
+            GLuint index = in.get<GLuint>();
+            GLfloat viewport[4];
+            for (int i = 0; i < 4; ++i)
+                viewport[i] = in.get<GLfloat>();
+            glViewportIndexedf(index, viewport[0], viewport[1], viewport[2], viewport[3]);
+            break;
+        }
+        case OP_FRAME_END:
+            break;
+        default:
+            return false;
+        }
+        return in.ok;
+    }
+
+    /* Runs the commands in data. With stats, every call is timed and frame ends wait for the
+     * GPU so the frame times are complete.
+     */
+    bool replayStream(const unsigned char* data, size_t size, ReplayState& state, ReplayStats* stats)
+    {
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point frameStart = Clock::now();
+        unsigned index = 0;
+        int frame = 0;
+        for (size_t position = 0; position < size; )
+        {
+            if (size - position < COMMAND_HEADER_BYTES)
+                return false;
+            uint16_t code;
+            uint32_t payload;
+            memcpy(&code, data + position, sizeof(code));
+            memcpy(&payload, data + position + sizeof(code), sizeof(payload));
+            position += COMMAND_HEADER_BYTES;
+            if (code >= OP_COUNT || payload > size - position)
+                return false;
+
+            CaptureOp op = (CaptureOp)code;
+            CommandReader reader(data + position, payload);
+            position += payload;
+
+            Clock::time_point start = Clock::now();
+            if (!replayCommand(op, reader, state))
+            {
+                ULOG_ERROR("Bad {} command in the capture", OP_NAMES[op]);
+                return false;
+            }
+            if (!stats)
+                continue;
+
+            if (stats->finishEachCall || op == OP_FRAME_END)
+                glFinish();
+            Clock::time_point end = Clock::now();
+            double seconds = std::chrono::duration<double>(end - start).count();
+
+            if (op == OP_FRAME_END)
+            {
+                stats->frameSeconds.push_back(std::chrono::duration<double>(end - frameStart).count());
+                frameStart = end;
+                index = 0;
+                ++frame;
+                continue;
+            }
+
+            OpTiming& timing = stats->ops[op];
+            ++timing.count;
+            timing.seconds += seconds;
+            timing.slowest = std::max(timing.slowest, seconds);
+
+            // Keep the slowest calls sorted, slowest first
+            if (stats->slowest.size() < SLOWEST_CALLS || seconds > stats->slowest.back().seconds)
+            {
+                SlowCall call = { seconds, frame, index, op };
+                if (stats->slowest.size() == SLOWEST_CALLS)
+                    stats->slowest.pop_back();
+                stats->slowest.push_back(call);
+                std::sort(stats->slowest.begin(), stats->slowest.end(), [](const SlowCall& a, const SlowCall& b) { return a.seconds > b.seconds; });
+            }
+            ++index;
+        }
+        return true;
+    }
+
+    bool createReplayTarget(unsigned width, unsigned height, GLuint& framebuffer, GLuint textures[2])
+    {
+        glGenTextures(2, textures);
+        glBindTexture(GL_TEXTURE_2D, textures[0]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, (GLsizei)width, (GLsizei)height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glBindTexture(GL_TEXTURE_2D, textures[1]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, (GLsizei)width, (GLsizei)height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[0], 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, textures[1], 0);
+        return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    }
+}
+
+
+void UArmGlCapture(const char* filename, int frames)
+{
+    gFilename = filename;
+    gFrames = std::max(frames, 1);
+    gArmed = true;
+    ULOG_INFO("GL capture armed, press F12 to write the next {} frames to {}", gFrames, gFilename);
+}
+
+
+bool UGlCaptureArmed()
+{
+    return gArmed;
+}
+
+
+void URequestGlCapture()
+{
+    if (gArmed)
+        gRequested = true;
+}
+
+
+void UGlCaptureFrameEnd(int windowWidth, int windowHeight)
+{
+    if (!gArmed)
+        return;
+
+    if (gRecording)
+    {
+        {
+            CommandWriter command(gFrameStream, OP_FRAME_END);
+            command.put(windowWidth);
+            command.put(windowHeight);
+        }
+        if (++gFramesRecorded < gFrames)
+            return;
+
+        gRecording = false;
+        writeCaptureFile(gPrologue);
+        gPrologue = std::vector<unsigned char>();
+        gFrameStream = std::vector<unsigned char>();
+        return;
+    }
+
+    if (gRequested.exchange(false))
+    {
+        gPrologue.clear();
+        gFrameStream.clear();
+        writePrologue(gPrologue);
+        gWidth = (unsigned)std::max(windowWidth, 1);
+        gHeight = (unsigned)std::max(windowHeight, 1);
+        gFramesRecorded = 0;
+        gRecording = true;
+    }
+}
+
+
+bool UReplayGlCapture(const char* filename, int repeats, bool finishEachCall)
+{
+    FILE* file = fopen(filename, "rb");
+    if (!file)
+    {
+        ULOG_ERROR("Can't open GL capture {}", filename);
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long fileBytes = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    // The stream sizes come from the file, so they have to fit in what follows the header before anything is allocated
+    GlCaptureFileHeader header;
+    bool ok = fileBytes >= (long)sizeof(header)
+        && fread(&header, sizeof(header), 1, file) == 1
+        && memcmp(header.magic, GL_CAPTURE_MAGIC, sizeof(header.magic)) == 0
+        && header.version == GL_CAPTURE_VERSION;
+    unsigned long long streamBytes = ok ? (unsigned long long)fileBytes - sizeof(header) : 0;
+    ok = ok && header.prologueBytes <= streamBytes && header.frameBytes <= streamBytes - header.prologueBytes;
+    std::vector<unsigned char> data;
+    if (ok)
+    {
+        data.resize((size_t)(header.prologueBytes + header.frameBytes));
+        ok = data.empty() || fread(&data[0], 1, data.size(), file) == data.size();
+    }
+    fclose(file);
+    if (!ok || data.empty())
+    {
+        ULOG_ERROR("{} is not a GL capture this version can read", filename);
+        return false;
+    }
+
+    ReplayState state;
+    state.program = 0;
+    GLuint targetTextures[2] = { 0, 0 };
+    if (!createReplayTarget(header.width, header.height, state.target, targetTextures))
+    {
+        ULOG_ERROR("Can't create a {}x{} replay target", header.width, header.height);
+        return false;
+    }
+
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    ok = replayStream(&data[0], (size_t)header.prologueBytes, state, nullptr);
+    glFinish();
+    double prologueSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    ReplayStats stats = {};
+    stats.finishEachCall = finishEachCall;
+    repeats = std::max(repeats, 1);
+    for (int r = 0; r < repeats && ok; ++r)
+        ok = replayStream(&data[(size_t)header.prologueBytes], (size_t)header.frameBytes, state, &stats);
+
+    if (ok && !stats.frameSeconds.empty())
+    {
+        double total = 0.0, fastest = stats.frameSeconds[0], slowest = stats.frameSeconds[0];
+        for (size_t f = 0; f < stats.frameSeconds.size(); ++f)
+        {
+            total += stats.frameSeconds[f];
+            fastest = std::min(fastest, stats.frameSeconds[f]);
+            slowest = std::max(slowest, stats.frameSeconds[f]);
+        }
+        ULOG_INFO("Replayed {}: {}x{}, state in {} ms, {} frames x {}: {} ms per frame (fastest {}, slowest {}){}",
+            filename, header.width, header.height, prologueSeconds * 1000.0, header.frameCount, repeats,
+            total * 1000.0 / stats.frameSeconds.size(), fastest * 1000.0, slowest * 1000.0, finishEachCall ? ", waiting for the GPU after every call" : "");
+
+        // Entry points by the time they took, over all repeats
+        int order[OP_COUNT];
+        for (int op = 0; op < OP_COUNT; ++op)
+            order[op] = op;
+        std::sort(order, order + OP_COUNT, [&stats](int a, int b) { return stats.ops[a].seconds > stats.ops[b].seconds; });
+        for (int i = 0; i < OP_COUNT; ++i)
+        {
+            const OpTiming& timing = stats.ops[order[i]];
+            if (timing.count == 0)
+                break;
+            ULOG_INFO("  {}: {} calls, {} ms, {} us each, slowest {} us", OP_NAMES[order[i]], timing.count, timing.seconds * 1000.0,
+                timing.seconds * 1.0e6 / timing.count, timing.slowest * 1.0e6);
+        }
+        for (size_t i = 0; i < stats.slowest.size(); ++i)
+        {
+            const SlowCall& call = stats.slowest[i];
+            ULOG_INFO("  Slow call: frame {} call {} {}: {} us", call.frame, call.index, OP_NAMES[call.op], call.seconds * 1.0e6);
+        }
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &state.target);
+    glDeleteTextures(2, targetTextures);
+    return ok;
+}
+
+
+// Wrappers: the real call first, then the shadow and the recording
+
+void UCaptureActiveTexture(GLenum texture)
+{
+    glActiveTexture(texture);
+    if (!gArmed)
+        return;
+    gShadow.activeTexture = texture;
+    if (gRecording)
+        writeEnum(gFrameStream, OP_ACTIVE_TEXTURE, texture);
+}
+
+
+void UCaptureAttachShader(GLuint program, GLuint shader)
+{
+    glAttachShader(program, shader);
+    if (!gArmed)
+        return;
+    gShadow.programs[program].shaders.push_back(gShadow.shaders[shader]);
+    if (gRecording)
+        writeTargetName(gFrameStream, OP_ATTACH_SHADER, program, shader);
+}
+
+
+void UCaptureBeginQuery(GLenum target, GLuint id)
+{
+    glBeginQuery(target, id);
+    if (gRecording)
+        writeTargetName(gFrameStream, OP_BEGIN_QUERY, target, id);
+}
+
+
+void UCaptureBindBuffer(GLenum target, GLuint buffer)
+{
+    glBindBuffer(target, buffer);
+    if (!gArmed)
+        return;
+    if (target == GL_ELEMENT_ARRAY_BUFFER)
+        gShadow.vertexArrays[gShadow.vertexArray].elementBuffer = buffer;
+    else
+        gShadow.bufferBindings[target] = buffer;
+    if (gRecording)
+        writeTargetName(gFrameStream, OP_BIND_BUFFER, target, buffer);
+}
+
+
+void UCaptureBindFramebuffer(GLenum target, GLuint framebuffer)
+{
+    glBindFramebuffer(target, framebuffer);
+    if (!gArmed)
+        return;
+    gShadow.framebuffer = framebuffer;
+    if (gRecording)
+        writeTargetName(gFrameStream, OP_BIND_FRAMEBUFFER, target, framebuffer);
+}
+
+
+void UCaptureBindTexture(GLenum target, GLuint texture)
+{
+    glBindTexture(target, texture);
+    if (!gArmed)
+        return;
+    gShadow.textureUnits[gShadow.activeTexture] = texture;
+    if (gRecording)
+        writeTargetName(gFrameStream, OP_BIND_TEXTURE, target, texture);
+}
+
+
+void UCaptureBindVertexArray(GLuint array)
+{
+    glBindVertexArray(array);
+    if (!gArmed)
+        return;
+    gShadow.vertexArray = array;
+    if (gRecording)
+        writeName(gFrameStream, OP_BIND_VERTEX_ARRAY, array);
+}
+
+
+void UCaptureBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+{
+    glBufferData(target, size, data, usage);
+    if (!gArmed)
+        return;
+    GLuint name = boundBuffer(target);
+    if (name != 0)
+    {
+        ShadowBuffer& buffer = gShadow.buffers[name];
+        buffer.usage = usage;
+        if (data)
+            buffer.data.assign(static_cast<const unsigned char*>(data), static_cast<const unsigned char*>(data) + size);
+        else
+            buffer.data.assign((size_t)size, 0);
+    }
+    if (gRecording)
+        writeBufferData(gFrameStream, target, (size_t)size, data, usage);
+}
+
+
+void UCaptureClear(GLbitfield mask)
+{
+    glClear(mask);
+    if (gRecording)
+        writeEnum(gFrameStream, OP_CLEAR, mask);
+}
+
+
+void UCaptureClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha)
+{
+    glClearColor(red, green, blue, alpha);
+    if (!gArmed)
+        return;
+    gShadow.clearColor[0] = red;
+    gShadow.clearColor[1] = green;
+    gShadow.clearColor[2] = blue;
+    gShadow.clearColor[3] = alpha;
+    if (gRecording)
+        writeClearColor(gFrameStream, gShadow.clearColor);
+}
+
+
+void UCaptureCompileShader(GLuint shader)
+{
+    glCompileShader(shader);
+    if (gRecording)
+        writeName(gFrameStream, OP_COMPILE_SHADER, shader);
+}
+
+
+GLuint UCaptureCreateProgram()
+{
+    GLuint program = glCreateProgram();
+    if (!gArmed)
+        return program;
+    gShadow.programs[program] = ShadowProgram();
+    if (gRecording)
+        writeCreate(gFrameStream, OP_CREATE_PROGRAM, 0, program);
+    return program;
+}
+
+
+GLuint UCaptureCreateShader(GLenum type)
+{
+    GLuint shader = glCreateShader(type);
+    if (!gArmed)
+        return shader;
+    gShadow.shaders[shader].type = type;
+    gShadow.shaders[shader].source.clear();
+    if (gRecording)
+        writeCreate(gFrameStream, OP_CREATE_SHADER, type, shader);
+    return shader;
+}
+
+
+void UCaptureDeleteBuffers(GLsizei n, const GLuint* buffers)
+{
+    glDeleteBuffers(n, buffers);
+    if (!gArmed)
+        return;
+    for (GLsizei i = 0; i < n; ++i)
+    {
+        gShadow.buffers.erase(buffers[i]);
+        for (std::map<GLenum, GLuint>::iterator it = gShadow.bufferBindings.begin(); it != gShadow.bufferBindings.end(); ++it)
+            if (it->second == buffers[i])
+                it->second = 0;
+        if (gShadow.vertexArrays[gShadow.vertexArray].elementBuffer == buffers[i])
+            gShadow.vertexArrays[gShadow.vertexArray].elementBuffer = 0;
+    }
+    if (gRecording)
+        writeNames(gFrameStream, OP_DELETE_BUFFERS, n, buffers);
+}
+
+
+void UCaptureDeleteFramebuffers(GLsizei n, const GLuint* framebuffers)
+{
+    glDeleteFramebuffers(n, framebuffers);
+    if (!gArmed)
+        return;
+    for (GLsizei i = 0; i < n; ++i)
+    {
+        gShadow.framebuffers.erase(framebuffers[i]);
+        if (gShadow.framebuffer == framebuffers[i])
+            gShadow.framebuffer = 0;
+    }
+    if (gRecording)
+        writeNames(gFrameStream, OP_DELETE_FRAMEBUFFERS, n, framebuffers);
+}
+
+
+void UCaptureDeleteProgram(GLuint program)
+{
+    glDeleteProgram(program);
+    if (!gArmed)
+        return;
+    gShadow.programs.erase(program);
+    if (gRecording)
+        writeName(gFrameStream, OP_DELETE_PROGRAM, program);
+}
+
+
+void UCaptureDeleteQueries(GLsizei n, const GLuint* ids)
+{
+    glDeleteQueries(n, ids);
+    if (!gArmed)
+        return;
+    for (GLsizei i = 0; i < n; ++i)
+        gShadow.queries.erase(ids[i]);
+    if (gRecording)
+        writeNames(gFrameStream, OP_DELETE_QUERIES, n, ids);
+}
+
+
+void UCaptureDeleteShader(GLuint shader)
+{
+    glDeleteShader(shader);
+    if (!gArmed)
+        return;
+    gShadow.shaders.erase(shader);
+    if (gRecording)
+        writeName(gFrameStream, OP_DELETE_SHADER, shader);
+}
+
+
+void UCaptureDeleteTextures(GLsizei n, const GLuint* textures)
+{
+    glDeleteTextures(n, textures);
+    if (!gArmed)
+        return;
+    for (GLsizei i = 0; i < n; ++i)
+    {
+        gShadow.textures.erase(textures[i]);
+        for (std::map<GLenum, GLuint>::iterator it = gShadow.textureUnits.begin(); it != gShadow.textureUnits.end(); ++it)
+            if (it->second == textures[i])
+                it->second = 0;
+    }
+    if (gRecording)
+        writeNames(gFrameStream, OP_DELETE_TEXTURES, n, textures);
+}
+
+
+void UCaptureDeleteVertexArrays(GLsizei n, const GLuint* arrays)
+{
+    glDeleteVertexArrays(n, arrays);
+    if (!gArmed)
+        return;
+    for (GLsizei i = 0; i < n; ++i)
+    {
+        if (arrays[i] == 0)
+            continue;
+        gShadow.vertexArrays.erase(arrays[i]);
+        if (gShadow.vertexArray == arrays[i])
+            gShadow.vertexArray = 0;
+    }
+    if (gRecording)
+        writeNames(gFrameStream, OP_DELETE_VERTEX_ARRAYS, n, arrays);
+}
+
+
+void UCaptureDisable(GLenum cap)
+{
+    glDisable(cap);
+    if (!gArmed)
+        return;
+    gShadow.capabilities[cap] = false;
+    if (gRecording)
+        writeEnum(gFrameStream, OP_DISABLE, cap);
+}
+
+
+void UCaptureDrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+    glDrawArrays(mode, first, count);
+    if (gRecording)
+    {
+        CommandWriter command(gFrameStream, OP_DRAW_ARRAYS);
+        command.put(mode);
+        command.put(first);
+        command.put(count);
+    }
+}
+
+
+void UCaptureDrawElements(GLenum mode, GLsizei count, GLenum type, const void* indices)
+{
+    glDrawElements(mode, count, type, indices);
+    if (gRecording)
+    {
+        // Indices always come from the element buffer, the pointer is an offset into it
+        CommandWriter command(gFrameStream, OP_DRAW_ELEMENTS);
+        command.put(mode);
+        command.put(count);
+        command.put(type);
+        command.put((uint64_t)(uintptr_t)indices);
+    }
+}
+
+
+void UCaptureDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instancecount)
+{
+    glDrawElementsInstanced(mode, count, type, indices, instancecount);
+    if (gRecording)
+    {
+        CommandWriter command(gFrameStream, OP_DRAW_ELEMENTS_INSTANCED);
+        command.put(mode);
+        command.put(count);
+        command.put(type);
+        command.put((uint64_t)(uintptr_t)indices);
+        command.put(instancecount);
+    }
+}
+
+
+void UCaptureEnable(GLenum cap)
+{
+    glEnable(cap);
+    if (!gArmed)
+        return;
+    gShadow.capabilities[cap] = true;
+    if (gRecording)
+        writeEnum(gFrameStream, OP_ENABLE, cap);
+}
+
+
+void UCaptureEnableVertexAttribArray(GLuint index)
+{
+    glEnableVertexAttribArray(index);
+    if (!gArmed)
+        return;
+    if (index < (GLuint)MAX_ATTRIBUTES)
+        gShadow.vertexArrays[gShadow.vertexArray].attributes[index].enabled = true;
+    if (gRecording)
+        writeName(gFrameStream, OP_ENABLE_VERTEX_ATTRIB_ARRAY, index);
+}
+
+
+void UCaptureEndQuery(GLenum target)
+{
+    glEndQuery(target);
+    if (gRecording)
+        writeEnum(gFrameStream, OP_END_QUERY, target);
+}
+
+
+void UCaptureFramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level)
+{
+    glFramebufferTexture2D(target, attachment, textarget, texture, level);
+    if (!gArmed)
+        return;
+    if (gShadow.framebuffer != 0)
+        gShadow.framebuffers[gShadow.framebuffer].attachments[attachment] = std::make_pair(texture, level);
+    if (gRecording)
+        writeFramebufferTexture2D(gFrameStream, target, attachment, textarget, texture, level);
+}
+
+
+void UCaptureGenBuffers(GLsizei n, GLuint* buffers)
+{
+    glGenBuffers(n, buffers);
+    if (!gArmed)
+        return;
+    for (GLsizei i = 0; i < n; ++i)
+        gShadow.buffers[buffers[i]] = ShadowBuffer();
+    if (gRecording)
+        writeNames(gFrameStream, OP_GEN_BUFFERS, n, buffers);
+}
+
+
+void UCaptureGenFramebuffers(GLsizei n, GLuint* framebuffers)
+{
+    glGenFramebuffers(n, framebuffers);
+    if (!gArmed)
+        return;
+    for (GLsizei i = 0; i < n; ++i)
+        gShadow.framebuffers[framebuffers[i]] = ShadowFramebuffer();
+    if (gRecording)
+        writeNames(gFrameStream, OP_GEN_FRAMEBUFFERS, n, framebuffers);
+}
+
+
+void UCaptureGenQueries(GLsizei n, GLuint* ids)
+{
+    glGenQueries(n, ids);
+    if (!gArmed)
+        return;
+    for (GLsizei i = 0; i < n; ++i)
+        gShadow.queries.insert(ids[i]);
+    if (gRecording)
+        writeNames(gFrameStream, OP_GEN_QUERIES, n, ids);
+}
+
+
+void UCaptureGenTextures(GLsizei n, GLuint* textures)
+{
+    glGenTextures(n, textures);
+    if (!gArmed)
+        return;
+    for (GLsizei i = 0; i < n; ++i)
+        gShadow.textures[textures[i]] = ShadowTexture();
+    if (gRecording)
+        writeNames(gFrameStream, OP_GEN_TEXTURES, n, textures);
+}
+
+
+void UCaptureGenVertexArrays(GLsizei n, GLuint* arrays)
+{
+    glGenVertexArrays(n, arrays);
+    if (!gArmed)
+        return;
+    for (GLsizei i = 0; i < n; ++i)
+        gShadow.vertexArrays[arrays[i]] = ShadowVertexArray();
+    if (gRecording)
+        writeNames(gFrameStream, OP_GEN_VERTEX_ARRAYS, n, arrays);
+}
+
+
+GLint UCaptureGetUniformLocation(GLuint program, const GLchar* name)
+{
+    GLint location = glGetUniformLocation(program, name);
+    if (!gArmed)
+        return location;
+    if (location >= 0)
+        gShadow.programs[program].uniformNames[location] = name;
+    if (gRecording)
+        writeGetUniformLocation(gFrameStream, program, location, name);
+    return location;
+}
+
+
+void UCaptureLinkProgram(GLuint program)
+{
+    glLinkProgram(program);
+    if (!gArmed)
+        return;
+    gShadow.programs[program].linked = true;
+    if (gRecording)
+        writeName(gFrameStream, OP_LINK_PROGRAM, program);
+}
+
+
+void* UCaptureMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access)
+{
+    void* mapped = glMapBufferRange(target, offset, length, access);
+    if (!gArmed || !mapped)
+        return mapped;
+
+    // What gets written is picked up at the unmap
+    GLuint name = boundBuffer(target);
+    if (name != 0)
+    {
+        ShadowBuffer& buffer = gShadow.buffers[name];
+        buffer.mapped = mapped;
+        buffer.mappedOffset = offset;
+        buffer.mappedLength = length;
+        buffer.mappedForWrite = (access & GL_MAP_WRITE_BIT) != 0;
+    }
+    return mapped;
+}
+
+
+void UCaptureShaderSource(GLuint shader, GLsizei count, const GLchar* const* string, const GLint* length)
+{
+    glShaderSource(shader, count, string, length);
+    if (!gArmed)
+        return;
+    std::string source;
+    for (GLsizei i = 0; i < count; ++i)
+    {
+        if (length && length[i] >= 0)
+            source.append(string[i], (size_t)length[i]);
+        else
+            source.append(string[i]);
+    }
+    gShadow.shaders[shader].source = source;
+    if (gRecording)
+        writeShaderSource(gFrameStream, shader, source);
+}
+
+
+void UCaptureTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels)
+{
+    glTexImage2D(target, level, internalformat, width, height, border, format, type, pixels);
+    if (!gArmed)
+        return;
+
+    // With a pixel unpack buffer bound the pointer is an offset into it
+    GLuint unpack = boundBuffer(GL_PIXEL_UNPACK_BUFFER);
+    size_t bytes = imageBytes(width, height, format, type);
+    const unsigned char* source = nullptr;
+    if (unpack != 0)
+    {
+        const ShadowBuffer& buffer = gShadow.buffers[unpack];
+        size_t offset = (size_t)(uintptr_t)pixels;
+        if (offset + bytes <= buffer.data.size())
+            source = &buffer.data[offset];
+    }
+    else
+        source = static_cast<const unsigned char*>(pixels);
+
+    GLuint texture = boundTexture();
+    if (texture != 0 && target == GL_TEXTURE_2D)
+    {
+        ShadowLevel& image = gShadow.textures[texture].levels[level];
+        image.internalFormat = internalformat;
+        image.width = width;
+        image.height = height;
+        image.format = format;
+        image.type = type;
+        image.hasPixels = source != nullptr && bytes > 0;
+        if (image.hasPixels)
+            image.pixels.assign(source, source + bytes);
+        else
+            image.pixels.clear();
+    }
+
+    if (gRecording)
+        writeTexImage2D(gFrameStream, target, level, internalformat, width, height, border, format, type,
+            unpack != 0 ? 2 : pixels ? 1 : 0, pixels, (uint64_t)(uintptr_t)pixels);
+}
+
+
+void UCaptureTexParameteri(GLenum target, GLenum pname, GLint param)
+{
+    glTexParameteri(target, pname, param);
+    if (!gArmed)
+        return;
+    GLuint texture = boundTexture();
+    if (texture != 0 && target == GL_TEXTURE_2D)
+        gShadow.textures[texture].parameters[pname] = param;
+    if (gRecording)
+        writeTexParameteri(gFrameStream, target, pname, param);
+}
+
+
+void UCaptureUniform1f(GLint location, GLfloat v0)
+{
+    glUniform1f(location, v0);
+    if (gArmed)
+        recordUniform(OP_UNIFORM_1F, location, &v0, 1);
+}
+
+
+void UCaptureUniform1i(GLint location, GLint v0)
+{
+    glUniform1i(location, v0);
+    if (!gArmed)
+        return;
+    // Stored in a float's four bytes, the replayer reads it back as an int
+    GLfloat bits;
+    memcpy(&bits, &v0, sizeof(bits));
+    recordUniform(OP_UNIFORM_1I, location, &bits, 1);
+}
+
+
+void UCaptureUniform2f(GLint location, GLfloat v0, GLfloat v1)
+{
+    glUniform2f(location, v0, v1);
+    if (!gArmed)
+        return;
+    GLfloat values[2] = { v0, v1 };
+    recordUniform(OP_UNIFORM_2F, location, values, 2);
+}
+
+
+void UCaptureUniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2)
+{
+    glUniform3f(location, v0, v1, v2);
+    if (!gArmed)
+        return;
+    GLfloat values[3] = { v0, v1, v2 };
+    recordUniform(OP_UNIFORM_3F, location, values, 3);
+}
+
+
+void UCaptureUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value)
+{
+    glUniformMatrix4fv(location, count, transpose, value);
+    if (!gArmed)
+        return;
+
+    std::vector<unsigned char> command;
+    {
+        CommandWriter writer(command, OP_UNIFORM_MATRIX_4FV);
+        writer.put(location);
+        writer.put(count);
+        writer.put((uint8_t)transpose);
+        writer.blob(value, sizeof(GLfloat) * 16 * (size_t)std::max(count, 0));
+    }
+    if (gShadow.program != 0 && location >= 0)
+        gShadow.programs[gShadow.program].uniformValues[location] = command;
+    if (gRecording)
+        gFrameStream.insert(gFrameStream.end(), command.begin(), command.end());
+}
+
+
+GLboolean UCaptureUnmapBuffer(GLenum target)
+{
+    if (gArmed)
+    {
+        GLuint name = boundBuffer(target);
+        std::map<GLuint, ShadowBuffer>::iterator found = gShadow.buffers.find(name);
+        if (found != gShadow.buffers.end() && found->second.mapped)
+        {
+            ShadowBuffer& buffer = found->second;
+            if (buffer.mappedForWrite)
+            {
+                const unsigned char* written = static_cast<const unsigned char*>(buffer.mapped);
+                size_t offset = (size_t)buffer.mappedOffset, length = (size_t)buffer.mappedLength;
+                if (buffer.data.size() < offset + length)
+                    buffer.data.resize(offset + length);
+                memcpy(&buffer.data[offset], written, length);
+                if (gRecording)
+                    writeBufferSubData(gFrameStream, target, offset, written, length);
+            }
+            buffer.mapped = nullptr;
+        }
+    }
+    return glUnmapBuffer(target);
+}
+
+
+void UCaptureUseProgram(GLuint program)
+{
+    glUseProgram(program);
+    if (!gArmed)
+        return;
+    gShadow.program = program;
+    if (gRecording)
+        writeName(gFrameStream, OP_USE_PROGRAM, program);
+}
+
+
+void UCaptureVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer)
+{
+    glVertexAttribPointer(index, size, type, normalized, stride, pointer);
+    if (!gArmed)
+        return;
+    if (index < (GLuint)MAX_ATTRIBUTES)
+    {
+        ShadowAttribute& attribute = gShadow.vertexArrays[gShadow.vertexArray].attributes[index];
+        attribute.pointerSet = true;
+        attribute.buffer = boundBuffer(GL_ARRAY_BUFFER);
+        attribute.size = size;
+        attribute.type = type;
+        attribute.normalized = normalized;
+        attribute.stride = stride;
+        attribute.offset = (uint64_t)(uintptr_t)pointer;
+    }
+    if (gRecording)
+        writeVertexAttribPointer(gFrameStream, index, size, type, normalized, stride, (uint64_t)(uintptr_t)pointer);
+}
+
+
+void UCaptureViewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    glViewport(x, y, width, height);
+    if (!gArmed)
+        return;
+    gShadow.viewport[0] = x;
+    gShadow.viewport[1] = y;
+    gShadow.viewport[2] = width;
+    gShadow.viewport[3] = height;
+    if (gRecording)
+        writeViewport(gFrameStream, gShadow.viewport);
+}
+
+
+void UCaptureViewportIndexedf(GLuint index, GLfloat x, GLfloat y, GLfloat w, GLfloat h)
+{
+    glViewportIndexedf(index, x, y, w, h);
+    if (gRecording)
+    {
+        CommandWriter command(gFrameStream, OP_VIEWPORT_INDEXED);
+        command.put(index);
+        command.put(x);
+        command.put(y);
+        command.put(w);
+        command.put(h);
+    }
+}
@@ -0,0 +1,216 @@
+#ifndef GL_CAPTURE_H
+#define GL_CAPTURE_H
+
+#include <GLEW/glew.h>      // GLEW library
+
+/* GL call capture (.uglc) and replay.
+ *
+ * Renderer translation units include this header after every other one; it routes the GL
+ * entry points the renderer uses through UCapture* wrappers. Unarmed, a wrapper only
+ * forwards the call. Armed (--capture), the wrappers keep a shadow of every GL object and
+ * the bindings, so a capture can start at any frame: it opens with a prologue that
+ * recreates the live objects with their contents and the current state, followed by the
+ * recorded calls of the captured frames.
+ *
+ * File, little endian:
+ *
+ *   GlCaptureFileHeader
+ *   prologue commands       prologueBytes
+ *   frame commands          frameBytes, every frame ends with a frame end command
+ *
+ * A command is a uint16 opcode and a uint32 payload size followed by the payload. Object
+ * names are the captured ones; the replayer maps them to the names it gets.
+ *
+ * The wrappers are not thread safe; like GL itself they belong to the thread that holds
+ * the context.
+ */
+const char GL_CAPTURE_MAGIC[4] = { 'U', 'G', 'L', 'C' };
+const unsigned GL_CAPTURE_VERSION = 2;
+
+struct GlCaptureFileHeader
+{
+    char magic[4];
+    unsigned version;
+    unsigned width;             // Default framebuffer size the frames were drawn at
+    unsigned height;
+    unsigned frameCount;
+    unsigned commandCount;      // Frame commands, the prologue's not included
+    unsigned long long prologueBytes;
+    unsigned long long frameBytes;
+};
+
+/* Starts shadowing GL objects for captures written to filename, frames at a time. Call it
+ * before the first GL object is created, objects made earlier can't be captured.
+ */
+void UArmGlCapture(const char* filename, int frames);
+
+bool UGlCaptureArmed();
+
+// Asks for the next frames to be captured. Safe from any thread; ignored unless armed.
+void URequestGlCapture();
+
+// Marks the end of a frame, right before the swap. Starts a requested capture and writes finished ones.
+void UGlCaptureFrameEnd(int windowWidth, int windowHeight);
+
+/* Replays a capture on the current context, headless: the default framebuffer is swapped for
+ * an offscreen target of the captured size. The prologue runs once, the frames repeats times.
+ * Logs frame times and per-call timing by entry point; finishEachCall waits for the GPU after
+ * every call, so the times include its work.
+ */
+bool UReplayGlCapture(const char* filename, int repeats, bool finishEachCall);
+
+
+// Wrappers, see above
+void UCaptureActiveTexture(GLenum texture);
+void UCaptureAttachShader(GLuint program, GLuint shader);
+void UCaptureBeginQuery(GLenum target, GLuint id);
+void UCaptureBindBuffer(GLenum target, GLuint buffer);
+void UCaptureBindFramebuffer(GLenum target, GLuint framebuffer);
+void UCaptureBindTexture(GLenum target, GLuint texture);
+void UCaptureBindVertexArray(GLuint array);
+void UCaptureBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage);
+void UCaptureClear(GLbitfield mask);
+void UCaptureClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha);
+void UCaptureCompileShader(GLuint shader);
+GLuint UCaptureCreateProgram();
+GLuint UCaptureCreateShader(GLenum type);
+void UCaptureDeleteBuffers(GLsizei n, const GLuint* buffers);
+void UCaptureDeleteFramebuffers(GLsizei n, const GLuint* framebuffers);
+void UCaptureDeleteProgram(GLuint program);
+void UCaptureDeleteQueries(GLsizei n, const GLuint* ids);
+void UCaptureDeleteShader(GLuint shader);
+void UCaptureDeleteTextures(GLsizei n, const GLuint* textures);
+void UCaptureDeleteVertexArrays(GLsizei n, const GLuint* arrays);
+void UCaptureDisable(GLenum cap);
+void UCaptureDrawArrays(GLenum mode, GLint first, GLsizei count);
+void UCaptureDrawElements(GLenum mode, GLsizei count, GLenum type, const void* indices);
+void UCaptureDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instancecount);
+void UCaptureEnable(GLenum cap);
+void UCaptureEnableVertexAttribArray(GLuint index);
+void UCaptureEndQuery(GLenum target);
+void UCaptureFramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level);
+void UCaptureGenBuffers(GLsizei n, GLuint* buffers);
+void UCaptureGenFramebuffers(GLsizei n, GLuint* framebuffers);
+void UCaptureGenQueries(GLsizei n, GLuint* ids);
+void UCaptureGenTextures(GLsizei n, GLuint* textures);
+void UCaptureGenVertexArrays(GLsizei n, GLuint* arrays);
+GLint UCaptureGetUniformLocation(GLuint program, const GLchar* name);
+void UCaptureLinkProgram(GLuint program);
+void* UCaptureMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+void UCaptureShaderSource(GLuint shader, GLsizei count, const GLchar* const* string, const GLint* length);
+void UCaptureTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels);
+void UCaptureTexParameteri(GLenum target, GLenum pname, GLint param);
+void UCaptureUniform1f(GLint location, GLfloat v0);
+void UCaptureUniform1i(GLint location, GLint v0);
+void UCaptureUniform2f(GLint location, GLfloat v0, GLfloat v1);
+void UCaptureUniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2);
+void UCaptureUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value);
+GLboolean UCaptureUnmapBuffer(GLenum target);
+void UCaptureUseProgram(GLuint program);
+void UCaptureVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer);
+void UCaptureViewport(GLint x, GLint y, GLsizei width, GLsizei height);
+void UCaptureViewportIndexedf(GLuint index, GLfloat x, GLfloat y, GLfloat w, GLfloat h);
+
+// gl_capture.cpp itself calls the real entry points
+#ifndef GL_CAPTURE_IMPLEMENTATION
+#undef glActiveTexture
+#define glActiveTexture UCaptureActiveTexture
+#undef glAttachShader
+#define glAttachShader UCaptureAttachShader
+#undef glBeginQuery
+#define glBeginQuery UCaptureBeginQuery
+#undef glBindBuffer
+#define glBindBuffer UCaptureBindBuffer
+#undef glBindFramebuffer
+#define glBindFramebuffer UCaptureBindFramebuffer
+#undef glBindTexture
+#define glBindTexture UCaptureBindTexture
+#undef glBindVertexArray
+#define glBindVertexArray UCaptureBindVertexArray
+#undef glBufferData
+#define glBufferData UCaptureBufferData
+#undef glClear
+#define glClear UCaptureClear
+#undef glClearColor
+#define glClearColor UCaptureClearColor
+#undef glCompileShader
+#define glCompileShader UCaptureCompileShader
+#undef glCreateProgram
+#define glCreateProgram UCaptureCreateProgram
+#undef glCreateShader
+#define glCreateShader UCaptureCreateShader
+#undef glDeleteBuffers
+#define glDeleteBuffers UCaptureDeleteBuffers
+#undef glDeleteFramebuffers
+#define glDeleteFramebuffers UCaptureDeleteFramebuffers
+#undef glDeleteProgram
+#define glDeleteProgram UCaptureDeleteProgram
+#undef glDeleteQueries
+#define glDeleteQueries UCaptureDeleteQueries
+#undef glDeleteShader
+#define glDeleteShader UCaptureDeleteShader
+#undef glDeleteTextures
+#define glDeleteTextures UCaptureDeleteTextures
+#undef glDeleteVertexArrays
+#define glDeleteVertexArrays UCaptureDeleteVertexArrays
+#undef glDisable
+#define glDisable UCaptureDisable
+#undef glDrawArrays
+#define glDrawArrays UCaptureDrawArrays
+#undef glDrawElements
+#define glDrawElements UCaptureDrawElements
+#undef glDrawElementsInstanced
+#define glDrawElementsInstanced UCaptureDrawElementsInstanced
+#undef glEnable
+#define glEnable UCaptureEnable
+#undef glEnableVertexAttribArray
+#define glEnableVertexAttribArray UCaptureEnableVertexAttribArray
+#undef glEndQuery
+#define glEndQuery UCaptureEndQuery
+#undef glFramebufferTexture2D
+#define glFramebufferTexture2D UCaptureFramebufferTexture2D
+#undef glGenBuffers
+#define glGenBuffers UCaptureGenBuffers
+#undef glGenFramebuffers
+#define glGenFramebuffers UCaptureGenFramebuffers
+#undef glGenQueries
+#define glGenQueries UCaptureGenQueries
+#undef glGenTextures
+#define glGenTextures UCaptureGenTextures
+#undef glGenVertexArrays
+#define glGenVertexArrays UCaptureGenVertexArrays
+#undef glGetUniformLocation
+#define glGetUniformLocation UCaptureGetUniformLocation
+#undef glLinkProgram
+#define glLinkProgram UCaptureLinkProgram
+#undef glMapBufferRange
+#define glMapBufferRange UCaptureMapBufferRange
+#undef glShaderSource
+#define glShaderSource UCaptureShaderSource
+#undef glTexImage2D
+#define glTexImage2D UCaptureTexImage2D
+#undef glTexParameteri
+#define glTexParameteri UCaptureTexParameteri
+#undef glUniform1f
+#define glUniform1f UCaptureUniform1f
+#undef glUniform1i
+#define glUniform1i UCaptureUniform1i
+#undef glUniform2f
+#define glUniform2f UCaptureUniform2f
+#undef glUniform3f
+#define glUniform3f UCaptureUniform3f
+#undef glUniformMatrix4fv
+#define glUniformMatrix4fv UCaptureUniformMatrix4fv
+#undef glUnmapBuffer
+#define glUnmapBuffer UCaptureUnmapBuffer
+#undef glUseProgram
+#define glUseProgram UCaptureUseProgram
+#undef glVertexAttribPointer
+#define glVertexAttribPointer UCaptureVertexAttribPointer
+#undef glViewport
+#define glViewport UCaptureViewport
+#undef glViewportIndexedf
+#define glViewportIndexedf UCaptureViewportIndexedf
+#endif
+
+#endif
@@ -0,0 +1,599 @@
+#include "gltf_import.h"
+
+#include <algorithm>        // std::max
+#include <cstdint>
+#include <cstdio>           // fopen, fread
+#include <cstdlib>          // strtol
+#include <cstring>          // memcpy
+#include <stb_image.h>      // Image loading Utility functions
+
+#include "job_pool.h"       // Parallel decoding
+#include "json.h"           // glTF document
+
+using namespace std; // Standard namespace
+
+// Unnamed namespace
+namespace
+{
+    // LOD settings for imported primitives, same as the converter
+    const int IMPORT_LOD_LEVELS = 4;
+    const float IMPORT_LOD_REDUCTION = 0.5f;
+
+    const uint32_t GLB_MAGIC = 0x46546C67;        // "glTF"
+    const uint32_t GLB_CHUNK_JSON = 0x4E4F534A;   // "JSON"
+    const uint32_t GLB_CHUNK_BIN = 0x004E4942;    // "BIN\0"
+
+    // glTF accessor component types
+    const int COMPONENT_BYTE = 5120;
+    const int COMPONENT_UNSIGNED_BYTE = 5121;
+    const int COMPONENT_SHORT = 5122;
+    const int COMPONENT_UNSIGNED_SHORT = 5123;
+    const int COMPONENT_UNSIGNED_INT = 5125;
+    const int COMPONENT_FLOAT = 5126;
+
+    const int MODE_TRIANGLES = 4;
+
+    bool readBinaryFile(const string& filename, vector<unsigned char>& contents)
+    {
+        FILE* file = fopen(filename.c_str(), "rb");
+        if (!file)
+            return false;
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        contents.resize(size > 0 ? size : 0);
+        bool ok = size <= 0 || fread(&contents[0], 1, size, file) == (size_t)size;
+        fclose(file);
+        return ok;
+    }
+
+    string directoryOf(const string& filename)
+    {
+        size_t slash = filename.find_last_of("/\\");
+        return slash == string::npos ? string() : filename.substr(0, slash + 1);
+    }
+
+    // Undoes %XX escapes in relative URIs
+    string decodeUri(const string& uri)
+    {
+        string out;
+        for (size_t i = 0; i < uri.size(); ++i)
+        {
+            if (uri[i] == '%' && i + 2 < uri.size())
+            {
+                char hex[3] = { uri[i + 1], uri[i + 2], 0 };
+                out += (char)strtol(hex, NULL, 16);
+                i += 2;
+            }
+            else
+                out += uri[i];
+        }
+        return out;
+    }
+
+    int base64Value(char c)
+    {
+        if (c >= 'A' && c <= 'Z') return c - 'A';
+        if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+        if (c >= '0' && c <= '9') return c - '0' + 52;
+        if (c == '+' || c == '-') return 62;
+        if (c == '/' || c == '_') return 63;
+        return -1;
+    }
+
+    bool decodeBase64(const char* text, size_t length, vector<unsigned char>& out)
+    {
+        out.clear();
+        out.reserve(length / 4 * 3);
+        unsigned accumulator = 0;
+        int bits = 0;
+        for (size_t i = 0; i < length; ++i)
+        {
+            if (text[i] == '=')
+                break;
+            int value = base64Value(text[i]);
+            if (value < 0)
+                return false;
+            accumulator = (accumulator << 6) | (unsigned)value;
+            bits += 6;
+            if (bits >= 8)
+            {
+                bits -= 8;
+                out.push_back((unsigned char)(accumulator >> bits));
+            }
+        }
+        return true;
+    }
+
+    // Loads a buffer or image URI: either an embedded base64 data URI or a file next to the asset
+    bool loadUri(const string& uri, const string& baseDirectory, vector<unsigned char>& out)
+    {
+        if (uri.compare(0, 5, "data:") == 0)
+        {
+            size_t comma = uri.find(";base64,");
+            if (comma == string::npos)
+                return false;
+            comma += 8;
+            return decodeBase64(uri.c_str() + comma, uri.size() - comma, out);
+        }
+        return readBinaryFile(baseDirectory + decodeUri(uri), out);
+    }
+
+    size_t componentSize(int componentType)
+    {
+        switch (componentType)
+        {
+        case COMPONENT_BYTE:
+        case COMPONENT_UNSIGNED_BYTE: return 1;
+        case COMPONENT_SHORT:
+        case COMPONENT_UNSIGNED_SHORT: return 2;
+        case COMPONENT_UNSIGNED_INT:
+        case COMPONENT_FLOAT: return 4;
+        default: return 0;
+        }
+    }
+
+    int componentCount(const string& type)
+    {
+        if (type == "SCALAR") return 1;
+        if (type == "VEC2") return 2;
+        if (type == "VEC3") return 3;
+        if (type == "VEC4") return 4;
+        if (type == "MAT4") return 16;
+        return 0;
+    }
+
+    // Strided view of an accessor's data inside a loaded buffer
+    struct AccessorView
+    {
+        const unsigned char* data;
+        size_t count;
+        size_t stride;
+        int componentType;
+        int components;
+        bool normalized;
+    };
+
+    bool getAccessor(const JsonValue& gltf, const vector<vector<unsigned char> >& buffers, int index, AccessorView& view)
+    {
+        const JsonValue& accessor = gltf["accessors"][(size_t)index];
+        if (accessor.isNull())
+            return false;
+
+        if (!accessor["count"].asSize(view.count))
+            return false;
+        view.componentType = accessor["componentType"].asInt();
+        view.components = componentCount(accessor["type"].asString());
+        view.normalized = accessor["normalized"].asBool();
+
+        size_t elementSize = componentSize(view.componentType) * view.components;
+        if (elementSize == 0)
+            return false;
+
+        const JsonValue& bufferView = gltf["bufferViews"][(size_t)accessor["bufferView"].asInt()];
+        if (bufferView.isNull())
+            return false; // sparse-only and zero-filled accessors aren't supported
+
+        int bufferIndex = bufferView["buffer"].asInt();
+        if (bufferIndex < 0 || bufferIndex >= (int)buffers.size())
+            return false;
+        const vector<unsigned char>& buffer = buffers[bufferIndex];
+
+        size_t viewOffset, viewLength, accessorOffset;
+        if (!bufferView["byteOffset"].asSize(viewOffset) || !bufferView["byteLength"].asSize(viewLength)
+            || !accessor["byteOffset"].asSize(accessorOffset) || !bufferView["byteStride"].asSize(view.stride))
+            return false;
+        if (view.stride == 0)
+            view.stride = elementSize;
+
+        // Every range check subtracts or divides, so crafted sizes can't wrap around
+        if (viewOffset > buffer.size() || viewLength > buffer.size() - viewOffset || accessorOffset > viewLength)
+            return false;
+        size_t available = viewLength - accessorOffset;
+        if (view.count > 0 && (elementSize > available || view.count - 1 > (available - elementSize) / view.stride))
+            return false;
+
+        view.data = buffer.empty() ? NULL : &buffer[0] + viewOffset + accessorOffset;
+        return true;
+    }
+
+    float readComponent(const unsigned char* p, int componentType, bool normalized)
+    {
+        switch (componentType)
+        {
+        case COMPONENT_FLOAT: { float v; memcpy(&v, p, 4); return v; }
+        case COMPONENT_UNSIGNED_BYTE: return normalized ? p[0] / 255.0f : (float)p[0];
+        case COMPONENT_BYTE: { float v = (float)(signed char)p[0]; return normalized ? std::max(v / 127.0f, -1.0f) : v; }
+        case COMPONENT_UNSIGNED_SHORT: { uint16_t v; memcpy(&v, p, 2); return normalized ? v / 65535.0f : (float)v; }
+        case COMPONENT_SHORT: { int16_t v; memcpy(&v, p, 2); return normalized ? std::max(v / 32767.0f, -1.0f) : (float)v; }
+        case COMPONENT_UNSIGNED_INT: { uint32_t v; memcpy(&v, p, 4); return (float)v; }
+        default: return 0.0f;
+        }
+    }
+
+    // Copies an accessor element by element into the interleaved vertices at floatOffset
+    void scatterAccessor(const AccessorView& view, int components, vector<GLfloat>& vertices, size_t floatOffset)
+    {
+        size_t size = componentSize(view.componentType);
+        int copied = components < view.components ? components : view.components;
+        for (size_t i = 0; i < view.count; ++i)
+        {
+            const unsigned char* element = view.data + i * view.stride;
+            GLfloat* out = &vertices[i * IMPORT_FLOATS_PER_VERTEX + floatOffset];
+            for (int c = 0; c < copied; ++c)
+                out[c] = readComponent(element + c * size, view.componentType, view.normalized);
+        }
+    }
+
+    // Decodes one glTF primitive into our vertex layout and builds its LOD chain
+    bool decodePrimitive(const JsonValue& gltf, const vector<vector<unsigned char> >& buffers,
+        const JsonValue& source, ImportedPrimitive& primitive, string& error)
+    {
+        const JsonValue& attributes = source["attributes"];
+
+        AccessorView positions;
+        if (!getAccessor(gltf, buffers, attributes["POSITION"].asInt(), positions) || positions.components != 3)
+        {
+            error = "primitive without a usable POSITION accessor";
+            return false;
+        }
+
+        // Defaults: white color, zero uv, normals filled in below if missing
+        primitive.vertices.assign(positions.count * IMPORT_FLOATS_PER_VERTEX, 0.0f);
+        for (size_t i = 0; i < positions.count; ++i)
+        {
+            GLfloat* v = &primitive.vertices[i * IMPORT_FLOATS_PER_VERTEX];
+            v[3] = v[4] = v[5] = 1.0f;
+        }
+        scatterAccessor(positions, 3, primitive.vertices, 0);
+
+        AccessorView view;
+        if (getAccessor(gltf, buffers, attributes["COLOR_0"].asInt(), view) && view.count == positions.count)
+            scatterAccessor(view, 3, primitive.vertices, 3);
+        if (getAccessor(gltf, buffers, attributes["TEXCOORD_0"].asInt(), view) && view.count == positions.count)
+            scatterAccessor(view, 2, primitive.vertices, 6);
+        bool hasNormals = getAccessor(gltf, buffers, attributes["NORMAL"].asInt(), view) && view.count == positions.count;
+        if (hasNormals)
+            scatterAccessor(view, 3, primitive.vertices, 8);
+
+        vector<GLuint> baseIndices;
+        if (getAccessor(gltf, buffers, source["indices"].asInt(), view))
+        {
+            size_t size = componentSize(view.componentType);
+            baseIndices.resize(view.count);
+            for (size_t i = 0; i < view.count; ++i)
+            {
+                const unsigned char* p = view.data + i * view.stride;
+                GLuint index = 0;
+                if (size == 1) index = p[0];
+                else if (size == 2) { uint16_t v; memcpy(&v, p, 2); index = v; }
+                else memcpy(&index, p, 4);
+                if (index >= positions.count)
+                {
+                    error = "index out of range";
+                    return false;
+                }
+                baseIndices[i] = index;
+            }
+        }
+        else
+        {
+            baseIndices.resize(positions.count);
+            for (size_t i = 0; i < positions.count; ++i)
+                baseIndices[i] = (GLuint)i;
+        }
+        baseIndices.resize(baseIndices.size() / 3 * 3);
+
+        if (!hasNormals)
+        {
+            // Area-weighted smooth normals
+            vector<glm::vec3> normals(positions.count, glm::vec3(0.0f));
+            for (size_t t = 0; t + 2 < baseIndices.size(); t += 3)
+            {
+                const GLfloat* a = &primitive.vertices[baseIndices[t] * IMPORT_FLOATS_PER_VERTEX];
+                const GLfloat* b = &primitive.vertices[baseIndices[t + 1] * IMPORT_FLOATS_PER_VERTEX];
+                const GLfloat* c = &primitive.vertices[baseIndices[t + 2] * IMPORT_FLOATS_PER_VERTEX];
+                glm::vec3 n = glm::cross(glm::vec3(b[0] - a[0], b[1] - a[1], b[2] - a[2]), glm::vec3(c[0] - a[0], c[1] - a[1], c[2] - a[2]));
+                normals[baseIndices[t]] += n;
+                normals[baseIndices[t + 1]] += n;
+                normals[baseIndices[t + 2]] += n;
+            }
+            for (size_t i = 0; i < positions.count; ++i)
+            {
+                glm::vec3 n = glm::length(normals[i]) > 0.0f ? glm::normalize(normals[i]) : glm::vec3(0.0f, 1.0f, 0.0f);
+                GLfloat* v = &primitive.vertices[i * IMPORT_FLOATS_PER_VERTEX];
+                v[8] = n.x; v[9] = n.y; v[10] = n.z;
+            }
+        }
+
+        UBuildLodChain(primitive.vertices, IMPORT_FLOATS_PER_VERTEX, baseIndices, IMPORT_LOD_LEVELS, IMPORT_LOD_REDUCTION,
+            primitive.indices, primitive.lod);
+        primitive.optimizeStats = UOptimizeMesh(primitive.vertices, IMPORT_FLOATS_PER_VERTEX, primitive.indices, primitive.lod);
+
+        // Base color texture of the material, if any
+        primitive.imageIndex = -1;
+        const JsonValue& material = gltf["materials"][(size_t)source["material"].asInt()];
+        int textureIndex = material["pbrMetallicRoughness"]["baseColorTexture"]["index"].asInt();
+        if (textureIndex >= 0)
+            primitive.imageIndex = gltf["textures"][(size_t)textureIndex]["source"].asInt();
+
+        return true;
+    }
+
+    glm::mat4 nodeMatrix(const JsonValue& node)
+    {
+        glm::mat4 m(1.0f);
+        const JsonValue& matrix = node["matrix"];
+        if (matrix.size() == 16)
+        {
+            for (int c = 0; c < 4; ++c)
+            {
+                for (int r = 0; r < 4; ++r)
+                    m[c][r] = (float)matrix[(size_t)(c * 4 + r)].asNumber();
+            }
+            return m;
+        }
+
+        // T * R * S, rotation is a unit quaternion (x, y, z, w)
+        const JsonValue& t = node["translation"];
+        const JsonValue& r = node["rotation"];
+        const JsonValue& s = node["scale"];
+        float qx = (float)r[(size_t)0].asNumber(0.0), qy = (float)r[1].asNumber(0.0), qz = (float)r[2].asNumber(0.0), qw = (float)r[3].asNumber(1.0);
+        glm::vec3 scale((float)s[(size_t)0].asNumber(1.0), (float)s[1].asNumber(1.0), (float)s[2].asNumber(1.0));
+
+        m[0] = glm::vec4(1 - 2 * (qy * qy + qz * qz), 2 * (qx * qy + qz * qw), 2 * (qx * qz - qy * qw), 0.0f) * scale.x;
+        m[1] = glm::vec4(2 * (qx * qy - qz * qw), 1 - 2 * (qx * qx + qz * qz), 2 * (qy * qz + qx * qw), 0.0f) * scale.y;
+        m[2] = glm::vec4(2 * (qx * qz + qy * qw), 2 * (qy * qz - qx * qw), 1 - 2 * (qx * qx + qy * qy), 0.0f) * scale.z;
+        m[3] = glm::vec4((float)t[(size_t)0].asNumber(), (float)t[1].asNumber(), (float)t[2].asNumber(), 1.0f);
+        return m;
+    }
+
+    // Walks the node hierarchy and records an instance for every primitive of every mesh node
+    void collectInstances(const JsonValue& gltf, int nodeIndex, const glm::mat4& parent,
+        const vector<size_t>& meshFirstPrimitive, const vector<int>& primitiveSlot, ImportedScene& scene, int depth)
+    {
+        const JsonValue& node = gltf["nodes"][(size_t)nodeIndex];
+        if (node.isNull() || depth > 64)
+            return;
+
+        glm::mat4 world = parent * nodeMatrix(node);
+
+        int meshIndex = node["mesh"].asInt();
+        bool occluder = node["extras"]["occluder"].asBool();
+        if (meshIndex >= 0 && meshIndex + 1 < (int)meshFirstPrimitive.size())
+        {
+            for (size_t p = meshFirstPrimitive[meshIndex]; p < meshFirstPrimitive[meshIndex + 1]; ++p)
+            {
+                if (primitiveSlot[p] < 0)
+                    continue; // not a triangle primitive
+                ImportedInstance instance = { (size_t)primitiveSlot[p], world, occluder };
+                scene.instances.push_back(instance);
+            }
+        }
+
+        const JsonValue& children = node["children"];
+        for (size_t c = 0; c < children.size(); ++c)
+            collectInstances(gltf, children[c].asInt(), world, meshFirstPrimitive, primitiveSlot, scene, depth + 1);
+    }
+}
+
+
+bool UImportGltf(const char* filename, ImportedScene& scene, string& error)
+{
+    vector<unsigned char> file;
+    if (!readBinaryFile(filename, file))
+    {
+        error = "can't read file";
+        return false;
+    }
+
+    const string baseDirectory = directoryOf(filename);
+
+    // .glb: 12 byte header, then a JSON chunk and an optional BIN chunk
+    const char* jsonText = reinterpret_cast<const char*>(file.empty() ? NULL : &file[0]);
+    size_t jsonLength = file.size();
+    const unsigned char* glbBinary = NULL;
+    size_t glbBinaryLength = 0;
+
+    uint32_t magic = 0;
+    if (file.size() >= 12)
+        memcpy(&magic, &file[0], 4);
+    if (magic == GLB_MAGIC)
+    {
+        size_t offset = 12;
+        jsonText = NULL;
+        while (offset + 8 <= file.size())
+        {
+            uint32_t chunkLength, chunkType;
+            memcpy(&chunkLength, &file[offset], 4);
+            memcpy(&chunkType, &file[offset + 4], 4);
+            offset += 8;
+            if (chunkLength > file.size() - offset)
+                break;
+            if (chunkType == GLB_CHUNK_JSON && !jsonText)
+            {
+                jsonText = reinterpret_cast<const char*>(&file[offset]);
+                jsonLength = chunkLength;
+            }
+            else if (chunkType == GLB_CHUNK_BIN && !glbBinary)
+            {
+                glbBinary = &file[offset];
+                glbBinaryLength = chunkLength;
+            }
+            offset += (chunkLength + 3) & ~3u;
+        }
+        if (!jsonText)
+        {
+            error = "GLB without a JSON chunk";
+            return false;
+        }
+    }
+
+    // The JSON is parsed exactly once, everything after this only reads it
+    JsonValue gltf;
+    if (!UParseJson(jsonText, jsonLength, gltf, error))
+        return false;
+
+    if (gltf["asset"]["version"].asString().compare(0, 1, "2") != 0)
+    {
+        error = "only glTF 2.0 is supported";
+        return false;
+    }
+
+    // Buffers load in parallel, they are usually the bulk of the I/O
+    const JsonValue& bufferList = gltf["buffers"];
+    vector<vector<unsigned char> > buffers(bufferList.size());
+    vector<string> jobErrors(bufferList.size());
+    {
+        JobGroup group;
+        for (size_t b = 0; b < bufferList.size(); ++b)
+        {
+            const JsonValue& uri = bufferList[b]["uri"];
+            if (uri.isNull())
+            {
+                // The GLB binary chunk
+                if (b == 0 && glbBinary)
+                    buffers[b].assign(glbBinary, glbBinary + glbBinaryLength);
+                continue;
+            }
+            USubmitJob(group, [&, b]
+            {
+                if (!loadUri(bufferList[b]["uri"].asString(), baseDirectory, buffers[b]))
+                    jobErrors[b] = "can't load buffer " + bufferList[b]["uri"].asString();
+            });
+        }
+        UWaitJobGroup(group);
+    }
+    for (size_t b = 0; b < jobErrors.size(); ++b)
+    {
+        if (!jobErrors[b].empty())
+        {
+            error = jobErrors[b];
+            return false;
+        }
+    }
+
+    // Flatten meshes[].primitives[] so every triangle primitive gets its own slot
+    const JsonValue& meshes = gltf["meshes"];
+    vector<size_t> meshFirstPrimitive;
+    vector<const JsonValue*> primitiveSources;
+    vector<int> primitiveSlot;
+    for (size_t m = 0; m < meshes.size(); ++m)
+    {
+        meshFirstPrimitive.push_back(primitiveSlot.size());
+        const JsonValue& primitives = meshes[m]["primitives"];
+        for (size_t p = 0; p < primitives.size(); ++p)
+        {
+            if (primitives[p]["mode"].asInt(MODE_TRIANGLES) != MODE_TRIANGLES)
+            {
+                primitiveSlot.push_back(-1);
+                continue;
+            }
+            primitiveSlot.push_back((int)primitiveSources.size());
+            primitiveSources.push_back(&primitives[p]);
+        }
+    }
+    meshFirstPrimitive.push_back(primitiveSlot.size());
+
+    const JsonValue& images = gltf["images"];
+    scene.primitives.resize(primitiveSources.size());
+    scene.images.resize(images.size());
+    jobErrors.assign(primitiveSources.size() + images.size(), string());
+
+    // Accessor decoding, index buffer building, LOD generation and image decoding all fan out
+    JobGroup group;
+    for (size_t p = 0; p < primitiveSources.size(); ++p)
+    {
+        USubmitJob(group, [&, p]
+        {
+            decodePrimitive(gltf, buffers, *primitiveSources[p], scene.primitives[p], jobErrors[p]);
+        });
+    }
+    for (size_t i = 0; i < images.size(); ++i)
+    {
+        USubmitJob(group, [&, i]
+        {
+            ImportedImage& image = scene.images[i];
+            image.pixels = NULL;
+
+            vector<unsigned char> encoded;
+            const JsonValue& source = images[i];
+            bool loaded = false;
+            if (!source["uri"].isNull())
+                loaded = loadUri(source["uri"].asString(), baseDirectory, encoded);
+            else
+            {
+                const JsonValue& bufferView = gltf["bufferViews"][(size_t)source["bufferView"].asInt()];
+                int bufferIndex = bufferView["buffer"].asInt();
+                size_t offset, length;
+                if (bufferView["byteOffset"].asSize(offset) && bufferView["byteLength"].asSize(length)
+                    && bufferIndex >= 0 && bufferIndex < (int)buffers.size()
+                    && offset <= buffers[bufferIndex].size() && length <= buffers[bufferIndex].size() - offset && length > 0)
+                {
+                    encoded.assign(&buffers[bufferIndex][0] + offset, &buffers[bufferIndex][0] + offset + length);
+                    loaded = true;
+                }
+            }
+
+            // Always 4 channels so every image takes the same upload path
+            if (loaded && !encoded.empty())
+                image.pixels = stbi_load_from_memory(&encoded[0], (int)encoded.size(), &image.width, &image.height, &image.channels, 4);
+            if (!image.pixels)
+                jobErrors[primitiveSources.size() + i] = "can't decode image " + to_string(i);
+            image.channels = 4;
+        });
+    }
+    UWaitJobGroup(group);
+
+    for (size_t e = 0; e < jobErrors.size(); ++e)
+    {
+        if (!jobErrors[e].empty())
+        {
+            error = jobErrors[e];
+            UFreeImportedScene(scene);
+            return false;
+        }
+    }
+
+    // Node transforms are cheap, walk the default scene on this thread
+    int sceneIndex = gltf["scene"].asInt(0);
+    const JsonValue& nodes = gltf["scenes"][(size_t)sceneIndex]["nodes"];
+    if (!nodes.isNull())
+    {
+        for (size_t n = 0; n < nodes.size(); ++n)
+            collectInstances(gltf, nodes[n].asInt(), glm::mat4(1.0f), meshFirstPrimitive, primitiveSlot, scene, 0);
+    }
+    else
+    {
+        // No scenes: every node that isn't somebody's child is a root
+        vector<bool> isChild(gltf["nodes"].size(), false);
+        for (size_t n = 0; n < isChild.size(); ++n)
+        {
+            const JsonValue& children = gltf["nodes"][n]["children"];
+            for (size_t c = 0; c < children.size(); ++c)
+            {
+                int child = children[c].asInt();
+                if (child >= 0 && child < (int)isChild.size())
+                    isChild[child] = true;
+            }
+        }
+        for (size_t n = 0; n < isChild.size(); ++n)
+        {
+            if (!isChild[n])
+                collectInstances(gltf, (int)n, glm::mat4(1.0f), meshFirstPrimitive, primitiveSlot, scene, 0);
+        }
+    }
+
+    return true;
+}
+
+
+void UFreeImportedScene(ImportedScene& scene)
+{
+    for (size_t i = 0; i < scene.images.size(); ++i)
+    {
+        if (scene.images[i].pixels)
+            stbi_image_free(scene.images[i].pixels);
+        scene.images[i].pixels = NULL;
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef GLTF_IMPORT_H
+#define GLTF_IMPORT_H
+
+#include <string>
+#include <vector>
+#include <GLEW/glew.h>      // GLEW library
+
+// GLM Math Header inclusions
+#include <glm/glm.hpp>
+
+#include "mesh_lod.h"       // Imported primitives get LOD chains like every other mesh
+#include "mesh_optimize.h"  // and are cache/overdraw optimized while they're decoded
+
+// Floats per imported vertex: position, color, uv, normal
+const GLuint IMPORT_FLOATS_PER_VERTEX = 11;
+
+// One triangle primitive, already in the interleaved layout the shaders use
+struct ImportedPrimitive
+{
+    std::vector<GLfloat> vertices;  // IMPORT_FLOATS_PER_VERTEX per vertex
+    std::vector<GLuint> indices;    // every LOD level back to back
+    MeshLodChain lod;
+    int imageIndex;                 // base color image, -1 when untextured
+    MeshOptimizeStats optimizeStats;
+};
+
+// Decoded RGBA/RGB pixels, owned by stb_image until UFreeImportedScene
+struct ImportedImage
+{
+    unsigned char* pixels;
+    int width;
+    int height;
+    int channels;
+};
+
+// A placement of a primitive in the scene
+struct ImportedInstance
+{
+    size_t primitive;
+    glm::mat4 model;
+    bool occluder;      // Node marked with "extras": { "occluder": true }, hides what's behind it on the CPU
+};
+
+struct ImportedScene
+{
+    std::vector<ImportedPrimitive> primitives;
+    std::vector<ImportedImage> images;
+    std::vector<ImportedInstance> instances;
+};
+
+/* Imports a .gltf (with external or embedded buffers) or .glb file. The JSON is parsed
+ * once on the calling thread; buffer loading, accessor decoding, LOD building and image
+ * decoding run as jobs on the job pool. No GL calls are made, the caller uploads the result.
+ */
+bool UImportGltf(const char* filename, ImportedScene& scene, std::string& error);
+
+// Releases the decoded image memory
+void UFreeImportedScene(ImportedScene& scene);
+
+#endif
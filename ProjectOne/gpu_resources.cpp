@@ -0,0 +1,265 @@
+#include "gpu_resources.h"
+
+#include <cstdio>           // snprintf
+#include <functional>       // std::hash, std::equal_to
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "async_log.h"      // Budget failures and the leak report
+#include "frame_memory.h"   // Entries come from a block pool
+#include "gl_capture.h"     // Routes the GL calls through the capture wrappers
+
+// Unnamed namespace
+namespace
+{
+    // Labels longer than this are cut short in the leak report
+    const size_t LABEL_BYTES = 48;
+
+    // The leak report lists objects until it is this long, the log cuts longer strings
+    const size_t LEAK_REPORT_BYTES = 1536;
+
+    // Fixed size, so objects made mid-frame (render targets, staging buffers) don't touch the heap
+    struct Entry
+    {
+        size_t bytes;
+        char label[LABEL_BYTES];
+    };
+
+    typedef std::unordered_map<unsigned long long, Entry, std::hash<unsigned long long>, std::equal_to<unsigned long long>,
+        PoolAllocator<std::pair<const unsigned long long, Entry> > > EntryMap;
+
+    // Never destroyed: handles in globals may still reset themselves during static destruction
+    struct Registry
+    {
+        std::mutex mutex;
+        EntryMap entries;
+        GpuMemoryStats stats;
+
+        Registry()
+        {
+            for (int t = 0; t < GPU_RESOURCE_TYPES; ++t)
+            {
+                stats.bytes[t] = 0;
+                stats.count[t] = 0;
+            }
+            stats.totalBytes = 0;
+            stats.peakBytes = 0;
+            stats.budgetBytes = 0;
+        }
+    };
+
+    Registry& registry()
+    {
+        static Registry* instance = new Registry();
+        return *instance;
+    }
+
+    unsigned long long key(GpuResourceType type, GLuint name)
+    {
+        return ((unsigned long long)type << 32) | name;
+    }
+
+    // Caller holds the registry mutex
+    bool fits(const Registry& r, size_t addedBytes)
+    {
+        return r.stats.budgetBytes == 0 || r.stats.totalBytes + addedBytes <= r.stats.budgetBytes;
+    }
+}
+
+
+bool UCreateGpuResource(GpuResourceType type, size_t estimatedBytes, const char* label, GLuint& name)
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+
+    name = 0;
+    if (!fits(r, estimatedBytes))
+    {
+        ULOG_ERROR("GPU budget of {} bytes exceeded: {} {} needs {} bytes, {} in use", r.stats.budgetBytes,
+            UGpuResourceTypeName(type), label, estimatedBytes, r.stats.totalBytes);
+        return false;
+    }
+
+    switch (type)
+    {
+    case GPU_BUFFER:
+        glGenBuffers(1, &name);
+        break;
+    case GPU_TEXTURE:
+        glGenTextures(1, &name);
+        break;
+    case GPU_VERTEX_ARRAY:
+        glGenVertexArrays(1, &name);
+        break;
+    case GPU_PROGRAM:
+        name = glCreateProgram();
+        break;
+    case GPU_FRAMEBUFFER:
+        glGenFramebuffers(1, &name);
+        break;
+    case GPU_QUERY:
+        glGenQueries(1, &name);
+        break;
+    default:
+        break;
+    }
+    if (name == 0)
+    {
+        ULOG_ERROR("Failed to create {} {}", UGpuResourceTypeName(type), label);
+        return false;
+    }
+
+    Entry& entry = r.entries[key(type, name)];
+    entry.bytes = estimatedBytes;
+    snprintf(entry.label, LABEL_BYTES, "%s", label);
+    r.stats.bytes[type] += estimatedBytes;
+    r.stats.count[type] += 1;
+    r.stats.totalBytes += estimatedBytes;
+    if (r.stats.totalBytes > r.stats.peakBytes)
+        r.stats.peakBytes = r.stats.totalBytes;
+    return true;
+}
+
+
+void UDeleteGpuResource(GpuResourceType type, GLuint name)
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+
+    EntryMap::iterator found = r.entries.find(key(type, name));
+    if (found == r.entries.end())
+        return;
+
+    r.stats.bytes[type] -= found->second.bytes;
+    r.stats.count[type] -= 1;
+    r.stats.totalBytes -= found->second.bytes;
+    r.entries.erase(found);
+
+    switch (type)
+    {
+    case GPU_BUFFER:
+        glDeleteBuffers(1, &name);
+        break;
+    case GPU_TEXTURE:
+        glDeleteTextures(1, &name);
+        break;
+    case GPU_VERTEX_ARRAY:
+        glDeleteVertexArrays(1, &name);
+        break;
+    case GPU_PROGRAM:
+        glDeleteProgram(name);
+        break;
+    case GPU_FRAMEBUFFER:
+        glDeleteFramebuffers(1, &name);
+        break;
+    case GPU_QUERY:
+        glDeleteQueries(1, &name);
+        break;
+    default:
+        break;
+    }
+}
+
+
+bool UResizeGpuResource(GpuResourceType type, GLuint name, size_t estimatedBytes)
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+
+    EntryMap::iterator found = r.entries.find(key(type, name));
+    if (found == r.entries.end())
+        return false;
+
+    size_t previous = found->second.bytes;
+    if (estimatedBytes > previous && !fits(r, estimatedBytes - previous))
+    {
+        ULOG_ERROR("GPU budget of {} bytes exceeded: {} {} grows to {} bytes, {} in use", r.stats.budgetBytes,
+            UGpuResourceTypeName(type), found->second.label, estimatedBytes, r.stats.totalBytes);
+        return false;
+    }
+
+    found->second.bytes = estimatedBytes;
+    r.stats.bytes[type] = r.stats.bytes[type] - previous + estimatedBytes;
+    r.stats.totalBytes = r.stats.totalBytes - previous + estimatedBytes;
+    if (r.stats.totalBytes > r.stats.peakBytes)
+        r.stats.peakBytes = r.stats.totalBytes;
+    return true;
+}
+
+
+bool UGpuBudgetAllows(size_t estimatedBytes)
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    return fits(r, estimatedBytes);
+}
+
+
+void USetGpuBudget(size_t bytes)
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.stats.budgetBytes = bytes;
+}
+
+
+void UGetGpuMemoryStats(GpuMemoryStats& stats)
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    stats = r.stats;
+}
+
+
+size_t UEstimateTextureBytes(int width, int height, bool mipmapped)
+{
+    size_t bytes = (size_t)width * height * 4;
+    while (mipmapped && (width > 1 || height > 1))
+    {
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+        bytes += (size_t)width * height * 4;
+    }
+    return bytes;
+}
+
+
+unsigned UReportGpuLeaks()
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+
+    if (r.entries.empty())
+    {
+        ULOG_INFO("GPU memory: no objects left, peak {} bytes", r.stats.peakBytes);
+        return 0;
+    }
+
+    // One message for the whole report: per-leak messages would hit the log's rate limit
+    std::string leaks;
+    unsigned listed = 0;
+    for (EntryMap::const_iterator it = r.entries.begin(); it != r.entries.end() && leaks.size() < LEAK_REPORT_BYTES; ++it, ++listed)
+    {
+        GpuResourceType type = (GpuResourceType)(it->first >> 32);
+        char line[LABEL_BYTES + 64];
+        snprintf(line, sizeof(line), "\n  %s %u \"%s\", %zu bytes", UGpuResourceTypeName(type), (unsigned)(it->first & 0xffffffffu),
+            it->second.label, it->second.bytes);
+        leaks += line;
+    }
+    if (listed < r.entries.size())
+    {
+        char more[32];
+        snprintf(more, sizeof(more), "\n  and %u more", (unsigned)r.entries.size() - listed);
+        leaks += more;
+    }
+    ULOG_ERROR("GPU leaks: {} objects, {} bytes, peak {} bytes:{}", (unsigned)r.entries.size(), r.stats.totalBytes, r.stats.peakBytes, leaks);
+    return (unsigned)r.entries.size();
+}
+
+
+const char* UGpuResourceTypeName(GpuResourceType type)
+{
+    static const char* const names[] = { "buffer", "texture", "vertex array", "program", "framebuffer", "query" };
+    return type >= 0 && type < GPU_RESOURCE_TYPES ? names[type] : "resource";
+}
@@ -0,0 +1,115 @@
+#ifndef GPU_RESOURCES_H
+#define GPU_RESOURCES_H
+
+#include <cstddef>
+#include <GLEW/glew.h>      // GLEW library
+
+enum GpuResourceType
+{
+    GPU_BUFFER,
+    GPU_TEXTURE,
+    GPU_VERTEX_ARRAY,
+    GPU_PROGRAM,
+    GPU_FRAMEBUFFER,
+    GPU_QUERY,
+    GPU_RESOURCE_TYPES
+};
+
+// Live objects and estimated bytes, per type and in total
+struct GpuMemoryStats
+{
+    size_t bytes[GPU_RESOURCE_TYPES];
+    unsigned count[GPU_RESOURCE_TYPES];
+    size_t totalBytes;
+    size_t peakBytes;
+    size_t budgetBytes;     // 0 is unlimited
+};
+
+/* Creates a GL object of the given type and registers it with its estimated size.
+ * Fails, and logs why, when the size would take the total over the budget.
+ * The label shows up in the leak report.
+ */
+bool UCreateGpuResource(GpuResourceType type, size_t estimatedBytes, const char* label, GLuint& name);
+
+// Deletes a registered object. Names the registry doesn't know (0, software renderer ids) are ignored.
+void UDeleteGpuResource(GpuResourceType type, GLuint name);
+
+// Changes a registered object's estimate, e.g. after glBufferData with a new size. Fails over the budget.
+bool UResizeGpuResource(GpuResourceType type, GLuint name, size_t estimatedBytes);
+
+// Whether estimatedBytes more would still fit in the budget
+bool UGpuBudgetAllows(size_t estimatedBytes);
+
+void USetGpuBudget(size_t bytes);
+void UGetGpuMemoryStats(GpuMemoryStats& stats);
+
+// Bytes of a 4-byte-per-texel texture with its full mip chain (3- and 4-channel textures both take 4 on the GPU)
+size_t UEstimateTextureBytes(int width, int height, bool mipmapped);
+
+// Logs the objects that are still registered as one error and returns how many there are. Call it after the final cleanup.
+unsigned UReportGpuLeaks();
+
+const char* UGpuResourceTypeName(GpuResourceType type);
+
+/* Owns one registered GL object and deletes it when it goes out of scope. Move-only.
+ * Converts to the GLuint name so it can be handed to GL calls directly. Handles that live
+ * in globals have to be reset before the context goes away.
+ */
+template <GpuResourceType Type>
+class GpuHandle
+{
+public:
+    GpuHandle() : name(0) {}
+    explicit GpuHandle(GLuint adopted) : name(adopted) {}   // Takes over a name from UCreateGpuResource (or a software id)
+    ~GpuHandle() { reset(); }
+
+    GpuHandle(GpuHandle&& other) noexcept : name(other.release()) {}
+    GpuHandle& operator=(GpuHandle&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            name = other.release();
+        }
+        return *this;
+    }
+
+    GpuHandle(const GpuHandle&) = delete;
+    GpuHandle& operator=(const GpuHandle&) = delete;
+
+    // Creates the object; whatever the handle held before is deleted first
+    bool create(size_t estimatedBytes, const char* label)
+    {
+        reset();
+        return UCreateGpuResource(Type, estimatedBytes, label, name);
+    }
+
+    void reset()
+    {
+        if (name != 0)
+            UDeleteGpuResource(Type, name);
+        name = 0;
+    }
+
+    GLuint release()
+    {
+        GLuint released = name;
+        name = 0;
+        return released;
+    }
+
+    GLuint get() const { return name; }
+    operator GLuint() const { return name; }
+
+private:
+    GLuint name;
+};
+
+typedef GpuHandle<GPU_BUFFER> GpuBuffer;
+typedef GpuHandle<GPU_TEXTURE> GpuTexture;
+typedef GpuHandle<GPU_VERTEX_ARRAY> GpuVertexArray;
+typedef GpuHandle<GPU_PROGRAM> GpuProgram;
+typedef GpuHandle<GPU_FRAMEBUFFER> GpuFramebuffer;
+typedef GpuHandle<GPU_QUERY> GpuQuery;
+
+#endif
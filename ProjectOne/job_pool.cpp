@@ -0,0 +1,429 @@
+#include "job_pool.h"
+
+#include <chrono>           // steady_clock, for the utilization counters
+#include <condition_variable>
+#include <memory>           // std::unique_ptr
+#include <mutex>
+#include <thread>
+
+#include "frame_memory.h"   // Jobs run under their submitter's allocation guard
+
+// Unnamed namespace
+namespace
+{
+    // Slots every queue starts with
+    const size_t JOB_QUEUE_SLOTS = 64;
+
+    // A plain job, a slice of a parallel for or a graph node. Only plain jobs hold a
+    // std::function of their own, the other two are queued without touching the heap.
+    struct QueuedJob
+    {
+        std::function<void()> run;
+        const std::function<void(size_t)>* body;    // Parallel for: body(i) for i in [begin, end)
+        size_t begin;
+        size_t end;
+        JobNode* node;
+        JobGroup* group;
+        bool guarded;                               // Submitted by a thread under an allocation guard
+
+        QueuedJob() : body(nullptr), begin(0), end(0), node(nullptr), group(nullptr), guarded(false) {}
+    };
+
+    // Ring of queued jobs. It doubles when full and never shrinks, so a steady load stops allocating.
+    struct JobRing
+    {
+        std::vector<QueuedJob> slots;
+        size_t head;            // Oldest job
+        size_t count;
+
+        JobRing() : slots(JOB_QUEUE_SLOTS), head(0), count(0) {}
+
+        bool empty() const { return count == 0; }
+
+        void pushBack(QueuedJob& job)
+        {
+            if (count == slots.size())
+            {
+                std::vector<QueuedJob> larger(slots.size() * 2);
+                for (size_t i = 0; i < count; ++i)
+                    larger[i] = std::move(slots[(head + i) % slots.size()]);
+                slots.swap(larger);
+                head = 0;
+            }
+            slots[(head + count) % slots.size()] = std::move(job);
+            ++count;
+        }
+
+        void popBack(QueuedJob& job)
+        {
+            --count;
+            job = std::move(slots[(head + count) % slots.size()]);
+        }
+
+        void popFront(QueuedJob& job)
+        {
+            job = std::move(slots[head]);
+            head = (head + 1) % slots.size();
+            --count;
+        }
+    };
+
+    // One per thread. The owner works LIFO at the back, thieves take FIFO from the front,
+    // so a thief gets the oldest (usually biggest) piece of work.
+    struct WorkerQueue
+    {
+        std::mutex mutex;
+        JobRing jobs;
+    };
+
+    // Counters for UGetJobWorkerStats. The threads outside the pool share a queue but not these.
+    struct ThreadStats
+    {
+        std::atomic<unsigned long long> busyNanoseconds;
+        std::atomic<unsigned long long> jobCount;
+        std::atomic<unsigned long long> steals;
+
+        ThreadStats() : busyNanoseconds(0), jobCount(0), steals(0) {}
+    };
+
+    typedef std::chrono::steady_clock Clock;
+
+    std::vector<std::thread> gWorkers;
+    std::vector<std::unique_ptr<WorkerQueue> > gQueues;    // [0] is shared by every thread outside the pool
+    std::vector<std::unique_ptr<ThreadStats> > gStats;     // [0] the thread that started the pool, [1] the other outside threads, then the workers
+    std::atomic<int> gQueuedJobs(0);
+    std::mutex gSleepMutex;
+    std::condition_variable gWakeSignal;    // Jobs arrived, a group finished or the pool is stopping
+    bool gStopping = false;
+    Clock::time_point gStatsSince;
+
+    thread_local unsigned tQueueIndex = 0;
+    thread_local unsigned tStatsIndex = 1;
+    thread_local int tJobDepth = 0;         // Jobs this thread is inside of, more than one while a job waits on a group
+
+    void wakeOne()
+    {
+        // Taking the lock means a thread between its check and its wait can't miss this
+        { std::lock_guard<std::mutex> lock(gSleepMutex); }
+        gWakeSignal.notify_one();
+    }
+
+    void wakeAll()
+    {
+        { std::lock_guard<std::mutex> lock(gSleepMutex); }
+        gWakeSignal.notify_all();
+    }
+
+    void enqueue(QueuedJob& job)
+    {
+        job.guarded = UAllocationGuarded();
+        WorkerQueue& queue = *gQueues[tQueueIndex];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.jobs.pushBack(job);
+        }
+        gQueuedJobs.fetch_add(1);
+        wakeOne();
+    }
+
+    // Own deque first, newest job; then the other deques round-robin, oldest job
+    bool takeJob(QueuedJob& job)
+    {
+        if (gQueuedJobs.load() == 0)
+            return false;
+
+        unsigned self = tQueueIndex;
+        {
+            WorkerQueue& own = *gQueues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.jobs.empty())
+            {
+                own.jobs.popBack(job);
+                gQueuedJobs.fetch_sub(1);
+                return true;
+            }
+        }
+
+        size_t count = gQueues.size();
+        for (size_t i = 1; i < count; ++i)
+        {
+            WorkerQueue& victim = *gQueues[(self + i) % count];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.jobs.empty())
+            {
+                victim.jobs.popFront(job);
+                gQueuedJobs.fetch_sub(1);
+                gStats[tStatsIndex]->steals.fetch_add(1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Runs a graph node, then queues every successor it was the last dependency of
+    void runGraphNode(JobNode* node, JobGroup* group)
+    {
+        node->run();
+        for (size_t s = 0; s < node->successors.size(); ++s)
+        {
+            JobNode* successor = node->successors[s];
+            if (successor->unfinished.fetch_sub(1) == 1)
+            {
+                QueuedJob queued;
+                queued.node = successor;
+                queued.group = group;
+                enqueue(queued);
+            }
+        }
+    }
+
+    void runJob(QueuedJob& job)
+    {
+        // Only the outermost job is timed: one that waits on a group runs other jobs inline,
+        // and their time is already part of its own
+        bool outermost = tJobDepth++ == 0;
+        Clock::time_point start = outermost ? Clock::now() : Clock::time_point();
+        bool guarded = UAllocationGuarded();
+        USetAllocationGuarded(job.guarded);
+        if (job.node)
+            runGraphNode(job.node, job.group);
+        else if (job.body)
+        {
+            for (size_t i = job.begin; i < job.end; ++i)
+                (*job.body)(i);
+        }
+        else
+            job.run();
+        USetAllocationGuarded(guarded);
+        --tJobDepth;
+
+        ThreadStats& own = *gStats[tStatsIndex];
+        if (outermost)
+            own.busyNanoseconds.fetch_add((unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+        own.jobCount.fetch_add(1);
+
+        if (job.group->pending.fetch_sub(1) == 1)
+            wakeAll();
+    }
+
+    void workerLoop(unsigned queueIndex)
+    {
+        tQueueIndex = queueIndex;
+        tStatsIndex = queueIndex + 1;
+        for (;;)
+        {
+            QueuedJob job;
+            if (takeJob(job))
+            {
+                runJob(job);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(gSleepMutex);
+            gWakeSignal.wait(lock, [] { return gStopping || gQueuedJobs.load() > 0; });
+            if (gStopping && gQueuedJobs.load() == 0)
+                return; // stopping and drained
+        }
+    }
+}
+
+
+void UStartJobPool(unsigned workerCount)
+{
+    if (!gWorkers.empty())
+        return;
+
+    if (workerCount == 0)
+    {
+        unsigned cores = std::thread::hardware_concurrency();
+        workerCount = cores > 1 ? cores - 1 : 1;
+    }
+
+    gStopping = false;
+    gQueues.clear();
+    for (unsigned i = 0; i <= workerCount; ++i)
+        gQueues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+    gStats.clear();
+    for (unsigned i = 0; i < workerCount + 2; ++i)
+        gStats.push_back(std::unique_ptr<ThreadStats>(new ThreadStats()));
+    tStatsIndex = 0;
+    gStatsSince = Clock::now();
+
+    for (unsigned i = 0; i < workerCount; ++i)
+        gWorkers.push_back(std::thread(workerLoop, i + 1));
+}
+
+
+void UStopJobPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(gSleepMutex);
+        gStopping = true;
+    }
+    gWakeSignal.notify_all();
+
+    for (size_t i = 0; i < gWorkers.size(); ++i)
+        gWorkers[i].join();
+    gWorkers.clear();
+    gQueues.clear();
+    gStats.clear();
+}
+
+
+unsigned UJobWorkerCount()
+{
+    return (unsigned)gWorkers.size();
+}
+
+
+void USubmitJob(JobGroup& group, const std::function<void()>& job)
+{
+    // No pool (e.g. the converter mode): just run it
+    if (gQueues.empty())
+    {
+        job();
+        return;
+    }
+
+    group.pending.fetch_add(1);
+
+    QueuedJob queued;
+    queued.run = job;
+    queued.group = &group;
+    enqueue(queued);
+}
+
+
+void UWaitJobGroup(JobGroup& group)
+{
+    while (group.pending.load() > 0)
+    {
+        QueuedJob job;
+        if (takeJob(job))
+        {
+            runJob(job);
+            continue;
+        }
+
+        // Nothing to help with, sleep until one of our jobs finishes or new work shows up
+        std::unique_lock<std::mutex> lock(gSleepMutex);
+        gWakeSignal.wait(lock, [&group] { return group.pending.load() == 0 || gQueuedJobs.load() > 0; });
+    }
+}
+
+
+void UParallelFor(size_t count, const std::function<void(size_t)>& body)
+{
+    if (count == 0)
+        return;
+
+    // A few batches per thread gives thieves something to take when the work is uneven
+    size_t threads = gWorkers.size() + 1;
+    size_t batches = threads * 4 < count ? threads * 4 : count;
+    size_t perBatch = (count + batches - 1) / batches;
+
+    // No pool: just run it
+    if (gQueues.empty())
+    {
+        for (size_t i = 0; i < count; ++i)
+            body(i);
+        return;
+    }
+
+    JobGroup group;
+    for (size_t begin = 0; begin < count; begin += perBatch)
+    {
+        group.pending.fetch_add(1);
+
+        QueuedJob queued;
+        queued.body = &body;
+        queued.begin = begin;
+        queued.end = begin + perBatch < count ? begin + perBatch : count;
+        queued.group = &group;
+        enqueue(queued);
+    }
+    UWaitJobGroup(group);
+}
+
+
+JobNode* UAddGraphJob(JobGraph& graph, const std::function<void()>& job)
+{
+    graph.nodes.emplace_back();
+    JobNode* node = &graph.nodes.back();
+    node->run = job;
+    return node;
+}
+
+
+void UAddJobDependency(JobNode* before, JobNode* after)
+{
+    before->successors.push_back(after);
+    ++after->dependencies;
+}
+
+
+void URunJobGraph(JobGraph& graph)
+{
+    if (graph.nodes.empty())
+        return;
+
+    // No pool: run in an order that respects the dependencies
+    if (gQueues.empty())
+    {
+        std::vector<JobNode*> ready;
+        for (size_t n = 0; n < graph.nodes.size(); ++n)
+        {
+            graph.nodes[n].unfinished = graph.nodes[n].dependencies;
+            if (graph.nodes[n].dependencies == 0)
+                ready.push_back(&graph.nodes[n]);
+        }
+        while (!ready.empty())
+        {
+            JobNode* node = ready.back();
+            ready.pop_back();
+            node->run();
+            for (size_t s = 0; s < node->successors.size(); ++s)
+            {
+                if (node->successors[s]->unfinished.fetch_sub(1) == 1)
+                    ready.push_back(node->successors[s]);
+            }
+        }
+        return;
+    }
+
+    // Every node counts against the group up front, so it can't reach zero while successors are still to be queued
+    JobGroup group;
+    group.pending = (int)graph.nodes.size();
+    for (size_t n = 0; n < graph.nodes.size(); ++n)
+        graph.nodes[n].unfinished = graph.nodes[n].dependencies;
+
+    for (size_t n = 0; n < graph.nodes.size(); ++n)
+    {
+        JobNode* node = &graph.nodes[n];
+        if (node->dependencies != 0)
+            continue;
+        QueuedJob queued;
+        queued.node = node;
+        queued.group = &group;
+        enqueue(queued);
+    }
+    UWaitJobGroup(group);
+}
+
+
+void UGetJobWorkerStats(std::vector<JobWorkerStats>& stats)
+{
+    Clock::time_point now = Clock::now();
+    double elapsed = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(now - gStatsSince).count();
+    gStatsSince = now;
+
+    stats.resize(gStats.size());
+    for (size_t i = 0; i < gStats.size(); ++i)
+    {
+        ThreadStats& thread = *gStats[i];
+        unsigned long long busy = thread.busyNanoseconds.exchange(0);
+        stats[i].utilization = elapsed > 0.0 ? (float)(busy / elapsed) : 0.0f;
+        stats[i].jobs = thread.jobCount.exchange(0);
+        stats[i].steals = thread.steals.exchange(0);
+    }
+}
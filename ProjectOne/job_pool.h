@@ -0,0 +1,72 @@
+#ifndef JOB_POOL_H
+#define JOB_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <vector>
+
+// Tracks a batch of submitted jobs so the caller can wait for all of them
+struct JobGroup
+{
+    std::atomic<int> pending;
+
+    JobGroup() : pending(0) {}
+};
+
+// A job in a dependency graph, it runs once every job it depends on has finished
+struct JobNode
+{
+    std::function<void()> run;
+    std::vector<JobNode*> successors;
+    int dependencies;
+    std::atomic<int> unfinished;
+
+    JobNode() : dependencies(0), unfinished(0) {}
+};
+
+// Owns its nodes. Add jobs and dependencies, then URunJobGraph; a graph can be run again.
+struct JobGraph
+{
+    std::deque<JobNode> nodes;  // deque keeps node addresses stable while jobs are added
+};
+
+// What one thread did since the last UGetJobWorkerStats
+struct JobWorkerStats
+{
+    float utilization;          // Time spent running jobs over wall time
+    unsigned long long jobs;
+    unsigned long long steals;  // Jobs taken from another thread's deque
+};
+
+/* Starts the worker threads. workerCount 0 uses one thread per core, minus the main thread.
+ * Every thread owns a deque: it pushes and pops its own jobs at the back and, when it runs
+ * dry, steals the oldest job from the front of another thread's deque.
+ */
+void UStartJobPool(unsigned workerCount = 0);
+void UStopJobPool();
+unsigned UJobWorkerCount();
+
+// Queues a job on the calling thread's deque. The group's counter drops when it has finished.
+void USubmitJob(JobGroup& group, const std::function<void()>& job);
+
+// Blocks until every job of the group has run. The calling thread runs or steals jobs meanwhile.
+void UWaitJobGroup(JobGroup& group);
+
+// Runs body(i) for every i in [0, count) across the pool and returns when all are done
+void UParallelFor(size_t count, const std::function<void(size_t)>& body);
+
+JobNode* UAddGraphJob(JobGraph& graph, const std::function<void()>& job);
+void UAddJobDependency(JobNode* before, JobNode* after);   // after waits for before
+
+// Runs the (acyclic) graph and returns when every node has finished
+void URunJobGraph(JobGraph& graph);
+
+/* Per-thread counters since the previous call, which resets them. Entry 0 is the thread that
+ * started the pool (the main thread), entry 1 every other thread outside the pool (the render
+ * thread), the workers follow. A job counts as busy time once, however many jobs it ran inline.
+ */
+void UGetJobWorkerStats(std::vector<JobWorkerStats>& stats);
+
+#endif
@@ -0,0 +1,300 @@
+#include "json.h"
+
+#include <cmath>            // floor
+#include <cstdlib>          // strtod
+#include <cstring>          // strcmp
+
+// Unnamed namespace
+namespace
+{
+    const JsonValue kNullValue;
+
+    struct Parser
+    {
+        const char* cursor;
+        const char* end;
+        std::string error;
+
+        void skipWhitespace()
+        {
+            while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\n' || *cursor == '\r'))
+                ++cursor;
+        }
+
+        bool fail(const char* message)
+        {
+            if (error.empty())
+                error = message;
+            return false;
+        }
+
+        bool literal(const char* word)
+        {
+            size_t length = strlen(word);
+            if ((size_t)(end - cursor) < length || strncmp(cursor, word, length) != 0)
+                return fail("unexpected token");
+            cursor += length;
+            return true;
+        }
+
+        void appendUtf8(std::string& out, unsigned codepoint)
+        {
+            if (codepoint < 0x80)
+                out += (char)codepoint;
+            else if (codepoint < 0x800)
+            {
+                out += (char)(0xC0 | (codepoint >> 6));
+                out += (char)(0x80 | (codepoint & 0x3F));
+            }
+            else if (codepoint < 0x10000)
+            {
+                out += (char)(0xE0 | (codepoint >> 12));
+                out += (char)(0x80 | ((codepoint >> 6) & 0x3F));
+                out += (char)(0x80 | (codepoint & 0x3F));
+            }
+            else
+            {
+                out += (char)(0xF0 | (codepoint >> 18));
+                out += (char)(0x80 | ((codepoint >> 12) & 0x3F));
+                out += (char)(0x80 | ((codepoint >> 6) & 0x3F));
+                out += (char)(0x80 | (codepoint & 0x3F));
+            }
+        }
+
+        bool hex4(unsigned& value)
+        {
+            if (end - cursor < 4)
+                return fail("truncated \\u escape");
+            value = 0;
+            for (int i = 0; i < 4; ++i)
+            {
+                char c = *cursor++;
+                value <<= 4;
+                if (c >= '0' && c <= '9') value |= c - '0';
+                else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+                else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+                else return fail("bad \\u escape");
+            }
+            return true;
+        }
+
+        bool parseString(std::string& out)
+        {
+            ++cursor; // opening quote
+            while (cursor < end && *cursor != '"')
+            {
+                char c = *cursor++;
+                if (c != '\\')
+                {
+                    out += c;
+                    continue;
+                }
+                if (cursor >= end)
+                    return fail("truncated escape");
+                char e = *cursor++;
+                switch (e)
+                {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u':
+                {
+                    unsigned codepoint;
+                    if (!hex4(codepoint))
+                        return false;
+                    // Surrogate pair
+                    if (codepoint >= 0xD800 && codepoint <= 0xDBFF && end - cursor >= 6 && cursor[0] == '\\' && cursor[1] == 'u')
+                    {
+                        cursor += 2;
+                        unsigned low;
+                        if (!hex4(low))
+                            return false;
+                        codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    appendUtf8(out, codepoint);
+                }
+                break;
+                default:
+                    return fail("bad escape");
+                }
+            }
+            if (cursor >= end)
+                return fail("unterminated string");
+            ++cursor; // closing quote
+            return true;
+        }
+
+        bool parseValue(JsonValue& value, int depth)
+        {
+            if (depth > 256)
+                return fail("nesting too deep");
+
+            skipWhitespace();
+            if (cursor >= end)
+                return fail("unexpected end of input");
+
+            switch (*cursor)
+            {
+            case '{':
+            {
+                value.type = JsonValue::Object;
+                ++cursor;
+                skipWhitespace();
+                if (cursor < end && *cursor == '}')
+                {
+                    ++cursor;
+                    return true;
+                }
+                for (;;)
+                {
+                    skipWhitespace();
+                    if (cursor >= end || *cursor != '"')
+                        return fail("expected object key");
+                    value.object.push_back(std::make_pair(std::string(), JsonValue()));
+                    if (!parseString(value.object.back().first))
+                        return false;
+                    skipWhitespace();
+                    if (cursor >= end || *cursor != ':')
+                        return fail("expected ':'");
+                    ++cursor;
+                    if (!parseValue(value.object.back().second, depth + 1))
+                        return false;
+                    skipWhitespace();
+                    if (cursor < end && *cursor == ',')
+                    {
+                        ++cursor;
+                        continue;
+                    }
+                    if (cursor < end && *cursor == '}')
+                    {
+                        ++cursor;
+                        return true;
+                    }
+                    return fail("expected ',' or '}'");
+                }
+            }
+            case '[':
+            {
+                value.type = JsonValue::Array;
+                ++cursor;
+                skipWhitespace();
+                if (cursor < end && *cursor == ']')
+                {
+                    ++cursor;
+                    return true;
+                }
+                for (;;)
+                {
+                    value.array.push_back(JsonValue());
+                    if (!parseValue(value.array.back(), depth + 1))
+                        return false;
+                    skipWhitespace();
+                    if (cursor < end && *cursor == ',')
+                    {
+                        ++cursor;
+                        continue;
+                    }
+                    if (cursor < end && *cursor == ']')
+                    {
+                        ++cursor;
+                        return true;
+                    }
+                    return fail("expected ',' or ']'");
+                }
+            }
+            case '"':
+                value.type = JsonValue::String;
+                return parseString(value.string);
+            case 't':
+                value.type = JsonValue::Bool;
+                value.boolean = true;
+                return literal("true");
+            case 'f':
+                value.type = JsonValue::Bool;
+                value.boolean = false;
+                return literal("false");
+            case 'n':
+                value.type = JsonValue::Null;
+                return literal("null");
+            default:
+            {
+                // strtod needs a terminated buffer, numbers are short so copy them out
+                char buffer[64];
+                size_t length = 0;
+                while (cursor + length < end && length < sizeof(buffer) - 1 && cursor[length] && strchr("+-0123456789.eE", cursor[length]))
+                    ++length;
+                if (length == 0)
+                    return fail("unexpected character");
+                memcpy(buffer, cursor, length);
+                buffer[length] = '\0';
+                value.type = JsonValue::Number;
+                value.number = strtod(buffer, NULL);
+                cursor += length;
+                return true;
+            }
+            }
+        }
+    };
+}
+
+
+const JsonValue& JsonValue::operator[](const char* key) const
+{
+    if (type != Object)
+        return kNullValue;
+    for (size_t i = 0; i < object.size(); ++i)
+    {
+        if (object[i].first == key)
+            return object[i].second;
+    }
+    return kNullValue;
+}
+
+
+const JsonValue& JsonValue::operator[](size_t index) const
+{
+    if (type != Array || index >= array.size())
+        return kNullValue;
+    return array[index];
+}
+
+
+bool JsonValue::asSize(size_t& out, size_t fallback) const
+{
+    if (type == Null)
+    {
+        out = fallback;
+        return true;
+    }
+
+    // Also false for NaN; the cap keeps the cast defined where size_t has 32 bits
+    if (type != Number || !(number >= 0.0 && number <= 4294967295.0) || floor(number) != number)
+        return false;
+    out = (size_t)number;
+    return true;
+}
+
+
+bool UParseJson(const char* text, size_t length, JsonValue& root, std::string& error)
+{
+    Parser parser;
+    parser.cursor = text;
+    parser.end = text + length;
+
+    // Skip a UTF-8 byte order mark
+    if (length >= 3 && (unsigned char)text[0] == 0xEF && (unsigned char)text[1] == 0xBB && (unsigned char)text[2] == 0xBF)
+        parser.cursor += 3;
+
+    root = JsonValue();
+    if (!parser.parseValue(root, 0))
+    {
+        error = parser.error;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,43 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <climits>          // INT_MIN, INT_MAX
+#include <string>
+#include <utility>
+#include <vector>
+
+// Minimal JSON document model, enough for glTF
+struct JsonValue
+{
+    enum Type { Null, Bool, Number, String, Array, Object };
+
+    Type type;
+    bool boolean;
+    double number;
+    std::string string;
+    std::vector<JsonValue> array;
+    std::vector<std::pair<std::string, JsonValue> > object;
+
+    JsonValue() : type(Null), boolean(false), number(0.0) {}
+
+    // Object member lookup, returns a shared null value when missing
+    const JsonValue& operator[](const char* key) const;
+    // Array element lookup, returns a shared null value when out of range
+    const JsonValue& operator[](size_t index) const;
+
+    bool isNull() const { return type == Null; }
+    size_t size() const { return type == Array ? array.size() : object.size(); }
+
+    double asNumber(double fallback = 0.0) const { return type == Number ? number : fallback; }
+    int asInt(int fallback = -1) const { return type == Number && number >= INT_MIN && number <= INT_MAX ? (int)number : fallback; }
+    bool asBool(bool fallback = false) const { return type == Bool ? boolean : fallback; }
+    const std::string& asString() const { return string; }
+
+    // Counts and byte sizes: a whole number in [0, 2^32). Missing reads as fallback, anything else fails.
+    bool asSize(size_t& out, size_t fallback = 0) const;
+};
+
+// Parses text[0, length). On failure returns false and fills error.
+bool UParseJson(const char* text, size_t length, JsonValue& root, std::string& error);
+
+#endif
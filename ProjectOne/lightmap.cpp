@@ -0,0 +1,857 @@
+#include "lightmap.h"
+
+#include <algorithm>        // std::sort, std::min, std::max
+#include <atomic>           // std::atomic
+#include <cassert>
+#include <cfloat>           // FLT_MAX
+#include <chrono>           // std::chrono::steady_clock
+#include <cmath>            // sqrt, cbrt, ceil, floor, fabs, cos, sin
+#include <cstdio>           // fopen, fwrite
+#include <cstring>          // memcmp, memcpy
+#include <map>              // std::map
+#include <utility>          // std::pair
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include "async_log.h"
+#include "job_pool.h"       // The bake runs on the job workers
+#include "ray_pick.h"       // SAH builder and triangle test, the bake's BVH is collapsed from it
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define LIGHTMAP_SSE2 1
+#endif
+
+// Unnamed namespace
+namespace
+{
+    // Rays start this far off the surface so they don't hit the triangle they left
+    const float RAY_OFFSET = 1e-3f;
+
+    // Share of the atlas the first packing attempt tries to fill, and the step down when it doesn't fit
+    const float PACK_FILL = 0.7f;
+    const float PACK_SHRINK = 0.9f;
+    const int PACK_ATTEMPTS = 100;
+
+    const int STACK_SIZE = 256;     // Traversal stack on the stack; deeper trees get one on the heap
+    const float PI = 3.14159265358979f;
+
+    /* Four children side by side, the boxes stored per axis so one SSE compare tests them all.
+     * Leaf lanes point at triangles, interior lanes at nodes; unused lanes get an inverted box.
+     */
+    struct Bvh4Node
+    {
+        float boundsMin[3][4];      // [axis][lane]
+        float boundsMax[3][4];
+        GLuint child[4];            // Node index, or first triangle of a leaf
+        GLuint count[4];            // Triangles of a leaf, 0 for interior and unused lanes
+    };
+
+    struct Bvh4
+    {
+        std::vector<Bvh4Node> nodes;
+        std::vector<BvhTriangle> triangles;
+        int depth;                  // Of the binary tree it was collapsed from, which it never exceeds
+    };
+
+    // A texel the bake lights, with the surface it covers
+    struct BakeTexel
+    {
+        size_t index;               // y * size + x
+        glm::vec3 position;
+        glm::vec3 normal;           // Shading normal
+        glm::vec3 faceNormal;       // Geometric normal, on the shading normal's side
+    };
+
+    // Half the surface area, enough to pick the biggest node to open
+    float halfArea(const BvhNode& node)
+    {
+        glm::vec3 size = node.boundsMax - node.boundsMin;
+        return size.x * size.y + size.y * size.z + size.z * size.x;
+    }
+
+    glm::vec3 position(const GLfloat* vertices, GLuint floatsPerVertex, GLuint vertex)
+    {
+        const GLfloat* p = vertices + (size_t)vertex * floatsPerVertex;
+        return glm::vec3(p[0], p[1], p[2]);
+    }
+
+    // Two axes perpendicular to n (Duff et al., "Building an Orthonormal Basis, Revisited")
+    void basis(const glm::vec3& n, glm::vec3& tangent, glm::vec3& bitangent)
+    {
+        float sign = n.z >= 0.0f ? 1.0f : -1.0f;
+        float a = -1.0f / (sign + n.z);
+        float b = n.x * n.y * a;
+        tangent = glm::vec3(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+        bitangent = glm::vec3(b, sign + n.y * n.y * a, -n.y);
+    }
+
+    // xorshift32, seeded per texel so a bake doesn't depend on how the jobs were split
+    float random(uint32_t& state)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return (state >> 8) * (1.0f / 16777216.0f);
+    }
+
+    uint32_t seed(size_t texel)
+    {
+        uint32_t h = (uint32_t)texel * 0x9E3779B9u + 0x7F4A7C15u;
+        h ^= h >> 16;
+        h *= 0x85EBCA6Bu;
+        h ^= h >> 13;
+        return h ? h : 1u;
+    }
+
+    // Direction around n with density cos(theta) / pi
+    glm::vec3 cosineSample(const glm::vec3& n, uint32_t& state)
+    {
+        float r1 = random(state), r2 = random(state);
+        float phi = 2.0f * PI * r1;
+        float r = sqrt(r2);
+        glm::vec3 tangent, bitangent;
+        basis(n, tangent, bitangent);
+        return tangent * (r * cos(phi)) + bitangent * (r * sin(phi)) + n * sqrt(std::max(1.0f - r2, 0.0f));
+    }
+
+    // Appends the 4-wide node for the children of binary node index and returns its number
+    GLuint collapse(const std::vector<BvhNode>& binary, GLuint index, std::vector<Bvh4Node>& wide)
+    {
+        // Open the largest interior child until there are four
+        GLuint lanes[4] = { index + 1, binary[index].first, 0, 0 };
+        int laneCount = 2;
+        while (laneCount < 4)
+        {
+            int open = -1;
+            for (int l = 0; l < laneCount; ++l)
+                if (binary[lanes[l]].count == 0 && (open < 0 || halfArea(binary[lanes[l]]) > halfArea(binary[lanes[open]])))
+                    open = l;
+            if (open < 0)
+                break;
+            GLuint node = lanes[open];
+            lanes[open] = node + 1;
+            lanes[laneCount++] = binary[node].first;
+        }
+
+        GLuint wideIndex = (GLuint)wide.size();
+        wide.push_back(Bvh4Node());
+        GLuint child[4] = { 0, 0, 0, 0 }, count[4] = { 0, 0, 0, 0 };
+        for (int l = 0; l < laneCount; ++l)
+        {
+            const BvhNode& node = binary[lanes[l]];
+            if (node.count > 0)
+            {
+                child[l] = node.first;
+                count[l] = node.count;
+            }
+            else
+                child[l] = collapse(binary, lanes[l], wide);   // May move wide's storage
+        }
+
+        Bvh4Node& out = wide[wideIndex];
+        for (int l = 0; l < 4; ++l)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                out.boundsMin[axis][l] = l < laneCount ? binary[lanes[l]].boundsMin[axis] : FLT_MAX;
+                out.boundsMax[axis][l] = l < laneCount ? binary[lanes[l]].boundsMax[axis] : -FLT_MAX;
+            }
+            out.child[l] = child[l];
+            out.count[l] = count[l];
+        }
+        return wideIndex;
+    }
+
+    void buildBvh4(const std::vector<GLfloat>& positions, const std::vector<GLuint>& indices, Bvh4& bvh)
+    {
+        MeshBvh binary;
+        UBuildMeshBvh(&positions[0], 3, &indices[0], indices.size(), binary);
+        bvh.triangles.swap(binary.triangles);
+        bvh.depth = binary.depth;
+        bvh.nodes.clear();
+        if (binary.nodes.empty())
+            return;
+
+        if (binary.nodes[0].count == 0)
+        {
+            collapse(binary.nodes, 0, bvh.nodes);
+            return;
+        }
+
+        // A single leaf: one node with one lane
+        Bvh4Node root;
+        for (int l = 0; l < 4; ++l)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                root.boundsMin[axis][l] = l == 0 ? binary.nodes[0].boundsMin[axis] : FLT_MAX;
+                root.boundsMax[axis][l] = l == 0 ? binary.nodes[0].boundsMax[axis] : -FLT_MAX;
+            }
+            root.child[l] = l == 0 ? binary.nodes[0].first : 0;
+            root.count[l] = l == 0 ? binary.nodes[0].count : 0;
+        }
+        bvh.nodes.push_back(root);
+    }
+
+    /* Walks the nodes whose boxes the ray enters before maxT, nearest lanes first. leaf(first,
+     * count) tests a leaf's triangles, may lower maxT, and returns true to stop the walk.
+     * The stack never holds more than 3 * depth + 1 nodes: up to three pending lanes per
+     * level plus the four just pushed.
+     */
+    template <typename Leaf>
+    void traverse(const Bvh4& bvh, const glm::vec3& origin, const glm::vec3& direction, float& maxT, Leaf leaf)
+    {
+        if (bvh.nodes.empty())
+            return;
+
+        // Axis-parallel rays would give 0 * inf in the slab test. The planes the ray enters
+        // through are picked by its direction, which also makes the inverted boxes of unused
+        // lanes come out empty.
+        glm::vec3 inverse;
+        bool negative[3];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float d = direction[axis];
+            negative[axis] = d < 0.0f;
+            inverse[axis] = 1.0f / (fabs(d) > 1e-12f ? d : (negative[axis] ? -1e-12f : 1e-12f));
+        }
+
+        GLuint fixedStack[STACK_SIZE];
+        float fixedStackNear[STACK_SIZE];
+        std::vector<GLuint> deepStack;
+        std::vector<float> deepStackNear;
+        GLuint* stack = fixedStack;
+        float* stackNear = fixedStackNear;
+        const int capacity = std::max(3 * bvh.depth + 1, STACK_SIZE);
+        if (capacity > STACK_SIZE)
+        {
+            deepStack.resize(capacity);
+            deepStackNear.resize(capacity);
+            stack = &deepStack[0];
+            stackNear = &deepStackNear[0];
+        }
+        int top = 0;
+        stack[top] = 0;
+        stackNear[top++] = 0.0f;
+
+#ifdef LIGHTMAP_SSE2
+        __m128 originLanes[3] = { _mm_set1_ps(origin.x), _mm_set1_ps(origin.y), _mm_set1_ps(origin.z) };
+        __m128 inverseLanes[3] = { _mm_set1_ps(inverse.x), _mm_set1_ps(inverse.y), _mm_set1_ps(inverse.z) };
+#endif
+
+        while (top > 0)
+        {
+            --top;
+            if (stackNear[top] > maxT)
+                continue;       // Something closer was found since it was pushed
+            const Bvh4Node& node = bvh.nodes[stack[top]];
+
+            float tNear[4];
+            int mask = 0;
+#ifdef LIGHTMAP_SSE2
+            __m128 nearLanes = _mm_setzero_ps();
+            __m128 farLanes = _mm_set1_ps(maxT);
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                const float* entry = negative[axis] ? node.boundsMax[axis] : node.boundsMin[axis];
+                const float* exit = negative[axis] ? node.boundsMin[axis] : node.boundsMax[axis];
+                nearLanes = _mm_max_ps(nearLanes, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(entry), originLanes[axis]), inverseLanes[axis]));
+                farLanes = _mm_min_ps(farLanes, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(exit), originLanes[axis]), inverseLanes[axis]));
+            }
+            mask = _mm_movemask_ps(_mm_cmple_ps(nearLanes, farLanes));
+            _mm_storeu_ps(tNear, nearLanes);
+#else
+            for (int l = 0; l < 4; ++l)
+            {
+                float enter = 0.0f, leave = maxT;
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    float entry = negative[axis] ? node.boundsMax[axis][l] : node.boundsMin[axis][l];
+                    float exit = negative[axis] ? node.boundsMin[axis][l] : node.boundsMax[axis][l];
+                    enter = std::max(enter, (entry - origin[axis]) * inverse[axis]);
+                    leave = std::min(leave, (exit - origin[axis]) * inverse[axis]);
+                }
+                tNear[l] = enter;
+                if (enter <= leave)
+                    mask |= 1 << l;
+            }
+#endif
+
+            // Leaves are tested straight away, interior lanes pushed farthest first
+            int order[4], hits = 0;
+            for (int l = 0; l < 4; ++l)
+            {
+                if (!(mask & (1 << l)))
+                    continue;
+                if (node.count[l] > 0)
+                {
+                    if (leaf(node.child[l], node.count[l]))
+                        return;
+                    continue;
+                }
+                int i = hits++;
+                for (; i > 0 && tNear[order[i - 1]] < tNear[l]; --i)
+                    order[i] = order[i - 1];
+                order[i] = l;
+            }
+            assert(top + hits <= capacity);
+            for (int i = 0; i < hits; ++i)
+            {
+                stack[top] = node.child[order[i]];
+                stackNear[top++] = tNear[order[i]];
+            }
+        }
+    }
+
+    bool closestHit(const Bvh4& bvh, const glm::vec3& origin, const glm::vec3& direction, float& distance, glm::vec3& normal)
+    {
+        float closest = FLT_MAX;
+        const BvhTriangle* found = nullptr;
+        traverse(bvh, origin, direction, closest, [&](GLuint first, GLuint count)
+        {
+            for (GLuint i = first; i < first + count; ++i)
+            {
+                float t, u, v;
+                if (UIntersectTriangle(bvh.triangles[i], origin, direction, t, u, v) && t < closest)
+                {
+                    closest = t;
+                    found = &bvh.triangles[i];
+                }
+            }
+            return false;
+        });
+        if (!found)
+            return false;
+        distance = closest;
+        normal = glm::normalize(glm::cross(found->edge1, found->edge2));
+        return true;
+    }
+
+    bool occluded(const Bvh4& bvh, const glm::vec3& origin, const glm::vec3& direction, float distance)
+    {
+        bool hit = false;
+        traverse(bvh, origin, direction, distance, [&](GLuint first, GLuint count)
+        {
+            for (GLuint i = first; i < first + count; ++i)
+            {
+                float t, u, v;
+                if (UIntersectTriangle(bvh.triangles[i], origin, direction, t, u, v) && t < distance)
+                    return hit = true;
+            }
+            return false;
+        });
+        return hit;
+    }
+
+    // Light arriving straight from the point light, in the shader's N.L units
+    glm::vec3 directLight(const Bvh4& bvh, const LightmapSettings& settings, const glm::vec3& origin, const glm::vec3& normal)
+    {
+        glm::vec3 toLight = settings.lightPosition - origin;
+        float distance = glm::length(toLight);
+        if (distance <= RAY_OFFSET)
+            return settings.lightColor;
+        glm::vec3 direction = toLight / distance;
+        float cosine = glm::dot(normal, direction);
+        if (cosine <= 0.0f || occluded(bvh, origin, direction, distance - RAY_OFFSET))
+            return glm::vec3(0.0f);
+        return settings.lightColor * cosine;
+    }
+
+    // One cosine-weighted path from a texel, with the light sampled at every bounce
+    glm::vec3 indirectLight(const Bvh4& bvh, const LightmapSettings& settings, glm::vec3 origin, glm::vec3 normal, uint32_t& state, uint64_t& rays)
+    {
+        glm::vec3 radiance(0.0f);
+        float throughput = 1.0f;
+        for (int bounce = 0; bounce <= settings.bounces; ++bounce)
+        {
+            glm::vec3 direction = cosineSample(normal, state);
+            float distance;
+            glm::vec3 hitNormal;
+            ++rays;
+            if (!closestHit(bvh, origin, direction, distance, hitNormal))
+            {
+                radiance += settings.skyColor * throughput;
+                break;
+            }
+
+            // Surfaces are lit from both sides, like the shader's two-sided meshes
+            if (glm::dot(hitNormal, direction) > 0.0f)
+                hitNormal = -hitNormal;
+            throughput *= settings.albedo;
+            origin = origin + direction * distance + hitNormal * RAY_OFFSET;
+            normal = hitNormal;
+            ++rays;
+            radiance += directLight(bvh, settings, origin, normal) * throughput;
+        }
+        return radiance;
+    }
+
+    // Finds the texels whose centers fall on a triangle in the atlas, one entry per texel
+    void rasterizeTexels(const std::vector<LightmapInstance>& instances, int size, std::vector<BakeTexel>& texels)
+    {
+        std::vector<bool> covered((size_t)size * size, false);
+        for (const LightmapInstance& instance : instances)
+        {
+            const LightmapMesh& mesh = *instance.mesh;
+            GLuint fpv = mesh.floatsPerVertex;
+            GLuint uvOffset = fpv - LIGHTMAP_UV_FLOATS;
+            bool hasNormals = uvOffset >= 11;
+            glm::mat4 normalMatrix = glm::transpose(glm::inverse(instance.model));
+
+            for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3)
+            {
+                glm::vec3 p[3], n[3];
+                glm::vec2 uv[3];
+                for (int c = 0; c < 3; ++c)
+                {
+                    const GLfloat* v = &mesh.vertices[(size_t)mesh.indices[t + c] * fpv];
+                    p[c] = glm::vec3(instance.model * glm::vec4(v[0], v[1], v[2], 1.0f));
+                    if (hasNormals)
+                        n[c] = glm::vec3(normalMatrix * glm::vec4(v[8], v[9], v[10], 0.0f));
+                    uv[c] = glm::vec2(v[uvOffset], v[uvOffset + 1]) * (float)size;
+                }
+
+                glm::vec3 face = glm::cross(p[1] - p[0], p[2] - p[0]);
+                float area = (uv[1].x - uv[0].x) * (uv[2].y - uv[0].y) - (uv[2].x - uv[0].x) * (uv[1].y - uv[0].y);
+                if (glm::length(face) <= 0.0f || fabs(area) <= 0.0f)
+                    continue;
+                face = glm::normalize(face);
+
+                int x0 = std::max((int)floor(std::min(uv[0].x, std::min(uv[1].x, uv[2].x))), 0);
+                int x1 = std::min((int)ceil(std::max(uv[0].x, std::max(uv[1].x, uv[2].x))), size - 1);
+                int y0 = std::max((int)floor(std::min(uv[0].y, std::min(uv[1].y, uv[2].y))), 0);
+                int y1 = std::min((int)ceil(std::max(uv[0].y, std::max(uv[1].y, uv[2].y))), size - 1);
+                for (int y = y0; y <= y1; ++y)
+                {
+                    for (int x = x0; x <= x1; ++x)
+                    {
+                        size_t index = (size_t)y * size + x;
+                        if (covered[index])
+                            continue;
+
+                        // Barycentrics of the texel center, a little slack so shared edges leave no gaps
+                        glm::vec2 c(x + 0.5f, y + 0.5f);
+                        float w0 = ((uv[1].x - c.x) * (uv[2].y - c.y) - (uv[2].x - c.x) * (uv[1].y - c.y)) / area;
+                        float w1 = ((uv[2].x - c.x) * (uv[0].y - c.y) - (uv[0].x - c.x) * (uv[2].y - c.y)) / area;
+                        float w2 = 1.0f - w0 - w1;
+                        if (w0 < -1e-4f || w1 < -1e-4f || w2 < -1e-4f)
+                            continue;
+
+                        BakeTexel texel;
+                        texel.index = index;
+                        texel.position = p[0] * w0 + p[1] * w1 + p[2] * w2;
+                        glm::vec3 normal = hasNormals ? n[0] * w0 + n[1] * w1 + n[2] * w2 : face;
+                        texel.normal = glm::length(normal) > 0.0f ? glm::normalize(normal) : face;
+                        texel.faceNormal = glm::dot(face, texel.normal) < 0.0f ? -face : face;
+                        texels.push_back(texel);
+                        covered[index] = true;
+                    }
+                }
+            }
+        }
+    }
+
+    // Spreads covered texels into the empty ones around them, once per padding texel
+    void dilate(std::vector<float>& texels, std::vector<bool>& covered, int size)
+    {
+        for (int pass = 0; pass < LIGHTMAP_PADDING; ++pass)
+        {
+            std::vector<bool> next = covered;
+            for (int y = 0; y < size; ++y)
+            {
+                for (int x = 0; x < size; ++x)
+                {
+                    size_t index = (size_t)y * size + x;
+                    if (covered[index])
+                        continue;
+
+                    float sum[3] = { 0.0f, 0.0f, 0.0f };
+                    int count = 0;
+                    for (int dy = -1; dy <= 1; ++dy)
+                    {
+                        for (int dx = -1; dx <= 1; ++dx)
+                        {
+                            int nx = x + dx, ny = y + dy;
+                            if (nx < 0 || ny < 0 || nx >= size || ny >= size || !covered[(size_t)ny * size + nx])
+                                continue;
+                            for (int c = 0; c < 3; ++c)
+                                sum[c] += texels[((size_t)ny * size + nx) * 3 + c];
+                            ++count;
+                        }
+                    }
+                    if (count == 0)
+                        continue;
+                    for (int c = 0; c < 3; ++c)
+                        texels[index * 3 + c] = sum[c] / count;
+                    next[index] = true;
+                }
+            }
+            covered.swap(next);
+        }
+    }
+
+    void hashBytes(uint64_t& hash, const void* data, size_t size)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= bytes[i];
+            hash *= 0x100000001B3ull;
+        }
+    }
+
+    struct LightmapFileHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t size;
+        uint32_t reserved;
+        uint64_t sceneHash;
+    };
+}
+
+
+void UUnwrapLightmap(const GLfloat* vertices, GLuint floatsPerVertex, const GLuint* indices, size_t indexCount, LightmapMesh& mesh)
+{
+    size_t triangleCount = indexCount / 3;
+    mesh.vertices.clear();
+    mesh.indices.clear();
+    mesh.charts.clear();
+    mesh.floatsPerVertex = floatsPerVertex + LIGHTMAP_UV_FLOATS;
+
+    // Vertices split for colors or UVs still share an edge when their positions match
+    std::map<std::pair<float, std::pair<float, float>>, GLuint> positionIds;
+    std::vector<GLuint> corners(triangleCount * 3);
+    for (size_t i = 0; i < triangleCount * 3; ++i)
+    {
+        glm::vec3 p = position(vertices, floatsPerVertex, indices[i]);
+        auto key = std::make_pair(p.x, std::make_pair(p.y, p.z));
+        auto found = positionIds.insert(std::make_pair(key, (GLuint)positionIds.size()));
+        corners[i] = found.first->second;
+    }
+
+    std::map<std::pair<GLuint, GLuint>, std::vector<GLuint>> edges;
+    std::vector<glm::vec3> normals(triangleCount);
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        glm::vec3 a = position(vertices, floatsPerVertex, indices[t * 3]);
+        glm::vec3 b = position(vertices, floatsPerVertex, indices[t * 3 + 1]);
+        glm::vec3 c = position(vertices, floatsPerVertex, indices[t * 3 + 2]);
+        glm::vec3 n = glm::cross(b - a, c - a);
+        normals[t] = glm::length(n) > 0.0f ? glm::normalize(n) : glm::vec3(0.0f);
+
+        for (int e = 0; e < 3; ++e)
+        {
+            GLuint v0 = corners[t * 3 + e], v1 = corners[t * 3 + (e + 1) % 3];
+            edges[std::make_pair(std::min(v0, v1), std::max(v0, v1))].push_back((GLuint)t);
+        }
+    }
+
+    // Grow each chart breadth first from the first triangle not in one yet
+    std::vector<int> chartOf(triangleCount, -1);
+    std::vector<GLuint> queue;
+    std::vector<GLuint> remap(indexCount > 0 ? *std::max_element(indices, indices + indexCount) + 1 : 0, ~0u);
+    for (size_t seedTriangle = 0; seedTriangle < triangleCount; ++seedTriangle)
+    {
+        if (chartOf[seedTriangle] >= 0)
+            continue;
+
+        int chart = (int)mesh.charts.size();
+        glm::vec3 seedNormal = normals[seedTriangle];
+        queue.assign(1, (GLuint)seedTriangle);
+        chartOf[seedTriangle] = chart;
+        for (size_t q = 0; q < queue.size(); ++q)
+        {
+            GLuint t = queue[q];
+            for (int e = 0; e < 3; ++e)
+            {
+                GLuint v0 = corners[t * 3 + e], v1 = corners[t * 3 + (e + 1) % 3];
+                for (GLuint neighbour : edges[std::make_pair(std::min(v0, v1), std::max(v0, v1))])
+                {
+                    if (chartOf[neighbour] < 0 && glm::dot(normals[neighbour], seedNormal) >= LIGHTMAP_CHART_COS)
+                    {
+                        chartOf[neighbour] = chart;
+                        queue.push_back(neighbour);
+                    }
+                }
+            }
+        }
+
+        // Flatten onto the seed's plane; the chart stays within the cone, so it doesn't fold over
+        glm::vec3 tangent, bitangent;
+        if (glm::length(seedNormal) > 0.0f)
+            basis(seedNormal, tangent, bitangent);
+        else
+            tangent = bitangent = glm::vec3(0.0f);
+
+        LightmapChart info;
+        info.firstVertex = (GLuint)(mesh.vertices.size() / mesh.floatsPerVertex);
+        info.uvMin = glm::vec2(FLT_MAX);
+        info.uvMax = glm::vec2(-FLT_MAX);
+        info.x = info.y = info.width = info.height = 0;
+
+        GLuint chartVertices = 0;
+        for (GLuint t : queue)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                GLuint source = indices[t * 3 + c];
+                if (remap[source] == ~0u || remap[source] < info.firstVertex)
+                {
+                    remap[source] = info.firstVertex + chartVertices++;
+                    const GLfloat* v = vertices + (size_t)source * floatsPerVertex;
+                    mesh.vertices.insert(mesh.vertices.end(), v, v + floatsPerVertex);
+
+                    // The planar position waits in the UV slot until packing places the chart
+                    glm::vec3 p(v[0], v[1], v[2]);
+                    glm::vec2 planar(glm::dot(p, tangent), glm::dot(p, bitangent));
+                    mesh.vertices.push_back(planar.x);
+                    mesh.vertices.push_back(planar.y);
+                    info.uvMin = glm::min(info.uvMin, planar);
+                    info.uvMax = glm::max(info.uvMax, planar);
+                }
+                mesh.indices.push_back(remap[source]);
+            }
+        }
+        info.vertexCount = chartVertices;
+        mesh.charts.push_back(info);
+    }
+}
+
+
+bool UPackLightmap(const std::vector<LightmapInstance>& instances, int size)
+{
+    struct ChartRef
+    {
+        LightmapChart* chart;
+        float scale;            // World units per object unit
+    };
+
+    std::vector<ChartRef> charts;
+    float area = 0.0f;
+    for (const LightmapInstance& instance : instances)
+    {
+        glm::vec3 x(instance.model[0]), y(instance.model[1]), z(instance.model[2]);
+        float scale = (float)cbrt(fabs(glm::dot(x, glm::cross(y, z))));
+        for (LightmapChart& chart : instance.mesh->charts)
+        {
+            ChartRef ref = { &chart, scale };
+            charts.push_back(ref);
+            glm::vec2 extent = (chart.uvMax - chart.uvMin) * scale;
+            area += extent.x * extent.y;
+        }
+    }
+    if (charts.empty())
+        return true;
+
+    // Tallest first onto shelves; lower the density until everything fits
+    std::sort(charts.begin(), charts.end(), [](const ChartRef& a, const ChartRef& b)
+    {
+        return (a.chart->uvMax.y - a.chart->uvMin.y) * a.scale > (b.chart->uvMax.y - b.chart->uvMin.y) * b.scale;
+    });
+
+    float density = area > 0.0f ? (float)sqrt(PACK_FILL * size * size / area) : 1.0f;
+    bool fits = false;
+    for (int attempt = 0; attempt < PACK_ATTEMPTS; ++attempt, density *= PACK_SHRINK)
+    {
+        int x = 0, y = 0, shelfHeight = 0;
+        fits = true;
+        for (ChartRef& ref : charts)
+        {
+            LightmapChart& chart = *ref.chart;
+            glm::vec2 extent = (chart.uvMax - chart.uvMin) * ref.scale * density;
+            chart.width = std::max((int)ceil(extent.x), 1) + 2 * LIGHTMAP_PADDING;
+            chart.height = std::max((int)ceil(extent.y), 1) + 2 * LIGHTMAP_PADDING;
+            if (x + chart.width > size)
+            {
+                x = 0;
+                y += shelfHeight;
+                shelfHeight = 0;
+            }
+            if (x + chart.width > size || y + chart.height > size)
+            {
+                fits = false;
+                break;
+            }
+            chart.x = x;
+            chart.y = y;
+            x += chart.width;
+            shelfHeight = std::max(shelfHeight, chart.height);
+        }
+        if (fits)
+            break;
+    }
+    if (!fits)
+    {
+        // Overlapping charts would bleed into each other's texels
+        ULOG_ERROR("Lightmap charts don't fit a {}x{} atlas", size, size);
+        return false;
+    }
+
+    for (const LightmapInstance& instance : instances)
+    {
+        LightmapMesh& mesh = *instance.mesh;
+        GLuint uvOffset = mesh.floatsPerVertex - LIGHTMAP_UV_FLOATS;
+        glm::vec3 x(instance.model[0]), y(instance.model[1]), z(instance.model[2]);
+        float scale = (float)cbrt(fabs(glm::dot(x, glm::cross(y, z))));
+        for (const LightmapChart& chart : mesh.charts)
+        {
+            for (GLuint v = chart.firstVertex; v < chart.firstVertex + chart.vertexCount; ++v)
+            {
+                GLfloat* uv = &mesh.vertices[(size_t)v * mesh.floatsPerVertex + uvOffset];
+                uv[0] = (chart.x + LIGHTMAP_PADDING + (uv[0] - chart.uvMin.x) * scale * density) / size;
+                uv[1] = (chart.y + LIGHTMAP_PADDING + (uv[1] - chart.uvMin.y) * scale * density) / size;
+            }
+        }
+    }
+    return true;
+}
+
+
+void UBakeLightmap(const std::vector<LightmapInstance>& instances, const LightmapSettings& settings, int size, std::vector<float>& texels)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // Everything in one world-space BVH, so shadows and bounces see the whole scene
+    std::vector<GLfloat> positions;
+    std::vector<GLuint> indices;
+    for (const LightmapInstance& instance : instances)
+    {
+        const LightmapMesh& mesh = *instance.mesh;
+        GLuint base = (GLuint)(positions.size() / 3);
+        for (size_t v = 0; v < mesh.vertices.size() / mesh.floatsPerVertex; ++v)
+        {
+            glm::vec3 p = glm::vec3(instance.model * glm::vec4(position(&mesh.vertices[0], mesh.floatsPerVertex, (GLuint)v), 1.0f));
+            positions.push_back(p.x);
+            positions.push_back(p.y);
+            positions.push_back(p.z);
+        }
+        for (GLuint index : mesh.indices)
+            indices.push_back(base + index);
+    }
+
+    texels.assign((size_t)size * size * 3, 0.0f);
+    if (indices.empty())
+        return;
+
+    Bvh4 bvh;
+    buildBvh4(positions, indices, bvh);
+
+    std::vector<BakeTexel> work;
+    rasterizeTexels(instances, size, work);
+
+    std::atomic<uint64_t> rays(0);
+    UParallelFor(work.size(), [&](size_t i)
+    {
+        const BakeTexel& texel = work[i];
+        uint32_t state = seed(texel.index);
+        uint64_t texelRays = 1;
+        glm::vec3 origin = texel.position + texel.faceNormal * RAY_OFFSET;
+
+        glm::vec3 light = directLight(bvh, settings, origin, texel.normal);
+        glm::vec3 indirect(0.0f);
+        for (int s = 0; s < settings.samples; ++s)
+            indirect += indirectLight(bvh, settings, origin, texel.normal, state, texelRays);
+        if (settings.samples > 0)
+            light += indirect / (float)settings.samples;
+
+        float* out = &texels[texel.index * 3];
+        out[0] = light.x;
+        out[1] = light.y;
+        out[2] = light.z;
+        rays += texelRays;
+    });
+
+    std::vector<bool> covered((size_t)size * size, false);
+    for (const BakeTexel& texel : work)
+        covered[texel.index] = true;
+    dilate(texels, covered, size);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    ULOG_INFO("Baked a {}x{} lightmap: {} texels, {} triangles, {} rays in {} s", size, size, work.size(), bvh.triangles.size(),
+        (unsigned long long)rays.load(), seconds);
+}
+
+
+uint64_t ULightmapSceneHash(const std::vector<LightmapInstance>& instances, const LightmapSettings& settings, int size)
+{
+    // FNV-1a
+    uint64_t hash = 0xCBF29CE484222325ull;
+    uint32_t header[3] = { LIGHTMAP_FILE_VERSION, (uint32_t)size, (uint32_t)instances.size() };
+    hashBytes(hash, header, sizeof(header));
+    hashBytes(hash, glm::value_ptr(settings.lightPosition), sizeof(float) * 3);
+    hashBytes(hash, glm::value_ptr(settings.lightColor), sizeof(float) * 3);
+    hashBytes(hash, glm::value_ptr(settings.skyColor), sizeof(float) * 3);
+    hashBytes(hash, &settings.albedo, sizeof(settings.albedo));
+    hashBytes(hash, &settings.samples, sizeof(settings.samples));
+    hashBytes(hash, &settings.bounces, sizeof(settings.bounces));
+
+    for (const LightmapInstance& instance : instances)
+    {
+        hashBytes(hash, glm::value_ptr(instance.model), sizeof(float) * 16);
+        const LightmapMesh& mesh = *instance.mesh;
+        hashBytes(hash, &mesh.floatsPerVertex, sizeof(mesh.floatsPerVertex));
+        if (!mesh.vertices.empty())
+            hashBytes(hash, &mesh.vertices[0], mesh.vertices.size() * sizeof(GLfloat));
+        if (!mesh.indices.empty())
+            hashBytes(hash, &mesh.indices[0], mesh.indices.size() * sizeof(GLuint));
+    }
+    return hash;
+}
+
+
+bool USaveLightmap(const char* filename, uint64_t sceneHash, int size, const std::vector<float>& texels)
+{
+    if (texels.size() != (size_t)size * size * 3)
+        return false;
+
+    FILE* file = fopen(filename, "wb");
+    if (!file)
+    {
+        ULOG_ERROR("Can't write {}", filename);
+        return false;
+    }
+
+    LightmapFileHeader header;
+    memcpy(header.magic, LIGHTMAP_FILE_MAGIC, sizeof(header.magic));
+    header.version = LIGHTMAP_FILE_VERSION;
+    header.size = (uint32_t)size;
+    header.reserved = 0;
+    header.sceneHash = sceneHash;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(&texels[0], sizeof(float), texels.size(), file) == texels.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok)
+        ULOG_ERROR("Failed writing {}", filename);
+    return ok;
+}
+
+
+bool ULoadLightmap(const char* filename, uint64_t sceneHash, int size, std::vector<float>& texels)
+{
+    FILE* file = fopen(filename, "rb");
+    if (!file)
+        return false;
+
+    LightmapFileHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1
+        && memcmp(header.magic, LIGHTMAP_FILE_MAGIC, sizeof(header.magic)) == 0
+        && header.version == LIGHTMAP_FILE_VERSION
+        && header.size == (uint32_t)size;
+    if (ok && header.sceneHash != sceneHash)
+    {
+        ULOG_INFO("{} was baked from another scene, ignoring it", filename);
+        ok = false;
+    }
+    if (ok)
+    {
+        texels.resize((size_t)size * size * 3);
+        ok = fread(&texels[0], sizeof(float), texels.size(), file) == texels.size();
+    }
+    fclose(file);
+    if (!ok)
+        texels.clear();
+    return ok;
+}
@@ -0,0 +1,96 @@
+#ifndef LIGHTMAP_H
+#define LIGHTMAP_H
+
+#include <cstdint>
+#include <vector>
+#include <GLEW/glew.h>      // GLEW library
+
+// GLM Math Header inclusions
+#include <glm/glm.hpp>
+
+// Lightmap atlas size in texels, shared by every lightmapped mesh
+const int LIGHTMAP_SIZE = 512;
+
+// Empty texels kept around every chart, so bilinear filtering never reaches a neighbour
+const int LIGHTMAP_PADDING = 2;
+
+// Triangles join a chart while their normal is within about 37 degrees of the chart's first one
+const float LIGHTMAP_CHART_COS = 0.8f;
+
+// Floats added to every vertex for the second UV set
+const GLuint LIGHTMAP_UV_FLOATS = 2;
+
+const char LIGHTMAP_FILE_MAGIC[4] = { 'U', 'L', 'M', '1' };
+const uint32_t LIGHTMAP_FILE_VERSION = 1;
+
+// Triangles that were flattened together, their vertices are consecutive
+struct LightmapChart
+{
+    GLuint firstVertex;
+    GLuint vertexCount;
+    glm::vec2 uvMin;        // Planar projection in world units, before packing
+    glm::vec2 uvMax;
+    int x;                  // Placement in the atlas, in texels
+    int y;
+    int width;
+    int height;
+};
+
+/* A mesh cut along its charts: the source vertices, duplicated where charts meet, each with
+ * LIGHTMAP_UV_FLOATS appended for its place in the atlas.
+ */
+struct LightmapMesh
+{
+    std::vector<GLfloat> vertices;
+    std::vector<GLuint> indices;
+    GLuint floatsPerVertex;     // The source's plus LIGHTMAP_UV_FLOATS
+    std::vector<LightmapChart> charts;
+
+    LightmapMesh() : floatsPerVertex(0) {}
+};
+
+// One placed mesh of the baked scene
+struct LightmapInstance
+{
+    LightmapMesh* mesh;     // Packing writes its UVs
+    glm::mat4 model;
+};
+
+struct LightmapSettings
+{
+    glm::vec3 lightPosition;
+    glm::vec3 lightColor;
+    glm::vec3 skyColor;         // Radiance of rays that leave the scene
+    float albedo;               // Diffuse reflectance of every surface for the bounces
+    int samples;                // Indirect paths per texel
+    int bounces;                // Diffuse bounces per path after the first hit
+};
+
+/* Splits a mesh into charts of triangles facing about the same way, growing them over edges
+ * shared by position, and projects each onto the plane of its first triangle. Positions are
+ * the first 3 floats of every vertex; the UVs are filled in by UPackLightmap.
+ */
+void UUnwrapLightmap(const GLfloat* vertices, GLuint floatsPerVertex, const GLuint* indices, size_t indexCount, LightmapMesh& mesh);
+
+/* Packs the charts of all meshes into one size x size atlas at a shared texel density, as high
+ * as fits, and writes every vertex's lightmap UV. Charts are sized by the models' scale, so
+ * texels cover the same world-space area everywhere. Returns false, with the UVs left alone,
+ * when the charts don't fit even at the lowest density it tries.
+ */
+bool UPackLightmap(const std::vector<LightmapInstance>& instances, int size);
+
+/* Path traces the lighting of every covered texel: direct light from the point light with a
+ * shadow ray, plus diffuse interreflection from cosine-weighted paths, on all job workers.
+ * Fills size * size RGB floats, dilated into the padding.
+ */
+void UBakeLightmap(const std::vector<LightmapInstance>& instances, const LightmapSettings& settings, int size, std::vector<float>& texels);
+
+// Hash over everything a bake depends on, stored with it to tell whether it is still current
+uint64_t ULightmapSceneHash(const std::vector<LightmapInstance>& instances, const LightmapSettings& settings, int size);
+
+bool USaveLightmap(const char* filename, uint64_t sceneHash, int size, const std::vector<float>& texels);
+
+// False when the file is missing, damaged, or baked from another scene
+bool ULoadLightmap(const char* filename, uint64_t sceneHash, int size, std::vector<float>& texels);
+
+#endif
@@ -1,5 +1,16 @@
-#include <iostream>         // cout, cerr
+#include <cassert>          // The frame allocation guard
 #include <cstdlib>          // EXIT_FAILURE
+#include <cstdio>           // snprintf
+#include <cstring>          // strcmp, strlen
+#include <algorithm>        // std::sort
+#include <atomic>
+#include <condition_variable>
+#include <chrono>           // Pick and import timing
+#include <memory>           // std::shared_ptr
+#include <mutex>
+#include <string>
+#include <thread>           // The render thread
+#include <vector>
 #include <GLEW/glew.h>        // GLEW library
 #include <GLFW/glfw3.h>     // GLFW library
 #define STB_IMAGE_IMPLEMENTATION
@@ -12,6 +23,24 @@
 
 #include <learnOpengl/camera.h> // Camera class
 
+#include "mesh_lod.h"       // LOD chains and selection
+#include "mesh_file.h"      // .umesh loading and OBJ conversion
+#include "job_pool.h"       // Work-stealing jobs for loading and frame setup
+#include "gltf_import.h"    // glTF 2.0 scenes
+#include "mesh_optimize.h"  // Vertex cache, overdraw and fetch ordering
+#include "occlusion.h"      // Software occlusion culling
+#include "soft_raster.h"    // CPU renderer backend
+#include "scene_snapshot.h" // Simulation to render thread hand-over
+#include "async_log.h"      // ULOG_INFO and friends, printed on a background thread
+#include "gpu_resources.h"  // Owning GL handles and GPU memory accounting
+#include "texture_stream.h" // Mip streaming by screen-space size
+#include "dynamic_resolution.h" // Offscreen rendering scaled to the frame time
+#include "ray_pick.h"       // BVH ray casts for selecting objects
+#include "lightmap.h"       // Baked lighting for the static desk set
+#include "frame_memory.h"   // Frame arena, block pools and the allocation guard
+#include "multi_view.h"     // Stereo and monitor views drawn in one pass
+#include "gl_capture.h"     // GL call capture and replay, after everything that might call GL
+
 using namespace std; // Standard namespace
 
 /*Shader program Macro*/
@@ -19,6 +48,11 @@ using namespace std; // Standard namespace
 #define GLSL(Version, Source) "#version " #Version " core \n" #Source
 #endif
 
+/*Multi-view shader Macro: lets the vertex shader write gl_ViewportIndex*/
+#ifndef GLSL_MULTI_VIEW
+#define GLSL_MULTI_VIEW(Version, Source) "#version " #Version " core \n#extension GL_ARB_shader_viewport_layer_array : require\n" #Source
+#endif
+
 // Unnamed namespace
 namespace
 {
@@ -31,37 +65,113 @@ namespace
     // Stores the GL data relative to a given mesh
     struct GLMesh
     {
-        GLuint vao_cylinder;         // Handle for the vertex array object
-        GLuint vbo_cylinder;         // Handle for the vertex buffer object
-        GLuint ebo_cylinder;
-        GLuint vao_plane;
-        GLuint vbo_plane;
-        GLuint ebo_plane;
-        GLuint vao_round;
-        GLuint vbo_round;
-        GLuint ebo_round;
-        GLuint vbo_keyboard;
-        GLuint vao_keyboard;
-        GLuint ebo_keyboard;
+        GpuVertexArray vao_cylinder;         // Handle for the vertex array object
+        GpuBuffer vbo_cylinder;              // Handle for the vertex buffer object
+        GpuBuffer ebo_cylinder;
+        GpuVertexArray vao_plane;
+        GpuBuffer vbo_plane;
+        GpuBuffer ebo_plane;
+        GpuVertexArray vao_round;
+        GpuBuffer vbo_round;
+        GpuBuffer ebo_round;
+        GpuBuffer vbo_keyboard;
+        GpuVertexArray vao_keyboard;
+        GpuBuffer ebo_keyboard;
         GLuint nVertices_keyboard;
         GLuint nVertices_plane;    // Number of indices of the mesh
         GLuint nVertices_cylinder;
         GLuint nVertices_round;
+        MeshLodChain lod_plane;      // Levels of detail, drawn from the ebo of the same mesh
+        MeshLodChain lod_cylinder;
+        MeshLodChain lod_keyboard;
+        MeshBvh bvh_plane;           // Picking, built from the finest level
+        MeshBvh bvh_cylinder;
+        MeshBvh bvh_keyboard;
+        LightmapMesh lightmap_plane;    // The finest level cut along its lightmap charts
+        LightmapMesh lightmap_cylinder;
+        LightmapMesh lightmap_keyboard;
+        GpuVertexArray vao_lit_plane;   // Drawn instead of the LOD chain while the lightmap is current
+        GpuBuffer vbo_lit_plane;
+        GpuBuffer ebo_lit_plane;
+        GpuVertexArray vao_lit_cylinder;
+        GpuBuffer vbo_lit_cylinder;
+        GpuBuffer ebo_lit_cylinder;
+        GpuVertexArray vao_lit_keyboard;
+        GpuBuffer vbo_lit_keyboard;
+        GpuBuffer ebo_lit_keyboard;
+    };
 
+    // A mesh loaded from disk instead of the hand-authored arrays
+    struct GLLoadedMesh
+    {
+        GLuint vao;         // Owned by gLoadedBuffers, instances of one glTF primitive share it
+        MeshLodChain lod;
+        GLuint textureId;   // 0 uses the desk texture
+        glm::mat4 model;
+        bool occluded;      // Result of this frame's occlusion test
+        std::shared_ptr<MeshBvh> bvh;   // Shared by the instances of one glTF primitive
+    };
+
+    // GL objects behind one or more GLLoadedMesh
+    struct LoadedBuffers
+    {
+        GpuVertexArray vao;
+        GpuBuffer vbo;
+        GpuBuffer ebo;
     };
 
     // Main GLFW window
     GLFWwindow* gWindow = nullptr;
     // Triangle mesh data
     GLMesh gMesh;
+    std::vector<GLLoadedMesh> gLoadedMeshes;
+    std::vector<LoadedBuffers> gLoadedBuffers;
+    std::vector<GpuTexture> gLoadedTextures;
     // Texture id
-    GLuint gTextureId_desk;
-    GLuint gTextureId_mug;
-    GLuint gTextureId_coffee;
-    GLuint gTextureId_keyboard;
+    GpuTexture gTextureId_desk;
+    GpuTexture gTextureId_mug;
+    GpuTexture gTextureId_keyboard;
     // Shader program
-    GLuint gProgramId;
-    GLuint gLampProgramId;
+    GpuProgram gProgramId;
+    GpuProgram gLampProgramId;
+    GpuProgram gLightmapProgramId;
+
+    // Estimated GPU memory the registry lets us allocate, --gpu-budget <MiB> overrides it
+    const size_t GPU_BUDGET_MB = 1024;
+
+    // Share of it the streamed texture mips may take, --texture-budget <MiB> overrides it
+    const size_t TEXTURE_BUDGET_MB = 256;
+
+    // Mip level bytes handed to GL per frame; more than that waits for the next frame
+    const size_t TEXTURE_STREAM_UPLOAD_BYTES = 4 * 1024 * 1024;
+
+    // The render scale follows the GPU time to hold this rate, --target-fps <n> overrides it (0 renders at full size)
+    const int TARGET_FPS = 60;
+    DynamicResolution gResolution;
+
+    // Baked lighting of the desk set: --bake-lightmaps path traces it at startup and saves it,
+    // later runs load the file while the scene it was baked from is unchanged
+    const char* const LIGHTMAP_FILE = "lightmap.ulmap";
+    const int LIGHTMAP_SAMPLES = 256;       // Indirect paths per texel
+    const int LIGHTMAP_BOUNCES = 2;
+    const float LIGHTMAP_ALBEDO = 0.6f;
+    GpuTexture gLightmap;                   // 0 until a bake is loaded
+    glm::vec3 gLightmapLightPosition;       // The light the bake saw, the desk set goes back to Phong when it changes
+    glm::vec3 gLightmapLightColor;
+
+    // --capture <file> arms GL call capture, F12 then writes this many frames (--capture-frames <n>)
+    const int GL_CAPTURE_FRAMES = 3;
+    int gCaptureFrames = GL_CAPTURE_FRAMES;
+    const int GL_REPLAY_WIDTH = 64;         // The hidden window of --replay, it draws offscreen
+    const int GL_REPLAY_HEIGHT = 64;
+
+    // --views stereo | monitors draws several views in one pass: an item is drawn once, instanced
+    // across the views that see it, and the vertex shader picks each instance's viewport
+    // (GL_ARB_shader_viewport_layer_array). Without the extension it stays a single view.
+    MultiViewLayout gViewLayout = MULTI_VIEW_SINGLE;
+    GpuProgram gMultiViewProgramId;
+    GpuProgram gMultiViewLightmapProgramId;
+    GpuProgram gMultiViewLampProgramId;
 
     // camera
     Camera gCamera(glm::vec3(0.0f, 0.0f, 3.0f));
@@ -71,7 +181,53 @@ namespace
 
     // timing
     float gDeltaTime = 0.0f; // time between current frame and last frame
-    float gLastFrame = 0.0f;
+    float gLastFrame = 0.0f; // Render thread's frame start
+
+    // Input and the camera update at a fixed rate on the main thread; every step publishes
+    // a snapshot the render thread picks up at its own pace and interpolates between
+    const double UPDATE_TICK = 1.0 / 120.0;
+    SnapshotBuffer gSnapshots;
+    unsigned long long gTick = 0;
+    std::thread gRenderThread;
+    std::atomic<bool> gRenderStopping(false);
+    int gViewportWidth = WINDOW_WIDTH;      // Latest framebuffer size, sent along with the snapshots
+    int gViewportHeight = WINDOW_HEIGHT;
+
+    // Window titles can only be set on the main thread, the render thread leaves them here
+    std::mutex gTitleMutex;
+    const size_t TITLE_BYTES = 512;
+    std::string gPendingTitle;
+
+    // Idle rendering: a step only publishes a snapshot when something in it changed, and the
+    // update loop blocks in glfwWaitEventsTimeout while nothing does. The render thread sleeps
+    // until a snapshot or a refinement request shows up.
+    const double IDLE_WAIT = 0.5;           // Longest block while idle, in seconds
+    SceneSnapshot gLastPublished;
+    unsigned gWindowVersion = 0;            // Bumped by the refresh callback
+    std::mutex gRenderWakeMutex;
+    std::condition_variable gRenderWake;
+
+    // Progressive effects that converge over several frames ask for more of them here. Those
+    // frames reuse the last draw list instead of running the frame jobs again.
+    std::atomic<int> gRefinementFrames(0);
+    unsigned long gFramesRendered = 0;
+    unsigned long gFramesRefined = 0;
+
+    // Frames before the allocation guard holds URender to zero heap allocations, while the
+    // containers it reuses grow to their working sizes
+    const unsigned long FRAME_GUARD_WARMUP_FRAMES = 16;
+    std::vector<JobWorkerStats> gJobStats;     // Sized before the render thread starts, refilled for the title
+
+    // Picking, on the main thread: instances are numbered like the frame's objects (desk,
+    // mug, keyboard, then gLoadedMeshes). The scene BVH is rebuilt when they move.
+    SceneBvh gPickScene;
+    glm::mat4 gPickModel(0.0f);
+    int gSelectedObject = -1;
+
+    // Highlight strength of the hovered and the selected object
+    const float HOVER_HIGHLIGHT = 0.25f;
+    const float SELECT_HIGHLIGHT = 0.6f;
+    const glm::vec3 HIGHLIGHT_COLOR(1.0f, 0.8f, 0.2f);
 
 
     // Cube and light color
@@ -81,6 +237,108 @@ namespace
     // Light position and scale
     glm::vec3 gLightPosition(1.5f, 0.5f, 3.0f);
     glm::vec3 gLightScale(0.3f);
+
+    // LOD selection: how many pixels of error we accept before switching to a finer level
+    const int LOD_MAX_LEVELS = 4;
+    const float LOD_REDUCTION = 0.5f;
+    const float LOD_MAX_PIXEL_ERROR = 1.0f;
+    const float LOD_HYSTERESIS = 0.25f;
+    LodStats gLodStats;              // Reset at the start of every frame
+    unsigned long long gLodTrianglesSaved = 0;
+    float gLodLastReport = 0.0f;
+
+    // Occlusion culling: the desk (and glTF nodes marked as occluders) are rasterized on the CPU
+    // every frame, the other objects' boxes are tested against it before they're submitted
+    const float OCCLUSION_BUDGET_MS = 1.0f;
+    int gDeskOccluder = -1;
+    OcclusionStats gOcclusionStats;  // Summed over the passes, an object tested from two views counts twice
+
+    // CPU copy of an uploaded mesh for the software renderer
+    struct SoftMesh
+    {
+        std::vector<GLfloat> vertices;
+        std::vector<GLuint> indices;
+    };
+
+    // Software renderer backend: no GL context, meshes and textures live in these vectors
+    // and the vao/texture names handed out are 1-based indices into them
+    bool gSoftware = false;
+    std::vector<SoftMesh> gSoftMeshes;
+    std::vector<SoftTexture> gSoftTextures;
+    SoftFramebuffer gSoftFramebuffer;
+    const int SOFT_BENCH_FRAMES = 100;
+
+    // A mesh built on a loading job, waiting for the main thread to create its GL objects
+    struct PendingUpload
+    {
+        std::vector<GLfloat> vertices;
+        std::vector<GLuint> indices;
+        GLuint floatsPerVertex;
+        const char* name;
+        GpuVertexArray* vao;
+        GpuBuffer* vbo;
+        GpuBuffer* ebo;
+        const MeshLodChain* lod;
+        int* occluder;      // Also register the finest level as an occluder when set
+    };
+    std::vector<PendingUpload> gPendingUploads;
+    std::mutex gPendingUploadsMutex;
+
+    // Pixels decoded on a loading job, flipped for GL and waiting to be uploaded
+    struct DecodedImage
+    {
+        unsigned char* pixels;
+        int width;
+        int height;
+        int channels;
+    };
+
+    // An object the frame jobs look at: LOD, culling and draw list
+    struct SceneObject
+    {
+        GLuint vao;
+        MeshLodChain* lod;
+        GLuint textureId;
+        glm::mat4 model;
+        const MeshLodLevel* level;  // Picked by the LOD job
+        LodStats lodStats;
+        unsigned occludedViews;     // Views whose occlusion pass hid it, set by the culling job
+        GLuint litVao;              // Lightmapped copy of the finest level, 0 for meshes without one
+        GLuint litIndexCount;
+        unsigned viewMask;          // Views whose frustum it touches, set by the LOD job
+        int detailView;             // The view LOD and texture detail were picked for
+    };
+
+    // One draw call, sorted by program, texture and VAO so the GL loop changes as little state as it can
+    struct DrawItem
+    {
+        unsigned long long sortKey;
+        GLuint vao;
+        GLuint textureId;
+        glm::mat4 model;
+        GLuint indexOffset;
+        GLuint indexCount;
+        bool lamp;
+        bool lightmapped;           // Lit from gLightmap instead of per pixel
+        float highlight;            // Hovered or selected, 0 draws the object as it is
+        int viewList;               // Views to draw it in, see UPackViewList
+        GLsizei viewCount;
+    };
+
+    // What the frame job graph produces for URender and USoftRenderFrame
+    struct FrameData
+    {
+        SceneSnapshot scene;        // The (interpolated) simulation state this frame shows
+        glm::mat4 model;            // The desk set
+        ViewSet views;
+        glm::mat4 view;             // The first view, for everything that needs a single camera
+        glm::mat4 projection;
+        glm::mat4 viewProjection;   // The first view's, the first occlusion pass is drawn from it
+        int renderHeight;           // Rendered pixels, below the window's with dynamic resolution
+        std::vector<SceneObject> objects;
+        FrameVector<DrawItem> drawList; // Frame scratch, see URender for frames that keep it
+    };
+    FrameData gFrame;
 }
 
 /* User-defined Function prototypes to:
@@ -94,15 +352,35 @@ void UProcessInput(GLFWwindow* window);
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos);
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
+void UWindowRefreshCallback(GLFWwindow* window);
 void UCreateMesh_Desk(GLMesh& mesh);
 void UCreateMesh_Mug(GLMesh& mesh);
 void UCreateMesh_Keyboard(GLMesh& mesh);
+void UCreateIndexedMesh(const char* name, const GLfloat* verts, size_t floatCount, GLuint floatsPerVertex, GpuVertexArray& vao, GpuBuffer& vbo, GpuBuffer& ebo, MeshLodChain& lod, MeshBvh& bvh, LightmapMesh& lightmap, int* occluder = nullptr);
+bool UUploadMesh(const char* name, const std::vector<GLfloat>& vertices, GLuint floatsPerVertex, const std::vector<GLuint>& indices, GpuVertexArray& vao, GpuBuffer& vbo, GpuBuffer& ebo);
+bool UFlushMeshUploads();
+bool UCreateMeshFromFile(const char* filename, GLLoadedMesh& mesh);
+bool UCreateSceneFromGltf(const char* filename);
 void UDestroyMesh(GLMesh& mesh);
-bool UCreateTexture(const char* filename, GLuint& textureId);
-void UDestroyTexture(GLuint textureId);
-void URender();
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
-void UDestroyShaderProgram(GLuint programId);
+bool UDecodeImage(const char* filename, DecodedImage& image);
+bool UCreateTexture(const char* name, DecodedImage& image, GpuTexture& texture);
+bool UCreateTextureFromPixels(const char* name, const unsigned char* image, int width, int height, int channels, GpuTexture& texture);
+void UDestroyTexture(GpuTexture& texture);
+glm::mat4 UDeskModel();
+void UCaptureSnapshot(SceneSnapshot& snapshot);
+bool UPickAtCursor(const SceneSnapshot& snapshot, PickHit& hit);
+void UBuildFrame(const SceneSnapshot& scene);
+void URender(const SceneSnapshot& scene, bool rebuild, bool fullResolution);
+void USetViewUniforms(GLuint program);
+void URenderThread();
+void UWakeRenderThread();
+void URequestRefinement(int frames);
+void USoftRenderFrame(SoftFrameStats& stats);
+int URunSoftware(int argc, char* argv[]);
+int URunReplay(int argc, char* argv[]);
+bool USetupLightmaps(bool bake);
+bool UCreateShaderProgram(const char* name, const char* vtxShaderSource, const char* fragShaderSource, GpuProgram& program);
+void UDestroyShaderProgram(GpuProgram& program);
 
 
 /* Vertex Shader Source Code*/
@@ -115,12 +393,14 @@ const GLchar* vertexShaderSource = GLSL(440,
     out vec3 vertexFragmentPos;     // For outgoing color / pixels to fragment shader
     out vec2 vertexTextureCoordinate;
     out vec3 vertexNormal;
+    out vec3 vertexViewPosition;    // Camera position, passed on so the multi-view shader can set it per view
 
 
     //Global variables for the transform matrices
     uniform mat4 model;
     uniform mat4 view;
     uniform mat4 projection;
+    uniform vec3 viewPosition;
 
     void main()
     {
@@ -131,6 +411,40 @@ const GLchar* vertexShaderSource = GLSL(440,
 
         vertexNormal = mat3(transpose(inverse(model))) * normal; // get normal vectors in world space only and exclude normal translation properties
 
+        vertexViewPosition = viewPosition;
+    }
+);
+
+
+/* Multi-view Vertex Shader Source Code: instance i draws the object into view (viewList >> 4i) & 15*/
+const GLchar* multiViewVertexShaderSource = GLSL_MULTI_VIEW(440,
+    layout(location = 0) in vec3 position;
+    layout(location = 2) in vec2 textureCoordinate;
+    layout(location = 3) in vec3 normal;
+
+    out vec3 vertexFragmentPos;
+    out vec2 vertexTextureCoordinate;
+    out vec3 vertexNormal;
+    out vec3 vertexViewPosition;
+
+    uniform mat4 model;
+    uniform mat4 views[4];          // MULTI_VIEW_MAX_VIEWS
+    uniform mat4 projections[4];
+    uniform int viewList;
+
+    void main()
+    {
+        int view = (viewList >> (4 * gl_InstanceID)) & 15;
+        gl_ViewportIndex = view;
+
+        vec4 worldPosition = model * vec4(position, 1.0f);
+        gl_Position = projections[view] * views[view] * worldPosition;
+        vertexTextureCoordinate = textureCoordinate;
+        vertexFragmentPos = vec3(worldPosition);
+        vertexNormal = mat3(transpose(inverse(model))) * normal;
+
+        // The camera of a rigid view matrix, without inverting it
+        vertexViewPosition = -(transpose(mat3(views[view])) * views[view][3].xyz);
     }
 );
 
@@ -141,6 +455,7 @@ const GLchar* fragmentShaderSource = GLSL(440,
 
     in vec3 vertexNormal; // For incoming normals
     in vec3 vertexFragmentPos; // For incoming fragment position
+    in vec3 vertexViewPosition; // For incoming camera position
 
     out vec4 fragmentColor;     // For outgoing cube color to the GPU
 
@@ -148,7 +463,6 @@ const GLchar* fragmentShaderSource = GLSL(440,
     uniform vec3 objectColor;
     uniform vec3 lightColor;
     uniform vec3 lightPos;
-    uniform vec3 viewPosition;
 
     uniform sampler2D uTexture;
 
@@ -170,7 +484,7 @@ const GLchar* fragmentShaderSource = GLSL(440,
         //Calculate Specular lighting*/
         float specularIntensity = 0.8f; // Set specular light strength
         float highlightSize = 16.0f; // Set specular highlight size
-        vec3 viewDir = normalize(viewPosition - vertexFragmentPos); // Calculate view direction
+        vec3 viewDir = normalize(vertexViewPosition - vertexFragmentPos); // Calculate view direction
         vec3 reflectDir = reflect(-lightDirection, norm);// Calculate reflection vector
         //Calculate specular component
         float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
@@ -186,6 +500,122 @@ const GLchar* fragmentShaderSource = GLSL(440,
 );
 
 
+/* Lightmap Shader Source Code: the desk set with its lighting baked*/
+const GLchar* lightmapVertexShaderSource = GLSL(440,
+    layout(location = 0) in vec3 position;
+    layout(location = 2) in vec2 textureCoordinate;
+    layout(location = 4) in vec2 lightmapCoordinate;
+
+    out vec2 vertexTextureCoordinate;
+    out vec2 vertexLightmapCoordinate;
+
+    uniform mat4 model;
+    uniform mat4 view;
+    uniform mat4 projection;
+
+void main()
+{
+    gl_Position = projection * view * model * vec4(position, 1.0f);
+    vertexTextureCoordinate = textureCoordinate;
+    vertexLightmapCoordinate = lightmapCoordinate;
+}
+);
+
+
+/* Multi-view Lightmap Vertex Shader Source Code*/
+const GLchar* multiViewLightmapVertexShaderSource = GLSL_MULTI_VIEW(440,
+    layout(location = 0) in vec3 position;
+    layout(location = 2) in vec2 textureCoordinate;
+    layout(location = 4) in vec2 lightmapCoordinate;
+
+    out vec2 vertexTextureCoordinate;
+    out vec2 vertexLightmapCoordinate;
+
+    uniform mat4 model;
+    uniform mat4 views[4];          // MULTI_VIEW_MAX_VIEWS
+    uniform mat4 projections[4];
+    uniform int viewList;
+
+void main()
+{
+    int view = (viewList >> (4 * gl_InstanceID)) & 15;
+    gl_ViewportIndex = view;
+    gl_Position = projections[view] * views[view] * model * vec4(position, 1.0f);
+    vertexTextureCoordinate = textureCoordinate;
+    vertexLightmapCoordinate = lightmapCoordinate;
+}
+);
+
+
+/* Lightmap Fragment Shader Source Code*/
+const GLchar* lightmapFragmentShaderSource = GLSL(440,
+    in vec2 vertexTextureCoordinate;
+    in vec2 vertexLightmapCoordinate;
+
+    out vec4 fragmentColor;
+
+    uniform vec3 objectColor;
+    uniform sampler2D uTexture;
+    uniform sampler2D uLightmap;    // Direct plus bounced light, in the Phong shader's ambient + diffuse units
+
+void main()
+{
+    vec3 light = texture(uLightmap, vertexLightmapCoordinate).rgb;
+    fragmentColor = texture(uTexture, vertexTextureCoordinate) * vec4(light * objectColor, 1.0f);
+}
+);
+
+
+/* Upscale Shader Source Code: one triangle covering the screen, no vertex data*/
+const GLchar* upscaleVertexShaderSource = GLSL(440,
+
+    out vec2 screenCoordinate; // 0 to 1 across the window
+
+void main()
+{
+    vec2 corner = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2)); // (0, 0), (2, 0), (0, 2)
+    screenCoordinate = corner;
+    gl_Position = vec4(corner * 2.0f - 1.0f, 0.0f, 1.0f);
+}
+);
+
+
+/* Upscale Fragment Shader Source Code*/
+const GLchar* upscaleFragmentShaderSource = GLSL(440,
+
+    in vec2 screenCoordinate;
+
+    out vec4 fragmentColor;
+
+    uniform sampler2D source;
+    uniform vec2 sourceScale;   // Part of the target the scene was drawn to, in texture coordinates
+    uniform vec2 texelSize;
+    uniform float sharpness;    // 0 keeps the bilinear result
+
+void main()
+{
+    // Stay half a texel inside the drawn part, so filtering doesn't pull in what's beyond it
+    vec2 limit = sourceScale - 0.5f * texelSize;
+    vec2 uv = min(screenCoordinate * sourceScale, limit);
+
+    vec3 center = texture(source, uv).rgb;
+    vec3 north = texture(source, min(uv + vec2(0.0f, texelSize.y), limit)).rgb;
+    vec3 south = texture(source, uv - vec2(0.0f, texelSize.y)).rgb;
+    vec3 east = texture(source, min(uv + vec2(texelSize.x, 0.0f), limit)).rgb;
+    vec3 west = texture(source, uv - vec2(texelSize.x, 0.0f)).rgb;
+
+    // Contrast-adaptive sharpening: the cross is subtracted less where the contrast is already high
+    vec3 low = min(center, min(min(north, south), min(east, west)));
+    vec3 high = max(center, max(max(north, south), max(east, west)));
+    vec3 amount = sqrt(clamp(min(low, 1.0f - high) / max(high, vec3(0.0001f)), 0.0f, 1.0f));
+    vec3 weight = amount * (-1.0f / mix(8.0f, 5.0f, sharpness));
+    vec3 sharpened = (center + (north + south + east + west) * weight) / (1.0f + 4.0f * weight);
+
+    fragmentColor = vec4(mix(center, clamp(sharpened, 0.0f, 1.0f), sharpness), 1.0f);
+}
+);
+
+
 /* Lamp Shader Source Code*/
 const GLchar* lampVertexShaderSource = GLSL(440,
 
@@ -203,6 +633,25 @@ void main()
 );
 
 
+/* Multi-view Lamp Vertex Shader Source Code*/
+const GLchar* multiViewLampVertexShaderSource = GLSL_MULTI_VIEW(440,
+
+    layout(location = 0) in vec3 position;
+
+uniform mat4 model;
+uniform mat4 views[4];          // MULTI_VIEW_MAX_VIEWS
+uniform mat4 projections[4];
+uniform int viewList;
+
+void main()
+{
+    int view = (viewList >> (4 * gl_InstanceID)) & 15;
+    gl_ViewportIndex = view;
+    gl_Position = projections[view] * views[view] * model * vec4(position, 1.0f);
+}
+);
+
+
 /* Fragment Shader Source Code*/
 const GLchar* lampFragmentShaderSource = GLSL(440,
 
@@ -237,83 +686,294 @@ void flipImageVertically(unsigned char* image, int width, int height, int channe
 
 int main(int argc, char* argv[])
 {
-    if (!UInitialize(argc, argv, &gWindow))
-        return EXIT_FAILURE;
+    // Converter mode: ProjectOne --convert model.obj model.umesh
+    if (argc == 4 && strcmp(argv[1], "--convert") == 0)
+        return UConvertObjToMeshFile(argv[2], argv[3]) ? EXIT_SUCCESS : EXIT_FAILURE;
 
-    // Create the mesh
-    UCreateMesh_Desk(gMesh); // Calls the function to create the Vertex Buffer Object
-    UCreateMesh_Mug(gMesh);
-    UCreateMesh_Keyboard(gMesh);
+    // Messages from here on are printed by the log thread
+    UStartLog();
 
+    // Replay mode: ProjectOne --replay frames.uglc [repeats] [--finish], plays a GL capture back headless
+    if (argc >= 3 && strcmp(argv[1], "--replay") == 0)
+        return URunReplay(argc, argv);
 
-    // Create the shader program
-    if (!UCreateShaderProgram(vertexShaderSource, fragmentShaderSource, gProgramId))
+    // Software mode: ProjectOne --software frame.ppm or ProjectOne --soft-bench [frames], no GL context needed
+    gSoftware = argc >= 2 && (strcmp(argv[1], "--software") == 0 || strcmp(argv[1], "--soft-bench") == 0);
+
+    if (!gSoftware && !UInitialize(argc, argv, &gWindow))
         return EXIT_FAILURE;
 
-    // plane goes here //
-    const char* texFilenameDesk = "desk.png";
-    if (!UCreateTexture(texFilenameDesk, gTextureId_desk))
+    // Cap on the estimated GPU memory of everything we create
+    size_t gpuBudgetMb = GPU_BUDGET_MB;
+    size_t textureBudgetMb = TEXTURE_BUDGET_MB;
+    int targetFps = TARGET_FPS;
+    const char* captureFile = nullptr;
+    MultiViewLayout viewLayout = MULTI_VIEW_SINGLE;
+    bool bakeLightmaps = false;
+    for (int i = 1; i < argc; ++i)
     {
-        cout << "Failed to load texture " << texFilenameDesk << endl;
-        return EXIT_FAILURE;
+        if (strcmp(argv[i], "--bake-lightmaps") == 0)
+            bakeLightmaps = true;
     }
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (strcmp(argv[i], "--gpu-budget") == 0)
+            gpuBudgetMb = (size_t)atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--texture-budget") == 0)
+            textureBudgetMb = (size_t)atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--target-fps") == 0)
+            targetFps = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--capture") == 0)
+            captureFile = argv[i + 1];
+        else if (strcmp(argv[i], "--capture-frames") == 0)
+            gCaptureFrames = std::max(atoi(argv[i + 1]), 1);
+        else if (strcmp(argv[i], "--views") == 0 && !UParseMultiViewLayout(argv[i + 1], viewLayout))
+            ULOG_WARNING("Unknown view layout {}, expected single, stereo or monitors", argv[i + 1]);
+    }
+
+    // Before any GL object exists, so the shadow knows every one of them
+    if (captureFile && !gSoftware)
+        UArmGlCapture(captureFile, gCaptureFrames);
+    USetGpuBudget(gpuBudgetMb * 1024 * 1024);
+    USetTextureStreamBudget(textureBudgetMb * 1024 * 1024);
+
+    // Scratch memory for the frames
+    UInitFrameMemory(FRAME_ARENA_BYTES);
+
+    // Worker threads for loading and frame setup
+    UStartJobPool();
+
+    // Mesh building and image decoding run as jobs, the GL objects are created on this thread afterwards
+    struct TextureLoad
+    {
+        const char* filename;
+        GpuTexture* texture;
+        DecodedImage image;
+        bool decoded;
+    };
+    TextureLoad textures[] = {
+        { "desk.png", &gTextureId_desk, { nullptr, 0, 0, 0 }, false },
+        { "mug.png", &gTextureId_mug, { nullptr, 0, 0, 0 }, false },
+        { "keyboard.png", &gTextureId_keyboard, { nullptr, 0, 0, 0 }, false },
+    };
+    const size_t textureCount = sizeof(textures) / sizeof(textures[0]);
+
+    // Pixels that haven't been uploaded yet when loading bails out
+    auto freeDecodedTextures = [&]
+    {
+        for (size_t i = 0; i < textureCount; ++i)
+        {
+            stbi_image_free(textures[i].image.pixels);
+            textures[i].image.pixels = nullptr;
+        }
+    };
 
-    const char* texFilenameMug = "mug.png";
-    if (!UCreateTexture(texFilenameMug, gTextureId_mug))
+    JobGraph loading;
+    UAddGraphJob(loading, [] { UCreateMesh_Desk(gMesh); }); // Calls the function to create the Vertex Buffer Object
+    UAddGraphJob(loading, [] { UCreateMesh_Mug(gMesh); });
+    UAddGraphJob(loading, [] { UCreateMesh_Keyboard(gMesh); });
+    for (size_t i = 0; i < textureCount; ++i)
+    {
+        TextureLoad* load = &textures[i];
+        UAddGraphJob(loading, [load] { load->decoded = UDecodeImage(load->filename, load->image); });
+    }
+    URunJobGraph(loading);
+    if (!UFlushMeshUploads())
     {
-        cout << "Failed to load texture " << texFilenameMug << endl;
+        freeDecodedTextures();
         return EXIT_FAILURE;
     }
 
-    const char* texFilenameKeyboard = "keyboard.png";
-    if (!UCreateTexture(texFilenameKeyboard, gTextureId_keyboard))
+    // Any .umesh, .gltf or .glb files on the command line are added to the scene
+    for (int i = 1; i < argc; ++i)
     {
-        cout << "Failed to load texture " << texFilenameKeyboard << endl;
-        return EXIT_FAILURE;
+        size_t length = strlen(argv[i]);
+        if (length > 6 && strcmp(argv[i] + length - 6, ".umesh") == 0)
+        {
+            GLLoadedMesh loaded;
+            if (!UCreateMeshFromFile(argv[i], loaded))
+            {
+                ULOG_ERROR("Failed to load mesh {}", argv[i]);
+                freeDecodedTextures();
+                return EXIT_FAILURE;
+            }
+            gLoadedMeshes.push_back(loaded);
+        }
+        else if ((length > 5 && strcmp(argv[i] + length - 5, ".gltf") == 0) || (length > 4 && strcmp(argv[i] + length - 4, ".glb") == 0))
+        {
+            if (!UCreateSceneFromGltf(argv[i]))
+            {
+                freeDecodedTextures();
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    // Desk, mug and keyboard textures
+    for (size_t i = 0; i < textureCount; ++i)
+    {
+        if (!textures[i].decoded || !UCreateTexture(textures[i].filename, textures[i].image, *textures[i].texture))
+        {
+            ULOG_ERROR("Failed to load texture {}", textures[i].filename);
+            freeDecodedTextures();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (gSoftware)
+    {
+        int result = URunSoftware(argc, argv);
+        UStopJobPool();
+        return result;
     }
 
-    if (!UCreateShaderProgram(lampVertexShaderSource, lampFragmentShaderSource, gLampProgramId)) {
+    // Create the shader program
+    if (!UCreateShaderProgram("scene", vertexShaderSource, fragmentShaderSource, gProgramId))
+        return EXIT_FAILURE;
+
+    if (!UCreateShaderProgram("lamp", lampVertexShaderSource, lampFragmentShaderSource, gLampProgramId)) {
         return EXIT_FAILURE;
     }
+
+    // Without the upscale program the scene is drawn straight to the window at full size
+    gResolution.targetMs = targetFps > 0 ? 1000.0f / targetFps : 0.0f;
+    gResolution.enabled = targetFps > 0 && UCreateShaderProgram("upscale", upscaleVertexShaderSource, upscaleFragmentShaderSource, gResolution.upscale);
+
+    // The desk set is lit per pixel until a current lightmap is loaded
+    if (UCreateShaderProgram("lightmap", lightmapVertexShaderSource, lightmapFragmentShaderSource, gLightmapProgramId))
+        USetupLightmaps(bakeLightmaps);
+
+    // Several views in one pass need every program in its multi-view variant
+    if (viewLayout != MULTI_VIEW_SINGLE)
+    {
+        GLint viewports = 0;
+        glGetIntegerv(GL_MAX_VIEWPORTS, &viewports);
+        if (!GLEW_ARB_shader_viewport_layer_array || viewports < MULTI_VIEW_MAX_VIEWS)
+            ULOG_WARNING("GL_ARB_shader_viewport_layer_array is not supported, drawing a single view");
+        else if (UCreateShaderProgram("multi-view scene", multiViewVertexShaderSource, fragmentShaderSource, gMultiViewProgramId)
+            && UCreateShaderProgram("multi-view lightmap", multiViewLightmapVertexShaderSource, lightmapFragmentShaderSource, gMultiViewLightmapProgramId)
+            && UCreateShaderProgram("multi-view lamp", multiViewLampVertexShaderSource, lampFragmentShaderSource, gMultiViewLampProgramId))
+            gViewLayout = viewLayout;
+    }
     
     //
 
-    // Sets the background color of the window to black (it will be implicitely used by glClear)
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    // The first snapshot, so the render thread has something to draw right away
+    double simulationTime = glfwGetTime();
+    SceneSnapshot& first = UBeginSnapshot(gSnapshots);
+    UCaptureSnapshot(first);
+    first.time = simulationTime;
+    gLastPublished = first;
+    UPublishSnapshot(gSnapshots);
+
+    // What the render thread reuses every frame gets its full size now, outside the guarded frames
+    UGetJobWorkerStats(gJobStats);
+    gPendingTitle.reserve(TITLE_BYTES);
 
+    // The GL context moves to the render thread until we shut down
+    glfwMakeContextCurrent(NULL);
+    gRenderThread = std::thread(URenderThread);
 
-    // render loop
+    // update loop
     // -----------
+    // GLFW only delivers events on the main thread, so input and the camera stay here and the
+    // frame rate no longer decides how often they are sampled
+    gDeltaTime = (float)UPDATE_TICK;
+    bool idle = false;
     while (!glfwWindowShouldClose(gWindow))
     {
-        // per-frame timing
-        // --------------------
-        float currentFrame = glfwGetTime();
-        gDeltaTime = currentFrame - gLastFrame;
-        gLastFrame = currentFrame;
-
-        // input
-        // -----
-        UProcessInput(gWindow);
+        // Catch up on the steps that are due, each one that changed something publishes a snapshot
+        double now = glfwGetTime();
+        bool changed = false;
+        int steps = 0;
+        while (simulationTime + UPDATE_TICK <= now)
+        {
+            simulationTime += UPDATE_TICK;
+            ++steps;
+
+            // input
+            // -----
+            UProcessInput(gWindow);
+
+            SceneSnapshot& snapshot = UBeginSnapshot(gSnapshots);
+            UCaptureSnapshot(snapshot);
+            snapshot.time = simulationTime;
+            if (USnapshotChanged(gLastPublished, snapshot))
+            {
+                gLastPublished = snapshot;
+                UPublishSnapshot(gSnapshots);
+                changed = true;
+            }
+        }
+        if (changed)
+            UWakeRenderThread();
 
-        // Render this frame
-        URender();
+        // Idle as soon as a step finds nothing changed; an early wake-up without a step keeps the state
+        if (steps > 0)
+            idle = !changed;
 
+        {
+            std::lock_guard<std::mutex> lock(gTitleMutex);
+            if (!gPendingTitle.empty())
+            {
+                glfwSetWindowTitle(gWindow, gPendingTitle.c_str());
+                gPendingTitle.clear();
+            }
+        }
 
+        if (idle)
+        {
+            // Nothing moves: block until an event arrives, then step right away. The steps
+            // missed while blocked are dropped, they would all have found the same scene.
+            glfwWaitEventsTimeout(IDLE_WAIT);
+            double resumed = glfwGetTime() - UPDATE_TICK;
+            if (simulationTime < resumed)
+                simulationTime = resumed;
+            continue;
+        }
 
-        glfwPollEvents();
+        // Sleep until the next step is due, waking early for events
+        double wait = simulationTime + UPDATE_TICK - glfwGetTime();
+        if (wait > 0.0)
+            glfwWaitEventsTimeout(wait);
+        else
+            glfwPollEvents();
     }
 
+    gRenderStopping = true;
+    UWakeRenderThread();
+    gRenderThread.join();
+    glfwMakeContextCurrent(gWindow);
+
+    ULOG_INFO("Rendered {} frames ({} refinement only) in {} s", gFramesRendered, gFramesRefined, glfwGetTime());
+
+    ULOG_INFO("LOD saved {} triangles over the session", gLodTrianglesSaved);
+
     // Release mesh data
     UDestroyMesh(gMesh);
 
     // Release texture
+    UShutdownTextureStreaming();
     UDestroyTexture(gTextureId_desk);
     UDestroyTexture(gTextureId_mug);
-    UDestroyTexture(gTextureId_coffee);
+    UDestroyTexture(gTextureId_keyboard);
+    UDestroyTexture(gLightmap);
+    gLoadedTextures.clear();
 
     // Release shader program
     UDestroyShaderProgram(gProgramId);
+    UDestroyShaderProgram(gLampProgramId);
+    UDestroyShaderProgram(gLightmapProgramId);
+    UDestroyShaderProgram(gMultiViewProgramId);
+    UDestroyShaderProgram(gMultiViewLightmapProgramId);
+    UDestroyShaderProgram(gMultiViewLampProgramId);
+    UDestroyDynamicResolution(gResolution);
+
+    // Anything still registered here was never released
+    UReportGpuLeaks();
+
+    UStopJobPool();
+    UStopLog();
 
     exit(EXIT_SUCCESS); // Terminates the program successfully
 }
@@ -338,7 +998,7 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
     * window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
     if (*window == NULL)
     {
-        std::cout << "Failed to create GLFW window" << std::endl;
+        ULOG_ERROR("Failed to create GLFW window");
         glfwTerminate();
         return false;
     }
@@ -347,6 +1007,7 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
     glfwSetCursorPosCallback(*window, UMousePositionCallback);
     glfwSetScrollCallback(*window, UMouseScrollCallback);
     glfwSetMouseButtonCallback(*window, UMouseButtonCallback);
+    glfwSetWindowRefreshCallback(*window, UWindowRefreshCallback);
 
     // tell GLFW to capture our mouse
     glfwSetInputMode(*window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -359,12 +1020,12 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
 
     if (GLEW_OK != GlewInitResult)
     {
-        std::cerr << glewGetErrorString(GlewInitResult) << std::endl;
+        ULOG_ERROR("{}", glewGetErrorString(GlewInitResult));
         return false;
     }
 
     // Displays GPU OpenGL version
-    cout << "INFO: OpenGL Version: " << glGetString(GL_VERSION) << endl;
+    ULOG_INFO("OpenGL Version: {}", glGetString(GL_VERSION));
 
     return true;
 }
@@ -386,13 +1047,33 @@ void UProcessInput(GLFWwindow* window)
         gCamera.ProcessKeyboard(LEFT, gDeltaTime);
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
         gCamera.ProcessKeyboard(RIGHT, gDeltaTime);
+
+    // F12 captures the next frames. The capture starts at the end of a frame, so one more is
+    // rendered, and they are rendered even when the scene is idle
+    static bool captureKeyDown = false;
+    bool captureKey = glfwGetKey(window, GLFW_KEY_F12) == GLFW_PRESS;
+    if (captureKey && !captureKeyDown && UGlCaptureArmed())
+    {
+        URequestGlCapture();
+        URequestRefinement(gCaptureFrames + 1);
+    }
+    captureKeyDown = captureKey;
 }
 
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
 void UResizeWindow(GLFWwindow* window, int width, int height)
 {
-    glViewport(0, 0, width, height);
+    // The render thread owns the context, it sets the viewport when the next snapshot arrives
+    gViewportWidth = width;
+    gViewportHeight = height;
+}
+
+
+// glfw: the window contents were damaged (uncovered, restored), the next step publishes a repaint
+void UWindowRefreshCallback(GLFWwindow* window)
+{
+    ++gWindowVersion;
 }
 
 
@@ -433,43 +1114,54 @@ void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
     case GLFW_MOUSE_BUTTON_LEFT:
     {
         if (action == GLFW_PRESS)
-            cout << "Left mouse button pressed" << endl;
+        {
+            ULOG_DEBUG("Left mouse button pressed");
+
+            // Select what's under the cursor, or nothing; the next step publishes the change
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            PickHit hit;
+            bool picked = UPickAtCursor(gLastPublished, hit);
+            double microseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+            gSelectedObject = picked ? hit.instance : -1;
+            if (picked)
+                ULOG_INFO("Picked object {}, triangle {} at {} ({} us)", hit.instance, hit.triangle, hit.distance, microseconds);
+            else
+                ULOG_INFO("Picked nothing ({} us)", microseconds);
+        }
         else
-            cout << "Left mouse button released" << endl;
+            ULOG_DEBUG("Left mouse button released");
     }
     break;
 
     case GLFW_MOUSE_BUTTON_MIDDLE:
     {
         if (action == GLFW_PRESS)
-            cout << "Middle mouse button pressed" << endl;
+            ULOG_DEBUG("Middle mouse button pressed");
         else
-            cout << "Middle mouse button released" << endl;
+            ULOG_DEBUG("Middle mouse button released");
     }
     break;
 
     case GLFW_MOUSE_BUTTON_RIGHT:
     {
         if (action == GLFW_PRESS)
-            cout << "Right mouse button pressed" << endl;
+            ULOG_DEBUG("Right mouse button pressed");
         else
-            cout << "Right mouse button released" << endl;
+            ULOG_DEBUG("Right mouse button released");
     }
     break;
 
     default:
-        cout << "Unhandled mouse button event" << endl;
+        ULOG_DEBUG("Unhandled mouse button event {}", button);
         break;
     }
 }
-void URender() {
-    // Enable z-depth
-    glEnable(GL_DEPTH_TEST);
 
-    // Clear the frame and z buffers
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+// The desk set's model matrix, shared by the desk, mug and keyboard
+glm::mat4 UDeskModel()
+{
     // placing the object at the origin
     glm::mat4 translation = glm::translate(glm::vec3(0.0f, 0.0f, -8.0f));
     // scaling the object
@@ -478,128 +1170,729 @@ void URender() {
     glm::mat4 rotation = glm::rotate(45.0f, glm::vec3(-90.0, 1.0f, 1.0f));
 
     // Model matrix: transformations are applied right-to-left order
-    glm::mat4 model = translation * rotation * scale;
+    return translation * rotation * scale;
+}
 
-    // camera/view transformation
-    glm::mat4 view = gCamera.GetViewMatrix();
 
-    // Creates a perspective projection
-    glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+// Copies the simulation state the renderer needs: camera, the desk set's model matrix and the light
+void UCaptureSnapshot(SceneSnapshot& snapshot)
+{
+    snapshot.model = UDeskModel();
 
-    // Set the shader to be used
-    glUseProgram(gProgramId);
+    snapshot.tick = gTick++;
+    snapshot.time = 0.0;    // The update loop stamps its own step time
 
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gProgramId, "projection");
+    // camera
+    snapshot.cameraPosition = gCamera.Position;
+    snapshot.cameraFront = gCamera.Front;
+    snapshot.cameraUp = gCamera.Up;
+    snapshot.cameraZoom = gCamera.Zoom;
+
+    // light
+    snapshot.lightPosition = gLightPosition;
+    snapshot.lightScale = gLightScale;
+    snapshot.lightColor = gLightColor;
+    snapshot.objectColor = gObjectColor;
+
+    snapshot.viewportWidth = gViewportWidth;
+    snapshot.viewportHeight = gViewportHeight;
+    snapshot.windowVersion = gWindowVersion;
+
+    // Hover picking runs every step, a BVH cast is cheap enough for that
+    PickHit hover;
+    snapshot.hoveredObject = UPickAtCursor(snapshot, hover) ? hover.instance : -1;
+    snapshot.selectedObject = gSelectedObject;
+}
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
-    // Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
-    GLint objectColorLoc = glGetUniformLocation(gProgramId, "objectColor");
-    GLint lightColorLoc = glGetUniformLocation(gProgramId, "lightColor");
-    GLint lightPositionLoc = glGetUniformLocation(gProgramId, "lightPos");
-    GLint viewPositionLoc = glGetUniformLocation(gProgramId, "viewPosition");
+// Casts a ray through the cursor from the camera of the view under it; with the cursor captured
+// for mouse look it goes through the middle of the scene camera's view
+bool UPickAtCursor(const SceneSnapshot& snapshot, PickHit& hit)
+{
+    if (snapshot.model != gPickModel)
+    {
+        UClearPickScene(gPickScene);
+        UAddPickInstance(gPickScene, &gMesh.bvh_plane, snapshot.model);
+        UAddPickInstance(gPickScene, &gMesh.bvh_cylinder, snapshot.model);
+        UAddPickInstance(gPickScene, &gMesh.bvh_keyboard, snapshot.model);
+        for (size_t i = 0; i < gLoadedMeshes.size(); ++i)
+            UAddPickInstance(gPickScene, gLoadedMeshes[i].bvh.get(), gLoadedMeshes[i].model);
+        UBuildPickScene(gPickScene);
+        gPickModel = snapshot.model;
+    }
 
-    // Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, gLightColor.r, gLightColor.g, gLightColor.b);
-    glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
-    const glm::vec3 cameraPosition = gCamera.Position;
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+    // The frame's views, built the way the transforms job builds them
+    ViewSet views;
+    float aspect = (float)std::max(snapshot.viewportWidth, 1) / (float)std::max(snapshot.viewportHeight, 1);
+    UBuildViewSet(gViewLayout, snapshot, glm::vec3(snapshot.model[3]), aspect, snapshot.viewportHeight, views);
 
-    // Load desk texture //
+    int view = 0;
+    float ndcX = 0.0f, ndcY = 0.0f;
+    if (gWindow && glfwGetInputMode(gWindow, GLFW_CURSOR) != GLFW_CURSOR_DISABLED)
+    {
+        int width, height;
+        double cursorX, cursorY;
+        glfwGetWindowSize(gWindow, &width, &height);
+        glfwGetCursorPos(gWindow, &cursorX, &cursorY);
+        view = UViewAt(views, (float)(cursorX / std::max(width, 1)), (float)(1.0 - cursorY / std::max(height, 1)), ndcX, ndcY);
+        if (view < 0)
+            return false;
+    }
 
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gProgramId);
-    // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gProgramId, "Desk"), 0);
+    PickRay ray = UScreenRay(views.views[view].view, views.views[view].projection, ndcX, ndcY);
+    return UPickScene(gPickScene, ray, hit);
+}
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gMesh.vao_plane);
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureId_desk);
+// Frame setup as a job graph: transforms first, then occluder rasterization and LOD selection
+// side by side, occlusion tests once the depth buffer is ready, and the sorted draw list last
+void UBuildFrame(const SceneSnapshot& scene)
+{
+    gFrame.scene = scene;
 
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, gMesh.nVertices_plane);
-    glBindVertexArray(0);
+    // The jobs only read gFrame, so the graph is built once and run again every frame
+    static JobGraph graph;
+    if (!graph.nodes.empty())
+    {
+        URunJobGraph(graph);
+        return;
+    }
 
-    //----------------//
-    // Load mug texture //
+    JobNode* transforms = UAddGraphJob(graph, []
+    {
+        const SceneSnapshot& scene = gFrame.scene;
+        gFrame.model = scene.model;
+
+        // The cameras of the frame's views; the monitor cameras look at the desk set
+        float aspect = (float)std::max(scene.viewportWidth, 1) / (float)std::max(scene.viewportHeight, 1);
+        UBuildViewSet(gViewLayout, scene, glm::vec3(scene.model[3]), aspect, gFrame.renderHeight, gFrame.views);
+        gFrame.view = gFrame.views.views[0].view;
+        gFrame.projection = gFrame.views.views[0].projection;
+        gFrame.viewProjection = gFrame.views.views[0].viewProjection;
+
+        // The desk, mug and keyboard share the desk set's model matrix
+        SceneObject desk = { gMesh.vao_plane, &gMesh.lod_plane, gTextureId_desk, gFrame.model, nullptr, { 0, 0 }, 0u,
+            gMesh.vao_lit_plane, (GLuint)gMesh.lightmap_plane.indices.size(), 0u, 0 };
+        SceneObject mug = { gMesh.vao_cylinder, &gMesh.lod_cylinder, gTextureId_mug, gFrame.model, nullptr, { 0, 0 }, 0u,
+            gMesh.vao_lit_cylinder, (GLuint)gMesh.lightmap_cylinder.indices.size(), 0u, 0 };
+        SceneObject keyboard = { gMesh.vao_keyboard, &gMesh.lod_keyboard, gTextureId_keyboard, gFrame.model, nullptr, { 0, 0 }, 0u,
+            gMesh.vao_lit_keyboard, (GLuint)gMesh.lightmap_keyboard.indices.size(), 0u, 0 };
+        gFrame.objects.clear();
+        gFrame.objects.push_back(desk);
+        gFrame.objects.push_back(mug);
+        gFrame.objects.push_back(keyboard);
+        for (size_t i = 0; i < gLoadedMeshes.size(); ++i)
+        {
+            GLLoadedMesh& loaded = gLoadedMeshes[i];
+            SceneObject object = { loaded.vao, &loaded.lod, loaded.textureId ? loaded.textureId : gTextureId_desk, loaded.model,
+                nullptr, { 0, 0 }, 0u, 0, 0, 0u, 0 };
+            gFrame.objects.push_back(object);
+        }
+    });
 
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    //glUseProgram(gProgramId);
-    // We set the texture as texture unit 1
-    glUniform1i(glGetUniformLocation(gProgramId, "Mug"), 1);
+    JobNode* occluders = UAddGraphJob(graph, []
+    {
+        USetOccluderModel(gDeskOccluder, gFrame.model);
+        URenderOccluders(gFrame.viewProjection, OCCLUSION_BUDGET_MS / UOcclusionPasses(gFrame.views), gOcclusionStats);
+    });
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureId_mug);
-    glBindVertexArray(gMesh.vao_cylinder);
-    glDrawArrays(GL_TRIANGLES, 0, gMesh.nVertices_cylinder);
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
+    JobNode* lod = UAddGraphJob(graph, []
+    {
+        UParallelFor(gFrame.objects.size(), [](size_t i)
+        {
+            SceneObject& object = gFrame.objects[i];
+            object.lodStats.trianglesFull = 0;
+            object.lodStats.trianglesDrawn = 0;
+
+            // One level for all views, the one the view that sees the object largest needs
+            object.viewMask = UViewMask(gFrame.views, object.lod->boundsMin, object.lod->boundsMax, object.model);
+            object.detailView = UDetailView(gFrame.views, object.viewMask, glm::vec3(object.model * glm::vec4(object.lod->center, 1.0f)));
+            const RenderView& view = gFrame.views.views[object.detailView];
+            object.level = &USelectLod(*object.lod, object.model, view.position, view.projectionScale, LOD_MAX_PIXEL_ERROR, LOD_HYSTERESIS, object.lodStats);
+        });
+    });
+
+    JobNode* culling = UAddGraphJob(graph, []
+    {
+        FrameVector<OcclusionQuery> queries(gFrame.objects.size());
+        for (size_t i = 0; i < gFrame.objects.size(); ++i)
+        {
+            queries[i].boundsMin = gFrame.objects[i].lod->boundsMin;
+            queries[i].boundsMax = gFrame.objects[i].lod->boundsMax;
+            queries[i].model = gFrame.objects[i].model;
+        }
 
-    // Load keyboard texture //
+        // Every pass only speaks for the view it was drawn from. View 0's buffer is already
+        // drawn, the others (the second eye) are drawn here once it has been tested. The LOD
+        // job fills in the frustum masks meanwhile, the draw list combines the two.
+        float budget = OCCLUSION_BUDGET_MS / UOcclusionPasses(gFrame.views);
+        for (size_t i = 0; i < gFrame.objects.size(); ++i)
+            gFrame.objects[i].occludedViews = 0;
+        gOcclusionStats.tested = 0;
+        gOcclusionStats.culled = 0;
+        for (int v = 0; v < gFrame.views.count; ++v)
+        {
+            unsigned bit = 1u << v;
+            if ((gFrame.views.occlusionViews & bit) == 0)
+                continue;
+
+            const glm::mat4& viewProjection = gFrame.views.views[v].viewProjection;
+            OcclusionStats pass;
+            if (v > 0)
+            {
+                URenderOccluders(viewProjection, budget, pass);
+                gOcclusionStats.occluderTriangles += pass.occluderTriangles;
+                gOcclusionStats.rasterizedTriangles += pass.rasterizedTriangles;
+                gOcclusionStats.rasterMilliseconds += pass.rasterMilliseconds;
+                gOcclusionStats.overBudget = gOcclusionStats.overBudget || pass.overBudget;
+            }
+            UTestOcclusion(queries, viewProjection, pass);
+            gOcclusionStats.tested += pass.tested;
+            gOcclusionStats.culled += pass.culled;
+
+            for (size_t i = 0; i < gFrame.objects.size(); ++i)
+            {
+                if (queries[i].occluded)
+                    gFrame.objects[i].occludedViews |= bit;
+            }
+        }
+    });
 
+    JobNode* drawList = UAddGraphJob(graph, []
+    {
+        gLodStats.trianglesFull = 0;
+        gLodStats.trianglesDrawn = 0;
 
-    //glUseProgram(gProgramId);
-    // We set the texture as texture unit 2
-    glUniform1i(glGetUniformLocation(gProgramId, "Keyboard"), 2);
+        // A fresh list: clearing would keep filling last frame's arena, which the next frame resets
+        FrameVector<DrawItem>().swap(gFrame.drawList);
+        gFrame.drawList.reserve(gFrame.objects.size() + 1);
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gMesh.vao_keyboard);
+        // The bake holds while the light stays where it was baked
+        bool baked = gLightmap && gFrame.scene.lightPosition == gLightmapLightPosition && gFrame.scene.lightColor == gLightmapLightColor;
+        for (size_t i = 0; i < gFrame.objects.size(); ++i)
+        {
+            const SceneObject& object = gFrame.objects[i];
+            gLodStats.trianglesFull += object.lodStats.trianglesFull;
+            gLodStats.trianglesDrawn += object.lodStats.trianglesDrawn;
+            unsigned viewMask = object.viewMask & ~object.occludedViews;
+            if (viewMask == 0)
+                continue;
+
+            float highlight = (int)i == gFrame.scene.selectedObject ? SELECT_HIGHLIGHT : (int)i == gFrame.scene.hoveredObject ? HOVER_HIGHLIGHT : 0.0f;
+            DrawItem item = { ((unsigned long long)object.textureId << 32) | object.vao, object.vao, object.textureId, object.model,
+                object.level->indexOffset, object.level->indexCount, false, false, highlight, 0, 0 };
+            item.viewList = UPackViewList(viewMask, item.viewCount);
+
+            // Lightmapped objects draw their finest level, the only one the lightmap UVs exist for,
+            // and sort between the Phong objects and the lamp
+            if (baked && object.litVao)
+            {
+                item.sortKey = (1ull << 62) | ((unsigned long long)object.textureId << 32) | object.litVao;
+                item.vao = object.litVao;
+                item.indexOffset = 0;
+                item.indexCount = object.litIndexCount;
+                item.lightmapped = true;
+            }
+            gFrame.drawList.push_back(item);
+
+            // The texture wants about as many texels as the bounding sphere covers pixels
+            float scale = std::max(glm::length(glm::vec3(object.model[0])),
+                std::max(glm::length(glm::vec3(object.model[1])), glm::length(glm::vec3(object.model[2]))));
+            glm::vec3 center = glm::vec3(object.model * glm::vec4(object.lod->center, 1.0f));
+            const RenderView& view = gFrame.views.views[object.detailView];
+            float distance = std::max(glm::distance(center, view.position) - object.lod->radius * scale, 0.1f);
+            URequestTextureDetail(object.textureId, 2.0f * object.lod->radius * scale * view.projectionScale / distance);
+        }
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureId_keyboard);
+        // The lamp reuses the mug geometry at full detail, with its own program
+        const MeshLodLevel& lampLevel = gMesh.lod_cylinder.levels[0];
+        DrawItem lamp = { 1ull << 63, gMesh.vao_cylinder, 0, glm::translate(gFrame.scene.lightPosition) * glm::scale(gFrame.scene.lightScale),
+            lampLevel.indexOffset, lampLevel.indexCount, true, false, 0.0f, 0, 0 };
+        lamp.viewList = UPackViewList((1u << gFrame.views.count) - 1, lamp.viewCount);
+        gFrame.drawList.push_back(lamp);
+
+        std::sort(gFrame.drawList.begin(), gFrame.drawList.end(), [](const DrawItem& a, const DrawItem& b) { return a.sortKey < b.sortKey; });
+    });
+
+    UAddJobDependency(transforms, occluders);
+    UAddJobDependency(transforms, lod);
+    UAddJobDependency(occluders, culling);
+    UAddJobDependency(lod, drawList);
+    UAddJobDependency(culling, drawList);
+    URunJobGraph(graph);
+}
 
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, gMesh.nVertices_keyboard);
-    glBindVertexArray(0);
 
-    // LAMP: draw lamp
-    //----------------
-    glUseProgram(gLampProgramId);
+void URender(const SceneSnapshot& scene, bool rebuild, bool fullResolution) {
+    // Frame scratch comes from the arena; from here to the swap the heap is off limits
+    UBeginFrameMemory();
+    UBeginAllocationGuard();
 
-    //Transform the smaller cube used as a visual que for the light source
-    model = glm::translate(gLightPosition) * glm::scale(gLightScale);
+    // Draw into the offscreen target at the scale the frame time allows
+    UBeginDynamicResolution(gResolution, scene.viewportWidth, scene.viewportHeight, fullResolution);
 
-    // Reference matrix uniforms from the Lamp Shader program
-    modelLoc = glGetUniformLocation(gLampProgramId, "model");
-    viewLoc = glGetUniformLocation(gLampProgramId, "view");
-    projLoc = glGetUniformLocation(gLampProgramId, "projection");
+    // Enable z-depth
+    glEnable(GL_DEPTH_TEST);
 
-    // Pass matrix data to the Lamp Shader program's matrix uniforms
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    // Clear the frame and z buffers
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    glDrawArrays(GL_TRIANGLES, 0, gMesh.nVertices_cylinder);
+    // Culling, matrices and the draw list are built on the job pool; only GL calls happen here.
+    // Refinement frames of an unchanged scene draw last frame's list again.
+    if (rebuild)
+    {
+        gFrame.renderHeight = gResolution.height;
+        UBuildFrame(scene);
+    }
+    else
+    {
+        // The list lives in last frame's arena, which the next frame resets; carry it into this one
+        FrameVector<DrawItem>(gFrame.drawList).swap(gFrame.drawList);
+    }
 
-    // Deactivate the Vertex Array Object and shader program
-    glBindVertexArray(0);
-    glUseProgram(0);
+    // Mips the draw list asked for; keep drawing while they arrive, even if nothing else moves
+    if (UUpdateTextureStreaming(TEXTURE_STREAM_UPLOAD_BYTES))
+        URequestRefinement(1);
 
+    // Several views: every view gets its viewport of the target, and the multi-view programs
+    // draw an item once per view that sees it, as instances
+    const ViewSet& views = gFrame.views;
+    bool multiView = views.count > 1;
+    for (int v = 0; multiView && v < views.count; ++v)
+    {
+        const RenderView& view = views.views[v];
+        glViewportIndexedf((GLuint)v, view.x * gResolution.width, view.y * gResolution.height, view.width * gResolution.width, view.height * gResolution.height);
+    }
 
-    glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
-}
+    // Set the shader to be used
+    GLuint sceneProgram = multiView ? gMultiViewProgramId : gProgramId;
+    glUseProgram(sceneProgram);
 
+    // Retrieves and passes transform matrices to the Shader program
+    GLint modelLoc = glGetUniformLocation(sceneProgram, "model");
+    GLint viewListLoc = glGetUniformLocation(sceneProgram, "viewList");
+    USetViewUniforms(sceneProgram);
 
-// Implements the UCreateMesh function
-void UCreateMesh_Desk(GLMesh& mesh)
-{
-    // Desk Vertex data
-    GLfloat desk_verts[] = {
-        //
-        // texture legend:
-        // 
-        // 0.0f, 1.0f,   // top left
-        // 1.0f, 1.0f,   // top right
+    // Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
+    GLint objectColorLoc = glGetUniformLocation(sceneProgram, "objectColor");
+    GLint lightColorLoc = glGetUniformLocation(sceneProgram, "lightColor");
+    GLint lightPositionLoc = glGetUniformLocation(sceneProgram, "lightPos");
+
+    // Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
+    glUniform3f(objectColorLoc, scene.objectColor.r, scene.objectColor.g, scene.objectColor.b);
+    glUniform3f(lightColorLoc, scene.lightColor.r, scene.lightColor.g, scene.lightColor.b);
+    glUniform3f(lightPositionLoc, scene.lightPosition.x, scene.lightPosition.y, scene.lightPosition.z);
+
+    // Every object samples texture unit 0
+    glActiveTexture(GL_TEXTURE0);
+
+    // Draw list is sorted, so state only changes when the texture or VAO actually does
+    GLuint boundTexture = 0, boundVao = 0;
+    float boundHighlight = 0.0f;
+    int boundViewList = -1;         // Per program, a program change sets it again
+    bool lightmapProgram = false, lampProgram = false;
+    for (size_t i = 0; i < gFrame.drawList.size(); ++i)
+    {
+        const DrawItem& item = gFrame.drawList[i];
+
+        // LIGHTMAP: baked objects come after the Phong ones, the lightmap goes on texture unit 1
+        if (item.lightmapped && !lightmapProgram)
+        {
+            GLuint program = multiView ? gMultiViewLightmapProgramId : gLightmapProgramId;
+            glUseProgram(program);
+            modelLoc = glGetUniformLocation(program, "model");
+            viewListLoc = glGetUniformLocation(program, "viewList");
+            boundViewList = -1;
+            USetViewUniforms(program);
+            glUniform1i(glGetUniformLocation(program, "uLightmap"), 1);
+            objectColorLoc = glGetUniformLocation(program, "objectColor");
+            glm::vec3 color = glm::mix(scene.objectColor, HIGHLIGHT_COLOR, boundHighlight);
+            glUniform3f(objectColorLoc, color.r, color.g, color.b);
+
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, gLightmap);
+            glActiveTexture(GL_TEXTURE0);
+            lightmapProgram = true;
+        }
+
+        // LAMP: the lamp items come last and use the Lamp Shader program
+        if (item.lamp && !lampProgram)
+        {
+            GLuint program = multiView ? gMultiViewLampProgramId : gLampProgramId;
+            glUseProgram(program);
+            modelLoc = glGetUniformLocation(program, "model");
+            viewListLoc = glGetUniformLocation(program, "viewList");
+            boundViewList = -1;
+            USetViewUniforms(program);
+            lampProgram = true;
+        }
+
+        if (!item.lamp && item.textureId != boundTexture)
+        {
+            glBindTexture(GL_TEXTURE_2D, item.textureId);
+            boundTexture = item.textureId;
+        }
+        // Hovered and selected objects are tinted through the object color
+        if (!item.lamp && item.highlight != boundHighlight)
+        {
+            glm::vec3 color = glm::mix(scene.objectColor, HIGHLIGHT_COLOR, item.highlight);
+            glUniform3f(objectColorLoc, color.r, color.g, color.b);
+            boundHighlight = item.highlight;
+        }
+        if (item.vao != boundVao)
+        {
+            glBindVertexArray(item.vao);
+            boundVao = item.vao;
+        }
+
+        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(item.model));
+        if (!multiView)
+        {
+            glDrawElements(GL_TRIANGLES, item.indexCount, GL_UNSIGNED_INT, (void*)(item.indexOffset * sizeof(GLuint)));
+            continue;
+        }
+
+        if (item.viewList != boundViewList)
+        {
+            glUniform1i(viewListLoc, item.viewList);
+            boundViewList = item.viewList;
+        }
+        glDrawElementsInstanced(GL_TRIANGLES, item.indexCount, GL_UNSIGNED_INT, (void*)(item.indexOffset * sizeof(GLuint)), item.viewCount);
+    }
+
+    // Deactivate the Vertex Array Object and shader program
+    glBindVertexArray(0);
+    glUseProgram(0);
+    if (lightmapProgram)
+    {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // Up to the window, and the scale for the next frames from the GPU time of earlier ones
+    UEndDynamicResolution(gResolution, scene.viewportWidth, scene.viewportHeight);
+
+    // Report the triangles the LOD selection saved, the culling results and how busy the job threads are, once a second
+    gLodTrianglesSaved += gLodStats.trianglesFull - gLodStats.trianglesDrawn;
+    if (gLastFrame - gLodLastReport >= 1.0f)
+    {
+        UGetJobWorkerStats(gJobStats);
+        float utilization = 0.0f;
+        for (size_t i = 0; i < gJobStats.size(); ++i)
+            utilization += gJobStats[i].utilization;
+        utilization /= gJobStats.empty() ? 1.0f : (float)gJobStats.size();
+
+        GpuMemoryStats gpuStats;
+        UGetGpuMemoryStats(gpuStats);
+
+        TextureStreamStats textureStats;
+        UGetTextureStreamStats(textureStats);
+
+        char title[TITLE_BYTES];
+        snprintf(title, sizeof(title), "%s | LOD: %lu of %lu triangles drawn | Occlusion: %u of %u culled, %.2f ms%s | Jobs: %d%% of %u threads | GPU: %.1f of %.0f MiB | Textures: %.1f MiB, %u mips in, %u out%s | Resolution: %d%%, GPU %.2f ms", WINDOW_TITLE,
+            gLodStats.trianglesDrawn, gLodStats.trianglesFull, gOcclusionStats.culled, gOcclusionStats.tested,
+            gOcclusionStats.rasterMilliseconds, gOcclusionStats.overBudget ? " (over budget)" : "",
+            (int)(utilization * 100.0f + 0.5f), (unsigned)gJobStats.size(),
+            gpuStats.totalBytes / (1024.0 * 1024.0), gpuStats.budgetBytes / (1024.0 * 1024.0),
+            textureStats.residentBytes / (1024.0 * 1024.0), textureStats.streamedIn, textureStats.evicted, textureStats.starved ? " (over budget)" : "",
+            (int)(gResolution.frameScale * 100.0f + 0.5f), gResolution.gpuMs);
+        {
+            std::lock_guard<std::mutex> lock(gTitleMutex);
+            gPendingTitle.assign(title);    // Into the capacity reserved up front
+        }
+        gLodLastReport = gLastFrame;
+    }
+
+    // Debug builds hold a warmed-up frame to zero heap allocations, a capture's recording aside
+    AllocationGuardStats allocations;
+    UEndAllocationGuard(allocations);
+    if (allocations.allocations > 0 && gFramesRendered + gFramesRefined >= FRAME_GUARD_WARMUP_FRAMES && !UGlCaptureArmed())
+    {
+        ULOG_ERROR("{} heap allocations ({} bytes) between frame start and swap", allocations.allocations, allocations.bytes);
+        UFlushLog();
+        assert(allocations.allocations == 0);
+    }
+
+    UGlCaptureFrameEnd(scene.viewportWidth, scene.viewportHeight);
+    glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
+}
+
+
+// The frame's cameras: view and projection, or the views and projections arrays of the multi-view programs
+void USetViewUniforms(GLuint program)
+{
+    const ViewSet& views = gFrame.views;
+    if (views.count == 1)
+    {
+        glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(gFrame.view));
+        glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(gFrame.projection));
+
+        // Only the scene program lights per pixel, the others don't have it
+        GLint viewPositionLoc = glGetUniformLocation(program, "viewPosition");
+        if (viewPositionLoc >= 0)
+            glUniform3f(viewPositionLoc, views.views[0].position.x, views.views[0].position.y, views.views[0].position.z);
+        return;
+    }
+
+    glm::mat4 matrices[MULTI_VIEW_MAX_VIEWS];
+    for (int v = 0; v < views.count; ++v)
+        matrices[v] = views.views[v].view;
+    glUniformMatrix4fv(glGetUniformLocation(program, "views"), views.count, GL_FALSE, glm::value_ptr(matrices[0]));
+    for (int v = 0; v < views.count; ++v)
+        matrices[v] = views.views[v].projection;
+    glUniformMatrix4fv(glGetUniformLocation(program, "projections"), views.count, GL_FALSE, glm::value_ptr(matrices[0]));
+}
+
+
+// Owns the GL context while the window is open: takes the newest snapshot, renders it, repeats
+void URenderThread()
+{
+    glfwMakeContextCurrent(gWindow);
+
+    // Sets the background color of the window to black (it will be implicitely used by glClear)
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+    SceneSnapshot previous, current, interpolated;
+    const SceneSnapshot* latest = nullptr;
+    UAcquireSnapshot(gSnapshots, latest);   // main() published one before starting us
+    previous = current = *latest;
+    bool settled = false;   // current has been drawn as it is, without interpolation
+    bool still = false;     // ...and again at full resolution
+
+    while (!gRenderStopping)
+    {
+        gLastFrame = (float)glfwGetTime();
+
+        if (UAcquireSnapshot(gSnapshots, latest))
+        {
+            previous = current;
+            current = *latest;
+            settled = false;
+            still = false;
+
+            // After an idle stretch the previous snapshot is old, blend from it over one step only
+            if (current.time - previous.time > UPDATE_TICK)
+                previous.time = current.time - UPDATE_TICK;
+        }
+
+        if (settled)
+        {
+            // Nothing changed, only progressive effects may still want frames
+            int refinements = gRefinementFrames.load();
+            if (refinements > 0)
+            {
+                gRefinementFrames.compare_exchange_strong(refinements, refinements - 1);
+                URender(interpolated, false, false);
+                ++gFramesRefined;
+                continue;
+            }
+
+            // The picture is going to stay up, it's worth a frame at the window's resolution
+            if (!still && UResolutionReduced(gResolution))
+            {
+                still = true;
+                URender(interpolated, false, true);
+                ++gFramesRefined;
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(gRenderWakeMutex);
+            gRenderWake.wait(lock, [] { return gRenderStopping || UHasNewSnapshot(gSnapshots) || gRefinementFrames.load() > 0; });
+            continue;
+        }
+
+        // Draw one step behind the simulation, between the last two snapshots. If the update
+        // thread stalls the picture stops at the newest one instead of guessing ahead.
+        float alpha = 1.0f;
+        if (current.time > previous.time)
+            alpha = glm::clamp((float)((glfwGetTime() - current.time) / (current.time - previous.time)), 0.0f, 1.0f);
+        UInterpolateSnapshot(previous, current, alpha, interpolated);
+        settled = alpha >= 1.0f;
+
+        // Render this frame
+        URender(interpolated, true, false);
+        ++gFramesRendered;
+    }
+
+    glfwMakeContextCurrent(NULL);
+}
+
+
+// Wakes the render thread when it sleeps on a settled scene
+void UWakeRenderThread()
+{
+    // Taking the lock means the render thread can't miss this between its check and its wait
+    { std::lock_guard<std::mutex> lock(gRenderWakeMutex); }
+    gRenderWake.notify_one();
+}
+
+
+// Asks for more frames of an unchanged scene, for effects that refine over several frames
+void URequestRefinement(int frames)
+{
+    gRefinementFrames.fetch_add(frames);
+    UWakeRenderThread();
+}
+
+
+// Renders the frame's draw list with the software backend into gSoftFramebuffer
+void USoftRenderFrame(SoftFrameStats& stats)
+{
+    UBeginFrameMemory();
+
+    SceneSnapshot scene;
+    UCaptureSnapshot(scene);
+    gFrame.renderHeight = scene.viewportHeight;
+    UBuildFrame(scene);
+
+    SoftFrameUniforms uniforms;
+    uniforms.view = gFrame.view;
+    uniforms.projection = gFrame.projection;
+    uniforms.objectColor = scene.objectColor;
+    uniforms.lightColor = scene.lightColor;
+    uniforms.lightPosition = scene.lightPosition;
+    uniforms.viewPosition = scene.cameraPosition;
+
+    FrameVector<SoftDrawCall> draws;
+    draws.reserve(gFrame.drawList.size());
+    for (size_t i = 0; i < gFrame.drawList.size(); ++i)
+    {
+        const DrawItem& item = gFrame.drawList[i];
+        const SoftMesh& mesh = gSoftMeshes[item.vao - 1];
+        SoftDrawCall draw = { &mesh.vertices[0], mesh.vertices.size() / SOFT_FLOATS_PER_VERTEX, &mesh.indices[item.indexOffset], item.indexCount,
+            item.model, item.textureId ? &gSoftTextures[item.textureId - 1] : nullptr, item.lamp };
+        draws.push_back(draw);
+    }
+
+    UClearSoftFramebuffer(gSoftFramebuffer, 0xff000000u);
+    USoftRender(draws, uniforms, gSoftFramebuffer, stats);
+}
+
+
+// --software writes one frame to a PPM file, --soft-bench renders frames back to back and reports throughput
+int URunSoftware(int argc, char* argv[])
+{
+    UResizeSoftFramebuffer(gSoftFramebuffer, WINDOW_WIDTH, WINDOW_HEIGHT);
+    SoftFrameStats stats;
+
+    if (strcmp(argv[1], "--software") == 0)
+    {
+        const char* output = argc >= 3 ? argv[2] : "frame.ppm";
+        USoftRenderFrame(stats);
+        if (!UWriteSoftFramebuffer(gSoftFramebuffer, output))
+        {
+            ULOG_ERROR("Failed to write {}", output);
+            return EXIT_FAILURE;
+        }
+        ULOG_INFO("Wrote {}: {} triangles, {} fragments in {} ms", output, stats.trianglesBinned, stats.fragmentsShaded,
+            stats.vertexMilliseconds + stats.binMilliseconds + stats.rasterMilliseconds);
+        return EXIT_SUCCESS;
+    }
+
+    int frames = argc >= 3 ? atoi(argv[2]) : 0;
+    if (frames <= 0)
+        frames = SOFT_BENCH_FRAMES;
+
+    // One warm-up frame so the bins and vertex buffers are already allocated
+    USoftRenderFrame(stats);
+
+    std::vector<JobWorkerStats> jobStats;
+    UGetJobWorkerStats(jobStats);
+
+    double vertexMs = 0.0, binMs = 0.0, rasterMs = 0.0;
+    double triangles = 0.0, fragments = 0.0;
+    for (int frame = 0; frame < frames; ++frame)
+    {
+        USoftRenderFrame(stats);
+        vertexMs += stats.vertexMilliseconds;
+        binMs += stats.binMilliseconds;
+        rasterMs += stats.rasterMilliseconds;
+        triangles += stats.trianglesSubmitted;
+        fragments += stats.fragmentsShaded;
+    }
+
+    double totalMs = vertexMs + binMs + rasterMs;
+    ULOG_INFO("Software renderer, {}x{}, {} frames, {} threads", gSoftFramebuffer.width, gSoftFramebuffer.height, frames, UJobWorkerCount() + 1);
+    ULOG_INFO("{} ms/frame (vertex {}, bin {}, raster {}), {} fps", totalMs / frames, vertexMs / frames, binMs / frames, rasterMs / frames,
+        1000.0 * frames / totalMs);
+    ULOG_INFO("{} Mtriangles/s, {} Mfragments/s", triangles / (totalMs * 1000.0), fragments / (totalMs * 1000.0));
+
+    // One message for all threads, a line each would run into the rate limit on many cores
+    UGetJobWorkerStats(jobStats);
+    string threads;
+    for (size_t i = 0; i < jobStats.size(); ++i)
+    {
+        threads += i == 0 ? "\n  main thread: " : i == 1 ? "\n  other threads: " : "\n  worker " + to_string(i - 1) + ": ";
+        threads += to_string((int)(jobStats[i].utilization * 100.0f + 0.5f)) + "% busy, " + to_string(jobStats[i].jobs) + " jobs, "
+            + to_string(jobStats[i].steals) + " steals";
+    }
+    ULOG_INFO("Job threads:{}", threads);
+    return EXIT_SUCCESS;
+}
+
+
+// --replay plays a GL capture on a hidden window's context; repeats defaults to 1, --finish times each call to completion
+int URunReplay(int argc, char* argv[])
+{
+    int repeats = 1;
+    bool finishEachCall = false;
+    for (int i = 3; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--finish") == 0)
+            finishEachCall = true;
+        else
+            repeats = std::max(atoi(argv[i]), 1);
+    }
+
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#ifdef __APPLE__
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+
+    GLFWwindow* window = glfwCreateWindow(GL_REPLAY_WIDTH, GL_REPLAY_HEIGHT, WINDOW_TITLE, NULL, NULL);
+    if (window == NULL)
+    {
+        ULOG_ERROR("Failed to create GLFW window");
+        glfwTerminate();
+        UStopLog();
+        return EXIT_FAILURE;
+    }
+    glfwMakeContextCurrent(window);
+
+    glewExperimental = GL_TRUE;
+    GLenum GlewInitResult = glewInit();
+    bool replayed = false;
+    if (GLEW_OK != GlewInitResult)
+        ULOG_ERROR("{}", glewGetErrorString(GlewInitResult));
+    else
+    {
+        ULOG_INFO("OpenGL Version: {}", glGetString(GL_VERSION));
+        replayed = UReplayGlCapture(argv[2], repeats, finishEachCall);
+    }
+
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    UStopLog();
+    return replayed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+// Implements the UCreateMesh function
+void UCreateMesh_Desk(GLMesh& mesh)
+{
+    // Desk Vertex data
+    GLfloat desk_verts[] = {
+        //
+        // texture legend:
+        // 
+        // 0.0f, 1.0f,   // top left
+        // 1.0f, 1.0f,   // top right
         // 1.0f, 0.0f,   //  bottom right
         // 0.0f, 1.0f,   // top left
         // 
@@ -625,32 +1918,207 @@ void UCreateMesh_Desk(GLMesh& mesh)
 
     mesh.nVertices_plane = sizeof(desk_verts) / (sizeof(desk_verts[0]) * (floatsPerVertex + floatsPerColor + floatsPerUV + floatsPerNormal));
 
-    glGenVertexArrays(1, &mesh.vao_plane); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.vao_plane);
+    // Weld the vertices, build the LOD chain and send everything to the GPU
+    UCreateIndexedMesh("desk", desk_verts, sizeof(desk_verts) / sizeof(desk_verts[0]), floatsPerVertex + floatsPerColor + floatsPerUV + floatsPerNormal,
+        mesh.vao_plane, mesh.vbo_plane, mesh.ebo_plane, mesh.lod_plane, mesh.bvh_plane, mesh.lightmap_plane, &gDeskOccluder);
+}
+
+
+// Welds an interleaved vertex array and builds its LOD chain; safe to call from a job.
+// The VBO and EBO are created by UFlushMeshUploads on the main thread, which also
+// registers the finest level for software occlusion culling when occluder is set.
+void UCreateIndexedMesh(const char* name, const GLfloat* verts, size_t floatCount, GLuint floatsPerVertex, GpuVertexArray& vao, GpuBuffer& vbo, GpuBuffer& ebo, MeshLodChain& lod, MeshBvh& bvh, LightmapMesh& lightmap, int* occluder)
+{
+    std::vector<GLfloat> vertices;
+    std::vector<GLuint> baseIndices;
+    UWeldVertices(verts, floatCount, floatsPerVertex, vertices, baseIndices);
+
+    std::vector<GLuint> indices;
+    UBuildLodChain(vertices, floatsPerVertex, baseIndices, LOD_MAX_LEVELS, LOD_REDUCTION, indices, lod);
+
+    // Triangle and vertex order were typed in by hand, reorder them for the GPU caches
+    MeshOptimizeStats stats = UOptimizeMesh(vertices, floatsPerVertex, indices, lod);
+
+    ULOG_INFO("{} ACMR {} -> {}, ATVR {} -> {}", name, stats.before.acmr, stats.after.acmr, stats.before.atvr, stats.after.atvr);
+
+    // Picking tests the finest level, the one closest to the real surface
+    const MeshLodLevel& finest = lod.levels[0];
+    UBuildMeshBvh(&vertices[0], floatsPerVertex, &indices[finest.indexOffset], finest.indexCount, bvh);
+
+    // So is the lightmap, packed by USetupLightmaps once every desk set mesh is unwrapped
+    UUnwrapLightmap(&vertices[0], floatsPerVertex, &indices[finest.indexOffset], finest.indexCount, lightmap);
+
+    PendingUpload upload;
+    upload.vertices.swap(vertices);
+    upload.indices.swap(indices);
+    upload.floatsPerVertex = floatsPerVertex;
+    upload.name = name;
+    upload.vao = &vao;
+    upload.vbo = &vbo;
+    upload.ebo = &ebo;
+    upload.lod = &lod;
+    upload.occluder = occluder;
+
+    std::lock_guard<std::mutex> lock(gPendingUploadsMutex);
+    gPendingUploads.push_back(upload);
+}
+
+
+// Creates the GL objects of every mesh built by the loading jobs
+bool UFlushMeshUploads()
+{
+    bool uploaded = true;
+    std::lock_guard<std::mutex> lock(gPendingUploadsMutex);
+    for (size_t i = 0; i < gPendingUploads.size(); ++i)
+    {
+        PendingUpload& upload = gPendingUploads[i];
+
+        // The model matrix is set every frame by UBuildFrame
+        if (upload.occluder)
+        {
+            const MeshLodLevel& finest = upload.lod->levels[0];
+            *upload.occluder = UAddOccluder(upload.vertices, upload.floatsPerVertex, &upload.indices[finest.indexOffset], finest.indexCount, glm::mat4(1.0f));
+        }
+
+        if (!UUploadMesh(upload.name, upload.vertices, upload.floatsPerVertex, upload.indices, *upload.vao, *upload.vbo, *upload.ebo))
+            uploaded = false;
+    }
+    gPendingUploads.clear();
+    return uploaded;
+}
+
+
+// Lights the desk set from a bake: a new one when bake is set, otherwise the saved one if it matches the scene
+bool USetupLightmaps(bool bake)
+{
+    glm::mat4 model = UDeskModel();
+    std::vector<LightmapInstance> instances(3);
+    instances[0].mesh = &gMesh.lightmap_plane;
+    instances[1].mesh = &gMesh.lightmap_cylinder;
+    instances[2].mesh = &gMesh.lightmap_keyboard;
+    for (size_t i = 0; i < instances.size(); ++i)
+        instances[i].model = model;
+
+    // Rays that leave the scene bring in the Phong shader's ambient term
+    LightmapSettings settings;
+    settings.lightPosition = gLightPosition;
+    settings.lightColor = gLightColor;
+    settings.skyColor = 0.1f * gLightColor;
+    settings.albedo = LIGHTMAP_ALBEDO;
+    settings.samples = LIGHTMAP_SAMPLES;
+    settings.bounces = LIGHTMAP_BOUNCES;
+
+    if (!UPackLightmap(instances, LIGHTMAP_SIZE))
+    {
+        ULOG_INFO("The desk set is lit per pixel");
+        return false;
+    }
+    uint64_t sceneHash = ULightmapSceneHash(instances, settings, LIGHTMAP_SIZE);
+
+    std::vector<float> texels;
+    if (bake)
+    {
+        UBakeLightmap(instances, settings, LIGHTMAP_SIZE, texels);
+        if (USaveLightmap(LIGHTMAP_FILE, sceneHash, LIGHTMAP_SIZE, texels))
+            ULOG_INFO("Saved {}", LIGHTMAP_FILE);
+    }
+    else if (!ULoadLightmap(LIGHTMAP_FILE, sceneHash, LIGHTMAP_SIZE, texels))
+    {
+        ULOG_INFO("No current {}, the desk set is lit per pixel (run with --bake-lightmaps to make one)", LIGHTMAP_FILE);
+        return false;
+    }
+
+    if (!UUploadMesh("desk lightmapped", gMesh.lightmap_plane.vertices, gMesh.lightmap_plane.floatsPerVertex, gMesh.lightmap_plane.indices,
+            gMesh.vao_lit_plane, gMesh.vbo_lit_plane, gMesh.ebo_lit_plane) ||
+        !UUploadMesh("mug lightmapped", gMesh.lightmap_cylinder.vertices, gMesh.lightmap_cylinder.floatsPerVertex, gMesh.lightmap_cylinder.indices,
+            gMesh.vao_lit_cylinder, gMesh.vbo_lit_cylinder, gMesh.ebo_lit_cylinder) ||
+        !UUploadMesh("keyboard lightmapped", gMesh.lightmap_keyboard.vertices, gMesh.lightmap_keyboard.floatsPerVertex, gMesh.lightmap_keyboard.indices,
+            gMesh.vao_lit_keyboard, gMesh.vbo_lit_keyboard, gMesh.ebo_lit_keyboard) ||
+        !gLightmap.create((size_t)LIGHTMAP_SIZE * LIGHTMAP_SIZE * 8, "lightmap"))
+        return false;
+
+    // Half floats keep the range above 1 that the light can reach
+    glBindTexture(GL_TEXTURE_2D, gLightmap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, LIGHTMAP_SIZE, LIGHTMAP_SIZE, 0, GL_RGB, GL_FLOAT, &texels[0]);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    gLightmapLightPosition = settings.lightPosition;
+    gLightmapLightColor = settings.lightColor;
+    return true;
+}
+
+
+// Uploads indexed, interleaved vertex data (position, color, uv and, with 11 floats, normal) into a new VAO
+bool UUploadMesh(const char* name, const std::vector<GLfloat>& vertices, GLuint floatsPerVertex, const std::vector<GLuint>& indices, GpuVertexArray& vao, GpuBuffer& vbo, GpuBuffer& ebo)
+{
+    if (gSoftware)
+    {
+        // The software renderer only reads the layout the shaders use
+        if (floatsPerVertex != SOFT_FLOATS_PER_VERTEX)
+        {
+            ULOG_ERROR("Software renderer can't draw {}: {} floats per vertex", name, floatsPerVertex);
+            return false;
+        }
+        SoftMesh mesh = { vertices, indices };
+        gSoftMeshes.push_back(mesh);
+        vao = GpuVertexArray((GLuint)gSoftMeshes.size());
+        return true;
+    }
+
+    // Every object is checked against the GPU budget before anything is allocated
+    if (!vao.create(0, name) || !vbo.create(vertices.size() * sizeof(GLfloat), name) || !ebo.create(indices.size() * sizeof(GLuint), name))
+    {
+        vao.reset();
+        vbo.reset();
+        return false;
+    }
+
+    glBindVertexArray(vao);
 
     // Create VBO
-    glGenBuffers(1, &mesh.vbo_plane);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo_plane); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(desk_verts), desk_verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+    glBindBuffer(GL_ARRAY_BUFFER, vbo); // Activates the buffer
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), &vertices[0], GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
 
+    // Create EBO, every LOD level lives in it back to back
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
 
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerColor + floatsPerUV + floatsPerNormal);
+    // Strides between vertex coordinates
+    GLint stride = sizeof(float) * floatsPerVertex;
 
     // position attribute
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, (void*)0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
     glEnableVertexAttribArray(0);
 
     // color attribute
-    glVertexAttribPointer(1, floatsPerColor, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
     glEnableVertexAttribArray(1);
 
     // texture coord attribute
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(6 * sizeof(float)));
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(6 * sizeof(float)));
     glEnableVertexAttribArray(2);
 
     // normal vertices
-    glVertexAttribPointer(3, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(8 * sizeof(float)));
-    glEnableVertexAttribArray(3);
+    if (floatsPerVertex >= 11)
+    {
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (void*)(8 * sizeof(float)));
+        glEnableVertexAttribArray(3);
+    }
+
+    // lightmap coord attribute, appended by UUnwrapLightmap
+    if (floatsPerVertex >= 13)
+    {
+        glVertexAttribPointer(4, 2, GL_FLOAT, GL_FALSE, stride, (void*)(11 * sizeof(float)));
+        glEnableVertexAttribArray(4);
+    }
+
+    glBindVertexArray(0);
+    return true;
 }
 
 
@@ -743,32 +2211,9 @@ void UCreateMesh_Mug(GLMesh& mesh)
 
     mesh.nVertices_cylinder = sizeof(mug_verts) / (sizeof(mug_verts[0]) * (floatsPerVertex + floatsPerColor + floatsPerUV + floatsPerNormal));
 
-    glGenVertexArrays(1, &mesh.vao_cylinder); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.vao_cylinder);
-
-    // Create VBO
-    glGenBuffers(1, &mesh.vbo_cylinder);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo_cylinder); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(mug_verts), mug_verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-    // Strides between vertex coordinates
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerColor + floatsPerUV + floatsPerNormal);
-
-    // position attribute
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, (void*)0);
-    glEnableVertexAttribArray(0);
-
-    // color attribute
-    glVertexAttribPointer(1, floatsPerColor, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-
-    // texture coord attribute
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(6 * sizeof(float)));
-    glEnableVertexAttribArray(2);
-
-    // normal vertices
-    glVertexAttribPointer(3, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(8 * sizeof(float)));
-    glEnableVertexAttribArray(3);
+    // Weld the vertices, build the LOD chain and send everything to the GPU
+    UCreateIndexedMesh("mug", mug_verts, sizeof(mug_verts) / sizeof(mug_verts[0]), floatsPerVertex + floatsPerColor + floatsPerUV + floatsPerNormal,
+        mesh.vao_cylinder, mesh.vbo_cylinder, mesh.ebo_cylinder, mesh.lod_cylinder, mesh.bvh_cylinder, mesh.lightmap_cylinder);
 }
 
 
@@ -828,11 +2273,11 @@ void UCreateMesh_coffee(GLMesh& mesh)
 
     mesh.nVertices_round = sizeof(coffee_verts) / (sizeof(coffee_verts[0]) * (floatsPerVertex + floatsPerColor + floatsPerUV));
 
-    glGenVertexArrays(1, &mesh.vao_round); // we can also generate multiple VAOs or buffers at the same time
+    if (!mesh.vao_round.create(0, "coffee") || !mesh.vbo_round.create(sizeof(coffee_verts), "coffee"))
+        return;
     glBindVertexArray(mesh.vao_round);
 
     // Create VBO
-    glGenBuffers(1, &mesh.vbo_round);
     glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo_round); // Activates the buffer
     glBufferData(GL_ARRAY_BUFFER, sizeof(coffee_verts), coffee_verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
 
@@ -917,108 +2362,317 @@ void UCreateMesh_Keyboard(GLMesh& mesh)
 
     mesh.nVertices_keyboard = sizeof(keyboard_verts) / (sizeof(keyboard_verts[0]) * (floatsPerVertex + floatsPerColor + floatsPerUV + floatsPerNormal));
 
-    glGenVertexArrays(1, &mesh.vao_keyboard); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.vao_keyboard);
+    // Weld the vertices, build the LOD chain and send everything to the GPU
+    UCreateIndexedMesh("keyboard", keyboard_verts, sizeof(keyboard_verts) / sizeof(keyboard_verts[0]), floatsPerVertex + floatsPerColor + floatsPerUV + floatsPerNormal,
+        mesh.vao_keyboard, mesh.vbo_keyboard, mesh.ebo_keyboard, mesh.lod_keyboard, mesh.bvh_keyboard, mesh.lightmap_keyboard);
+}
 
-    // Create VBO
-    glGenBuffers(1, &mesh.vbo_keyboard);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo_keyboard); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(keyboard_verts), keyboard_verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
 
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerColor + floatsPerUV + floatsPerNormal);
+// Maps a .umesh file and hands its blobs straight to glBufferData, no parsing or copying on our side
+bool UCreateMeshFromFile(const char* filename, GLLoadedMesh& mesh)
+{
+    MappedMeshFile file;
+    if (!UMapMeshFile(filename, file))
+        return false;
 
-    // position attribute
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, (void*)0);
-    glEnableVertexAttribArray(0);
+    const MeshFileHeader& header = *file.header;
+    LoadedBuffers buffers;
 
-    // color attribute
-    glVertexAttribPointer(1, floatsPerColor, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
+    if (gSoftware)
+    {
+        // The software renderer only reads the interleaved layout the shaders use
+        if (header.vertexStride != SOFT_FLOATS_PER_VERTEX * sizeof(GLfloat))
+        {
+            ULOG_ERROR("Software renderer can't draw {}: vertex stride {}", filename, header.vertexStride);
+            UUnmapMeshFile(file);
+            return false;
+        }
+        const GLfloat* vertices = (const GLfloat*)file.vertices;
+        std::vector<GLuint> indices(file.indices, file.indices + header.indexCount);
+        if (!UUploadMesh(filename, std::vector<GLfloat>(vertices, vertices + header.vertexBytes / sizeof(GLfloat)), SOFT_FLOATS_PER_VERTEX, indices, buffers.vao, buffers.vbo, buffers.ebo))
+        {
+            UUnmapMeshFile(file);
+            return false;
+        }
+    }
+    else
+    {
+        if (!buffers.vao.create(0, filename) || !buffers.vbo.create((size_t)header.vertexBytes, filename) ||
+            !buffers.ebo.create((size_t)header.indexBytes, filename))
+        {
+            UUnmapMeshFile(file);
+            return false;
+        }
 
-    // texture coord attribute
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(6 * sizeof(float)));
-    glEnableVertexAttribArray(2);
+        glBindVertexArray(buffers.vao);
 
-    // normal vertices
-    glVertexAttribPointer(3, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(8 * sizeof(float)));
-    glEnableVertexAttribArray(3);
+        glBindBuffer(GL_ARRAY_BUFFER, buffers.vbo);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)header.vertexBytes, file.vertices, GL_STATIC_DRAW);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)header.indexBytes, file.indices, GL_STATIC_DRAW);
+
+        // Vertex format comes from the file's descriptor
+        for (uint32_t i = 0; i < header.attributeCount; ++i)
+        {
+            const MeshFileAttribute& attribute = file.attributes[i];
+            glVertexAttribPointer(attribute.location, attribute.components, attribute.type, GL_FALSE, header.vertexStride, (void*)(size_t)attribute.offset);
+            glEnableVertexAttribArray(attribute.location);
+        }
+        glBindVertexArray(0);
+    }
+
+    // LOD chain, a file without one is drawn as a single level
+    mesh.lod.levels.clear();
+    mesh.lod.currentLevel = 0;
+    for (uint32_t i = 0; i < header.lodCount; ++i)
+    {
+        MeshLodLevel level = { file.lods[i].indexOffset, file.lods[i].indexCount, file.lods[i].geometricError };
+        mesh.lod.levels.push_back(level);
+    }
+    if (mesh.lod.levels.empty())
+    {
+        MeshLodLevel level = { 0, header.indexCount, 0.0f };
+        mesh.lod.levels.push_back(level);
+    }
+
+    glm::vec3 boundsMin(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+    glm::vec3 boundsMax(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+    mesh.lod.boundsMin = boundsMin;
+    mesh.lod.boundsMax = boundsMax;
+    mesh.lod.center = (boundsMin + boundsMax) * 0.5f;
+    mesh.lod.radius = glm::length(boundsMax - boundsMin) * 0.5f;
+
+    // Picking BVH over the finest level, from the float positions at location 0. UMapMeshFile
+    // has checked every index against the vertex count.
+    mesh.bvh = std::make_shared<MeshBvh>();
+    for (uint32_t i = 0; i < header.attributeCount; ++i)
+    {
+        const MeshFileAttribute& attribute = file.attributes[i];
+        if (attribute.location == 0 && attribute.type == GL_FLOAT && attribute.components >= 3 &&
+            attribute.offset % sizeof(GLfloat) == 0 && header.vertexStride % sizeof(GLfloat) == 0)
+        {
+            const MeshLodLevel& finest = mesh.lod.levels[0];
+            UBuildMeshBvh((const GLfloat*)((const char*)file.vertices + attribute.offset), header.vertexStride / sizeof(GLfloat),
+                file.indices + finest.indexOffset, finest.indexCount, *mesh.bvh);
+        }
+    }
+
+    mesh.vao = buffers.vao;
+    mesh.textureId = 0;
+    mesh.model = glm::mat4(1.0f);
+    mesh.occluded = false;
+    gLoadedBuffers.push_back(std::move(buffers));
+
+    UUnmapMeshFile(file);
+    return true;
 }
 
 
-void UDestroyMesh(GLMesh& mesh)
+// Imports a glTF scene on the job pool, then creates its textures and meshes through the usual upload paths
+bool UCreateSceneFromGltf(const char* filename)
 {
-    glDeleteVertexArrays(1, &mesh.vao_plane);
-    glDeleteBuffers(1, &mesh.vbo_plane);
-    glDeleteBuffers(1, &mesh.ebo_plane);
+    // Not glfwGetTime, --software loads scenes without initializing GLFW
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    ImportedScene scene;
+    std::string error;
+    if (!UImportGltf(filename, scene, error))
+    {
+        ULOG_ERROR("Failed to import {}: {}", filename, error);
+        return false;
+    }
+
+    std::vector<GLuint> textures(scene.images.size(), 0);
+    for (size_t i = 0; i < scene.images.size(); ++i)
+    {
+        const ImportedImage& image = scene.images[i];
+        GpuTexture texture;
+        if (!UCreateTextureFromPixels(filename, image.pixels, image.width, image.height, image.channels, texture))
+        {
+            UFreeImportedScene(scene);
+            return false;
+        }
+        textures[i] = texture;
+        gLoadedTextures.push_back(std::move(texture));
+    }
+
+    // Primitives no node instances get no GL objects, nothing would ever draw them
+    std::vector<bool> instanced(scene.primitives.size(), false);
+    for (size_t i = 0; i < scene.instances.size(); ++i)
+        instanced[scene.instances[i].primitive] = true;
+
+    std::vector<GLLoadedMesh> primitives(scene.primitives.size());
+    MeshOptimizeStats optimized = { { 0.0f, 0.0f }, { 0.0f, 0.0f }, 0 };
+    float optimizedTriangles = 0.0f;
+    for (size_t p = 0; p < scene.primitives.size(); ++p)
+    {
+        if (!instanced[p])
+            continue;
+        ImportedPrimitive& source = scene.primitives[p];
+
+        // Triangle-weighted average of the cache stats over all primitives
+        float triangles = source.lod.levels.empty() ? 0.0f : source.lod.levels[0].indexCount / 3.0f;
+        optimized.before.acmr += source.optimizeStats.before.acmr * triangles;
+        optimized.after.acmr += source.optimizeStats.after.acmr * triangles;
+        optimized.before.atvr += source.optimizeStats.before.atvr * triangles;
+        optimized.after.atvr += source.optimizeStats.after.atvr * triangles;
+        optimizedTriangles += triangles;
+
+        GLLoadedMesh& mesh = primitives[p];
+        LoadedBuffers buffers;
+        if (!UUploadMesh(filename, source.vertices, IMPORT_FLOATS_PER_VERTEX, source.indices, buffers.vao, buffers.vbo, buffers.ebo))
+        {
+            UFreeImportedScene(scene);
+            return false;
+        }
+        mesh.vao = buffers.vao;
+        mesh.lod = source.lod;
+        mesh.bvh = std::make_shared<MeshBvh>();
+        if (!source.lod.levels.empty())
+        {
+            const MeshLodLevel& finest = source.lod.levels[0];
+            UBuildMeshBvh(&source.vertices[0], IMPORT_FLOATS_PER_VERTEX, &source.indices[finest.indexOffset], finest.indexCount, *mesh.bvh);
+        }
+        mesh.textureId = source.imageIndex >= 0 && source.imageIndex < (int)textures.size() ? textures[source.imageIndex] : 0;
+        mesh.occluded = false;
+        gLoadedBuffers.push_back(std::move(buffers));
+    }
+
+    for (size_t i = 0; i < scene.instances.size(); ++i)
+    {
+        GLLoadedMesh instance = primitives[scene.instances[i].primitive];
+        instance.model = scene.instances[i].model;
+        gLoadedMeshes.push_back(instance);
+
+        // Coarser levels can bulge past the real surface, only the finest one is a safe occluder
+        const ImportedPrimitive& source = scene.primitives[scene.instances[i].primitive];
+        if (scene.instances[i].occluder && !source.lod.levels.empty())
+        {
+            const MeshLodLevel& finest = source.lod.levels[0];
+            UAddOccluder(source.vertices, IMPORT_FLOATS_PER_VERTEX, &source.indices[finest.indexOffset], finest.indexCount, instance.model);
+        }
+    }
+
+    UFreeImportedScene(scene);
+
+    ULOG_INFO("Imported {}: {} primitives, {} images, {} instances in {}s", filename, scene.primitives.size(), scene.images.size(),
+        scene.instances.size(), std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    if (optimizedTriangles > 0.0f)
+    {
+        ULOG_INFO("{} ACMR {} -> {}, ATVR {} -> {}", filename, optimized.before.acmr / optimizedTriangles, optimized.after.acmr / optimizedTriangles,
+            optimized.before.atvr / optimizedTriangles, optimized.after.atvr / optimizedTriangles);
+    }
+    return true;
+}
 
-    glDeleteVertexArrays(1, &mesh.vao_cylinder);
-    glDeleteBuffers(1, &mesh.vbo_cylinder);
-    glDeleteBuffers(1, &mesh.ebo_cylinder);
 
-    glDeleteVertexArrays(1, &mesh.vao_keyboard);
-    glDeleteBuffers(1, &mesh.vbo_keyboard);
-    glDeleteBuffers(1, &mesh.ebo_keyboard);
+void UDestroyMesh(GLMesh& mesh)
+{
+    mesh.vao_plane.reset();
+    mesh.vbo_plane.reset();
+    mesh.ebo_plane.reset();
+
+    mesh.vao_cylinder.reset();
+    mesh.vbo_cylinder.reset();
+    mesh.ebo_cylinder.reset();
+
+    mesh.vao_round.reset();
+    mesh.vbo_round.reset();
+    mesh.ebo_round.reset();
+
+    mesh.vao_keyboard.reset();
+    mesh.vbo_keyboard.reset();
+    mesh.ebo_keyboard.reset();
+
+    mesh.vao_lit_plane.reset();
+    mesh.vbo_lit_plane.reset();
+    mesh.ebo_lit_plane.reset();
+    mesh.vao_lit_cylinder.reset();
+    mesh.vbo_lit_cylinder.reset();
+    mesh.ebo_lit_cylinder.reset();
+    mesh.vao_lit_keyboard.reset();
+    mesh.vbo_lit_keyboard.reset();
+    mesh.ebo_lit_keyboard.reset();
+
+    gLoadedMeshes.clear();
+    gLoadedBuffers.clear();
 }
 
 
 
 /*Generate and load the texture*/
-bool UCreateTexture(const char* filename, GLuint& textureId)
+// Loads and flips an image; no GL calls, so it can run on a loading job
+bool UDecodeImage(const char* filename, DecodedImage& image)
 {
-    int width, height, channels;
-    unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
-    if (image)
-    {
-        flipImageVertically(image, width, height, channels);
-
-        glGenTextures(1, &textureId);
-        glBindTexture(GL_TEXTURE_2D, textureId);
-
-        // set the texture wrapping parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        // set texture filtering parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        if (channels == 3)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-        else if (channels == 4)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-        else
-        {
-            cout << "Not implemented to handle image with " << channels << " channels" << endl;
-            return false;
-        }
+    image.pixels = stbi_load(filename, &image.width, &image.height, &image.channels, 0);
+    if (!image.pixels)
+        return false; // Error loading the image
+
+    flipImageVertically(image.pixels, image.width, image.height, image.channels);
+    return true;
+}
+
+
+// Uploads a decoded image and frees its pixels
+bool UCreateTexture(const char* name, DecodedImage& image, GpuTexture& texture)
+{
+    bool created = UCreateTextureFromPixels(name, image.pixels, image.width, image.height, image.channels, texture);
+
+    stbi_image_free(image.pixels);
+    image.pixels = nullptr;
+    return created;
+}
 
-        glGenerateMipmap(GL_TEXTURE_2D);
 
-        stbi_image_free(image);
-        glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
+// Uploads decoded pixels (first row at t = 0) and builds the mip chain
+bool UCreateTextureFromPixels(const char* name, const unsigned char* image, int width, int height, int channels, GpuTexture& texture)
+{
+    if (channels != 3 && channels != 4)
+    {
+        ULOG_ERROR("Not implemented to handle image with {} channels", channels);
+        return false;
+    }
 
+    if (gSoftware)
+    {
+        // Keep an RGBA copy, rows stay in the flipped order GL would get them in
+        SoftTexture soft;
+        soft.width = width;
+        soft.height = height;
+        soft.pixels.resize((size_t)width * height * 4);
+        for (size_t p = 0; p < (size_t)width * height; ++p)
+        {
+            for (int c = 0; c < 4; ++c)
+                soft.pixels[p * 4 + c] = c < channels ? image[p * channels + c] : 255;
+        }
+        gSoftTextures.push_back(soft);
+        texture = GpuTexture((GLuint)gSoftTextures.size());
         return true;
     }
 
-    // Error loading the image
-    return false;
+    // GL textures start with their coarse mips, the finer ones follow as the camera gets close
+    return UCreateStreamedTexture(name, image, width, height, channels, texture);
 }
 
 
-void UDestroyTexture(GLuint textureId)
+void UDestroyTexture(GpuTexture& texture)
 {
-    glGenTextures(1, &textureId);
+    texture.reset();
 }
 
 
 // Implements the UCreateShaders function
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId)
+bool UCreateShaderProgram(const char* name, const char* vtxShaderSource, const char* fragShaderSource, GpuProgram& program)
 {
     // Compilation and linkage error reporting
     int success = 0;
     char infoLog[512];
 
     // Create a Shader program object.
-    programId = glCreateProgram();
+    if (!program.create(0, name))
+        return false;
+    GLuint programId = program;
 
     // Create the vertex and fragment shader objects
     GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
@@ -1035,8 +2689,11 @@ bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSou
     if (!success)
     {
         glGetShaderInfoLog(vertexShaderId, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
+        ULOG_ERROR("SHADER::VERTEX::COMPILATION_FAILED\n{}", infoLog);
 
+        glDeleteShader(vertexShaderId);
+        glDeleteShader(fragmentShaderId);
+        program.reset();
         return false;
     }
 
@@ -1046,8 +2703,11 @@ bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSou
     if (!success)
     {
         glGetShaderInfoLog(fragmentShaderId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+        ULOG_ERROR("SHADER::FRAGMENT::COMPILATION_FAILED\n{}", infoLog);
 
+        glDeleteShader(vertexShaderId);
+        glDeleteShader(fragmentShaderId);
+        program.reset();
         return false;
     }
 
@@ -1061,18 +2721,25 @@ bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSou
     if (!success)
     {
         glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+        ULOG_ERROR("SHADER::PROGRAM::LINKING_FAILED\n{}", infoLog);
 
+        glDeleteShader(vertexShaderId);
+        glDeleteShader(fragmentShaderId);
+        program.reset();
         return false;
     }
 
+    // The program keeps its own reference, the shader objects go away with it
+    glDeleteShader(vertexShaderId);
+    glDeleteShader(fragmentShaderId);
+
     glUseProgram(programId);    // Uses the shader program
 
     return true;
 }
 
 
-void UDestroyShaderProgram(GLuint programId)
+void UDestroyShaderProgram(GpuProgram& program)
 {
-    glDeleteProgram(programId);
+    program.reset();
 }
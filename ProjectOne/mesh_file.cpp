@@ -0,0 +1,451 @@
+#include "mesh_file.h"
+
+#include <algorithm>        // std::min, std::max
+#include <cstdio>           // fopen, fwrite
+#include <cstdlib>          // strtof, strtol
+#include <cstring>          // memcmp, memset
+
+#include "async_log.h"      // Load and converter messages
+#include "mesh_optimize.h"  // Cache and overdraw ordering when cooking
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>        // CreateFileMapping, MapViewOfFile
+#else
+#include <fcntl.h>          // open
+#include <sys/mman.h>       // mmap
+#include <sys/stat.h>       // fstat
+#include <unistd.h>         // close
+#endif
+
+using namespace std; // Standard namespace
+
+// Unnamed namespace
+namespace
+{
+    // LOD settings used when cooking meshes from OBJ
+    const int CONVERT_LOD_LEVELS = 4;
+    const float CONVERT_LOD_REDUCTION = 0.5f;
+
+    // Corners an OBJ face may have, larger polygons are rejected
+    const int OBJ_MAX_FACE_CORNERS = 64;
+
+    uint64_t alignUp(uint64_t value)
+    {
+        return (value + MESH_FILE_ALIGNMENT - 1) & ~(uint64_t)(MESH_FILE_ALIGNMENT - 1);
+    }
+
+    // Writes zero bytes until the file position reaches offset
+    bool padTo(FILE* file, uint64_t offset)
+    {
+        static const char zeros[MESH_FILE_ALIGNMENT] = { 0 };
+        long position = ftell(file);
+        if (position < 0 || (uint64_t)position > offset)
+            return false;
+        return fwrite(zeros, 1, (size_t)(offset - position), file) == offset - position;
+    }
+
+    // Reads a whole text file into memory
+    bool readFile(const char* filename, vector<char>& contents)
+    {
+        FILE* file = fopen(filename, "rb");
+        if (!file)
+            return false;
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        contents.resize(size > 0 ? size + 1 : 1);
+        size_t read = size > 0 ? fread(&contents[0], 1, size, file) : 0;
+        fclose(file);
+        contents.resize(read + 1);
+        contents[read] = '\0';
+        return true;
+    }
+
+    // Resolves a 1-based (or negative, relative) OBJ index to a 0-based one, -1 when absent
+    long objIndex(long index, size_t count)
+    {
+        if (index > 0)
+            return index - 1;
+        if (index < 0)
+            return (long)count + index;
+        return -1;
+    }
+
+    // Bytes of one component of a vertex attribute type, 0 for types the loader doesn't take
+    uint32_t componentBytes(uint32_t type)
+    {
+        switch (type)
+        {
+        case GL_FLOAT:
+        case GL_INT:
+        case GL_UNSIGNED_INT:
+            return 4;
+        case GL_HALF_FLOAT:
+        case GL_SHORT:
+        case GL_UNSIGNED_SHORT:
+            return 2;
+        case GL_BYTE:
+        case GL_UNSIGNED_BYTE:
+            return 1;
+        default:
+            return 0;
+        }
+    }
+}
+
+
+bool UMapMeshFile(const char* filename, MappedMeshFile& file)
+{
+    memset(&file, 0, sizeof(file));
+#ifndef _WIN32
+    file.fileDescriptor = -1;
+#endif
+
+#ifdef _WIN32
+    HANDLE fileHandle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(MeshFileHeader))
+    {
+        CloseHandle(fileHandle);
+        return false;
+    }
+
+    HANDLE mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mappingHandle)
+    {
+        CloseHandle(fileHandle);
+        return false;
+    }
+
+    file.base = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+    file.size = (size_t)fileSize.QuadPart;
+    file.fileHandle = fileHandle;
+    file.mappingHandle = mappingHandle;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(MeshFileHeader))
+    {
+        close(fd);
+        return false;
+    }
+
+    void* base = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    file.base = base == MAP_FAILED ? NULL : base;
+    file.size = (size_t)info.st_size;
+    file.fileDescriptor = fd;
+#endif
+
+    if (!file.base)
+    {
+        UUnmapMeshFile(file);
+        return false;
+    }
+
+    // Validate everything before handing out pointers into the mapping
+    const unsigned char* bytes = static_cast<const unsigned char*>(file.base);
+    const MeshFileHeader* header = reinterpret_cast<const MeshFileHeader*>(bytes);
+    uint64_t tablesEnd = sizeof(MeshFileHeader)
+        + (uint64_t)header->attributeCount * sizeof(MeshFileAttribute)
+        + (uint64_t)header->lodCount * sizeof(MeshFileLod);
+
+    bool valid = memcmp(header->magic, MESH_FILE_MAGIC, sizeof(MESH_FILE_MAGIC)) == 0
+        && header->version == MESH_FILE_VERSION
+        && header->vertexStride > 0
+        && tablesEnd <= header->vertexOffset
+        && header->vertexOffset % MESH_FILE_ALIGNMENT == 0
+        && header->indexOffset % MESH_FILE_ALIGNMENT == 0
+        && header->vertexBytes == (uint64_t)header->vertexCount * header->vertexStride
+        && header->indexBytes == (uint64_t)header->indexCount * sizeof(GLuint)
+        && header->vertexOffset <= file.size && header->vertexBytes <= file.size - header->vertexOffset
+        && header->indexOffset <= file.size && header->indexBytes <= file.size - header->indexOffset;
+
+    if (!valid)
+    {
+        ULOG_ERROR("Invalid or unsupported mesh file {}", filename);
+        UUnmapMeshFile(file);
+        return false;
+    }
+
+    file.header = header;
+    file.attributes = reinterpret_cast<const MeshFileAttribute*>(bytes + sizeof(MeshFileHeader));
+    file.lods = reinterpret_cast<const MeshFileLod*>(file.attributes + header->attributeCount);
+    file.vertices = bytes + header->vertexOffset;
+    file.indices = reinterpret_cast<const GLuint*>(bytes + header->indexOffset);
+
+    for (uint32_t i = 0; i < header->lodCount; ++i)
+    {
+        if ((uint64_t)file.lods[i].indexOffset + file.lods[i].indexCount > header->indexCount)
+        {
+            ULOG_ERROR("Invalid LOD range in mesh file {}", filename);
+            UUnmapMeshFile(file);
+            return false;
+        }
+    }
+
+    // Every attribute has to fit inside one vertex, the loader hands them to GL as they are
+    for (uint32_t i = 0; i < header->attributeCount; ++i)
+    {
+        const MeshFileAttribute& attribute = file.attributes[i];
+        uint32_t bytesPerComponent = componentBytes(attribute.type);
+        if (bytesPerComponent == 0 || attribute.components < 1 || attribute.components > 4
+            || attribute.offset > header->vertexStride || attribute.components * bytesPerComponent > header->vertexStride - attribute.offset)
+        {
+            ULOG_ERROR("Invalid vertex attribute {} in mesh file {}", i, filename);
+            UUnmapMeshFile(file);
+            return false;
+        }
+    }
+
+    // The indices go to the GPU and the pick BVH build as they are, one pass here covers both
+    for (uint32_t i = 0; i < header->indexCount; ++i)
+    {
+        if (file.indices[i] >= header->vertexCount)
+        {
+            ULOG_ERROR("Index {} out of range in mesh file {}", i, filename);
+            UUnmapMeshFile(file);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+void UUnmapMeshFile(MappedMeshFile& file)
+{
+#ifdef _WIN32
+    if (file.base)
+        UnmapViewOfFile(file.base);
+    if (file.mappingHandle)
+        CloseHandle(file.mappingHandle);
+    if (file.fileHandle)
+        CloseHandle(file.fileHandle);
+#else
+    if (file.base)
+        munmap(file.base, file.size);
+    if (file.fileDescriptor >= 0)
+        close(file.fileDescriptor);
+#endif
+    memset(&file, 0, sizeof(file));
+#ifndef _WIN32
+    file.fileDescriptor = -1;
+#endif
+}
+
+
+bool UWriteMeshFile(const char* filename, const vector<GLfloat>& vertices, GLuint floatsPerVertex,
+    const vector<GLuint>& indices, const MeshLodChain& lod)
+{
+    // Same attribute layout as the hand-authored meshes
+    MeshFileAttribute attributes[4] = {
+        { 0, 3, GL_FLOAT, 0 },                  // position
+        { 1, 3, GL_FLOAT, 3 * sizeof(float) },  // color
+        { 2, 2, GL_FLOAT, 6 * sizeof(float) },  // texture coordinate
+        { 3, 3, GL_FLOAT, 8 * sizeof(float) }   // normal
+    };
+    uint32_t attributeCount = floatsPerVertex >= 11 ? 4 : 3;
+
+    MeshFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MESH_FILE_MAGIC, sizeof(MESH_FILE_MAGIC));
+    header.version = MESH_FILE_VERSION;
+    header.attributeCount = attributeCount;
+    header.lodCount = (uint32_t)lod.levels.size();
+    header.vertexStride = floatsPerVertex * sizeof(GLfloat);
+    header.vertexCount = (uint32_t)(vertices.size() / floatsPerVertex);
+    header.indexCount = (uint32_t)indices.size();
+    header.vertexBytes = (uint64_t)header.vertexCount * header.vertexStride;
+    header.indexBytes = (uint64_t)header.indexCount * sizeof(GLuint);
+    header.vertexOffset = alignUp(sizeof(MeshFileHeader) + attributeCount * sizeof(MeshFileAttribute)
+        + header.lodCount * sizeof(MeshFileLod));
+    header.indexOffset = alignUp(header.vertexOffset + header.vertexBytes);
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        header.boundsMin[axis] = header.vertexCount ? vertices[axis] : 0.0f;
+        header.boundsMax[axis] = header.boundsMin[axis];
+    }
+    for (size_t v = 0; v < header.vertexCount; ++v)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            header.boundsMin[axis] = min(header.boundsMin[axis], vertices[v * floatsPerVertex + axis]);
+            header.boundsMax[axis] = max(header.boundsMax[axis], vertices[v * floatsPerVertex + axis]);
+        }
+    }
+
+    FILE* file = fopen(filename, "wb");
+    if (!file)
+    {
+        ULOG_ERROR("Failed to open {} for writing", filename);
+        return false;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(attributes, sizeof(MeshFileAttribute), attributeCount, file) == attributeCount;
+
+    for (size_t i = 0; ok && i < lod.levels.size(); ++i)
+    {
+        MeshFileLod level = { lod.levels[i].indexOffset, lod.levels[i].indexCount, lod.levels[i].geometricError, 0 };
+        ok = fwrite(&level, sizeof(level), 1, file) == 1;
+    }
+
+    ok = ok && padTo(file, header.vertexOffset)
+        && (header.vertexBytes == 0 || fwrite(&vertices[0], 1, (size_t)header.vertexBytes, file) == header.vertexBytes)
+        && padTo(file, header.indexOffset)
+        && (header.indexBytes == 0 || fwrite(&indices[0], 1, (size_t)header.indexBytes, file) == header.indexBytes);
+
+    fclose(file);
+
+    if (!ok)
+        ULOG_ERROR("Failed to write mesh file {}", filename);
+    return ok;
+}
+
+
+bool UConvertObjToMeshFile(const char* objFilename, const char* meshFilename)
+{
+    vector<char> text;
+    if (!readFile(objFilename, text))
+    {
+        ULOG_ERROR("Failed to read {}", objFilename);
+        return false;
+    }
+
+    vector<glm::vec3> positions;
+    vector<glm::vec2> uvs;
+    vector<glm::vec3> normals;
+    vector<GLfloat> corners;    // Interleaved triangle corners, 11 floats each
+    const GLuint floatsPerVertex = 11;
+
+    char* cursor = &text[0];
+    while (*cursor)
+    {
+        char* line = cursor;
+        while (*cursor && *cursor != '\n')
+            ++cursor;
+        if (*cursor)
+            *cursor++ = '\0';
+
+        while (*line == ' ' || *line == '\t')
+            ++line;
+
+        if (line[0] == 'v' && line[1] == ' ')
+        {
+            char* p = line + 2;
+            glm::vec3 v;
+            v.x = strtof(p, &p); v.y = strtof(p, &p); v.z = strtof(p, &p);
+            positions.push_back(v);
+        }
+        else if (line[0] == 'v' && line[1] == 't')
+        {
+            char* p = line + 2;
+            glm::vec2 t;
+            t.x = strtof(p, &p); t.y = strtof(p, &p);
+            uvs.push_back(t);
+        }
+        else if (line[0] == 'v' && line[1] == 'n')
+        {
+            char* p = line + 2;
+            glm::vec3 n;
+            n.x = strtof(p, &p); n.y = strtof(p, &p); n.z = strtof(p, &p);
+            normals.push_back(n);
+        }
+        else if (line[0] == 'f' && line[1] == ' ')
+        {
+            // Collect the polygon's corners as (position, uv, normal) index triples
+            long face[OBJ_MAX_FACE_CORNERS][3];
+            int cornerCount = 0;
+            char* p = line + 2;
+            for (;;)
+            {
+                while (*p == ' ' || *p == '\t' || *p == '\r')
+                    ++p;
+                if (!*p)
+                    break;
+                if (cornerCount == OBJ_MAX_FACE_CORNERS)
+                {
+                    ULOG_ERROR("Face with more than {} corners in {}", OBJ_MAX_FACE_CORNERS, objFilename);
+                    return false;
+                }
+
+                long v = strtol(p, &p, 10), t = 0, n = 0;
+                if (*p == '/')
+                {
+                    ++p;
+                    if (*p != '/')
+                        t = strtol(p, &p, 10);
+                    if (*p == '/')
+                    {
+                        ++p;
+                        n = strtol(p, &p, 10);
+                    }
+                }
+                while (*p && *p != ' ' && *p != '\t' && *p != '\r')
+                    ++p;
+
+                face[cornerCount][0] = objIndex(v, positions.size());
+                face[cornerCount][1] = objIndex(t, uvs.size());
+                face[cornerCount][2] = objIndex(n, normals.size());
+                if (face[cornerCount][0] < 0 || face[cornerCount][0] >= (long)positions.size())
+                {
+                    ULOG_ERROR("Invalid face index in {}", objFilename);
+                    return false;
+                }
+                ++cornerCount;
+            }
+
+            // Triangulate as a fan
+            for (int k = 1; k + 1 < cornerCount; ++k)
+            {
+                const long* tri[3] = { face[0], face[k], face[k + 1] };
+                glm::vec3 faceNormal = glm::cross(positions[tri[1][0]] - positions[tri[0][0]], positions[tri[2][0]] - positions[tri[0][0]]);
+                if (glm::length(faceNormal) > 0.0f)
+                    faceNormal = glm::normalize(faceNormal);
+
+                for (int c = 0; c < 3; ++c)
+                {
+                    glm::vec3 pos = positions[tri[c][0]];
+                    glm::vec2 uv = tri[c][1] >= 0 && tri[c][1] < (long)uvs.size() ? uvs[tri[c][1]] : glm::vec2(0.0f);
+                    glm::vec3 normal = tri[c][2] >= 0 && tri[c][2] < (long)normals.size() ? normals[tri[c][2]] : faceNormal;
+                    GLfloat vertex[11] = { pos.x, pos.y, pos.z, 1.0f, 1.0f, 1.0f, uv.x, uv.y, normal.x, normal.y, normal.z };
+                    corners.insert(corners.end(), vertex, vertex + floatsPerVertex);
+                }
+            }
+        }
+    }
+
+    if (corners.empty())
+    {
+        ULOG_ERROR("No triangles found in {}", objFilename);
+        return false;
+    }
+
+    vector<GLfloat> vertices;
+    vector<GLuint> baseIndices;
+    UWeldVertices(&corners[0], corners.size(), floatsPerVertex, vertices, baseIndices);
+
+    vector<GLuint> indices;
+    MeshLodChain lod;
+    UBuildLodChain(vertices, floatsPerVertex, baseIndices, CONVERT_LOD_LEVELS, CONVERT_LOD_REDUCTION, indices, lod);
+
+    // Cooking is the place for the expensive reordering, the loader just maps the result
+    MeshOptimizeStats stats = UOptimizeMesh(vertices, floatsPerVertex, indices, lod);
+
+    if (!UWriteMeshFile(meshFilename, vertices, floatsPerVertex, indices, lod))
+        return false;
+
+    ULOG_INFO("{} -> {}: {} vertices, {} triangles, {} LOD levels", objFilename, meshFilename, vertices.size() / floatsPerVertex,
+        baseIndices.size() / 3, lod.levels.size());
+    ULOG_INFO("ACMR {} -> {}, ATVR {} -> {}", stats.before.acmr, stats.after.acmr, stats.before.atvr, stats.after.atvr);
+    return true;
+}
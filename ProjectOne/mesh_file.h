@@ -0,0 +1,91 @@
+#ifndef MESH_FILE_H
+#define MESH_FILE_H
+
+#include <cstdint>
+#include <vector>
+#include <GLEW/glew.h>      // GLEW library
+
+#include "mesh_lod.h"       // LOD chains stored alongside the geometry
+
+/* Binary mesh container (.umesh), little endian:
+ *
+ *   MeshFileHeader
+ *   MeshFileAttribute[attributeCount]   vertex format, one entry per shader location
+ *   MeshFileLod[lodCount]               index ranges of the LOD chain, finest first
+ *   vertex blob                         interleaved, starts on a MESH_FILE_ALIGNMENT boundary
+ *   index blob                          GLuint, starts on a MESH_FILE_ALIGNMENT boundary
+ *
+ * The blobs are laid out exactly as glBufferData wants them, so the loader maps the
+ * file and passes the pointers straight through.
+ */
+const char MESH_FILE_MAGIC[4] = { 'U', 'M', 'S', 'H' };
+const uint32_t MESH_FILE_VERSION = 1;
+const uint32_t MESH_FILE_ALIGNMENT = 16;
+
+struct MeshFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t attributeCount;
+    uint32_t lodCount;
+    uint32_t vertexStride;      // Bytes per vertex
+    uint32_t vertexCount;
+    uint32_t indexCount;        // Total over all LOD levels
+    uint32_t reserved;
+    uint64_t vertexOffset;      // Byte offsets from the start of the file
+    uint64_t vertexBytes;
+    uint64_t indexOffset;
+    uint64_t indexBytes;
+    float boundsMin[3];
+    float boundsMax[3];
+};
+
+struct MeshFileAttribute
+{
+    uint32_t location;          // layout(location = n) in the vertex shader
+    uint32_t components;
+    uint32_t type;              // GL type enum, GL_FLOAT for everything we write
+    uint32_t offset;            // Byte offset inside the vertex
+};
+
+struct MeshFileLod
+{
+    uint32_t indexOffset;
+    uint32_t indexCount;
+    float geometricError;
+    uint32_t reserved;
+};
+
+// A .umesh file mapped into memory. The pointers stay valid until UUnmapMeshFile.
+struct MappedMeshFile
+{
+    const MeshFileHeader* header;
+    const MeshFileAttribute* attributes;
+    const MeshFileLod* lods;
+    const void* vertices;
+    const GLuint* indices;
+
+    void* base;                 // Start of the mapping
+    size_t size;
+#ifdef _WIN32
+    void* fileHandle;
+    void* mappingHandle;
+#else
+    int fileDescriptor;
+#endif
+};
+
+// Maps the file read-only and validates the header, the blob ranges and every index
+bool UMapMeshFile(const char* filename, MappedMeshFile& file);
+void UUnmapMeshFile(MappedMeshFile& file);
+
+/* Writes interleaved vertices in the layout the shaders use (position, color, uv, normal;
+ * floatsPerVertex of 8 drops the normal) plus every LOD level's indices.
+ */
+bool UWriteMeshFile(const char* filename, const std::vector<GLfloat>& vertices, GLuint floatsPerVertex,
+    const std::vector<GLuint>& indices, const MeshLodChain& lod);
+
+// Converter: parses a Wavefront OBJ, welds it, builds the LOD chain and writes a .umesh
+bool UConvertObjToMeshFile(const char* objFilename, const char* meshFilename);
+
+#endif
@@ -0,0 +1,551 @@
+#include "mesh_lod.h"
+
+#include <algorithm>        // std::max, std::min
+#include <cassert>          // assert
+#include <cmath>            // std::sqrt
+#include <cstring>          // memcmp
+#include <functional>       // std::greater
+#include <map>
+#include <queue>            // std::priority_queue
+#include <unordered_map>
+
+// Unnamed namespace
+namespace
+{
+    // Symmetric 4x4 error quadric, stored as its 10 unique entries plus the face area it covers
+    struct Quadric
+    {
+        double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+        double area;
+    };
+
+    const Quadric kZeroQuadric = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+    // Vertices at one position whose normal and UV differ by more than this sit on a hard edge or
+    // a UV seam; one side can't take over the other's attributes
+    const float SEAM_TOLERANCE = 0.5f;
+
+    // Builds the quadric of the plane ax + by + cz + d = 0, scaled by weight
+    Quadric planeQuadric(double a, double b, double c, double d, double weight)
+    {
+        Quadric q;
+        q.a2 = a * a * weight; q.ab = a * b * weight; q.ac = a * c * weight; q.ad = a * d * weight;
+        q.b2 = b * b * weight; q.bc = b * c * weight; q.bd = b * d * weight;
+        q.c2 = c * c * weight; q.cd = c * d * weight;
+        q.d2 = d * d * weight;
+        q.area = 0.0;
+        return q;
+    }
+
+    void addQuadric(Quadric& q, const Quadric& o)
+    {
+        q.a2 += o.a2; q.ab += o.ab; q.ac += o.ac; q.ad += o.ad;
+        q.b2 += o.b2; q.bc += o.bc; q.bd += o.bd;
+        q.c2 += o.c2; q.cd += o.cd;
+        q.d2 += o.d2;
+        q.area += o.area;
+    }
+
+    // Area-weighted squared distance of point p to the planes in the quadric, divided by
+    // the area so the result is a mean squared distance in object units
+    double evalQuadric(const Quadric& q, const glm::vec3& p)
+    {
+        double x = p.x, y = p.y, z = p.z;
+        double e = q.a2 * x * x + 2 * q.ab * x * y + 2 * q.ac * x * z + 2 * q.ad * x
+            + q.b2 * y * y + 2 * q.bc * y * z + 2 * q.bd * y
+            + q.c2 * z * z + 2 * q.cd * z
+            + q.d2;
+        if (e <= 0.0)
+            return 0.0;
+        return q.area > 0.0 ? e / q.area : e;
+    }
+
+    // Candidate half-edge collapse: vertex "from" moves onto vertex "to"
+    struct Collapse
+    {
+        double cost;
+        GLuint from;
+        GLuint to;
+        unsigned stampFrom;
+        unsigned stampTo;
+
+        bool operator>(const Collapse& other) const { return cost > other.cost; }
+    };
+
+    glm::vec3 positionOf(const std::vector<GLfloat>& vertices, GLuint floatsPerVertex, GLuint index)
+    {
+        const GLfloat* v = &vertices[(size_t)index * floatsPerVertex];
+        return glm::vec3(v[0], v[1], v[2]);
+    }
+
+    // Squared distance between the attributes (everything after the position) of two vertices
+    float attributeDistance(const std::vector<GLfloat>& vertices, GLuint floatsPerVertex, GLuint a, GLuint b)
+    {
+        const GLfloat* va = &vertices[(size_t)a * floatsPerVertex];
+        const GLfloat* vb = &vertices[(size_t)b * floatsPerVertex];
+        float sum = 0.0f;
+        for (GLuint k = 3; k < floatsPerVertex; ++k)
+            sum += (va[k] - vb[k]) * (va[k] - vb[k]);
+        return sum;
+    }
+
+    // Runs quadric edge collapse on one index list until targetTriangles is reached.
+    // Returns the largest collapse error (as a distance) that was accepted.
+    float simplify(const std::vector<GLfloat>& vertices, GLuint floatsPerVertex,
+        const std::vector<GLuint>& indices, size_t targetTriangles, std::vector<GLuint>& result)
+    {
+        const size_t vertexCount = vertices.size() / floatsPerVertex;
+        const size_t triangleCount = indices.size() / 3;
+
+        // Vertices at one position differ only in their normal or UV (faceted meshes have one per
+        // face). Collapses move whole positions, and every vertex at the collapsed position takes
+        // over the attributes of a vertex at the target.
+        std::vector<GLuint> groupOf(vertexCount);
+        std::vector<GLuint> groupVertex;        // One vertex per position, for its coordinates
+        std::map<std::vector<float>, GLuint> groupAtPosition;
+        for (size_t v = 0; v < vertexCount; ++v)
+        {
+            glm::vec3 p = positionOf(vertices, floatsPerVertex, (GLuint)v);
+            std::vector<float> key(3);
+            key[0] = p.x; key[1] = p.y; key[2] = p.z;
+            std::map<std::vector<float>, GLuint>::iterator it = groupAtPosition.find(key);
+            if (it == groupAtPosition.end())
+            {
+                it = groupAtPosition.insert(std::make_pair(key, (GLuint)groupVertex.size())).first;
+                groupVertex.push_back((GLuint)v);
+            }
+            groupOf[v] = it->second;
+        }
+        const size_t groupCount = groupVertex.size();
+
+        std::vector<GLuint> tris(indices);
+        std::vector<bool> triAlive(triangleCount, true);
+        std::vector<std::vector<GLuint> > groupTris(groupCount);
+        std::vector<Quadric> quadrics(groupCount, kZeroQuadric);
+        std::vector<unsigned> stamps(groupCount, 0);
+        std::vector<bool> removed(groupCount, false);
+
+        for (size_t t = 0; t < triangleCount; ++t)
+        {
+            for (int k = 0; k < 3; ++k)
+                groupTris[groupOf[tris[t * 3 + k]]].push_back((GLuint)t);
+        }
+
+        // Face quadrics, weighted by area
+        std::map<std::pair<GLuint, GLuint>, int> edgeUse;
+        for (size_t t = 0; t < triangleCount; ++t)
+        {
+            GLuint i0 = tris[t * 3], i1 = tris[t * 3 + 1], i2 = tris[t * 3 + 2];
+            glm::vec3 p0 = positionOf(vertices, floatsPerVertex, i0);
+            glm::vec3 p1 = positionOf(vertices, floatsPerVertex, i1);
+            glm::vec3 p2 = positionOf(vertices, floatsPerVertex, i2);
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+            float area = glm::length(n);
+            if (area <= 0.0f)
+                continue;
+            n /= area;
+            Quadric q = planeQuadric(n.x, n.y, n.z, -glm::dot(n, p0), area * 0.5);
+            q.area = area * 0.5;
+            addQuadric(quadrics[groupOf[i0]], q);
+            addQuadric(quadrics[groupOf[i1]], q);
+            addQuadric(quadrics[groupOf[i2]], q);
+
+            GLuint corners[3] = { groupOf[i0], groupOf[i1], groupOf[i2] };
+            for (int k = 0; k < 3; ++k)
+            {
+                GLuint a = corners[k], b = corners[(k + 1) % 3];
+                edgeUse[std::make_pair(std::min(a, b), std::max(a, b))]++;
+            }
+        }
+
+        // Border edges get a perpendicular constraint plane so open edges keep their outline
+        for (size_t t = 0; t < triangleCount; ++t)
+        {
+            GLuint corners[3] = { tris[t * 3], tris[t * 3 + 1], tris[t * 3 + 2] };
+            glm::vec3 p0 = positionOf(vertices, floatsPerVertex, corners[0]);
+            glm::vec3 faceNormal = glm::cross(positionOf(vertices, floatsPerVertex, corners[1]) - p0,
+                positionOf(vertices, floatsPerVertex, corners[2]) - p0);
+            if (glm::length(faceNormal) <= 0.0f)
+                continue;
+            faceNormal = glm::normalize(faceNormal);
+
+            for (int k = 0; k < 3; ++k)
+            {
+                GLuint a = groupOf[corners[k]], b = groupOf[corners[(k + 1) % 3]];
+                if (edgeUse[std::make_pair(std::min(a, b), std::max(a, b))] != 1)
+                    continue;
+                glm::vec3 pa = positionOf(vertices, floatsPerVertex, corners[k]);
+                glm::vec3 edge = positionOf(vertices, floatsPerVertex, corners[(k + 1) % 3]) - pa;
+                glm::vec3 n = glm::cross(edge, faceNormal);
+                float len = glm::length(n);
+                if (len <= 0.0f)
+                    continue;
+                n /= len;
+                Quadric q = planeQuadric(n.x, n.y, n.z, -glm::dot(n, pa), glm::dot(edge, edge) * 10.0);
+                addQuadric(quadrics[a], q);
+                addQuadric(quadrics[b], q);
+            }
+        }
+
+        std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse> > heap;
+
+        // Queues both directions of every edge around position group g
+        auto pushEdges = [&](GLuint g)
+        {
+            for (GLuint t : groupTris[g])
+            {
+                if (!triAlive[t])
+                    continue;
+                for (int k = 0; k < 3; ++k)
+                {
+                    GLuint other = groupOf[tris[t * 3 + k]];
+                    if (other == g)
+                        continue;
+                    GLuint pairs[2][2] = { { g, other }, { other, g } };
+                    for (int d = 0; d < 2; ++d)
+                    {
+                        GLuint from = pairs[d][0], to = pairs[d][1];
+                        Quadric q = quadrics[from];
+                        addQuadric(q, quadrics[to]);
+                        Collapse c = { evalQuadric(q, positionOf(vertices, floatsPerVertex, groupVertex[to])), from, to, stamps[from], stamps[to] };
+                        heap.push(c);
+                    }
+                }
+            }
+        };
+
+        for (size_t g = 0; g < groupCount; ++g)
+            pushEdges((GLuint)g);
+
+        size_t liveTriangles = triangleCount;
+        double maxCost = 0.0;
+
+        // Vertex at "from" -> vertex at "to" it turns into; the first direct ones share a dying triangle
+        std::vector<std::pair<GLuint, GLuint> > moved;
+
+        while (liveTriangles > targetTriangles && !heap.empty())
+        {
+            Collapse c = heap.top();
+            heap.pop();
+
+            if (removed[c.from] || removed[c.to] || stamps[c.from] != c.stampFrom || stamps[c.to] != c.stampTo)
+                continue; // stale candidate
+
+            glm::vec3 target = positionOf(vertices, floatsPerVertex, groupVertex[c.to]);
+
+            // A vertex on a dying triangle turns into that triangle's vertex at "to", so its attributes
+            // carry on along the same face. Reject collapses that would flip or squash a surviving triangle.
+            moved.clear();
+            bool valid = true;
+            for (GLuint t : groupTris[c.from])
+            {
+                if (!triAlive[t])
+                    continue;
+                GLuint* corner = &tris[t * 3];
+                int fromCorner = -1, toCorner = -1;
+                for (int k = 0; k < 3; ++k)
+                {
+                    if (groupOf[corner[k]] == c.from)
+                        fromCorner = k;
+                    else if (groupOf[corner[k]] == c.to)
+                        toCorner = k;
+                }
+
+                if (toCorner >= 0)
+                {
+                    size_t m = 0;
+                    while (m < moved.size() && moved[m].first != corner[fromCorner])
+                        ++m;
+                    if (m == moved.size())
+                        moved.push_back(std::make_pair(corner[fromCorner], corner[toCorner]));
+                    else if (attributeDistance(vertices, floatsPerVertex, corner[fromCorner], corner[toCorner])
+                        < attributeDistance(vertices, floatsPerVertex, corner[fromCorner], moved[m].second))
+                        moved[m].second = corner[toCorner];
+                    continue; // this triangle collapses away
+                }
+
+                glm::vec3 before[3], after[3];
+                for (int k = 0; k < 3; ++k)
+                {
+                    before[k] = positionOf(vertices, floatsPerVertex, corner[k]);
+                    after[k] = k == fromCorner ? target : before[k];
+                }
+                glm::vec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+                glm::vec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+                float l0 = glm::length(n0), l1 = glm::length(n1);
+                if (l1 <= 1e-12f || (l0 > 0.0f && glm::dot(n0, n1) < 0.2f * l0 * l1))
+                {
+                    valid = false;
+                    break;
+                }
+            }
+            const size_t direct = moved.size();
+            if (!valid || direct == 0)
+                continue;
+
+            // The other vertices at "from" go wherever their closest direct one goes. One with no
+            // close match is across a hard edge or a UV seam, and the collapse would smear it.
+            for (GLuint t : groupTris[c.from])
+            {
+                if (!triAlive[t] || !valid)
+                    continue;
+                for (int k = 0; k < 3; ++k)
+                {
+                    GLuint v = tris[t * 3 + k];
+                    if (groupOf[v] != c.from)
+                        continue;
+                    size_t m = 0;
+                    while (m < moved.size() && moved[m].first != v)
+                        ++m;
+                    if (m < moved.size())
+                        continue;
+
+                    size_t best = 0;
+                    float bestDistance = attributeDistance(vertices, floatsPerVertex, v, moved[0].first);
+                    for (size_t d = 1; d < direct; ++d)
+                    {
+                        float distance = attributeDistance(vertices, floatsPerVertex, v, moved[d].first);
+                        if (distance < bestDistance)
+                        {
+                            best = d;
+                            bestDistance = distance;
+                        }
+                    }
+                    if (bestDistance > SEAM_TOLERANCE * SEAM_TOLERANCE)
+                        valid = false;
+                    moved.push_back(std::make_pair(v, moved[best].second));
+                }
+            }
+            if (!valid)
+                continue;
+
+            // Apply: triangles that share the edge die, the rest move over to "to"
+            for (GLuint t : groupTris[c.from])
+            {
+                if (!triAlive[t])
+                    continue;
+                GLuint* corner = &tris[t * 3];
+                if (groupOf[corner[0]] == c.to || groupOf[corner[1]] == c.to || groupOf[corner[2]] == c.to)
+                {
+                    triAlive[t] = false;
+                    --liveTriangles;
+                    continue;
+                }
+                for (int k = 0; k < 3; ++k)
+                {
+                    if (groupOf[corner[k]] != c.from)
+                        continue;
+                    for (size_t m = 0; m < moved.size(); ++m)
+                    {
+                        if (moved[m].first == corner[k])
+                        {
+                            corner[k] = moved[m].second;
+                            break;
+                        }
+                    }
+                }
+                groupTris[c.to].push_back(t);
+            }
+
+            addQuadric(quadrics[c.to], quadrics[c.from]);
+            removed[c.from] = true;
+            maxCost = std::max(maxCost, c.cost);
+
+            // Every neighbour of "to" now has stale costs
+            ++stamps[c.to];
+            for (GLuint t : groupTris[c.to])
+            {
+                if (!triAlive[t])
+                    continue;
+                for (int k = 0; k < 3; ++k)
+                    ++stamps[groupOf[tris[t * 3 + k]]];
+            }
+            pushEdges(c.to);
+            for (GLuint t : groupTris[c.to])
+            {
+                if (!triAlive[t])
+                    continue;
+                for (int k = 0; k < 3; ++k)
+                {
+                    if (groupOf[tris[t * 3 + k]] != c.to)
+                        pushEdges(groupOf[tris[t * 3 + k]]);
+                }
+            }
+        }
+
+        result.clear();
+        for (size_t t = 0; t < triangleCount; ++t)
+        {
+            if (!triAlive[t])
+                continue;
+            result.push_back(tris[t * 3]);
+            result.push_back(tris[t * 3 + 1]);
+            result.push_back(tris[t * 3 + 2]);
+        }
+
+        return (float)std::sqrt(maxCost);
+    }
+}
+
+
+// Welds identical interleaved vertices into a shared vertex list plus indices
+void UWeldVertices(const GLfloat* vertices, size_t floatCount, GLuint floatsPerVertex,
+    std::vector<GLfloat>& outVertices, std::vector<GLuint>& outIndices)
+{
+    const size_t vertexCount = floatCount / floatsPerVertex;
+    const size_t vertexBytes = sizeof(GLfloat) * floatsPerVertex;
+
+    // Hash the raw bytes of the vertex, collisions are resolved with memcmp
+    std::unordered_multimap<size_t, GLuint> lookup;
+    outVertices.clear();
+    outIndices.clear();
+    outIndices.reserve(vertexCount);
+
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        const GLfloat* src = vertices + v * floatsPerVertex;
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(src);
+        size_t hash = 14695981039346656037ull;
+        for (size_t b = 0; b < vertexBytes; ++b)
+            hash = (hash ^ bytes[b]) * 1099511628211ull;
+
+        GLuint found = (GLuint)-1;
+        auto range = lookup.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (memcmp(&outVertices[(size_t)it->second * floatsPerVertex], src, vertexBytes) == 0)
+            {
+                found = it->second;
+                break;
+            }
+        }
+
+        if (found == (GLuint)-1)
+        {
+            found = (GLuint)(outVertices.size() / floatsPerVertex);
+            outVertices.insert(outVertices.end(), src, src + floatsPerVertex);
+            lookup.insert(std::make_pair(hash, found));
+        }
+        outIndices.push_back(found);
+    }
+}
+
+
+void UComputeLodBounds(const std::vector<GLfloat>& vertices, GLuint floatsPerVertex, MeshLodChain& chain)
+{
+    const size_t vertexCount = vertices.size() / floatsPerVertex;
+    if (vertexCount == 0)
+    {
+        chain.center = glm::vec3(0.0f);
+        chain.radius = 0.0f;
+        chain.boundsMin = chain.boundsMax = glm::vec3(0.0f);
+        return;
+    }
+
+    glm::vec3 minPos = positionOf(vertices, floatsPerVertex, 0);
+    glm::vec3 maxPos = minPos;
+    for (size_t v = 1; v < vertexCount; ++v)
+    {
+        glm::vec3 p = positionOf(vertices, floatsPerVertex, (GLuint)v);
+        minPos = glm::min(minPos, p);
+        maxPos = glm::max(maxPos, p);
+    }
+
+    chain.boundsMin = minPos;
+    chain.boundsMax = maxPos;
+    chain.center = (minPos + maxPos) * 0.5f;
+    chain.radius = 0.0f;
+    for (size_t v = 0; v < vertexCount; ++v)
+        chain.radius = std::max(chain.radius, glm::distance(chain.center, positionOf(vertices, floatsPerVertex, (GLuint)v)));
+}
+
+
+void UAddLodLevel(MeshLodChain& chain, const std::vector<GLuint>& levelIndices, float geometricError,
+    std::vector<GLuint>& allIndices)
+{
+    MeshLodLevel level;
+    level.indexOffset = (GLuint)allIndices.size();
+    level.indexCount = (GLuint)levelIndices.size();
+    level.geometricError = geometricError;
+    allIndices.insert(allIndices.end(), levelIndices.begin(), levelIndices.end());
+    chain.levels.push_back(level);
+}
+
+
+void UBuildLodChain(const std::vector<GLfloat>& vertices, GLuint floatsPerVertex,
+    const std::vector<GLuint>& baseIndices, int maxLevels, float reductionRatio,
+    std::vector<GLuint>& allIndices, MeshLodChain& chain)
+{
+    chain.levels.clear();
+    chain.currentLevel = 0;
+    UComputeLodBounds(vertices, floatsPerVertex, chain);
+    UAddLodLevel(chain, baseIndices, 0.0f, allIndices);
+
+    std::vector<GLuint> previous(baseIndices);
+    float error = 0.0f;
+
+    for (int level = 1; level < maxLevels; ++level)
+    {
+        size_t previousTriangles = previous.size() / 3;
+        size_t target = (size_t)(previousTriangles * reductionRatio);
+        if (target < 4)
+            break;
+
+        std::vector<GLuint> simplified;
+        float levelError = simplify(vertices, floatsPerVertex, previous, target, simplified);
+
+        // Stop once the simplifier can't get at least 10% further, the level wouldn't pay for itself
+        if (simplified.size() / 3 > previousTriangles * 9 / 10)
+            break;
+
+        // Errors only accumulate, so a coarser level never claims to be more accurate
+        error = std::max(error, levelError);
+        UAddLodLevel(chain, simplified, error, allIndices);
+        previous.swap(simplified);
+    }
+}
+
+
+const MeshLodLevel& USelectLod(MeshLodChain& chain, const glm::mat4& model, const glm::vec3& cameraPosition,
+    float projectionScale, float maxPixelError, float hysteresis, LodStats& stats)
+{
+    // Every chain has at least the full-detail level, UBuildLodChain or UAddLodLevel adds it
+    assert(!chain.levels.empty());
+    const int levelCount = (int)chain.levels.size();
+
+    // Largest axis scale of the model matrix, so the errors are in world units
+    float scale = std::max(glm::length(glm::vec3(model[0])),
+        std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+    glm::vec3 center = glm::vec3(model * glm::vec4(chain.center, 1.0f));
+    float distance = glm::distance(center, cameraPosition) - chain.radius * scale;
+    distance = std::max(distance, 0.1f); // inside the bounds: use the near plane
+
+    float pixelsPerUnit = projectionScale * scale / distance;
+
+    // Coarsest level we can switch down to (with the hysteresis margin)
+    int coarser = 0;
+    for (int level = levelCount - 1; level > 0; --level)
+    {
+        if (chain.levels[level].geometricError * pixelsPerUnit <= maxPixelError * (1.0f - hysteresis))
+        {
+            coarser = level;
+            break;
+        }
+    }
+
+    int current = std::min(chain.currentLevel, levelCount - 1);
+    if (coarser > current)
+        current = coarser;
+    else if (chain.levels[current].geometricError * pixelsPerUnit > maxPixelError)
+    {
+        // Too coarse for this distance, refine straight away to the first level that fits
+        while (current > 0 && chain.levels[current].geometricError * pixelsPerUnit > maxPixelError)
+            --current;
+    }
+    chain.currentLevel = current;
+
+    stats.trianglesFull += chain.levels[0].indexCount / 3;
+    stats.trianglesDrawn += chain.levels[current].indexCount / 3;
+
+    return chain.levels[current];
+}
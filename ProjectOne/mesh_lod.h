@@ -0,0 +1,66 @@
+#ifndef MESH_LOD_H
+#define MESH_LOD_H
+
+#include <vector>
+#include <GLEW/glew.h>      // GLEW library
+
+// GLM Math Header inclusions
+#include <glm/glm.hpp>
+
+// One level of detail: a range inside the mesh's shared index buffer
+struct MeshLodLevel
+{
+    GLuint indexOffset;      // First index of this level inside the element buffer
+    GLuint indexCount;       // Number of indices (3 per triangle)
+    float geometricError;    // Largest surface deviation from level 0, in object units
+};
+
+// Chain of levels for one mesh, finest first. All levels share one VBO and one EBO.
+struct MeshLodChain
+{
+    std::vector<MeshLodLevel> levels;
+    glm::vec3 center;        // Bounding sphere in object space, used for the distance estimate
+    float radius;
+    glm::vec3 boundsMin;     // Bounding box in object space, used for culling
+    glm::vec3 boundsMax;
+    int currentLevel;        // Level picked last frame, needed for hysteresis
+};
+
+// Per-frame counters so we can see what the LOD selection buys us
+struct LodStats
+{
+    unsigned long trianglesFull;     // Triangles we would have drawn at level 0
+    unsigned long trianglesDrawn;    // Triangles actually submitted
+};
+
+/* Welds identical interleaved vertices so the mesh can be drawn with an index buffer.
+ * floatsPerVertex is the full stride (position must be the first 3 floats).
+ */
+void UWeldVertices(const GLfloat* vertices, size_t floatCount, GLuint floatsPerVertex,
+    std::vector<GLfloat>& outVertices, std::vector<GLuint>& outIndices);
+
+/* Builds a LOD chain by quadric edge collapse. Level 0 is baseIndices; each following
+ * level targets reductionRatio of the previous triangle count until maxLevels is reached
+ * or the mesh can't be simplified any further. All level indices are appended to allIndices.
+ */
+void UBuildLodChain(const std::vector<GLfloat>& vertices, GLuint floatsPerVertex,
+    const std::vector<GLuint>& baseIndices, int maxLevels, float reductionRatio,
+    std::vector<GLuint>& allIndices, MeshLodChain& chain);
+
+// Appends a hand-authored level (indices into the same vertex buffer) to the chain. Levels go
+// finest first, so the first one added is the full-detail mesh.
+void UAddLodLevel(MeshLodChain& chain, const std::vector<GLuint>& levelIndices, float geometricError,
+    std::vector<GLuint>& allIndices);
+
+// Computes the bounding sphere and box of the chain from the vertex positions
+void UComputeLodBounds(const std::vector<GLfloat>& vertices, GLuint floatsPerVertex, MeshLodChain& chain);
+
+/* Picks the level whose projected error stays under maxPixelError.
+ * projectionScale is viewportHeight / (2 * tan(fovY / 2)). The chain only switches to a
+ * coarser level once the error is below maxPixelError * (1 - hysteresis), so levels don't
+ * flicker when the camera sits near a threshold.
+ */
+const MeshLodLevel& USelectLod(MeshLodChain& chain, const glm::mat4& model, const glm::vec3& cameraPosition,
+    float projectionScale, float maxPixelError, float hysteresis, LodStats& stats);
+
+#endif
@@ -0,0 +1,300 @@
+#include "mesh_optimize.h"
+
+#include <algorithm>        // std::stable_sort
+
+// GLM Math Header inclusions
+#include <glm/glm.hpp>
+
+// Unnamed namespace
+namespace
+{
+    // Vertex-to-triangle adjacency in compressed form
+    struct Adjacency
+    {
+        std::vector<GLuint> offsets;    // vertexCount + 1 entries
+        std::vector<GLuint> triangles;
+    };
+
+    void buildAdjacency(const GLuint* indices, size_t indexCount, size_t vertexCount, Adjacency& adjacency)
+    {
+        adjacency.offsets.assign(vertexCount + 1, 0);
+        for (size_t i = 0; i < indexCount; ++i)
+            ++adjacency.offsets[indices[i] + 1];
+        for (size_t v = 0; v < vertexCount; ++v)
+            adjacency.offsets[v + 1] += adjacency.offsets[v];
+
+        adjacency.triangles.resize(indexCount);
+        std::vector<GLuint> fill(adjacency.offsets.begin(), adjacency.offsets.end() - 1);
+        for (size_t i = 0; i < indexCount; ++i)
+            adjacency.triangles[fill[indices[i]]++] = (GLuint)(i / 3);
+    }
+
+    // Tipsify: next fanning vertex after a dead end. Recently used vertices first, then a linear scan.
+    int skipDeadEnd(std::vector<GLuint>& deadEnd, const std::vector<int>& liveTriangles, size_t& cursor, size_t vertexCount)
+    {
+        while (!deadEnd.empty())
+        {
+            GLuint d = deadEnd.back();
+            deadEnd.pop_back();
+            if (liveTriangles[d] > 0)
+                return (int)d;
+        }
+        while (cursor < vertexCount)
+        {
+            if (liveTriangles[cursor] > 0)
+                return (int)cursor;
+            ++cursor;
+        }
+        return -1;
+    }
+
+    glm::vec3 positionOf(const std::vector<GLfloat>& vertices, GLuint floatsPerVertex, GLuint index)
+    {
+        const GLfloat* v = &vertices[(size_t)index * floatsPerVertex];
+        return glm::vec3(v[0], v[1], v[2]);
+    }
+}
+
+
+VertexCacheStats UAnalyzeVertexCache(const GLuint* indices, size_t indexCount, size_t vertexCount)
+{
+    VertexCacheStats stats = { 0.0f, 0.0f };
+    if (indexCount < 3)
+        return stats;
+
+    // FIFO cache: a vertex is in the cache if it was pushed within the last VERTEX_CACHE_SIZE misses
+    std::vector<size_t> pushedAt(vertexCount, 0);
+    std::vector<bool> referenced(vertexCount, false);
+    size_t misses = 0;
+    size_t unique = 0;
+
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        GLuint v = indices[i];
+        if (!referenced[v])
+        {
+            referenced[v] = true;
+            ++unique;
+        }
+        if (pushedAt[v] == 0 || misses - pushedAt[v] >= VERTEX_CACHE_SIZE)
+        {
+            ++misses;
+            pushedAt[v] = misses;
+        }
+    }
+
+    stats.acmr = (float)misses / (float)(indexCount / 3);
+    stats.atvr = (float)misses / (float)unique;
+    return stats;
+}
+
+
+void UOptimizeVertexCache(GLuint* indices, size_t indexCount, size_t vertexCount, std::vector<size_t>& clusterStarts)
+{
+    clusterStarts.clear();
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+        return;
+
+    Adjacency adjacency;
+    buildAdjacency(indices, indexCount, vertexCount, adjacency);
+
+    std::vector<int> liveTriangles(vertexCount, 0);
+    for (size_t v = 0; v < vertexCount; ++v)
+        liveTriangles[v] = (int)(adjacency.offsets[v + 1] - adjacency.offsets[v]);
+
+    std::vector<size_t> cacheTime(vertexCount, 0);
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<GLuint> deadEnd;
+    std::vector<GLuint> candidates;
+    std::vector<GLuint> output;
+    output.reserve(indexCount);
+
+    size_t timestamp = VERTEX_CACHE_SIZE + 1;
+    size_t cursor = 0;
+    int fanning = skipDeadEnd(deadEnd, liveTriangles, cursor, vertexCount);
+    clusterStarts.push_back(0);
+
+    while (fanning >= 0)
+    {
+        candidates.clear();
+
+        // Emit every remaining triangle around the fanning vertex
+        for (GLuint a = adjacency.offsets[fanning]; a < adjacency.offsets[fanning + 1]; ++a)
+        {
+            GLuint t = adjacency.triangles[a];
+            if (emitted[t])
+                continue;
+            emitted[t] = true;
+
+            for (int k = 0; k < 3; ++k)
+            {
+                GLuint v = indices[t * 3 + k];
+                output.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                --liveTriangles[v];
+                if (timestamp - cacheTime[v] > VERTEX_CACHE_SIZE)
+                    cacheTime[v] = timestamp++;
+            }
+        }
+
+        // Next fanning vertex: the candidate that will still be in the cache after its own triangles, oldest first
+        int best = -1;
+        size_t bestPriority = 0;
+        for (size_t c = 0; c < candidates.size(); ++c)
+        {
+            GLuint v = candidates[c];
+            if (liveTriangles[v] <= 0)
+                continue;
+            size_t priority = 0;
+            if (timestamp - cacheTime[v] + 2 * liveTriangles[v] <= VERTEX_CACHE_SIZE)
+                priority = timestamp - cacheTime[v];
+            if (best < 0 || priority > bestPriority)
+            {
+                best = (int)v;
+                bestPriority = priority;
+            }
+        }
+
+        if (best < 0)
+        {
+            // Dead end: whatever we jump to starts a new cluster
+            best = skipDeadEnd(deadEnd, liveTriangles, cursor, vertexCount);
+            if (best >= 0 && output.size() / 3 < triangleCount)
+                clusterStarts.push_back(output.size() / 3);
+        }
+        fanning = best;
+    }
+
+    std::copy(output.begin(), output.end(), indices);
+}
+
+
+void UOptimizeOverdraw(GLuint* indices, size_t indexCount, const std::vector<GLfloat>& vertices, GLuint floatsPerVertex,
+    const std::vector<size_t>& clusterStarts)
+{
+    const size_t triangleCount = indexCount / 3;
+    if (clusterStarts.size() < 2)
+        return; // one cluster, nothing to sort
+
+    // Mesh centroid, area weighted
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        glm::vec3 p0 = positionOf(vertices, floatsPerVertex, indices[t * 3]);
+        glm::vec3 p1 = positionOf(vertices, floatsPerVertex, indices[t * 3 + 1]);
+        glm::vec3 p2 = positionOf(vertices, floatsPerVertex, indices[t * 3 + 2]);
+        float area = glm::length(glm::cross(p1 - p0, p2 - p0));
+        meshCentroid += (p0 + p1 + p2) * (area / 3.0f);
+        meshArea += area;
+    }
+    if (meshArea > 0.0f)
+        meshCentroid /= meshArea;
+
+    // Occlusion potential of each cluster: how far it sits out along its own normal
+    struct Cluster
+    {
+        size_t begin;
+        size_t end;
+        float sortKey;
+    };
+    std::vector<Cluster> clusters;
+    for (size_t c = 0; c < clusterStarts.size(); ++c)
+    {
+        Cluster cluster;
+        cluster.begin = clusterStarts[c];
+        cluster.end = c + 1 < clusterStarts.size() ? clusterStarts[c + 1] : triangleCount;
+
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = cluster.begin; t < cluster.end; ++t)
+        {
+            glm::vec3 p0 = positionOf(vertices, floatsPerVertex, indices[t * 3]);
+            glm::vec3 p1 = positionOf(vertices, floatsPerVertex, indices[t * 3 + 1]);
+            glm::vec3 p2 = positionOf(vertices, floatsPerVertex, indices[t * 3 + 2]);
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+            float triangleArea = glm::length(n);
+            centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            normal += n;
+            area += triangleArea;
+        }
+        if (area > 0.0f)
+            centroid /= area;
+        float normalLength = glm::length(normal);
+        cluster.sortKey = normalLength > 0.0f ? glm::dot(centroid - meshCentroid, normal / normalLength) : 0.0f;
+        clusters.push_back(cluster);
+    }
+
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+    std::vector<GLuint> sorted;
+    sorted.reserve(triangleCount * 3);
+    for (size_t c = 0; c < clusters.size(); ++c)
+        sorted.insert(sorted.end(), indices + clusters[c].begin * 3, indices + clusters[c].end * 3);
+    std::copy(sorted.begin(), sorted.end(), indices);
+}
+
+
+void UOptimizeVertexFetch(std::vector<GLfloat>& vertices, GLuint floatsPerVertex, std::vector<GLuint>& indices)
+{
+    const size_t vertexCount = vertices.size() / floatsPerVertex;
+    const GLuint unassigned = (GLuint)-1;
+    std::vector<GLuint> remap(vertexCount, unassigned);
+    std::vector<GLfloat> reordered;
+    reordered.reserve(vertices.size());
+
+    GLuint next = 0;
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        GLuint v = indices[i];
+        if (remap[v] == unassigned)
+        {
+            remap[v] = next++;
+            reordered.insert(reordered.end(), vertices.begin() + v * floatsPerVertex, vertices.begin() + (v + 1) * floatsPerVertex);
+        }
+        indices[i] = remap[v];
+    }
+
+    vertices.swap(reordered);
+}
+
+
+MeshOptimizeStats UOptimizeMesh(std::vector<GLfloat>& vertices, GLuint floatsPerVertex, std::vector<GLuint>& indices,
+    const MeshLodChain& lod)
+{
+    MeshOptimizeStats stats;
+    stats.clusters = 0;
+    size_t vertexCount = vertices.size() / floatsPerVertex;
+
+    if (lod.levels.empty())
+    {
+        stats.before = stats.after = UAnalyzeVertexCache(indices.empty() ? NULL : &indices[0], indices.size(), vertexCount);
+        return stats;
+    }
+
+    const MeshLodLevel& finest = lod.levels[0];
+    stats.before = UAnalyzeVertexCache(&indices[finest.indexOffset], finest.indexCount, vertexCount);
+
+    // Levels sit back to back in one buffer and are reordered in place, so their ranges stay valid
+    std::vector<size_t> clusterStarts;
+    for (size_t l = 0; l < lod.levels.size(); ++l)
+    {
+        const MeshLodLevel& level = lod.levels[l];
+        if (level.indexCount == 0)
+            continue;
+        GLuint* levelIndices = &indices[level.indexOffset];
+        UOptimizeVertexCache(levelIndices, level.indexCount, vertexCount, clusterStarts);
+        UOptimizeOverdraw(levelIndices, level.indexCount, vertices, floatsPerVertex, clusterStarts);
+        if (l == 0)
+            stats.clusters = (GLuint)clusterStarts.size();
+    }
+
+    // Finest level first in the index buffer, so its vertices get the front of the vertex buffer
+    UOptimizeVertexFetch(vertices, floatsPerVertex, indices);
+    vertexCount = vertices.size() / floatsPerVertex;
+
+    stats.after = UAnalyzeVertexCache(&indices[finest.indexOffset], finest.indexCount, vertexCount);
+    return stats;
+}
@@ -0,0 +1,51 @@
+#ifndef MESH_OPTIMIZE_H
+#define MESH_OPTIMIZE_H
+
+#include <vector>
+#include <GLEW/glew.h>      // GLEW library
+
+#include "mesh_lod.h"       // Each LOD level is optimized on its own
+
+// Post-transform cache size we optimize and measure for, typical of current GPUs
+const GLuint VERTEX_CACHE_SIZE = 16;
+
+// Cache efficiency of an index list, simulated with a FIFO cache of VERTEX_CACHE_SIZE
+struct VertexCacheStats
+{
+    float acmr;     // Average cache miss ratio: transformed vertices per triangle (0.5 is ideal, 3 is worst)
+    float atvr;     // Average transformed vertex ratio: transformed vertices per unique vertex (1 is ideal)
+};
+
+// What a whole UOptimizeMesh pass did to the finest level
+struct MeshOptimizeStats
+{
+    VertexCacheStats before;
+    VertexCacheStats after;
+    GLuint clusters;    // Overdraw clusters the triangles were sorted in
+};
+
+VertexCacheStats UAnalyzeVertexCache(const GLuint* indices, size_t indexCount, size_t vertexCount);
+
+/* Reorders triangles for post-transform cache locality with Tipsify (Sander et al. 2007).
+ * clusterStarts receives the triangle index of every hard boundary, where the
+ * algorithm had to jump to an unconnected part of the mesh.
+ */
+void UOptimizeVertexCache(GLuint* indices, size_t indexCount, size_t vertexCount, std::vector<size_t>& clusterStarts);
+
+/* Sorts the clusters found by UOptimizeVertexCache so the ones facing away from the mesh
+ * center are drawn first. From most outside viewpoints those are the front surfaces,
+ * so later clusters fail the depth test instead of being shaded and overwritten.
+ */
+void UOptimizeOverdraw(GLuint* indices, size_t indexCount, const std::vector<GLfloat>& vertices, GLuint floatsPerVertex,
+    const std::vector<size_t>& clusterStarts);
+
+/* Reorders the vertex buffer in the order vertices are first referenced and rewrites the
+ * indices to match, so vertex fetch walks memory forward. Unreferenced vertices are dropped.
+ */
+void UOptimizeVertexFetch(std::vector<GLfloat>& vertices, GLuint floatsPerVertex, std::vector<GLuint>& indices);
+
+// Runs all three passes over every level of the chain and reports level 0 before and after
+MeshOptimizeStats UOptimizeMesh(std::vector<GLfloat>& vertices, GLuint floatsPerVertex, std::vector<GLuint>& indices,
+    const MeshLodChain& lod);
+
+#endif
@@ -0,0 +1,203 @@
+#include "multi_view.h"
+
+#include <algorithm>        // std::max
+#include <cmath>            // tan
+#include <cstring>          // strcmp
+
+#include <glm/gtc/matrix_transform.hpp> // lookAt, perspective, frustum
+
+// Unnamed namespace
+namespace
+{
+    // The fixed monitor cameras: offset from the focus point, up vector and viewport corner
+    struct MonitorCamera
+    {
+        glm::vec3 offset;
+        glm::vec3 up;
+        float x;
+        float y;
+    };
+
+    const MonitorCamera MONITOR_CAMERAS[MULTI_VIEW_MAX_VIEWS - 1] = {
+        { glm::vec3(0.0f, 2.0f, 6.0f), glm::vec3(0.0f, 1.0f, 0.0f), 0.5f, 0.5f },     // Front, top right
+        { glm::vec3(7.0f, 2.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), 0.0f, 0.0f },     // Side, bottom left
+        { glm::vec3(0.0f, 9.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f), 0.5f, 0.0f },    // Top down, bottom right
+    };
+
+    void setView(RenderView& view, const glm::mat4& matrix, const glm::mat4& projection, const glm::vec3& position,
+        float tanHalfFov, int renderHeight, float x, float y, float width, float height)
+    {
+        view.view = matrix;
+        view.projection = projection;
+        view.viewProjection = projection * matrix;
+        view.position = position;
+        view.projectionScale = renderHeight * height / (2.0f * tanHalfFov);
+        view.x = x;
+        view.y = y;
+        view.width = width;
+        view.height = height;
+    }
+}
+
+
+bool UParseMultiViewLayout(const char* name, MultiViewLayout& layout)
+{
+    if (strcmp(name, "single") == 0)
+        layout = MULTI_VIEW_SINGLE;
+    else if (strcmp(name, "stereo") == 0)
+        layout = MULTI_VIEW_STEREO;
+    else if (strcmp(name, "monitors") == 0)
+        layout = MULTI_VIEW_MONITORS;
+    else
+        return false;
+    return true;
+}
+
+
+void UBuildViewSet(MultiViewLayout layout, const SceneSnapshot& scene, const glm::vec3& focus, float aspect, int renderHeight, ViewSet& views)
+{
+    glm::vec3 front = glm::normalize(scene.cameraFront);
+    float tanHalfFov = tan(glm::radians(scene.cameraZoom) * 0.5f);
+
+    if (layout == MULTI_VIEW_STEREO)
+    {
+        // Off-axis frusta instead of toed-in eyes: both look straight ahead and their images
+        // are shifted to line up at the convergence distance
+        glm::vec3 right = glm::normalize(glm::cross(front, scene.cameraUp));
+        float top = VIEW_NEAR * tanHalfFov;
+        float side = top * aspect * 0.5f;
+        float shift = 0.5f * STEREO_EYE_SEPARATION * VIEW_NEAR / STEREO_CONVERGENCE;
+        for (int eye = 0; eye < 2; ++eye)
+        {
+            float toward = eye == 0 ? shift : -shift;
+            glm::vec3 position = scene.cameraPosition + right * ((eye == 0 ? -0.5f : 0.5f) * STEREO_EYE_SEPARATION);
+            setView(views.views[eye], glm::lookAt(position, position + front, scene.cameraUp),
+                glm::frustum(-side + toward, side + toward, -top, top, VIEW_NEAR, VIEW_FAR), position, tanHalfFov, renderHeight,
+                eye * 0.5f, 0.0f, 0.5f, 1.0f);
+        }
+        views.count = 2;
+
+        // One pass per eye: a box hidden from a point between or behind them can still show
+        // past an occluder's edge to either eye
+        views.occlusionViews = 3u;
+        return;
+    }
+
+    if (layout == MULTI_VIEW_MONITORS)
+    {
+        // Quarters of the target keep its aspect
+        setView(views.views[0], USnapshotView(scene), glm::perspective(glm::radians(scene.cameraZoom), aspect, VIEW_NEAR, VIEW_FAR),
+            scene.cameraPosition, tanHalfFov, renderHeight, 0.0f, 0.5f, 0.5f, 0.5f);
+
+        float monitorTanHalfFov = tan(glm::radians(MONITOR_FOV) * 0.5f);
+        glm::mat4 monitorProjection = glm::perspective(glm::radians(MONITOR_FOV), aspect, VIEW_NEAR, VIEW_FAR);
+        for (int m = 0; m < MULTI_VIEW_MAX_VIEWS - 1; ++m)
+        {
+            const MonitorCamera& camera = MONITOR_CAMERAS[m];
+            glm::vec3 position = focus + camera.offset;
+            setView(views.views[m + 1], glm::lookAt(position, focus, camera.up), monitorProjection, position, monitorTanHalfFov,
+                renderHeight, camera.x, camera.y, 0.5f, 0.5f);
+        }
+        views.count = MULTI_VIEW_MAX_VIEWS;
+
+        // The monitors are far from the camera, its occlusion pass says nothing about what they see
+        views.occlusionViews = 1u;
+        return;
+    }
+
+    setView(views.views[0], USnapshotView(scene), glm::perspective(glm::radians(scene.cameraZoom), aspect, VIEW_NEAR, VIEW_FAR),
+        scene.cameraPosition, tanHalfFov, renderHeight, 0.0f, 0.0f, 1.0f, 1.0f);
+    views.count = 1;
+    views.occlusionViews = 1u;
+}
+
+
+unsigned UViewMask(const ViewSet& views, const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& model)
+{
+    unsigned mask = 0;
+    for (int v = 0; v < views.count; ++v)
+    {
+        glm::mat4 transform = views.views[v].viewProjection * model;
+        glm::vec4 corners[8];
+        for (int c = 0; c < 8; ++c)
+        {
+            glm::vec3 corner((c & 1) ? boundsMax.x : boundsMin.x, (c & 2) ? boundsMax.y : boundsMin.y, (c & 4) ? boundsMax.z : boundsMin.z);
+            corners[c] = transform * glm::vec4(corner, 1.0f);
+        }
+
+        // Clip space planes, so corners behind the camera are handled like any other
+        bool outside = false;
+        for (int axis = 0; axis < 3 && !outside; ++axis)
+        {
+            bool below = true, above = true;
+            for (int c = 0; c < 8; ++c)
+            {
+                below = below && corners[c][axis] < -corners[c].w;
+                above = above && corners[c][axis] > corners[c].w;
+            }
+            outside = below || above;
+        }
+        if (!outside)
+            mask |= 1u << v;
+    }
+    return mask;
+}
+
+
+int UViewAt(const ViewSet& views, float x, float y, float& ndcX, float& ndcY)
+{
+    for (int v = 0; v < views.count; ++v)
+    {
+        const RenderView& view = views.views[v];
+        if (x < view.x || x > view.x + view.width || y < view.y || y > view.y + view.height)
+            continue;
+        ndcX = 2.0f * (x - view.x) / view.width - 1.0f;
+        ndcY = 2.0f * (y - view.y) / view.height - 1.0f;
+        return v;
+    }
+    return -1;
+}
+
+
+int UOcclusionPasses(const ViewSet& views)
+{
+    int passes = 0;
+    for (int v = 0; v < views.count; ++v)
+        passes += (views.occlusionViews >> v) & 1u;
+    return passes;
+}
+
+
+int UDetailView(const ViewSet& views, unsigned mask, const glm::vec3& point)
+{
+    int best = 0;
+    float bestScale = -1.0f;
+    for (int v = 0; v < views.count; ++v)
+    {
+        if (mask != 0 && (mask & (1u << v)) == 0)
+            continue;
+        const RenderView& view = views.views[v];
+        float scale = view.projectionScale / std::max(glm::distance(point, view.position), VIEW_NEAR);
+        if (scale > bestScale)
+        {
+            best = v;
+            bestScale = scale;
+        }
+    }
+    return best;
+}
+
+
+int UPackViewList(unsigned mask, int& count)
+{
+    int list = 0;
+    count = 0;
+    for (int v = 0; v < MULTI_VIEW_MAX_VIEWS; ++v)
+    {
+        if ((mask & (1u << v)) == 0)
+            continue;
+        list |= v << (4 * count);
+        ++count;
+    }
+    return list;
+}
@@ -0,0 +1,84 @@
+#ifndef MULTI_VIEW_H
+#define MULTI_VIEW_H
+
+// GLM Math Header inclusions
+#include <glm/glm.hpp>
+
+#include "scene_snapshot.h" // The camera the views are placed around
+
+// Views one pass can draw. The multi-view shaders size their arrays to match, and a draw's
+// view list packs one view index into every 4 bits of an int.
+const int MULTI_VIEW_MAX_VIEWS = 4;
+
+// Stereo: distance between the eyes and where their images line up (zero parallax), in world units
+const float STEREO_EYE_SEPARATION = 0.065f;
+const float STEREO_CONVERGENCE = 3.0f;
+
+// Field of view of the fixed monitor cameras, in degrees
+const float MONITOR_FOV = 45.0f;
+
+// Near and far planes of every view, the same as the single camera's projection
+const float VIEW_NEAR = 0.1f;
+const float VIEW_FAR = 100.0f;
+
+enum MultiViewLayout
+{
+    MULTI_VIEW_SINGLE,      // The camera, the whole target
+    MULTI_VIEW_STEREO,      // Left and right eye of the camera, side by side
+    MULTI_VIEW_MONITORS,    // The camera top left, three fixed cameras on the focus point around it
+};
+
+// One camera of a frame and the part of the render target it draws to
+struct RenderView
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    glm::vec3 position;
+    float projectionScale;      // Pixels covered by one world unit at distance 1
+    float x;                    // Viewport as a fraction of the render target, from the lower left
+    float y;
+    float width;
+    float height;
+};
+
+/* The views of a frame. Frustum culling runs once for all of them: every object gets a mask of
+ * the views whose frustum it touches. Each view in occlusionViews then gets an occlusion pass
+ * drawn from its own camera, which only clears that view's bit; a view left out (a monitor
+ * camera) is culled by its frustum alone.
+ */
+struct ViewSet
+{
+    RenderView views[MULTI_VIEW_MAX_VIEWS];
+    int count;
+    unsigned occlusionViews;    // Bit per view, always includes view 0
+};
+
+// --views single | stereo | monitors
+bool UParseMultiViewLayout(const char* name, MultiViewLayout& layout);
+
+/* Places the layout's views around the scene's camera. aspect is the render target's width
+ * over its height, renderHeight its height in pixels; focus is what the monitor cameras look at.
+ * A single view covers the whole target with the scene camera's field of view.
+ */
+void UBuildViewSet(MultiViewLayout layout, const SceneSnapshot& scene, const glm::vec3& focus, float aspect, int renderHeight, ViewSet& views);
+
+// Views whose frustum the box may be visible in, conservatively: a view is left out only when all eight corners are outside one of its planes
+unsigned UViewMask(const ViewSet& views, const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& model);
+
+/* The view whose viewport holds a point of the render target, given as fractions from the lower
+ * left like the viewports. Also remaps the point into that view's normalized device coordinates.
+ * Returns -1 when no viewport holds it.
+ */
+int UViewAt(const ViewSet& views, float x, float y, float& ndcX, float& ndcY);
+
+// Views in occlusionViews, one occlusion pass each; the frame's occlusion budget is split between them
+int UOcclusionPasses(const ViewSet& views);
+
+// Of the views in mask (all views when it's empty), the one that sees point largest; LOD and texture detail follow it
+int UDetailView(const ViewSet& views, unsigned mask, const glm::vec3& point);
+
+// The views in mask as a view list for the multi-view shaders: instance i draws view (list >> 4i) & 15
+int UPackViewList(unsigned mask, int& count);
+
+#endif
@@ -0,0 +1,420 @@
+#include "occlusion.h"
+
+#include <algorithm>        // std::sort, std::min, std::max
+#include <atomic>
+#include <chrono>           // steady_clock
+#include <cmath>            // floor, ceil
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>      // SSE2
+#define OCCLUSION_SSE2 1
+#endif
+
+#include "job_pool.h"       // Bands and box tests run on the workers
+#include "frame_memory.h"   // Setup scratch comes from the frame arena
+
+// Unnamed namespace
+namespace
+{
+    const int TILES_X = OCCLUSION_BUFFER_WIDTH / OCCLUSION_TILE_SIZE;
+    const int TILES_Y = OCCLUSION_BUFFER_HEIGHT / OCCLUSION_TILE_SIZE;
+    const int BAND_HEIGHT = 16;     // Rows per raster job, every band is owned by one thread
+    const int BAND_COUNT = (OCCLUSION_BUFFER_HEIGHT + BAND_HEIGHT - 1) / BAND_HEIGHT;
+    const size_t BATCH_TEST_THRESHOLD = 32;
+
+    struct Occluder
+    {
+        std::vector<glm::vec3> positions;
+        std::vector<GLuint> indices;
+        glm::mat4 model;
+    };
+
+    // Triangle after clipping and viewport transform, wound counter-clockwise
+    struct ScreenTriangle
+    {
+        float x[3], y[3], z[3];
+        float area;
+        int minX, maxX, minY, maxY;
+    };
+
+    std::vector<Occluder> gOccluders;
+    std::vector<ScreenTriangle> gTriangles;
+
+#ifdef _MSC_VER
+    __declspec(align(16)) float gDepth[OCCLUSION_BUFFER_WIDTH * OCCLUSION_BUFFER_HEIGHT];
+#else
+    float gDepth[OCCLUSION_BUFFER_WIDTH * OCCLUSION_BUFFER_HEIGHT] __attribute__((aligned(16)));
+#endif
+    float gHiZ[TILES_X * TILES_Y];
+
+    typedef std::chrono::steady_clock Clock;
+
+    // Clips a clip-space triangle against the near plane (z >= -w) and appends the screen triangles
+    void setupTriangle(const glm::vec4 clip[3], FrameVector<ScreenTriangle>& out)
+    {
+        glm::vec4 polygon[4];
+        int count = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            const glm::vec4& a = clip[i];
+            const glm::vec4& b = clip[(i + 1) % 3];
+            float da = a.z + a.w, db = b.z + b.w;
+            if (da >= 0.0f)
+                polygon[count++] = a;
+            if ((da >= 0.0f) != (db >= 0.0f))
+            {
+                float t = da / (da - db);
+                polygon[count++] = a + (b - a) * t;
+            }
+        }
+        if (count < 3)
+            return;
+
+        // Viewport transform
+        float sx[4], sy[4], sz[4];
+        for (int i = 0; i < count; ++i)
+        {
+            float invW = 1.0f / std::max(polygon[i].w, 1e-6f);
+            sx[i] = (polygon[i].x * invW * 0.5f + 0.5f) * OCCLUSION_BUFFER_WIDTH;
+            sy[i] = (polygon[i].y * invW * 0.5f + 0.5f) * OCCLUSION_BUFFER_HEIGHT;
+            sz[i] = polygon[i].z * invW * 0.5f + 0.5f;
+        }
+
+        // Fan out the (at most) quad
+        for (int k = 1; k + 1 < count; ++k)
+        {
+            int v[3] = { 0, k, k + 1 };
+            ScreenTriangle tri;
+            for (int c = 0; c < 3; ++c)
+            {
+                tri.x[c] = sx[v[c]];
+                tri.y[c] = sy[v[c]];
+                tri.z[c] = sz[v[c]];
+            }
+
+            tri.area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.x[2] - tri.x[0]) * (tri.y[1] - tri.y[0]);
+            if (tri.area < 0.0f)
+            {
+                std::swap(tri.x[1], tri.x[2]);
+                std::swap(tri.y[1], tri.y[2]);
+                std::swap(tri.z[1], tri.z[2]);
+                tri.area = -tri.area;
+            }
+            if (tri.area < 1e-4f)
+                continue;
+
+            float minX = std::min(tri.x[0], std::min(tri.x[1], tri.x[2]));
+            float maxX = std::max(tri.x[0], std::max(tri.x[1], tri.x[2]));
+            float minY = std::min(tri.y[0], std::min(tri.y[1], tri.y[2]));
+            float maxY = std::max(tri.y[0], std::max(tri.y[1], tri.y[2]));
+            tri.minX = std::max(0, (int)floor(minX));
+            tri.maxX = std::min(OCCLUSION_BUFFER_WIDTH - 1, (int)ceil(maxX));
+            tri.minY = std::max(0, (int)floor(minY));
+            tri.maxY = std::min(OCCLUSION_BUFFER_HEIGHT - 1, (int)ceil(maxY));
+            if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+                continue;
+
+            out.push_back(tri);
+        }
+    }
+
+    // Rasterizes one triangle into rows [bandMinY, bandMaxY], keeping the nearest depth
+    void rasterTriangle(const ScreenTriangle& tri, int bandMinY, int bandMaxY)
+    {
+        int minY = std::max(tri.minY, bandMinY);
+        int maxY = std::min(tri.maxY, bandMaxY);
+        if (minY > maxY)
+            return;
+        int minX = tri.minX & ~3;   // SIMD works on aligned groups of 4 pixels
+
+        // Edge functions E(x, y) = A x + B y + C, positive inside for a counter-clockwise triangle.
+        // Pixels exactly on an edge belong to it only for top and left edges, so triangles
+        // sharing an edge neither leave cracks nor both cover it.
+        float a[3], b[3], c[3];
+        bool topLeft[3];
+        for (int e = 0; e < 3; ++e)
+        {
+            int n = (e + 1) % 3;
+            a[e] = tri.y[e] - tri.y[n];
+            b[e] = tri.x[n] - tri.x[e];
+            c[e] = tri.x[e] * tri.y[n] - tri.y[e] * tri.x[n];
+            topLeft[e] = a[e] > 0.0f || (a[e] == 0.0f && b[e] < 0.0f);
+        }
+
+        // Depth plane z(x, y) = zx x + zy y + z0
+        float invArea = 1.0f / tri.area;
+        float zx = ((tri.z[1] - tri.z[0]) * (tri.y[2] - tri.y[0]) - (tri.z[2] - tri.z[0]) * (tri.y[1] - tri.y[0])) * invArea;
+        float zy = ((tri.z[2] - tri.z[0]) * (tri.x[1] - tri.x[0]) - (tri.z[1] - tri.z[0]) * (tri.x[2] - tri.x[0])) * invArea;
+        float z0 = tri.z[0] - zx * tri.x[0] - zy * tri.y[0];
+
+#ifdef OCCLUSION_SSE2
+        const __m128 laneOffsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 a0 = _mm_set1_ps(a[0]), a1 = _mm_set1_ps(a[1]), a2 = _mm_set1_ps(a[2]);
+        const __m128 zxv = _mm_set1_ps(zx);
+        const __m128 onEdge0 = _mm_castsi128_ps(_mm_set1_epi32(topLeft[0] ? -1 : 0));
+        const __m128 onEdge1 = _mm_castsi128_ps(_mm_set1_epi32(topLeft[1] ? -1 : 0));
+        const __m128 onEdge2 = _mm_castsi128_ps(_mm_set1_epi32(topLeft[2] ? -1 : 0));
+
+        for (int y = minY; y <= maxY; ++y)
+        {
+            float py = y + 0.5f;
+            __m128 row0 = _mm_set1_ps(b[0] * py + c[0]);
+            __m128 row1 = _mm_set1_ps(b[1] * py + c[1]);
+            __m128 row2 = _mm_set1_ps(b[2] * py + c[2]);
+            __m128 rowZ = _mm_set1_ps(zy * py + z0);
+            float* depthRow = gDepth + y * OCCLUSION_BUFFER_WIDTH;
+
+            for (int x = minX; x <= tri.maxX; x += 4)
+            {
+                __m128 px = _mm_add_ps(_mm_set1_ps((float)x), laneOffsets);
+                __m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), row0);
+                __m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), row1);
+                __m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), row2);
+
+                __m128 in0 = _mm_or_ps(_mm_cmpgt_ps(e0, zero), _mm_and_ps(_mm_cmpeq_ps(e0, zero), onEdge0));
+                __m128 in1 = _mm_or_ps(_mm_cmpgt_ps(e1, zero), _mm_and_ps(_mm_cmpeq_ps(e1, zero), onEdge1));
+                __m128 in2 = _mm_or_ps(_mm_cmpgt_ps(e2, zero), _mm_and_ps(_mm_cmpeq_ps(e2, zero), onEdge2));
+                __m128 inside = _mm_and_ps(in0, _mm_and_ps(in1, in2));
+                if (_mm_movemask_ps(inside) == 0)
+                    continue;
+
+                __m128 z = _mm_add_ps(_mm_mul_ps(zxv, px), rowZ);
+                __m128 current = _mm_load_ps(depthRow + x);
+                __m128 nearest = _mm_min_ps(current, z);
+                _mm_store_ps(depthRow + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+            }
+        }
+#else
+        for (int y = minY; y <= maxY; ++y)
+        {
+            float py = y + 0.5f;
+            float* depthRow = gDepth + y * OCCLUSION_BUFFER_WIDTH;
+            for (int x = minX; x <= tri.maxX; ++x)
+            {
+                float px = x + 0.5f;
+                bool inside = true;
+                for (int e = 0; e < 3 && inside; ++e)
+                {
+                    float edge = a[e] * px + b[e] * py + c[e];
+                    inside = edge > 0.0f || (edge == 0.0f && topLeft[e]);
+                }
+                if (!inside)
+                    continue;
+                float z = zx * px + zy * py + z0;
+                if (z < depthRow[x])
+                    depthRow[x] = z;
+            }
+        }
+#endif
+    }
+
+    // Farthest depth of every tile in one tile row
+    void buildHiZRow(int tileY)
+    {
+        for (int tileX = 0; tileX < TILES_X; ++tileX)
+        {
+            const float* block = gDepth + tileY * OCCLUSION_TILE_SIZE * OCCLUSION_BUFFER_WIDTH + tileX * OCCLUSION_TILE_SIZE;
+#ifdef OCCLUSION_SSE2
+            __m128 farthest = _mm_load_ps(block);
+            for (int y = 0; y < OCCLUSION_TILE_SIZE; ++y)
+            {
+                for (int x = 0; x < OCCLUSION_TILE_SIZE; x += 4)
+                    farthest = _mm_max_ps(farthest, _mm_load_ps(block + y * OCCLUSION_BUFFER_WIDTH + x));
+            }
+            farthest = _mm_max_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(1, 0, 3, 2)));
+            farthest = _mm_max_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(2, 3, 0, 1)));
+            gHiZ[tileY * TILES_X + tileX] = _mm_cvtss_f32(farthest);
+#else
+            float farthest = block[0];
+            for (int y = 0; y < OCCLUSION_TILE_SIZE; ++y)
+            {
+                for (int x = 0; x < OCCLUSION_TILE_SIZE; ++x)
+                    farthest = std::max(farthest, block[y * OCCLUSION_BUFFER_WIDTH + x]);
+            }
+            gHiZ[tileY * TILES_X + tileX] = farthest;
+#endif
+        }
+    }
+}
+
+
+int UAddOccluder(const std::vector<GLfloat>& vertices, GLuint floatsPerVertex, const GLuint* indices, size_t indexCount, const glm::mat4& model)
+{
+    Occluder occluder;
+    size_t vertexCount = vertices.size() / floatsPerVertex;
+    occluder.positions.reserve(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v)
+        occluder.positions.push_back(glm::vec3(vertices[v * floatsPerVertex], vertices[v * floatsPerVertex + 1], vertices[v * floatsPerVertex + 2]));
+    occluder.indices.assign(indices, indices + indexCount / 3 * 3);
+    occluder.model = model;
+
+    gOccluders.push_back(occluder);
+    return (int)gOccluders.size() - 1;
+}
+
+
+void USetOccluderModel(int occluder, const glm::mat4& model)
+{
+    if (occluder >= 0 && occluder < (int)gOccluders.size())
+        gOccluders[occluder].model = model;
+}
+
+
+void UClearOccluders()
+{
+    gOccluders.clear();
+    gTriangles.clear();
+}
+
+
+void URenderOccluders(const glm::mat4& viewProjection, float budgetMilliseconds, OcclusionStats& stats)
+{
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = start + std::chrono::microseconds((long long)(budgetMilliseconds * 1000.0f));
+
+    // Setup: transform, clip and bin every occluder triangle. One job per occluder keeps it simple.
+    // The scratch lives in the frame arena.
+    FrameVector<FrameVector<ScreenTriangle> > perOccluder(gOccluders.size());
+    UParallelFor(gOccluders.size(), [&](size_t o)
+    {
+        const Occluder& occluder = gOccluders[o];
+        glm::mat4 mvp = viewProjection * occluder.model;
+
+        FrameVector<glm::vec4> clip(occluder.positions.size());
+        perOccluder[o].reserve(occluder.indices.size() / 3);
+        for (size_t v = 0; v < occluder.positions.size(); ++v)
+            clip[v] = mvp * glm::vec4(occluder.positions[v], 1.0f);
+
+        for (size_t i = 0; i + 2 < occluder.indices.size(); i += 3)
+        {
+            glm::vec4 corners[3] = { clip[occluder.indices[i]], clip[occluder.indices[i + 1]], clip[occluder.indices[i + 2]] };
+
+            // Trivially outside one of the side/far planes
+            bool outside = false;
+            for (int axis = 0; axis < 3 && !outside; ++axis)
+            {
+                outside = (corners[0][axis] > corners[0].w && corners[1][axis] > corners[1].w && corners[2][axis] > corners[2].w)
+                    || (axis < 2 && corners[0][axis] < -corners[0].w && corners[1][axis] < -corners[1].w && corners[2][axis] < -corners[2].w);
+            }
+            if (!outside)
+                setupTriangle(corners, perOccluder[o]);
+        }
+    });
+
+    gTriangles.clear();
+    for (size_t o = 0; o < perOccluder.size(); ++o)
+        gTriangles.insert(gTriangles.end(), perOccluder[o].begin(), perOccluder[o].end());
+
+    // Biggest first, so a budget cut drops the triangles that hide the least
+    std::sort(gTriangles.begin(), gTriangles.end(), [](const ScreenTriangle& a, const ScreenTriangle& b) { return a.area > b.area; });
+
+    // Raster: each band of rows belongs to one job, so no two threads touch the same pixels
+    std::atomic<unsigned> rasterized((unsigned)gTriangles.size());
+    std::atomic<bool> overBudget(false);
+    UParallelFor(BAND_COUNT, [&](size_t band)
+    {
+        int bandMinY = (int)band * BAND_HEIGHT;
+        int bandMaxY = std::min(bandMinY + BAND_HEIGHT, OCCLUSION_BUFFER_HEIGHT) - 1;
+
+        for (int y = bandMinY; y <= bandMaxY; ++y)
+            std::fill(gDepth + y * OCCLUSION_BUFFER_WIDTH, gDepth + (y + 1) * OCCLUSION_BUFFER_WIDTH, 1.0f);
+
+        for (size_t t = 0; t < gTriangles.size(); ++t)
+        {
+            if ((t & 31) == 0 && t > 0 && Clock::now() > deadline)
+            {
+                overBudget = true;
+                unsigned done = (unsigned)t;
+                unsigned previous = rasterized.load();
+                while (done < previous && !rasterized.compare_exchange_weak(previous, done))
+                    ;
+                break;
+            }
+            rasterTriangle(gTriangles[t], bandMinY, bandMaxY);
+        }
+
+        // The band's rows cover whole tile rows, so the hierarchical-Z can be built right here
+        for (int tileY = bandMinY / OCCLUSION_TILE_SIZE; tileY <= bandMaxY / OCCLUSION_TILE_SIZE; ++tileY)
+            buildHiZRow(tileY);
+    });
+
+    stats.occluderTriangles = (unsigned)gTriangles.size();
+    stats.rasterizedTriangles = rasterized.load();
+    stats.overBudget = overBudget.load();
+    stats.rasterMilliseconds = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+
+bool UIsBoxOccluded(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& model, const glm::mat4& viewProjection)
+{
+    glm::mat4 mvp = viewProjection * model;
+
+    float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f, nearestZ = 1e30f;
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        glm::vec3 p((corner & 1) ? boundsMax.x : boundsMin.x, (corner & 2) ? boundsMax.y : boundsMin.y, (corner & 4) ? boundsMax.z : boundsMin.z);
+        glm::vec4 clip = mvp * glm::vec4(p, 1.0f);
+        if (clip.z < -clip.w || clip.w <= 1e-6f)
+            return false; // crosses the near plane, too close to call
+
+        float invW = 1.0f / clip.w;
+        float x = clip.x * invW, y = clip.y * invW, z = clip.z * invW * 0.5f + 0.5f;
+        minX = std::min(minX, x); maxX = std::max(maxX, x);
+        minY = std::min(minY, y); maxY = std::max(maxY, y);
+        nearestZ = std::min(nearestZ, z);
+    }
+
+    // Entirely outside the view
+    if (maxX < -1.0f || minX > 1.0f || maxY < -1.0f || minY > 1.0f || nearestZ > 1.0f)
+        return true;
+
+    int tileMinX = std::max(0, (int)((minX * 0.5f + 0.5f) * OCCLUSION_BUFFER_WIDTH) / OCCLUSION_TILE_SIZE);
+    int tileMaxX = std::min(TILES_X - 1, (int)((maxX * 0.5f + 0.5f) * OCCLUSION_BUFFER_WIDTH) / OCCLUSION_TILE_SIZE);
+    int tileMinY = std::max(0, (int)((minY * 0.5f + 0.5f) * OCCLUSION_BUFFER_HEIGHT) / OCCLUSION_TILE_SIZE);
+    int tileMaxY = std::min(TILES_Y - 1, (int)((maxY * 0.5f + 0.5f) * OCCLUSION_BUFFER_HEIGHT) / OCCLUSION_TILE_SIZE);
+
+    // Visible as soon as one covered tile has something farther than the box's nearest point
+    for (int tileY = tileMinY; tileY <= tileMaxY; ++tileY)
+    {
+        const float* row = gHiZ + tileY * TILES_X;
+        int tileX = tileMinX;
+#ifdef OCCLUSION_SSE2
+        __m128 boxZ = _mm_set1_ps(nearestZ);
+        for (; tileX + 3 <= tileMaxX; tileX += 4)
+        {
+            if (_mm_movemask_ps(_mm_cmple_ps(boxZ, _mm_loadu_ps(row + tileX))) != 0)
+                return false;
+        }
+#endif
+        for (; tileX <= tileMaxX; ++tileX)
+        {
+            if (nearestZ <= row[tileX])
+                return false;
+        }
+    }
+    return true;
+}
+
+
+void UTestOcclusion(FrameVector<OcclusionQuery>& queries, const glm::mat4& viewProjection, OcclusionStats& stats)
+{
+    if (queries.size() < BATCH_TEST_THRESHOLD)
+    {
+        // A handful of boxes is cheaper to test here than to hand out
+        for (size_t q = 0; q < queries.size(); ++q)
+            queries[q].occluded = UIsBoxOccluded(queries[q].boundsMin, queries[q].boundsMax, queries[q].model, viewProjection);
+    }
+    else
+    {
+        UParallelFor(queries.size(), [&](size_t q)
+        {
+            queries[q].occluded = UIsBoxOccluded(queries[q].boundsMin, queries[q].boundsMax, queries[q].model, viewProjection);
+        });
+    }
+
+    stats.tested = (unsigned)queries.size();
+    stats.culled = 0;
+    for (size_t q = 0; q < queries.size(); ++q)
+        stats.culled += queries[q].occluded ? 1 : 0;
+}
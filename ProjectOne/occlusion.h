@@ -0,0 +1,56 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <vector>
+#include <GLEW/glew.h>      // GLEW library
+
+// GLM Math Header inclusions
+#include <glm/glm.hpp>
+
+#include "frame_memory.h"   // A frame's queries are frame scratch
+
+// Software depth buffer resolution. Width must be a multiple of 4 (SIMD) and of the tile size.
+const int OCCLUSION_BUFFER_WIDTH = 256;
+const int OCCLUSION_BUFFER_HEIGHT = 192;
+const int OCCLUSION_TILE_SIZE = 8;  // Hierarchical-Z tiles, each stores the farthest depth inside it
+
+struct OcclusionStats
+{
+    unsigned occluderTriangles;     // Triangles that survived setup this frame
+    unsigned rasterizedTriangles;   // How many of them every band got to before the budget ran out
+    unsigned tested;
+    unsigned culled;
+    float rasterMilliseconds;
+    bool overBudget;
+};
+
+// A box to test against the occlusion buffer, filled in by UTestOcclusion
+struct OcclusionQuery
+{
+    glm::vec3 boundsMin;    // Object space
+    glm::vec3 boundsMax;
+    glm::mat4 model;
+    bool occluded;
+};
+
+/* Registers an occluder mesh. Only the positions (first 3 floats of each vertex) are kept.
+ * Returns a handle for USetOccluderModel.
+ */
+int UAddOccluder(const std::vector<GLfloat>& vertices, GLuint floatsPerVertex, const GLuint* indices, size_t indexCount, const glm::mat4& model);
+void USetOccluderModel(int occluder, const glm::mat4& model);
+void UClearOccluders();
+
+/* Rasterizes every occluder into the low resolution depth buffer on the job pool, then
+ * builds the hierarchical-Z tiles. Triangles are drawn largest first and rasterization
+ * stops when budgetMilliseconds is used up; an unfinished buffer is still conservative,
+ * it only hides less.
+ */
+void URenderOccluders(const glm::mat4& viewProjection, float budgetMilliseconds, OcclusionStats& stats);
+
+// Tests one box against the hierarchical-Z buffer. Boxes outside the frustum count as occluded.
+bool UIsBoxOccluded(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& model, const glm::mat4& viewProjection);
+
+// Tests a batch of boxes, spread across the job pool when the batch is large
+void UTestOcclusion(FrameVector<OcclusionQuery>& queries, const glm::mat4& viewProjection, OcclusionStats& stats);
+
+#endif
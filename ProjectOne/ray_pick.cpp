@@ -0,0 +1,416 @@
+#include "ray_pick.h"
+
+#include <algorithm>        // std::partition, std::min, std::max, std::swap
+#include <cassert>
+#include <cfloat>           // FLT_MAX
+#include <cmath>            // fabs
+
+// Unnamed namespace
+namespace
+{
+    const int SAH_BINS = 12;
+    const size_t MESH_LEAF_SIZE = 4;
+    const size_t SCENE_LEAF_SIZE = 1;
+    const int STACK_SIZE = 64;       // Traversal stack on the stack; deeper trees get one on the heap
+
+    // What the builder needs to know about a triangle or an instance
+    struct BuildItem
+    {
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        glm::vec3 centroid;
+    };
+
+    struct Bin
+    {
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        size_t count;
+    };
+
+    // Half the surface area, the heuristic only compares them
+    float halfArea(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+    {
+        glm::vec3 size = boundsMax - boundsMin;
+        return size.x * size.y + size.y * size.z + size.z * size.x;
+    }
+
+    // Appends the subtree over order[begin, end) in depth-first order and returns its root.
+    // maxDepth is raised to the depth of the deepest node, the root being 0.
+    GLuint buildNode(const std::vector<BuildItem>& items, std::vector<GLuint>& order, size_t begin, size_t end,
+        size_t leafSize, int depth, int& maxDepth, std::vector<BvhNode>& nodes)
+    {
+        maxDepth = std::max(maxDepth, depth);
+        glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX), centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+        for (size_t i = begin; i < end; ++i)
+        {
+            const BuildItem& item = items[order[i]];
+            boundsMin = glm::min(boundsMin, item.boundsMin);
+            boundsMax = glm::max(boundsMax, item.boundsMax);
+            centroidMin = glm::min(centroidMin, item.centroid);
+            centroidMax = glm::max(centroidMax, item.centroid);
+        }
+
+        GLuint index = (GLuint)nodes.size();
+        BvhNode node = { boundsMin, (GLuint)begin, boundsMax, (GLuint)(end - begin) };
+        nodes.push_back(node);
+
+        size_t count = end - begin;
+        if (count <= 1)
+            return index;
+
+        // Cheapest split over every axis and bin boundary, costs in units of the node's half area
+        float bestCost = FLT_MAX;
+        int bestAxis = -1, bestSplit = 0;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float extent = centroidMax[axis] - centroidMin[axis];
+            if (extent <= 0.0f)
+                continue;
+
+            Bin bins[SAH_BINS];
+            for (int b = 0; b < SAH_BINS; ++b)
+            {
+                bins[b].boundsMin = glm::vec3(FLT_MAX);
+                bins[b].boundsMax = glm::vec3(-FLT_MAX);
+                bins[b].count = 0;
+            }
+            float binScale = SAH_BINS / extent;
+            for (size_t i = begin; i < end; ++i)
+            {
+                const BuildItem& item = items[order[i]];
+                int b = std::min((int)((item.centroid[axis] - centroidMin[axis]) * binScale), SAH_BINS - 1);
+                bins[b].boundsMin = glm::min(bins[b].boundsMin, item.boundsMin);
+                bins[b].boundsMax = glm::max(bins[b].boundsMax, item.boundsMax);
+                ++bins[b].count;
+            }
+
+            // Sweep from the right for the right-hand areas, then from the left to price each split
+            float rightArea[SAH_BINS];
+            size_t rightCount[SAH_BINS];
+            glm::vec3 sweepMin(FLT_MAX), sweepMax(-FLT_MAX);
+            size_t sweepCount = 0;
+            for (int b = SAH_BINS - 1; b > 0; --b)
+            {
+                sweepMin = glm::min(sweepMin, bins[b].boundsMin);
+                sweepMax = glm::max(sweepMax, bins[b].boundsMax);
+                sweepCount += bins[b].count;
+                rightArea[b] = sweepCount ? halfArea(sweepMin, sweepMax) : 0.0f;
+                rightCount[b] = sweepCount;
+            }
+            sweepMin = glm::vec3(FLT_MAX);
+            sweepMax = glm::vec3(-FLT_MAX);
+            sweepCount = 0;
+            for (int b = 0; b < SAH_BINS - 1; ++b)
+            {
+                sweepMin = glm::min(sweepMin, bins[b].boundsMin);
+                sweepMax = glm::max(sweepMax, bins[b].boundsMax);
+                sweepCount += bins[b].count;
+                if (sweepCount == 0 || rightCount[b + 1] == 0)
+                    continue;
+                float cost = halfArea(sweepMin, sweepMax) * sweepCount + rightArea[b + 1] * rightCount[b + 1];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b + 1;
+                }
+            }
+        }
+
+        // A leaf when nothing separates the centroids, or when small enough that testing all is cheaper
+        float leafCost = halfArea(boundsMin, boundsMax) * count;
+        if (bestAxis < 0 || (count <= leafSize && leafCost <= halfArea(boundsMin, boundsMax) + bestCost))
+            return index;
+
+        float binScale = SAH_BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+        float axisMin = centroidMin[bestAxis];
+        std::vector<GLuint>::iterator middle = std::partition(order.begin() + begin, order.begin() + end, [&](GLuint item)
+        {
+            return std::min((int)((items[item].centroid[bestAxis] - axisMin) * binScale), SAH_BINS - 1) < bestSplit;
+        });
+        size_t split = (size_t)(middle - order.begin());
+
+        buildNode(items, order, begin, split, leafSize, depth + 1, maxDepth, nodes);
+        GLuint second = buildNode(items, order, split, end, leafSize, depth + 1, maxDepth, nodes);
+        nodes[index].first = second;
+        nodes[index].count = 0;
+        return index;
+    }
+
+    // Builds nodes over the items and returns the tree's depth; order gets the item for every leaf slot
+    int buildBvh(const std::vector<BuildItem>& items, size_t leafSize, std::vector<BvhNode>& nodes, std::vector<GLuint>& order)
+    {
+        nodes.clear();
+        order.resize(items.size());
+        for (size_t i = 0; i < items.size(); ++i)
+            order[i] = (GLuint)i;
+        if (items.empty())
+            return 0;
+
+        nodes.reserve(items.size() * 2 / leafSize + 1);
+        int depth = 0;
+        buildNode(items, order, 0, items.size(), leafSize, 0, depth, nodes);
+        return depth;
+    }
+
+    // Slab test; entry is where the ray enters the box
+    bool hitBox(const BvhNode& node, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance, float& entry)
+    {
+        float nearest = 0.0f, farthest = maxDistance;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float t0 = (node.boundsMin[axis] - origin[axis]) * inverseDirection[axis];
+            float t1 = (node.boundsMax[axis] - origin[axis]) * inverseDirection[axis];
+            nearest = std::max(nearest, std::min(t0, t1));
+            farthest = std::min(farthest, std::max(t0, t1));
+        }
+        entry = nearest;
+        return nearest <= farthest;
+    }
+
+    /* Visits the leaves the ray reaches, nearer child first. leaf(first, count) tests the
+     * primitives and lowers closest when it finds a nearer hit, which prunes the rest.
+     * depth is the tree's, from the build: the stack never holds more than depth + 1 nodes,
+     * one pending sibling per level plus the two children just pushed.
+     */
+    template <typename LeafTest>
+    void traverse(const std::vector<BvhNode>& nodes, int depth, const glm::vec3& origin, const glm::vec3& direction, const float& closest, LeafTest leaf)
+    {
+        if (nodes.empty())
+            return;
+
+        glm::vec3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        GLuint fixedStack[STACK_SIZE];
+        std::vector<GLuint> deepStack;
+        GLuint* stack = fixedStack;
+        if (depth >= STACK_SIZE)
+        {
+            deepStack.resize((size_t)depth + 1);
+            stack = &deepStack[0];
+        }
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0)
+        {
+            const BvhNode& node = nodes[stack[--top]];
+            float entry;
+            if (!hitBox(node, origin, inverseDirection, closest, entry))
+                continue;
+
+            if (node.count)
+            {
+                leaf(node.first, node.count);
+                continue;
+            }
+
+            GLuint nearChild = (GLuint)(&node - &nodes[0]) + 1, farChild = node.first;
+            float nearEntry, farEntry;
+            bool nearHit = hitBox(nodes[nearChild], origin, inverseDirection, closest, nearEntry);
+            bool farHit = hitBox(nodes[farChild], origin, inverseDirection, closest, farEntry);
+            if (nearHit && farHit && farEntry < nearEntry)
+                std::swap(nearChild, farChild);
+            else if (!nearHit)
+            {
+                nearChild = farChild;
+                nearHit = farHit;
+                farHit = false;
+            }
+
+            // Pushed children get their box tested again when popped, against what closest is by then
+            assert(top + (int)farHit + (int)nearHit <= std::max(depth + 1, STACK_SIZE));
+            if (farHit)
+                stack[top++] = farChild;
+            if (nearHit)
+                stack[top++] = nearChild;
+        }
+    }
+}
+
+
+void UBuildMeshBvh(const GLfloat* vertices, GLuint floatsPerVertex, const GLuint* indices, size_t indexCount, MeshBvh& bvh)
+{
+    size_t triangleCount = indexCount / 3;
+    std::vector<BuildItem> items(triangleCount);
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        const GLfloat* a = vertices + (size_t)indices[t * 3] * floatsPerVertex;
+        const GLfloat* b = vertices + (size_t)indices[t * 3 + 1] * floatsPerVertex;
+        const GLfloat* c = vertices + (size_t)indices[t * 3 + 2] * floatsPerVertex;
+        glm::vec3 v0(a[0], a[1], a[2]), v1(b[0], b[1], b[2]), v2(c[0], c[1], c[2]);
+        items[t].boundsMin = glm::min(v0, glm::min(v1, v2));
+        items[t].boundsMax = glm::max(v0, glm::max(v1, v2));
+        items[t].centroid = (v0 + v1 + v2) / 3.0f;
+    }
+
+    std::vector<GLuint> order;
+    bvh.depth = buildBvh(items, MESH_LEAF_SIZE, bvh.nodes, order);
+
+    // Triangles in leaf order, so a leaf reads one contiguous run
+    bvh.triangles.resize(triangleCount);
+    for (size_t i = 0; i < triangleCount; ++i)
+    {
+        GLuint t = order[i];
+        const GLfloat* a = vertices + (size_t)indices[t * 3] * floatsPerVertex;
+        const GLfloat* b = vertices + (size_t)indices[t * 3 + 1] * floatsPerVertex;
+        const GLfloat* c = vertices + (size_t)indices[t * 3 + 2] * floatsPerVertex;
+        BvhTriangle& triangle = bvh.triangles[i];
+        triangle.v0 = glm::vec3(a[0], a[1], a[2]);
+        triangle.edge1 = glm::vec3(b[0], b[1], b[2]) - triangle.v0;
+        triangle.edge2 = glm::vec3(c[0], c[1], c[2]) - triangle.v0;
+        triangle.index = t;
+    }
+}
+
+
+void UClearPickScene(SceneBvh& scene)
+{
+    scene.nodes.clear();
+    scene.instances.clear();
+    scene.ids.clear();
+    scene.added = 0;
+    scene.depth = 0;
+}
+
+
+void UAddPickInstance(SceneBvh& scene, const MeshBvh* bvh, const glm::mat4& model)
+{
+    int id = scene.added++;
+    if (!bvh || bvh->nodes.empty())
+        return;
+
+    PickInstance instance;
+    instance.bvh = bvh;
+    instance.model = model;
+    instance.inverseModel = glm::inverse(model);
+
+    // World box around the 8 corners of the mesh's box
+    const BvhNode& root = bvh->nodes[0];
+    instance.boundsMin = glm::vec3(FLT_MAX);
+    instance.boundsMax = glm::vec3(-FLT_MAX);
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        glm::vec3 local(corner & 1 ? root.boundsMax.x : root.boundsMin.x, corner & 2 ? root.boundsMax.y : root.boundsMin.y,
+            corner & 4 ? root.boundsMax.z : root.boundsMin.z);
+        glm::vec3 world = glm::vec3(model * glm::vec4(local, 1.0f));
+        instance.boundsMin = glm::min(instance.boundsMin, world);
+        instance.boundsMax = glm::max(instance.boundsMax, world);
+    }
+
+    scene.instances.push_back(instance);
+    scene.ids.push_back(id);
+}
+
+
+void UBuildPickScene(SceneBvh& scene)
+{
+    std::vector<BuildItem> items(scene.instances.size());
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        items[i].boundsMin = scene.instances[i].boundsMin;
+        items[i].boundsMax = scene.instances[i].boundsMax;
+        items[i].centroid = (items[i].boundsMin + items[i].boundsMax) * 0.5f;
+    }
+
+    std::vector<GLuint> order;
+    scene.depth = buildBvh(items, SCENE_LEAF_SIZE, scene.nodes, order);
+
+    std::vector<PickInstance> instances(order.size());
+    std::vector<int> ids(order.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        instances[i] = scene.instances[order[i]];
+        ids[i] = scene.ids[order[i]];
+    }
+    scene.instances.swap(instances);
+    scene.ids.swap(ids);
+}
+
+
+bool UIntersectMeshBvh(const MeshBvh& bvh, const PickRay& ray, float maxDistance, PickHit& hit)
+{
+    float closest = maxDistance;
+    bool found = false;
+    traverse(bvh.nodes, bvh.depth, ray.origin, ray.direction, closest, [&](GLuint first, GLuint count)
+    {
+        for (GLuint i = first; i < first + count; ++i)
+        {
+            float t, u, v;
+            if (UIntersectTriangle(bvh.triangles[i], ray.origin, ray.direction, t, u, v) && t < closest)
+            {
+                closest = t;
+                hit.triangle = bvh.triangles[i].index;
+                hit.distance = t;
+                hit.u = u;
+                hit.v = v;
+                found = true;
+            }
+        }
+    });
+    return found;
+}
+
+
+bool UIntersectTriangle(const BvhTriangle& triangle, const glm::vec3& origin, const glm::vec3& direction, float& t, float& u, float& v)
+{
+    glm::vec3 p = glm::cross(direction, triangle.edge2);
+    float determinant = glm::dot(triangle.edge1, p);
+    if (fabs(determinant) < 1e-12f)
+        return false;
+    float inverse = 1.0f / determinant;
+
+    glm::vec3 s = origin - triangle.v0;
+    u = glm::dot(s, p) * inverse;
+    if (u < 0.0f || u > 1.0f)
+        return false;
+
+    glm::vec3 q = glm::cross(s, triangle.edge1);
+    v = glm::dot(direction, q) * inverse;
+    if (v < 0.0f || u + v > 1.0f)
+        return false;
+
+    t = glm::dot(triangle.edge2, q) * inverse;
+    return t > 1e-6f;
+}
+
+
+bool UPickScene(const SceneBvh& scene, const PickRay& ray, PickHit& hit)
+{
+    hit.instance = -1;
+    float closest = FLT_MAX;
+    traverse(scene.nodes, scene.depth, ray.origin, ray.direction, closest, [&](GLuint first, GLuint count)
+    {
+        for (GLuint i = first; i < first + count; ++i)
+        {
+            // The mesh is tested in its own space; t means the same along both rays
+            const PickInstance& instance = scene.instances[i];
+            PickRay local;
+            local.origin = glm::vec3(instance.inverseModel * glm::vec4(ray.origin, 1.0f));
+            local.direction = glm::vec3(instance.inverseModel * glm::vec4(ray.direction, 0.0f));
+            if (UIntersectMeshBvh(*instance.bvh, local, closest, hit))
+            {
+                closest = hit.distance;
+                hit.instance = scene.ids[i];
+            }
+        }
+    });
+
+    if (hit.instance < 0)
+        return false;
+    hit.position = ray.origin + ray.direction * hit.distance;
+    return true;
+}
+
+
+PickRay UScreenRay(const glm::mat4& view, const glm::mat4& projection, float ndcX, float ndcY)
+{
+    glm::mat4 inverse = glm::inverse(projection * view);
+    glm::vec4 nearPoint = inverse * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+    glm::vec4 farPoint = inverse * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+
+    PickRay ray;
+    ray.origin = glm::vec3(nearPoint) / nearPoint.w;
+    ray.direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - ray.origin);
+    return ray;
+}
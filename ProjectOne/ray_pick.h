@@ -0,0 +1,106 @@
+#ifndef RAY_PICK_H
+#define RAY_PICK_H
+
+#include <vector>
+#include <GLEW/glew.h>      // GLEW library
+
+// GLM Math Header inclusions
+#include <glm/glm.hpp>
+
+/* One node of a flattened BVH, 32 bytes so two share a cache line. Nodes are stored depth
+ * first: an interior node's first child follows it directly and first is the index of the
+ * second; a leaf holds count primitives starting at first.
+ */
+struct BvhNode
+{
+    glm::vec3 boundsMin;
+    GLuint first;
+    glm::vec3 boundsMax;
+    GLuint count;           // 0 for interior nodes
+};
+
+// A triangle stored in leaf order, ready for the intersection test
+struct BvhTriangle
+{
+    glm::vec3 v0;
+    glm::vec3 edge1;        // v1 - v0
+    glm::vec3 edge2;        // v2 - v0
+    GLuint index;           // Triangle number in the index list it was built from
+};
+
+// Triangle BVH of one mesh, in object space
+struct MeshBvh
+{
+    std::vector<BvhNode> nodes;
+    std::vector<BvhTriangle> triangles;
+    int depth;              // Longest root to leaf path, sizes the traversal stack
+
+    MeshBvh() : depth(0) {}
+};
+
+// One placed mesh in the scene BVH
+struct PickInstance
+{
+    const MeshBvh* bvh;
+    glm::mat4 model;
+    glm::mat4 inverseModel;
+    glm::vec3 boundsMin;    // World-space box around the mesh's root node
+    glm::vec3 boundsMax;
+};
+
+// Top-level BVH over the instances; leaves index instances
+struct SceneBvh
+{
+    std::vector<BvhNode> nodes;
+    std::vector<PickInstance> instances;    // In leaf order once built
+    std::vector<int> ids;                   // Number each of them was added as
+    int added;
+    int depth;                              // Longest root to leaf path, sizes the traversal stack
+
+    SceneBvh() : added(0), depth(0) {}
+};
+
+struct PickRay
+{
+    glm::vec3 origin;
+    glm::vec3 direction;    // Normalized, so hit distances are in world units
+};
+
+struct PickHit
+{
+    int instance;           // As numbered by UAddPickInstance's order, -1 for no hit
+    GLuint triangle;        // See BvhTriangle::index
+    float distance;
+    glm::vec3 position;     // World space
+    float u;                // Barycentrics of the hit on the triangle, weights of v1 and v2
+    float v;
+};
+
+/* Builds a mesh's BVH with the surface area heuristic over binned centroids. Positions are
+ * the first 3 floats of every vertex. Leaves hold up to 4 triangles. The indices are not
+ * range checked here, loaders reject files with indices past their vertices.
+ */
+void UBuildMeshBvh(const GLfloat* vertices, GLuint floatsPerVertex, const GLuint* indices, size_t indexCount, MeshBvh& bvh);
+
+// Starts a new set of instances
+void UClearPickScene(SceneBvh& scene);
+
+// Adds an instance, numbered in the order of the calls. Meshes without triangles are skipped (but numbered).
+void UAddPickInstance(SceneBvh& scene, const MeshBvh* bvh, const glm::mat4& model);
+
+// Builds the top-level BVH over the instances added since UClearPickScene
+void UBuildPickScene(SceneBvh& scene);
+
+// Closest hit along the ray, false when it hits nothing
+bool UPickScene(const SceneBvh& scene, const PickRay& ray, PickHit& hit);
+
+// Closest hit against one mesh, in the mesh's space, closer than maxDistance
+bool UIntersectMeshBvh(const MeshBvh& bvh, const PickRay& ray, float maxDistance, PickHit& hit);
+
+// Möller-Trumbore against both faces; t is the distance along direction in its units
+bool UIntersectTriangle(const BvhTriangle& triangle, const glm::vec3& origin, const glm::vec3& direction, float& t, float& u, float& v);
+
+// Ray from the camera through a point of the screen, given in normalized device coordinates
+PickRay UScreenRay(const glm::mat4& view, const glm::mat4& projection, float ndcX, float ndcY);
+
+#endif
@@ -0,0 +1,90 @@
+#include "scene_snapshot.h"
+
+#include <glm/gtx/transform.hpp>
+
+// Unnamed namespace
+namespace
+{
+    const unsigned SNAPSHOT_INDEX = 3u;
+    const unsigned SNAPSHOT_FRESH = 4u;
+}
+
+
+SceneSnapshot& UBeginSnapshot(SnapshotBuffer& buffer)
+{
+    return buffer.slots[buffer.writing];
+}
+
+
+void UPublishSnapshot(SnapshotBuffer& buffer)
+{
+    // Release makes the slot's contents visible to whoever acquires it next
+    unsigned previous = buffer.middle.exchange(buffer.writing | SNAPSHOT_FRESH, std::memory_order_acq_rel);
+    buffer.writing = previous & SNAPSHOT_INDEX;
+}
+
+
+bool UAcquireSnapshot(SnapshotBuffer& buffer, const SceneSnapshot*& latest)
+{
+    if ((buffer.middle.load(std::memory_order_relaxed) & SNAPSHOT_FRESH) == 0)
+        return false;
+
+    // The slot we hand back is the one we were reading, it's stale so it goes back without the flag
+    unsigned published = buffer.middle.exchange(buffer.reading, std::memory_order_acq_rel);
+    buffer.reading = published & SNAPSHOT_INDEX;
+    latest = &buffer.slots[buffer.reading];
+    return true;
+}
+
+
+bool UHasNewSnapshot(const SnapshotBuffer& buffer)
+{
+    return (buffer.middle.load(std::memory_order_relaxed) & SNAPSHOT_FRESH) != 0;
+}
+
+
+bool USnapshotChanged(const SceneSnapshot& previous, const SceneSnapshot& current)
+{
+    // Camera
+    if (previous.cameraPosition != current.cameraPosition || previous.cameraFront != current.cameraFront ||
+        previous.cameraUp != current.cameraUp || previous.cameraZoom != current.cameraZoom)
+        return true;
+    // Light
+    if (previous.lightPosition != current.lightPosition || previous.lightScale != current.lightScale ||
+        previous.lightColor != current.lightColor || previous.objectColor != current.objectColor)
+        return true;
+    // Objects
+    if (previous.model != current.model)
+        return true;
+    // Resized, or uncovered and in need of a repaint
+    if (previous.viewportWidth != current.viewportWidth || previous.viewportHeight != current.viewportHeight ||
+        previous.windowVersion != current.windowVersion)
+        return true;
+    // Hovered or selected object
+    return previous.hoveredObject != current.hoveredObject || previous.selectedObject != current.selectedObject;
+}
+
+
+void UInterpolateSnapshot(const SceneSnapshot& previous, const SceneSnapshot& current, float alpha, SceneSnapshot& result)
+{
+    result = current;
+    result.time = previous.time + (current.time - previous.time) * alpha;
+
+    result.cameraPosition = glm::mix(previous.cameraPosition, current.cameraPosition, alpha);
+    result.cameraFront = glm::normalize(glm::mix(previous.cameraFront, current.cameraFront, alpha));
+    result.cameraUp = glm::normalize(glm::mix(previous.cameraUp, current.cameraUp, alpha));
+    result.cameraZoom = glm::mix(previous.cameraZoom, current.cameraZoom, alpha);
+
+    // Per element is good enough between two ticks: rotations barely move in 1/120 s
+    for (int column = 0; column < 4; ++column)
+        result.model[column] = previous.model[column] + (current.model[column] - previous.model[column]) * alpha;
+
+    result.lightPosition = glm::mix(previous.lightPosition, current.lightPosition, alpha);
+    result.lightScale = glm::mix(previous.lightScale, current.lightScale, alpha);
+}
+
+
+glm::mat4 USnapshotView(const SceneSnapshot& snapshot)
+{
+    return glm::lookAt(snapshot.cameraPosition, snapshot.cameraPosition + snapshot.cameraFront, snapshot.cameraUp);
+}
@@ -0,0 +1,75 @@
+#ifndef SCENE_SNAPSHOT_H
+#define SCENE_SNAPSHOT_H
+
+#include <atomic>
+
+// GLM Math Header inclusions
+#include <glm/glm.hpp>
+
+// Everything the renderer needs from the simulation for one tick. Plain values, no pointers
+// into simulation state, so the render thread can keep a copy as long as it likes.
+struct SceneSnapshot
+{
+    unsigned long long tick;        // Simulation step that produced it
+    double time;                    // Simulation time of that step, in glfwGetTime seconds
+
+    // Camera
+    glm::vec3 cameraPosition;
+    glm::vec3 cameraFront;
+    glm::vec3 cameraUp;
+    float cameraZoom;               // Vertical field of view in degrees
+
+    // Transforms
+    glm::mat4 model;                // The desk set; loaded meshes are fixed once loading is done
+
+    // Lights
+    glm::vec3 lightPosition;
+    glm::vec3 lightScale;
+    glm::vec3 lightColor;
+    glm::vec3 objectColor;
+
+    // Framebuffer size at the time of the tick
+    int viewportWidth;
+    int viewportHeight;
+    unsigned windowVersion;         // Bumped when the window needs repainting at the same size
+
+    // Picking, as indices into the frame's objects; -1 for none
+    int hoveredObject;
+    int selectedObject;
+};
+
+/* Single producer, single consumer triple buffer. The producer fills the slot from
+ * UBeginSnapshot and hands it over with UPublishSnapshot; the consumer swaps in the newest
+ * published slot with UAcquireSnapshot. Neither side ever waits: the slots are exchanged
+ * through one atomic index, a publish the consumer didn't get to is simply overwritten.
+ */
+struct SnapshotBuffer
+{
+    SceneSnapshot slots[3];
+    std::atomic<unsigned> middle;   // Slot between the two sides, plus SNAPSHOT_FRESH when it was published since the last acquire
+    unsigned writing;               // Producer's slot
+    unsigned reading;               // Consumer's slot
+
+    SnapshotBuffer() : middle(1), writing(0), reading(2) {}
+};
+
+// Producer side
+SceneSnapshot& UBeginSnapshot(SnapshotBuffer& buffer);
+void UPublishSnapshot(SnapshotBuffer& buffer);
+
+// Consumer side: true and the newest snapshot when one was published since the last call
+bool UAcquireSnapshot(SnapshotBuffer& buffer, const SceneSnapshot*& latest);
+
+// Consumer side: whether UAcquireSnapshot would return a new snapshot
+bool UHasNewSnapshot(const SnapshotBuffer& buffer);
+
+// False when a redraw of current would look the same as one of previous
+bool USnapshotChanged(const SceneSnapshot& previous, const SceneSnapshot& current);
+
+// Blends two consecutive snapshots, alpha 0 is previous and 1 is current
+void UInterpolateSnapshot(const SceneSnapshot& previous, const SceneSnapshot& current, float alpha, SceneSnapshot& result);
+
+// View matrix of the snapshot's camera, the same one Camera::GetViewMatrix builds
+glm::mat4 USnapshotView(const SceneSnapshot& snapshot);
+
+#endif
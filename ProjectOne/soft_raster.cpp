@@ -0,0 +1,500 @@
+#include "soft_raster.h"
+
+#include <algorithm>        // std::min, std::max, std::swap
+#include <atomic>
+#include <chrono>           // steady_clock
+#include <cmath>            // floor, ceil, pow
+#include <cstdio>           // fopen, fwrite
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>      // SSE2
+#define SOFT_RASTER_SSE2 1
+#endif
+
+#include "job_pool.h"       // Vertices, bins and tiles are all spread over the workers
+
+using namespace std;
+
+// Unnamed namespace
+namespace
+{
+    const size_t VERTICES_PER_JOB = 1024;
+    const size_t TRIANGLES_PER_CHUNK = 2048;
+    const int ATTRIBUTE_COUNT = 8;      // world position, normal, uv
+
+    // Output of the vertex stage (the vertexShaderSource outputs)
+    struct ShadedVertex
+    {
+        glm::vec4 clip;
+        float attributes[ATTRIBUTE_COUNT];
+    };
+
+    // A clipped triangle in screen space, counter-clockwise
+    struct SetupTriangle
+    {
+        float x[3], y[3], z[3];
+        float invW[3];
+        float attributes[3][ATTRIBUTE_COUNT];   // As shaded; the per-pixel weights carry the 1/w correction
+        float area;
+        int minX, maxX, minY, maxY;
+        const SoftDrawCall* draw;
+    };
+
+    // A run of triangles set up and binned by one job. Chunks are rasterized in order, so
+    // triangles keep the order they were submitted in.
+    struct BinChunk
+    {
+        size_t draw;
+        size_t firstTriangle;
+        size_t triangleCount;
+        std::vector<SetupTriangle> triangles;
+        std::vector<std::vector<unsigned> > bins;   // Per tile, indices into triangles
+    };
+
+    std::vector<std::vector<ShadedVertex> > gShadedVertices;   // Per draw, reused every frame
+    std::vector<BinChunk> gChunks;
+
+    typedef std::chrono::steady_clock Clock;
+
+    float millisecondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+    }
+
+    // vertexShaderSource
+    void shadeVertices(const SoftDrawCall& draw, const glm::mat4& viewProjection, const glm::mat4& normalMatrix,
+        std::vector<ShadedVertex>& out, size_t begin, size_t end)
+    {
+        glm::mat4 mvp = viewProjection * draw.model;
+        for (size_t v = begin; v < end; ++v)
+        {
+            const GLfloat* in = draw.vertices + v * SOFT_FLOATS_PER_VERTEX;
+            glm::vec4 position(in[0], in[1], in[2], 1.0f);
+            glm::vec4 world = draw.model * position;
+            glm::vec4 normal = normalMatrix * glm::vec4(in[8], in[9], in[10], 0.0f);
+
+            ShadedVertex& shaded = out[v];
+            shaded.clip = mvp * position;
+            shaded.attributes[0] = world.x;
+            shaded.attributes[1] = world.y;
+            shaded.attributes[2] = world.z;
+            shaded.attributes[3] = normal.x;
+            shaded.attributes[4] = normal.y;
+            shaded.attributes[5] = normal.z;
+            shaded.attributes[6] = in[6];
+            shaded.attributes[7] = in[7];
+        }
+    }
+
+    // Clips against the near plane (z >= -w), then sets up and bins the resulting triangles
+    void setupTriangle(const ShadedVertex* corners[3], const SoftDrawCall* draw, int width, int height, int tilesX, BinChunk& chunk)
+    {
+        ShadedVertex polygon[4];
+        int count = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            const ShadedVertex& a = *corners[i];
+            const ShadedVertex& b = *corners[(i + 1) % 3];
+            float da = a.clip.z + a.clip.w, db = b.clip.z + b.clip.w;
+            if (da >= 0.0f)
+                polygon[count++] = a;
+            if ((da >= 0.0f) != (db >= 0.0f))
+            {
+                float t = da / (da - db);
+                ShadedVertex& clipped = polygon[count++];
+                clipped.clip = a.clip + (b.clip - a.clip) * t;
+                for (int k = 0; k < ATTRIBUTE_COUNT; ++k)
+                    clipped.attributes[k] = a.attributes[k] + (b.attributes[k] - a.attributes[k]) * t;
+            }
+        }
+
+        for (int k = 1; k + 1 < count; ++k)
+        {
+            const ShadedVertex* v[3] = { &polygon[0], &polygon[k], &polygon[k + 1] };
+            SetupTriangle tri;
+            for (int c = 0; c < 3; ++c)
+            {
+                float invW = 1.0f / v[c]->clip.w;
+                tri.x[c] = (v[c]->clip.x * invW * 0.5f + 0.5f) * width;
+                tri.y[c] = (v[c]->clip.y * invW * 0.5f + 0.5f) * height;
+                tri.z[c] = v[c]->clip.z * invW * 0.5f + 0.5f;
+                tri.invW[c] = invW;
+                for (int a = 0; a < ATTRIBUTE_COUNT; ++a)
+                    tri.attributes[c][a] = v[c]->attributes[a];
+            }
+
+            // Face culling is off in the GL path too, so both windings are drawn
+            tri.area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.x[2] - tri.x[0]) * (tri.y[1] - tri.y[0]);
+            if (tri.area < 0.0f)
+            {
+                std::swap(tri.x[1], tri.x[2]);
+                std::swap(tri.y[1], tri.y[2]);
+                std::swap(tri.z[1], tri.z[2]);
+                std::swap(tri.invW[1], tri.invW[2]);
+                for (int a = 0; a < ATTRIBUTE_COUNT; ++a)
+                    std::swap(tri.attributes[1][a], tri.attributes[2][a]);
+                tri.area = -tri.area;
+            }
+            if (!(tri.area > 1e-6f))
+                continue;
+
+            tri.minX = std::max(0, (int)floor(std::min(tri.x[0], std::min(tri.x[1], tri.x[2]))));
+            tri.maxX = std::min(width - 1, (int)ceil(std::max(tri.x[0], std::max(tri.x[1], tri.x[2]))));
+            tri.minY = std::max(0, (int)floor(std::min(tri.y[0], std::min(tri.y[1], tri.y[2]))));
+            tri.maxY = std::min(height - 1, (int)ceil(std::max(tri.y[0], std::max(tri.y[1], tri.y[2]))));
+            if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+                continue;
+            tri.draw = draw;
+
+            unsigned index = (unsigned)chunk.triangles.size();
+            chunk.triangles.push_back(tri);
+            for (int tileY = tri.minY / SOFT_TILE_SIZE; tileY <= tri.maxY / SOFT_TILE_SIZE; ++tileY)
+            {
+                for (int tileX = tri.minX / SOFT_TILE_SIZE; tileX <= tri.maxX / SOFT_TILE_SIZE; ++tileX)
+                    chunk.bins[tileY * tilesX + tileX].push_back(index);
+            }
+        }
+    }
+
+    // texture() with GL_LINEAR filtering and GL_REPEAT wrapping
+    glm::vec4 sampleTexture(const SoftTexture* texture, float s, float t)
+    {
+        if (!texture || texture->width <= 0 || texture->height <= 0)
+            return glm::vec4(1.0f);
+
+        float x = s * texture->width - 0.5f;
+        float y = t * texture->height - 0.5f;
+        float fx = floor(x), fy = floor(y);
+        float ax = x - fx, ay = y - fy;
+        int x0 = (int)fx % texture->width, y0 = (int)fy % texture->height;
+        if (x0 < 0) x0 += texture->width;
+        if (y0 < 0) y0 += texture->height;
+        int x1 = (x0 + 1) % texture->width, y1 = (y0 + 1) % texture->height;
+
+        const unsigned char* p00 = &texture->pixels[((size_t)y0 * texture->width + x0) * 4];
+        const unsigned char* p10 = &texture->pixels[((size_t)y0 * texture->width + x1) * 4];
+        const unsigned char* p01 = &texture->pixels[((size_t)y1 * texture->width + x0) * 4];
+        const unsigned char* p11 = &texture->pixels[((size_t)y1 * texture->width + x1) * 4];
+
+        glm::vec4 result;
+        for (int c = 0; c < 4; ++c)
+        {
+            float top = p00[c] + (p10[c] - p00[c]) * ax;
+            float bottom = p01[c] + (p11[c] - p01[c]) * ax;
+            result[c] = (top + (bottom - top) * ay) * (1.0f / 255.0f);
+        }
+        return result;
+    }
+
+    // fragmentShaderSource
+    unsigned int shadeFragment(const SetupTriangle& tri, const float weights[3], const SoftFrameUniforms& uniforms)
+    {
+        if (tri.draw->unlit)
+            return 0xffffffffu;
+
+        float a[ATTRIBUTE_COUNT];
+        for (int k = 0; k < ATTRIBUTE_COUNT; ++k)
+            a[k] = tri.attributes[0][k] * weights[0] + tri.attributes[1][k] * weights[1] + tri.attributes[2][k] * weights[2];
+        glm::vec3 fragmentPos(a[0], a[1], a[2]);
+        glm::vec3 vertexNormal(a[3], a[4], a[5]);
+
+        // Ambient
+        glm::vec3 ambient = 0.1f * uniforms.lightColor;
+
+        // Diffuse
+        glm::vec3 norm = glm::normalize(vertexNormal);
+        glm::vec3 lightDirection = glm::normalize(uniforms.lightPosition - fragmentPos);
+        float impact = std::max(glm::dot(norm, lightDirection), 0.0f);
+        glm::vec3 diffuse = impact * uniforms.lightColor;
+
+        // Specular
+        glm::vec3 viewDir = glm::normalize(uniforms.viewPosition - fragmentPos);
+        glm::vec3 reflectDir = glm::reflect(-lightDirection, norm);
+        float specularComponent = pow(std::max(glm::dot(viewDir, reflectDir), 0.0f), 16.0f);
+        glm::vec3 specular = 0.8f * specularComponent * uniforms.lightColor;
+
+        glm::vec3 phong = (ambient + diffuse + specular) * uniforms.objectColor;
+        glm::vec4 texel = sampleTexture(tri.draw->texture, a[6], a[7]);
+
+        // Unorm render target: clamp and round like GL does
+        unsigned int r = (unsigned int)(std::min(std::max(texel.r * phong.r, 0.0f), 1.0f) * 255.0f + 0.5f);
+        unsigned int g = (unsigned int)(std::min(std::max(texel.g * phong.g, 0.0f), 1.0f) * 255.0f + 0.5f);
+        unsigned int b = (unsigned int)(std::min(std::max(texel.b * phong.b, 0.0f), 1.0f) * 255.0f + 0.5f);
+        unsigned int alpha = (unsigned int)(std::min(std::max(texel.a, 0.0f), 1.0f) * 255.0f + 0.5f);
+        return r | (g << 8) | (b << 16) | (alpha << 24);
+    }
+
+    // Rasterizes one triangle inside one tile, depth test GL_LESS with writes
+    unsigned long long rasterTriangle(const SetupTriangle& tri, int tileMinX, int tileMaxX, int tileMinY, int tileMaxY,
+        const SoftFrameUniforms& uniforms, SoftFramebuffer& framebuffer)
+    {
+        int minX = std::max(tri.minX, tileMinX) & ~3;  // Tiles start on multiples of 4, so this stays in the tile
+        int maxX = std::min(tri.maxX, tileMaxX);
+        int minY = std::max(tri.minY, tileMinY);
+        int maxY = std::min(tri.maxY, tileMaxY);
+        if (minX > maxX || minY > maxY)
+            return 0;
+
+        // Edge functions, positive inside; pixels on an edge go to its top or left side only
+        float a[3], b[3], c[3];
+        bool topLeft[3];
+        for (int e = 0; e < 3; ++e)
+        {
+            int n = (e + 1) % 3;
+            a[e] = tri.y[e] - tri.y[n];
+            b[e] = tri.x[n] - tri.x[e];
+            c[e] = tri.x[e] * tri.y[n] - tri.y[e] * tri.x[n];
+            topLeft[e] = a[e] > 0.0f || (a[e] == 0.0f && b[e] < 0.0f);
+        }
+
+        // Edge e is opposite vertex (e + 2) % 3, so E_e / area is that vertex's barycentric weight
+        float invArea = 1.0f / tri.area;
+        float zx = ((tri.z[1] - tri.z[0]) * (tri.y[2] - tri.y[0]) - (tri.z[2] - tri.z[0]) * (tri.y[1] - tri.y[0])) * invArea;
+        float zy = ((tri.z[2] - tri.z[0]) * (tri.x[1] - tri.x[0]) - (tri.z[1] - tri.z[0]) * (tri.x[2] - tri.x[0])) * invArea;
+        float z0 = tri.z[0] - zx * tri.x[0] - zy * tri.y[0];
+
+        unsigned long long shaded = 0;
+
+#ifdef SOFT_RASTER_SSE2
+        const __m128 laneOffsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 a0 = _mm_set1_ps(a[0]), a1 = _mm_set1_ps(a[1]), a2 = _mm_set1_ps(a[2]);
+        const __m128 zxv = _mm_set1_ps(zx);
+        const __m128 onEdge0 = _mm_castsi128_ps(_mm_set1_epi32(topLeft[0] ? -1 : 0));
+        const __m128 onEdge1 = _mm_castsi128_ps(_mm_set1_epi32(topLeft[1] ? -1 : 0));
+        const __m128 onEdge2 = _mm_castsi128_ps(_mm_set1_epi32(topLeft[2] ? -1 : 0));
+        const __m128 lastPixel = _mm_set1_ps(maxX + 1.0f);
+
+        for (int y = minY; y <= maxY; ++y)
+        {
+            float py = y + 0.5f;
+            __m128 row0 = _mm_set1_ps(b[0] * py + c[0]);
+            __m128 row1 = _mm_set1_ps(b[1] * py + c[1]);
+            __m128 row2 = _mm_set1_ps(b[2] * py + c[2]);
+            __m128 rowZ = _mm_set1_ps(zy * py + z0);
+            float* depthRow = &framebuffer.depth[(size_t)y * framebuffer.stride];
+            unsigned int* colorRow = &framebuffer.color[(size_t)y * framebuffer.stride];
+
+            for (int x = minX; x <= maxX; x += 4)
+            {
+                __m128 px = _mm_add_ps(_mm_set1_ps((float)x), laneOffsets);
+                __m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), row0);
+                __m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), row1);
+                __m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), row2);
+
+                __m128 in0 = _mm_or_ps(_mm_cmpgt_ps(e0, zero), _mm_and_ps(_mm_cmpeq_ps(e0, zero), onEdge0));
+                __m128 in1 = _mm_or_ps(_mm_cmpgt_ps(e1, zero), _mm_and_ps(_mm_cmpeq_ps(e1, zero), onEdge1));
+                __m128 in2 = _mm_or_ps(_mm_cmpgt_ps(e2, zero), _mm_and_ps(_mm_cmpeq_ps(e2, zero), onEdge2));
+                __m128 inside = _mm_and_ps(_mm_and_ps(in0, in1), _mm_and_ps(in2, _mm_cmplt_ps(px, lastPixel)));
+                if (_mm_movemask_ps(inside) == 0)
+                    continue;
+
+                __m128 z = _mm_add_ps(_mm_mul_ps(zxv, px), rowZ);
+                __m128 stored = _mm_loadu_ps(depthRow + x);
+                __m128 pass = _mm_and_ps(inside, _mm_and_ps(_mm_cmplt_ps(z, stored), _mm_cmpge_ps(z, zero)));
+                int passMask = _mm_movemask_ps(pass);
+                if (passMask == 0)
+                    continue;
+                _mm_storeu_ps(depthRow + x, _mm_or_ps(_mm_and_ps(pass, z), _mm_andnot_ps(pass, stored)));
+
+                // Shading stays scalar per covered pixel
+                float edges[3][4];
+                _mm_storeu_ps(edges[0], e0);
+                _mm_storeu_ps(edges[1], e1);
+                _mm_storeu_ps(edges[2], e2);
+                for (int lane = 0; lane < 4; ++lane)
+                {
+                    if (!(passMask & (1 << lane)))
+                        continue;
+                    float w0 = edges[1][lane] * tri.invW[0];    // vertex 0 is opposite edge 1
+                    float w1 = edges[2][lane] * tri.invW[1];
+                    float w2 = edges[0][lane] * tri.invW[2];
+                    float normalize = 1.0f / (w0 + w1 + w2);
+                    float weights[3] = { w0 * normalize, w1 * normalize, w2 * normalize };
+                    colorRow[x + lane] = shadeFragment(tri, weights, uniforms);
+                    ++shaded;
+                }
+            }
+        }
+#else
+        for (int y = minY; y <= maxY; ++y)
+        {
+            float py = y + 0.5f;
+            float* depthRow = &framebuffer.depth[(size_t)y * framebuffer.stride];
+            unsigned int* colorRow = &framebuffer.color[(size_t)y * framebuffer.stride];
+            for (int x = minX; x <= maxX; ++x)
+            {
+                float px = x + 0.5f;
+                float edges[3];
+                bool inside = true;
+                for (int e = 0; e < 3 && inside; ++e)
+                {
+                    edges[e] = a[e] * px + b[e] * py + c[e];
+                    inside = edges[e] > 0.0f || (edges[e] == 0.0f && topLeft[e]);
+                }
+                float z = zx * px + zy * py + z0;
+                if (!inside || z < 0.0f || !(z < depthRow[x]))
+                    continue;
+                depthRow[x] = z;
+
+                float w0 = edges[1] * tri.invW[0];
+                float w1 = edges[2] * tri.invW[1];
+                float w2 = edges[0] * tri.invW[2];
+                float normalize = 1.0f / (w0 + w1 + w2);
+                float weights[3] = { w0 * normalize, w1 * normalize, w2 * normalize };
+                colorRow[x] = shadeFragment(tri, weights, uniforms);
+                ++shaded;
+            }
+        }
+#endif
+        return shaded;
+    }
+}
+
+
+void UResizeSoftFramebuffer(SoftFramebuffer& framebuffer, int width, int height)
+{
+    framebuffer.width = width;
+    framebuffer.height = height;
+    framebuffer.stride = (width + 3) & ~3;
+    framebuffer.color.assign((size_t)framebuffer.stride * height, 0);
+    framebuffer.depth.assign((size_t)framebuffer.stride * height, 1.0f);
+}
+
+
+void UClearSoftFramebuffer(SoftFramebuffer& framebuffer, unsigned int color)
+{
+    std::fill(framebuffer.color.begin(), framebuffer.color.end(), color);
+    std::fill(framebuffer.depth.begin(), framebuffer.depth.end(), 1.0f);
+}
+
+
+void USoftRender(const FrameVector<SoftDrawCall>& draws, const SoftFrameUniforms& uniforms, SoftFramebuffer& framebuffer, SoftFrameStats& stats)
+{
+    const int width = framebuffer.width;
+    const int height = framebuffer.height;
+    const int tilesX = (width + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    const int tilesY = (height + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    const glm::mat4 viewProjection = uniforms.projection * uniforms.view;
+
+    stats.trianglesSubmitted = 0;
+    stats.trianglesBinned = 0;
+    stats.fragmentsShaded = 0;
+
+    // Vertex stage
+    Clock::time_point start = Clock::now();
+    gShadedVertices.resize(draws.size());
+    for (size_t d = 0; d < draws.size(); ++d)
+    {
+        const SoftDrawCall& draw = draws[d];
+        std::vector<ShadedVertex>& shaded = gShadedVertices[d];
+        shaded.resize(draw.vertexCount);
+        glm::mat4 normalMatrix = glm::transpose(glm::inverse(draw.model));
+        size_t jobs = (draw.vertexCount + VERTICES_PER_JOB - 1) / VERTICES_PER_JOB;
+        UParallelFor(jobs, [&](size_t job)
+        {
+            shadeVertices(draw, viewProjection, normalMatrix, shaded, job * VERTICES_PER_JOB, std::min(draw.vertexCount, (job + 1) * VERTICES_PER_JOB));
+        });
+        stats.trianglesSubmitted += (unsigned long)(draw.indexCount / 3);
+    }
+    stats.vertexMilliseconds = millisecondsSince(start);
+
+    // Setup and binning, in chunks that never span two draws
+    start = Clock::now();
+    size_t chunkCount = 0;
+    for (size_t d = 0; d < draws.size(); ++d)
+    {
+        size_t triangles = draws[d].indexCount / 3;
+        for (size_t first = 0; first < triangles; first += TRIANGLES_PER_CHUNK)
+        {
+            if (chunkCount == gChunks.size())
+                gChunks.push_back(BinChunk());
+            BinChunk& chunk = gChunks[chunkCount++];
+            chunk.draw = d;
+            chunk.firstTriangle = first;
+            chunk.triangleCount = std::min(TRIANGLES_PER_CHUNK, triangles - first);
+        }
+    }
+
+    UParallelFor(chunkCount, [&](size_t c)
+    {
+        BinChunk& chunk = gChunks[c];
+        chunk.triangles.clear();
+        chunk.bins.resize((size_t)tilesX * tilesY);
+        for (size_t t = 0; t < chunk.bins.size(); ++t)
+            chunk.bins[t].clear();
+
+        const SoftDrawCall& draw = draws[chunk.draw];
+        const std::vector<ShadedVertex>& shaded = gShadedVertices[chunk.draw];
+        for (size_t t = chunk.firstTriangle; t < chunk.firstTriangle + chunk.triangleCount; ++t)
+        {
+            const GLuint* index = draw.indices + t * 3;
+            if (index[0] >= draw.vertexCount || index[1] >= draw.vertexCount || index[2] >= draw.vertexCount)
+                continue;
+            const ShadedVertex* corners[3] = { &shaded[index[0]], &shaded[index[1]], &shaded[index[2]] };
+
+            // Trivially outside one of the side or far planes
+            bool outside = false;
+            for (int axis = 0; axis < 3 && !outside; ++axis)
+            {
+                outside = (corners[0]->clip[axis] > corners[0]->clip.w && corners[1]->clip[axis] > corners[1]->clip.w && corners[2]->clip[axis] > corners[2]->clip.w)
+                    || (axis < 2 && corners[0]->clip[axis] < -corners[0]->clip.w && corners[1]->clip[axis] < -corners[1]->clip.w && corners[2]->clip[axis] < -corners[2]->clip.w);
+            }
+            if (!outside)
+                setupTriangle(corners, &draw, width, height, tilesX, chunk);
+        }
+    });
+
+    for (size_t c = 0; c < chunkCount; ++c)
+        stats.trianglesBinned += (unsigned long)gChunks[c].triangles.size();
+    stats.binMilliseconds = millisecondsSince(start);
+
+    // Raster and shade, one tile per job
+    start = Clock::now();
+    std::atomic<unsigned long long> fragments(0);
+    UParallelFor((size_t)tilesX * tilesY, [&](size_t tile)
+    {
+        int tileMinX = (int)(tile % tilesX) * SOFT_TILE_SIZE;
+        int tileMinY = (int)(tile / tilesX) * SOFT_TILE_SIZE;
+        int tileMaxX = std::min(tileMinX + SOFT_TILE_SIZE, width) - 1;
+        int tileMaxY = std::min(tileMinY + SOFT_TILE_SIZE, height) - 1;
+
+        unsigned long long shaded = 0;
+        for (size_t c = 0; c < chunkCount; ++c)
+        {
+            const BinChunk& chunk = gChunks[c];
+            const std::vector<unsigned>& bin = chunk.bins[tile];
+            for (size_t i = 0; i < bin.size(); ++i)
+                shaded += rasterTriangle(chunk.triangles[bin[i]], tileMinX, tileMaxX, tileMinY, tileMaxY, uniforms, framebuffer);
+        }
+        fragments += shaded;
+    });
+    stats.fragmentsShaded = fragments.load();
+    stats.rasterMilliseconds = millisecondsSince(start);
+}
+
+
+bool UWriteSoftFramebuffer(const SoftFramebuffer& framebuffer, const char* filename)
+{
+    FILE* file = fopen(filename, "wb");
+    if (!file)
+        return false;
+
+    fprintf(file, "P6\n%d %d\n255\n", framebuffer.width, framebuffer.height);
+    std::vector<unsigned char> row((size_t)framebuffer.width * 3);
+    bool ok = true;
+    for (int y = framebuffer.height - 1; y >= 0 && ok; --y)
+    {
+        const unsigned int* colorRow = &framebuffer.color[(size_t)y * framebuffer.stride];
+        for (int x = 0; x < framebuffer.width; ++x)
+        {
+            row[x * 3] = (unsigned char)(colorRow[x] & 0xff);
+            row[x * 3 + 1] = (unsigned char)((colorRow[x] >> 8) & 0xff);
+            row[x * 3 + 2] = (unsigned char)((colorRow[x] >> 16) & 0xff);
+        }
+        ok = fwrite(&row[0], 1, row.size(), file) == row.size();
+    }
+
+    fclose(file);
+    return ok;
+}
@@ -0,0 +1,82 @@
+#ifndef SOFT_RASTER_H
+#define SOFT_RASTER_H
+
+#include <vector>
+#include <GLEW/glew.h>      // GLEW library (GLfloat/GLuint only, no GL calls are made)
+
+// GLM Math Header inclusions
+#include <glm/glm.hpp>
+
+#include "frame_memory.h"   // A frame's draws are frame scratch
+
+// Screen tiles every triangle is binned into; one tile is rasterized by one thread
+const int SOFT_TILE_SIZE = 64;
+
+// RGBA8 texture with the first row at t = 0, like the GL textures
+struct SoftTexture
+{
+    std::vector<unsigned char> pixels;
+    int width;
+    int height;
+};
+
+// Color and depth target, bottom row first like the GL default framebuffer
+struct SoftFramebuffer
+{
+    int width;
+    int height;
+    int stride;                         // Width rounded up to 4, so SIMD rows never spill into the next one
+    std::vector<unsigned int> color;    // RGBA8, red in the lowest byte
+    std::vector<float> depth;
+};
+
+// The vertex layout the shaders use: position, color, uv, normal
+const GLuint SOFT_FLOATS_PER_VERTEX = 11;
+
+// One glDrawElements worth of work with SOFT_FLOATS_PER_VERTEX floats per vertex
+struct SoftDrawCall
+{
+    const GLfloat* vertices;
+    size_t vertexCount;
+    const GLuint* indices;
+    size_t indexCount;
+    glm::mat4 model;
+    const SoftTexture* texture;     // nullptr samples white
+    bool unlit;                     // Lamp shader: plain white, no lighting
+};
+
+// The uniforms of fragmentShaderSource that don't change between draws
+struct SoftFrameUniforms
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec3 objectColor;
+    glm::vec3 lightColor;
+    glm::vec3 lightPosition;
+    glm::vec3 viewPosition;
+};
+
+struct SoftFrameStats
+{
+    unsigned long trianglesSubmitted;
+    unsigned long trianglesBinned;      // After clipping and back-of-screen rejection
+    unsigned long long fragmentsShaded;
+    float vertexMilliseconds;
+    float binMilliseconds;
+    float rasterMilliseconds;
+};
+
+void UResizeSoftFramebuffer(SoftFramebuffer& framebuffer, int width, int height);
+void UClearSoftFramebuffer(SoftFramebuffer& framebuffer, unsigned int color);
+
+/* Renders the draw calls into the framebuffer on the job pool: vertices are shaded in
+ * parallel per draw, triangles are clipped and binned into SOFT_TILE_SIZE tiles in
+ * parallel chunks, then every tile is rasterized and shaded on its own, in submission
+ * order, with the Phong model of fragmentShaderSource.
+ */
+void USoftRender(const FrameVector<SoftDrawCall>& draws, const SoftFrameUniforms& uniforms, SoftFramebuffer& framebuffer, SoftFrameStats& stats);
+
+// Writes the color buffer as a binary PPM, top row first
+bool UWriteSoftFramebuffer(const SoftFramebuffer& framebuffer, const char* filename);
+
+#endif
@@ -0,0 +1,422 @@
+#include "texture_stream.h"
+
+#include <algorithm>        // std::sort, std::min
+#include <climits>          // INT_MAX
+#include <cmath>            // log2, floor
+#include <cstring>          // memcpy
+#include <functional>       // std::hash, std::equal_to
+#include <memory>           // std::unique_ptr
+#include <unordered_map>
+#include <vector>
+
+#include "job_pool.h"       // Copies into the pixel buffers run as jobs
+#include "frame_memory.h"   // The upload queue is frame scratch, the name lookup is pooled
+#include "async_log.h"
+#include "gl_capture.h"     // Routes the GL calls through the capture wrappers
+
+// Unnamed namespace
+namespace
+{
+    struct MipLevel
+    {
+        int width;
+        int height;
+        std::vector<unsigned char> pixels;      // RGBA8
+    };
+
+    struct StreamedTexture
+    {
+        GLuint name;
+        std::vector<MipLevel> levels;           // Finest first
+        int residentLevel;                      // Finest level on the GPU, GL_TEXTURE_BASE_LEVEL
+        int initialLevel;                       // Never evicted past this one
+        int wantedLevel;                        // What the last frames asked for
+        int frameLevel;                         // Finest request during the current frame, INT_MAX without one
+        unsigned lastSeen;                      // Frame of the last request
+        size_t residentBytes;                   // Levels residentLevel and coarser, plus one in flight
+        bool uploading;
+    };
+
+    // A pixel buffer mapped on the GL thread and filled by a job
+    struct Staging
+    {
+        GpuBuffer buffer;
+        size_t capacity;
+        void* mapped;
+        const unsigned char* source;            // What the job copies into mapped
+        size_t bytes;
+        JobGroup copying;
+        StreamedTexture* texture;
+        int level;
+
+        Staging() : capacity(0), mapped(nullptr), source(nullptr), bytes(0), texture(nullptr), level(0) {}
+    };
+
+    typedef std::unordered_map<GLuint, StreamedTexture*, std::hash<GLuint>, std::equal_to<GLuint>, PoolAllocator<std::pair<const GLuint, StreamedTexture*> > > TextureLookup;
+
+    std::vector<std::unique_ptr<StreamedTexture> > gTextures;
+    TextureLookup gByName;
+    Staging gStaging[TEXTURE_STREAM_MAX_IN_FLIGHT];
+    size_t gBudgetBytes = 256u * 1024 * 1024;
+    size_t gResidentBytes = 0;
+    unsigned gFrame = 0;
+    unsigned gStreamedIn = 0;
+    unsigned gEvicted = 0;
+    unsigned gStarved = 0;
+
+    size_t levelBytes(const MipLevel& level)
+    {
+        return (size_t)level.width * level.height * 4;
+    }
+
+    // Box filter, odd sizes clamp to the last row and column
+    void downsample(const MipLevel& source, MipLevel& target)
+    {
+        target.width = source.width > 1 ? source.width / 2 : 1;
+        target.height = source.height > 1 ? source.height / 2 : 1;
+        target.pixels.resize(levelBytes(target));
+
+        for (int y = 0; y < target.height; ++y)
+        {
+            int y0 = std::min(y * 2, source.height - 1), y1 = std::min(y * 2 + 1, source.height - 1);
+            for (int x = 0; x < target.width; ++x)
+            {
+                int x0 = std::min(x * 2, source.width - 1), x1 = std::min(x * 2 + 1, source.width - 1);
+                const unsigned char* a = &source.pixels[((size_t)y0 * source.width + x0) * 4];
+                const unsigned char* b = &source.pixels[((size_t)y0 * source.width + x1) * 4];
+                const unsigned char* c = &source.pixels[((size_t)y1 * source.width + x0) * 4];
+                const unsigned char* d = &source.pixels[((size_t)y1 * source.width + x1) * 4];
+                unsigned char* out = &target.pixels[((size_t)y * target.width + x) * 4];
+                for (int k = 0; k < 4; ++k)
+                    out[k] = (unsigned char)((a[k] + b[k] + c[k] + d[k] + 2) / 4);
+            }
+        }
+    }
+
+    void uploadLevel(const StreamedTexture& texture, int level, const void* pixels)
+    {
+        const MipLevel& mip = texture.levels[level];
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, mip.width, mip.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    }
+
+    // Drops the finest resident level: sampling moves off it first, then its storage goes
+    void evictLevel(StreamedTexture& texture)
+    {
+        int level = texture.residentLevel;
+        glBindTexture(GL_TEXTURE_2D, texture.name);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+        size_t bytes = levelBytes(texture.levels[level]);
+        texture.residentLevel = level + 1;
+        texture.residentBytes -= bytes;
+        gResidentBytes -= bytes;
+        UResizeGpuResource(GPU_TEXTURE, texture.name, texture.residentBytes);
+        ++gEvicted;
+    }
+
+    // Evicts levels finer than wanted, from textures other than keep, until bytes fit in the budget
+    bool makeRoom(size_t bytes, const StreamedTexture* keep)
+    {
+        while (gResidentBytes + bytes > gBudgetBytes)
+        {
+            // The biggest level nobody needs goes first
+            StreamedTexture* victim = nullptr;
+            for (size_t t = 0; t < gTextures.size(); ++t)
+            {
+                StreamedTexture* candidate = gTextures[t].get();
+                if (candidate == keep || candidate->uploading || candidate->residentLevel >= candidate->wantedLevel)
+                    continue;
+                if (!victim || levelBytes(candidate->levels[candidate->residentLevel]) > levelBytes(victim->levels[victim->residentLevel]))
+                    victim = candidate;
+            }
+            if (!victim)
+                return false;
+            evictLevel(*victim);
+        }
+        return true;
+    }
+
+    // Finishes a copy whose job is done: the level goes from the pixel buffer into the texture
+    void finishUpload(Staging& staging)
+    {
+        StreamedTexture& texture = *staging.texture;
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.buffer);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        staging.mapped = nullptr;
+
+        glBindTexture(GL_TEXTURE_2D, texture.name);
+        uploadLevel(texture, staging.level, (const void*)0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, staging.level);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        texture.residentLevel = staging.level;
+        texture.uploading = false;
+        staging.texture = nullptr;
+        ++gStreamedIn;
+    }
+
+    // Maps a pixel buffer and hands the copy to the job pool
+    bool startUpload(Staging& staging, StreamedTexture& texture, int level)
+    {
+        const MipLevel& mip = texture.levels[level];
+        size_t bytes = levelBytes(mip);
+
+        if (staging.capacity < bytes)
+        {
+            // create deleted the old buffer either way, a failed one leaves nothing to reuse
+            if (!staging.buffer.create(bytes, "texture streaming"))
+            {
+                staging.capacity = 0;
+                return false;
+            }
+            staging.capacity = bytes;
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.buffer);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)bytes, nullptr, GL_STREAM_DRAW);
+        }
+        else
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.buffer);
+
+        // Invalidating lets the driver hand out fresh memory while the last upload may still read the old one
+        staging.mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (!staging.mapped)
+            return false;
+
+        staging.texture = &texture;
+        staging.level = level;
+        staging.source = &mip.pixels[0];
+        staging.bytes = bytes;
+        texture.uploading = true;
+
+        // The job only captures the staging slot, small enough for std::function to keep inline
+        Staging* copy = &staging;
+        USubmitJob(staging.copying, [copy] { memcpy(copy->mapped, copy->source, copy->bytes); });
+        return true;
+    }
+}
+
+
+bool UCreateStreamedTexture(const char* name, const unsigned char* pixels, int width, int height, int channels, GpuTexture& texture)
+{
+    std::unique_ptr<StreamedTexture> streamed(new StreamedTexture());
+
+    // Level 0 as RGBA, so every level has 4-byte rows whatever its width
+    MipLevel base;
+    base.width = width;
+    base.height = height;
+    base.pixels.resize(levelBytes(base));
+    for (size_t p = 0; p < (size_t)width * height; ++p)
+    {
+        for (int c = 0; c < 4; ++c)
+            base.pixels[p * 4 + c] = c < channels ? pixels[p * channels + c] : 255;
+    }
+    streamed->levels.push_back(base);
+    while (streamed->levels.back().width > 1 || streamed->levels.back().height > 1)
+    {
+        MipLevel next;
+        downsample(streamed->levels.back(), next);
+        streamed->levels.push_back(next);
+    }
+
+    int last = (int)streamed->levels.size() - 1;
+    int initial = 0;
+    while (initial < last && std::max(streamed->levels[initial].width, streamed->levels[initial].height) > TEXTURE_STREAM_INITIAL_SIZE)
+        ++initial;
+
+    size_t bytes = 0;
+    for (int l = initial; l <= last; ++l)
+        bytes += levelBytes(streamed->levels[l]);
+
+    if (!texture.create(bytes, name))
+        return false;
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+
+    // set the texture wrapping parameters
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    // set texture filtering parameters, sampling between the resident mips
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    // Levels outside [BASE_LEVEL, MAX_LEVEL] don't count for completeness, so the missing fine ones are fine
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, initial);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, last);
+    for (int l = initial; l <= last; ++l)
+        uploadLevel(*streamed, l, &streamed->levels[l].pixels[0]);
+
+    glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
+
+    streamed->name = texture;
+    streamed->residentLevel = initial;
+    streamed->initialLevel = initial;
+    streamed->wantedLevel = initial;
+    streamed->frameLevel = INT_MAX;
+    streamed->lastSeen = gFrame;
+    streamed->residentBytes = bytes;
+    streamed->uploading = false;
+    gResidentBytes += bytes;
+
+    gByName[streamed->name] = streamed.get();
+    gTextures.push_back(std::move(streamed));
+    return true;
+}
+
+
+void USetTextureStreamBudget(size_t bytes)
+{
+    gBudgetBytes = bytes;
+}
+
+
+void URequestTextureDetail(GLuint texture, float projectedPixels)
+{
+    TextureLookup::iterator found = gByName.find(texture);
+    if (found == gByName.end() || projectedPixels <= 0.0f)
+        return;
+
+    // One texel per pixel: the level whose size matches the object's size on screen
+    StreamedTexture& streamed = *found->second;
+    float size = (float)std::max(streamed.levels[0].width, streamed.levels[0].height);
+    int level = size > projectedPixels ? (int)floor(log2(size / projectedPixels)) : 0;
+    level = std::min(level, (int)streamed.levels.size() - 1);
+
+    streamed.frameLevel = std::min(streamed.frameLevel, level);
+    streamed.lastSeen = gFrame;
+}
+
+
+bool UUpdateTextureStreaming(size_t uploadBytes)
+{
+    ++gFrame;
+
+    // Settle what every texture wants: this frame's request, or back to the start once unseen for a while
+    for (size_t t = 0; t < gTextures.size(); ++t)
+    {
+        StreamedTexture& texture = *gTextures[t];
+        if (texture.frameLevel != INT_MAX)
+            texture.wantedLevel = std::min(texture.frameLevel, texture.initialLevel);
+        else if (gFrame - texture.lastSeen > TEXTURE_STREAM_KEEP_FRAMES)
+            texture.wantedLevel = texture.initialLevel;
+        texture.frameLevel = INT_MAX;
+    }
+
+    // Copies that are done go to GL
+    for (int s = 0; s < TEXTURE_STREAM_MAX_IN_FLIGHT; ++s)
+    {
+        if (gStaging[s].texture && gStaging[s].copying.pending.load() == 0)
+            finishUpload(gStaging[s]);
+    }
+
+    // Largest gap between what is wanted and what is resident first
+    FrameVector<StreamedTexture*> queue;
+    queue.reserve(gTextures.size());
+    for (size_t t = 0; t < gTextures.size(); ++t)
+    {
+        StreamedTexture* texture = gTextures[t].get();
+        if (!texture->uploading && texture->residentLevel > texture->wantedLevel)
+            queue.push_back(texture);
+    }
+    std::sort(queue.begin(), queue.end(), [](const StreamedTexture* a, const StreamedTexture* b)
+    {
+        return a->residentLevel - a->wantedLevel > b->residentLevel - b->wantedLevel;
+    });
+
+    size_t started = 0;
+    bool more = false;
+    for (size_t q = 0; q < queue.size(); ++q)
+    {
+        StreamedTexture& texture = *queue[q];
+        int level = texture.residentLevel - 1;
+        size_t bytes = levelBytes(texture.levels[level]);
+
+        // Always let one level through, however big, so a huge level can't stall forever
+        if (started > 0 && started + bytes > uploadBytes)
+        {
+            more = true;
+            break;
+        }
+
+        int free = -1;
+        for (int s = 0; s < TEXTURE_STREAM_MAX_IN_FLIGHT && free < 0; ++s)
+        {
+            if (!gStaging[s].texture)
+                free = s;
+        }
+        if (free < 0)
+        {
+            more = true;
+            break;
+        }
+
+        // Room comes from levels other textures no longer need, and has to pass the GPU budget too
+        if (!makeRoom(bytes, &texture) || !UResizeGpuResource(GPU_TEXTURE, texture.name, texture.residentBytes + bytes))
+        {
+            ++gStarved;
+            continue;
+        }
+        if (!startUpload(gStaging[free], texture, level))
+        {
+            UResizeGpuResource(GPU_TEXTURE, texture.name, texture.residentBytes);
+            ++gStarved;
+            continue;
+        }
+
+        texture.residentBytes += bytes;
+        gResidentBytes += bytes;
+        started += bytes;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // Levels left out for the budget don't count, they'd keep an idle renderer spinning
+    for (int s = 0; s < TEXTURE_STREAM_MAX_IN_FLIGHT && !more; ++s)
+        more = gStaging[s].texture != nullptr;
+    return more;
+}
+
+
+void UGetTextureStreamStats(TextureStreamStats& stats)
+{
+    stats.residentBytes = gResidentBytes;
+    stats.budgetBytes = gBudgetBytes;
+    stats.textures = (unsigned)gTextures.size();
+    stats.uploadsInFlight = 0;
+    for (int s = 0; s < TEXTURE_STREAM_MAX_IN_FLIGHT; ++s)
+    {
+        if (gStaging[s].texture)
+            ++stats.uploadsInFlight;
+    }
+    stats.streamedIn = gStreamedIn;
+    stats.evicted = gEvicted;
+    stats.starved = gStarved;
+    gStreamedIn = gEvicted = gStarved = 0;
+}
+
+
+void UShutdownTextureStreaming()
+{
+    for (int s = 0; s < TEXTURE_STREAM_MAX_IN_FLIGHT; ++s)
+    {
+        Staging& staging = gStaging[s];
+        UWaitJobGroup(staging.copying);
+        if (staging.mapped)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.buffer);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+        staging.buffer.reset();
+        staging.capacity = 0;
+        staging.mapped = nullptr;
+        staging.texture = nullptr;
+    }
+
+    if (!gTextures.empty())
+        ULOG_INFO("Texture streaming: {} textures, {} bytes resident at shutdown", (unsigned)gTextures.size(), gResidentBytes);
+    gByName.clear();
+    gTextures.clear();
+    gResidentBytes = 0;
+}
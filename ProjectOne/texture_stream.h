@@ -0,0 +1,58 @@
+#ifndef TEXTURE_STREAM_H
+#define TEXTURE_STREAM_H
+
+#include <cstddef>
+#include <GLEW/glew.h>      // GLEW library
+
+#include "gpu_resources.h"  // GpuTexture
+
+// A texture starts out with the levels no larger than this, finer ones are streamed in on demand
+const int TEXTURE_STREAM_INITIAL_SIZE = 64;
+
+// Levels being copied into pixel buffers at the same time
+const int TEXTURE_STREAM_MAX_IN_FLIGHT = 4;
+
+// Frames a texture may go unseen before its finer levels may be evicted
+const unsigned TEXTURE_STREAM_KEEP_FRAMES = 120;
+
+struct TextureStreamStats
+{
+    size_t residentBytes;       // Levels on the GPU plus the ones being uploaded
+    size_t budgetBytes;
+    unsigned textures;
+    unsigned uploadsInFlight;
+    unsigned streamedIn;        // Levels, since the last call
+    unsigned evicted;
+    unsigned starved;           // Levels wanted but left out because of the budget
+};
+
+/* Creates a texture that streams its mips. The whole chain is built on the CPU and kept
+ * there (RGBA8, first row at t = 0), but only the levels up to TEXTURE_STREAM_INITIAL_SIZE
+ * are uploaded; GL_TEXTURE_BASE_LEVEL keeps sampling inside the resident levels.
+ * Needs the GL context. The texture must outlive the streaming (see UShutdownTextureStreaming).
+ */
+bool UCreateStreamedTexture(const char* name, const unsigned char* pixels, int width, int height, int channels, GpuTexture& texture);
+
+void USetTextureStreamBudget(size_t bytes);
+
+/* Notes that the texture is drawn on something about projectedPixels across on screen.
+ * The finest level any call asks for during a frame is what the next UUpdateTextureStreaming
+ * works towards. Names that aren't streamed are ignored. Not thread-safe: call it from one
+ * job at a time.
+ */
+void URequestTextureDetail(GLuint texture, float projectedPixels);
+
+/* Once per frame on the GL thread: finishes the copies that are done, evicts levels no
+ * longer needed when the budget is tight, and starts copies of the next finer levels on
+ * the job pool through mapped pixel buffers. At most uploadBytes are handed to GL.
+ * Returns true while there is more to do, so an idle renderer knows to keep going.
+ */
+bool UUpdateTextureStreaming(size_t uploadBytes);
+
+// Counters since the previous call, which resets them; sizes are current values
+void UGetTextureStreamStats(TextureStreamStats& stats);
+
+// Waits for copies in flight and forgets every streamed texture. Call before releasing them.
+void UShutdownTextureStreaming();
+
+#endif